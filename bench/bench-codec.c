@@ -0,0 +1,277 @@
+/*
+ * LibYAM -- E-Mail client library
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* transfer decodings, charset conversion and HTML to text */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "base64.h"
+#include "quoted-printable.h"
+#include "codeconv.h"
+#include "unmime.h"
+#include "html.h"
+#include "utils.h"
+
+/* bytes of input per benchmark */
+#define DATA_SIZE	(16 * 1024 * 1024)
+#define N_HEADERS	200000
+#define N_HTML_MAILS	20
+#define HTML_PARAGRAPHS	2000
+
+static void
+bench_base64 (gsize size)
+{
+  guchar *data;
+  gchar *encoded, *line;
+  guchar *out;
+  Base64Decoder *decoder;
+  GString *lines;
+  gsize i, len;
+
+  data = g_malloc (size);
+  for (i = 0; i < size; i++)
+    data[i] = g_rand_int (bench_get_rand ()) & 0xff;
+
+  encoded = g_malloc ((size + 2) / 3 * 4 + 1);
+  out = g_malloc (size + 3);
+
+  bench_start ();
+  base64_encode (encoded, data, size);
+  bench_report ("base64_encode", 1, size);
+
+  len = strlen (encoded);
+
+  bench_start ();
+  base64_decode (out, encoded, len);
+  bench_report ("base64_decode", 1, len);
+
+  /* the way message bodies come in: 76 column lines */
+  lines = g_string_sized_new (len + len / 76 * 2 + 2);
+  for (i = 0; i < len; i += 76)
+    {
+      g_string_append_len (lines, encoded + i, MIN (76, len - i));
+      g_string_append_c (lines, '\n');
+    }
+
+  decoder = base64_decoder_new ();
+  bench_start ();
+  for (line = lines->str; *line != '\0';)
+    {
+      gchar *next = strchr (line, '\n');
+      gchar buf[BUFFSIZE];
+
+      strncpy2 (buf, line, MIN (next - line + 2, sizeof (buf)));
+      base64_decoder_decode (decoder, buf, out);
+      line = next + 1;
+    }
+  bench_report ("base64_decoder_decode", lines->len / 77, lines->len);
+  base64_decoder_free (decoder);
+
+  g_string_free (lines, TRUE);
+  g_free (out);
+  g_free (encoded);
+  g_free (data);
+}
+
+static void
+bench_qp (gsize size)
+{
+  GString *text;
+  gchar *p;
+  guint64 n_lines = 0;
+
+  /* mostly ASCII with some encoded Latin-1 / UTF-8 bytes */
+  text = g_string_sized_new (size + 128);
+  while (text->len < size)
+    {
+      g_string_append (text, "Gr=C3=BC=C3=9Fe aus K=C3=B6ln, die Stra=C3=9Fe ist lang und das ");
+      g_string_append (text, "Wetter ist sch=C3=B6n. Some plain text to fill the line up=\n");
+    }
+
+  bench_start ();
+  for (p = text->str; *p != '\0';)
+    {
+      gchar *next = strchr (p, '\n');
+
+      *next = '\0';
+      qp_decode_line (p);
+      p = next + 1;
+      n_lines++;
+    }
+  bench_report ("qp_decode_line", n_lines, text->len);
+
+  g_string_free (text, TRUE);
+}
+
+static void
+bench_conv (gsize size)
+{
+  GString *latin1;
+  gchar *utf8, *str;
+  gint i;
+
+  latin1 = g_string_sized_new (size + 128);
+  while (latin1->len < size)
+    g_string_append (latin1, "Gr\374\337e aus K\366ln, \340 bient\364t, se\361or, ni\361o. ");
+
+  bench_start ();
+  utf8 = conv_codeset_strdup (latin1->str, CS_ISO_8859_1, CS_UTF_8);
+  bench_report ("conv_codeset_strdup_latin1_to_utf8", 1, latin1->len);
+
+  bench_start ();
+  str = conv_codeset_strdup (utf8, CS_UTF_8, CS_ISO_8859_1);
+  bench_report ("conv_codeset_strdup_utf8_to_latin1", 1, strlen (utf8));
+  g_free (str);
+
+  bench_start ();
+  str = conv_codeset_strdup (utf8, CS_UTF_8, CS_ISO_2022_JP);
+  bench_report ("conv_codeset_strdup_utf8_to_iso2022jp", 1, strlen (utf8));
+  g_free (str);
+
+  /* short strings, as for header fields */
+  bench_start ();
+  for (i = 0; i < N_HEADERS; i++)
+    {
+      str = conv_codeset_strdup ("Gr\374\337e aus K\366ln", CS_ISO_8859_1, CS_UTF_8);
+      g_free (str);
+    }
+  bench_report ("conv_codeset_strdup_short", N_HEADERS, 0);
+
+  bench_start ();
+  for (i = 0; i < N_HEADERS; i++)
+    {
+      str = unmime_header ("=?ISO-8859-1?Q?Gr=FC=DFe_aus_K=F6ln?= and =?UTF-8?B?w6Agw6lsw6h2ZQ==?=");
+      g_free (str);
+    }
+  bench_report ("unmime_header", N_HEADERS, 0);
+
+  g_free (utf8);
+  g_string_free (latin1, TRUE);
+}
+
+static guint64
+html_to_text (const gchar * file, const gchar * charset)
+{
+  HTMLParser *parser;
+  CodeConverter *conv;
+  const gchar *str;
+  guint64 out_len = 0;
+  FILE *fp;
+
+  if ((fp = g_fopen (file, "rb")) == NULL)
+    {
+      FILE_OP_ERROR (file, "fopen");
+      return 0;
+    }
+
+  conv = conv_code_converter_new (charset, CS_UTF_8);
+  parser = html_parser_new (fp, conv);
+  while ((str = html_parse (parser)) != NULL)
+    out_len += strlen (str);
+  html_parser_destroy (parser);
+  conv_code_converter_destroy (conv);
+  fclose (fp);
+
+  return out_len;
+}
+
+/* synthetic newsletters, plus the *.html files in $BENCH_HTML_DIR if set */
+static void
+bench_html (gint n_mails)
+{
+  GPtrArray *files;
+  const gchar *dir;
+  guint64 bytes = 0;
+  guint i;
+
+  files = g_ptr_array_new_with_free_func (g_free);
+
+  for (i = 0; i < n_mails; i++)
+    {
+      gchar *file, *html;
+
+      file = g_strdup_printf ("%s%cmail%u.html", bench_get_tmp_dir (), G_DIR_SEPARATOR, i);
+      html = bench_make_html (HTML_PARAGRAPHS);
+      if (bench_write_file (file, html, -1) < 0)
+        exit (1);
+      g_free (html);
+      g_ptr_array_add (files, file);
+    }
+
+  if ((dir = g_getenv ("BENCH_HTML_DIR")) != NULL)
+    {
+      GDir *gdir;
+      const gchar *name;
+
+      if ((gdir = g_dir_open (dir, 0, NULL)) != NULL)
+        {
+          while ((name = g_dir_read_name (gdir)) != NULL)
+            {
+              if (g_str_has_suffix (name, ".html") || g_str_has_suffix (name, ".htm"))
+                g_ptr_array_add (files, g_build_filename (dir, name, NULL));
+            }
+          g_dir_close (gdir);
+        }
+    }
+
+  for (i = 0; i < files->len; i++)
+    bytes += get_file_size (g_ptr_array_index (files, i));
+
+  bench_start ();
+  for (i = 0; i < files->len; i++)
+    html_to_text (g_ptr_array_index (files, i), CS_UTF_8);
+  bench_report ("html_parse", files->len, bytes);
+
+  bench_start ();
+  for (i = 0; i < files->len; i++)
+    html_to_text (g_ptr_array_index (files, i), CS_ISO_8859_1);
+  bench_report ("html_parse_latin1", files->len, bytes);
+
+  g_ptr_array_free (files, TRUE);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gsize size;
+
+  bench_init (argc, argv);
+
+  size = bench_count (DATA_SIZE);
+
+  bench_base64 (size);
+  bench_qp (size);
+  bench_conv (size);
+  bench_html (bench_count (N_HTML_MAILS));
+
+  bench_cleanup ();
+
+  return 0;
+}
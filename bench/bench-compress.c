@@ -0,0 +1,265 @@
+/*
+ * LibYAM -- E-Mail client library
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* IMAP header sync over a throttled loopback, with and without
+   COMPRESS=DEFLATE */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#if USE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "bench.h"
+#include "socket.h"
+#include "utils.h"
+
+#define N_MSGS		5000
+/* link speed in kbit/s, BENCH_LINK_KBPS overrides it */
+#define LINK_KBPS	2000
+#define LINK_CHUNK	4096
+
+typedef struct _BenchServer BenchServer;
+
+struct _BenchServer {
+  gint fd;
+  gboolean compress;
+  gint n_msgs;
+  gchar **headers;
+  glong rate;                   /* bytes per second */
+  gint64 start;
+  guint64 sent;
+#if USE_ZLIB
+  z_stream deflate;
+#endif
+};
+
+/* writes at most rate bytes per second */
+static void
+server_write (BenchServer * server, const gchar * buf, gsize len)
+{
+  gint64 due, now;
+  gsize n;
+
+  while (len > 0)
+    {
+      n = MIN (len, LINK_CHUNK);
+      if (fd_write_all (server->fd, buf, n) < 0)
+        {
+          g_warning ("bench server: write failed\n");
+          exit (1);
+        }
+      server->sent += n;
+
+      due = server->start + (gint64) ((gdouble) server->sent * G_USEC_PER_SEC / server->rate);
+      if ((now = g_get_monotonic_time ()) < due)
+        g_usleep (due - now);
+      buf += n;
+      len -= n;
+    }
+}
+
+/* one response; the server flushes the compressor after each, as
+   servers do at the end of every response */
+static void
+server_send (BenchServer * server, const gchar * buf, gsize len)
+{
+#if USE_ZLIB
+  if (server->compress)
+    {
+      gchar outbuf[BUFFSIZE];
+
+      server->deflate.next_in = (Bytef *) buf;
+      server->deflate.avail_in = len;
+      do
+        {
+          server->deflate.next_out = (Bytef *) outbuf;
+          server->deflate.avail_out = sizeof (outbuf);
+          deflate (&server->deflate, Z_SYNC_FLUSH);
+          server_write (server, outbuf, sizeof (outbuf) - server->deflate.avail_out);
+        }
+      while (server->deflate.avail_out == 0 || server->deflate.avail_in > 0);
+      return;
+    }
+#endif
+  server_write (server, buf, len);
+}
+
+/* the response to imap_get_uncached_messages()' UID FETCH */
+static gpointer
+server_thread_func (gpointer data)
+{
+  BenchServer *server = (BenchServer *) data;
+  GString *str;
+  gint i;
+
+  str = g_string_sized_new (4096);
+
+  for (i = 0; i < server->n_msgs; i++)
+    {
+      const gchar *header = server->headers[i];
+
+      g_string_printf (str, "* %d FETCH (UID %d FLAGS (\\Seen) RFC822.SIZE %d "
+                       "BODY[HEADER.FIELDS (DATE FROM TO CC SUBJECT MESSAGE-ID IN-REPLY-TO REFERENCES)] {%d}\r\n",
+                       i + 1, i + 1, 2000 + i % 1000, (gint) strlen (header));
+      g_string_append (str, header);
+      g_string_append (str, ")\r\n");
+      server_send (server, str->str, str->len);
+    }
+  server_send (server, "A001 OK UID FETCH completed\r\n", 29);
+
+  g_string_free (str, TRUE);
+
+  return NULL;
+}
+
+/* the header part of a message, with CRLF line ends */
+static gchar *
+make_header (gint num)
+{
+  gchar *msg, *p, *crlf;
+  gchar **lines;
+
+  msg = bench_make_message (num, 0);
+  if ((p = strstr (msg, "\n\n")) != NULL)
+    p[2] = '\0';
+  lines = g_strsplit (msg, "\n", -1);
+  crlf = g_strjoinv ("\r\n", lines);
+  g_strfreev (lines);
+  g_free (msg);
+
+  return crlf;
+}
+
+static void
+bench_sync (gchar ** headers, gint n_msgs, glong rate, gboolean compress)
+{
+  BenchServer server;
+  GThread *thread;
+  SockInfo *sock;
+  gint fds[2];
+  gchar *line;
+  gint n_fetched = 0;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+      perror ("socketpair");
+      exit (1);
+    }
+
+  memset (&server, 0, sizeof (server));
+  server.fd = fds[1];
+  server.compress = compress;
+  server.n_msgs = n_msgs;
+  server.headers = headers;
+  server.rate = rate;
+
+  sock = sock_new ("loopback", 0);
+  sock->sock = fds[0];
+  sock->sock_ch = g_io_channel_unix_new (fds[0]);
+
+#if USE_ZLIB
+  if (compress)
+    {
+      deflateInit2 (&server.deflate, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+      sock_enable_compress (sock);
+    }
+#endif
+
+  bench_start ();
+  server.start = g_get_monotonic_time ();
+  thread = g_thread_new ("bench-server", server_thread_func, &server);
+
+  while (sock_getline (sock, &line) >= 0)
+    {
+      gchar *p;
+      gint size;
+
+      if (!strncmp (line, "A001 ", 5))
+        {
+          g_free (line);
+          break;
+        }
+      /* read the literal as imap_cmd_gen_recv_literal() does */
+      if ((p = strrchr (line, '{')) != NULL && (size = atoi (p + 1)) > 0)
+        {
+          gchar buf[BUFFSIZE];
+          gint n;
+
+          while (size > 0 && (n = sock_read (sock, buf, MIN (size, (gint) sizeof (buf)))) > 0)
+            size -= n;
+          n_fetched++;
+        }
+      g_free (line);
+    }
+
+  bench_report (compress ? "imap_header_sync_deflate" : "imap_header_sync_plain", n_fetched, sock->rx_bytes);
+
+  g_thread_join (thread);
+#if USE_ZLIB
+  if (compress)
+    deflateEnd (&server.deflate);
+#endif
+  close (fds[1]);
+  sock_close (sock);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gchar **headers;
+  const gchar *kbps;
+  glong rate;
+  gint n_msgs, i;
+
+  bench_init (argc, argv);
+
+  kbps = g_getenv ("BENCH_LINK_KBPS");
+  rate = (kbps ? atol (kbps) : LINK_KBPS) * 1000 / 8;
+  if (rate <= 0)
+    rate = LINK_KBPS * 1000 / 8;
+
+  n_msgs = bench_count (N_MSGS);
+  headers = g_new0 (gchar *, n_msgs + 1);
+  for (i = 0; i < n_msgs; i++)
+    headers[i] = make_header (i + 1);
+
+  /* "bytes" is what went over the wire */
+  bench_sync (headers, n_msgs, rate, FALSE);
+#if USE_ZLIB
+  bench_sync (headers, n_msgs, rate, TRUE);
+#endif
+
+  g_strfreev (headers);
+
+  bench_cleanup ();
+
+  return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * LibYAM -- E-Mail client library
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* filter rule loading and matching */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "folder.h"
+#include "procmsg.h"
+#include "procheader.h"
+#include "filter.h"
+#include "utils.h"
+
+#define N_MESSAGES	2000
+#define N_RULES		100
+#define N_LOADS		20
+
+static const gchar *subject_words[] = {
+  "invoice", "urgent", "weekly", "release", "newsletter", "offer", "review", "status"
+};
+
+static GSList *
+make_filter_list (gint n_rules)
+{
+  GSList *fltlist = NULL;
+  gint i;
+
+  for (i = 0; i < n_rules; i++)
+    {
+      GSList *cond_list = NULL, *action_list = NULL;
+      const gchar *word = subject_words[i % G_N_ELEMENTS (subject_words)];
+      gchar *name, *value;
+
+      switch (i % 5)
+        {
+        case 0:
+          cond_list = g_slist_append (cond_list, filter_cond_new (FLT_COND_HEADER, FLT_CONTAIN, 0, "Subject", word));
+          break;
+        case 1:
+          value = g_strdup_printf ("%s@example.org", word);
+          cond_list = g_slist_append (cond_list, filter_cond_new (FLT_COND_TO_OR_CC, FLT_CONTAIN, 0, NULL, value));
+          g_free (value);
+          break;
+        case 2:
+          value = g_strdup_printf ("^(Re: )?%s [a-z]+ [0-9]+$", word);
+          cond_list = g_slist_append (cond_list, filter_cond_new (FLT_COND_HEADER, FLT_REGEX, 0, "Subject", value));
+          g_free (value);
+          break;
+        case 3:
+          cond_list = g_slist_append (cond_list, filter_cond_new (FLT_COND_ANY_HEADER, FLT_CONTAIN, 0, NULL, word));
+          break;
+        default:
+          cond_list = g_slist_append (cond_list, filter_cond_new (FLT_COND_HEADER, FLT_EQUAL, FLT_CASE_SENS,
+                                                                  "From", "Nobody <nobody@example.com>"));
+          cond_list = g_slist_append (cond_list, filter_cond_new (FLT_COND_SIZE_GREATER, 0, 0, NULL, "100"));
+          break;
+        }
+
+      action_list = g_slist_append (action_list, filter_action_new (FLT_ACTION_MARK, NULL));
+      name = g_strdup_printf ("rule %d", i);
+      fltlist = g_slist_append (fltlist,
+                                filter_rule_new (name, i % 5 == 4 ? FLT_AND : FLT_OR, cond_list, action_list));
+      g_free (name);
+    }
+
+  return fltlist;
+}
+
+static void
+bench_filter_load (GSList * fltlist, gint n_rules)
+{
+  gchar *file;
+  gint i;
+
+  file = g_build_filename (bench_get_tmp_dir (), "filter.xml", NULL);
+  filter_write_file (fltlist, file);
+
+  bench_start ();
+  for (i = 0; i < N_LOADS; i++)
+    filter_rule_list_free (filter_read_file (file));
+  bench_report ("filter_read_file", (guint64) n_rules * N_LOADS, get_file_size (file) * N_LOADS);
+
+  g_free (file);
+}
+
+static void
+bench_filter_match (FolderItem * item, GSList * fltlist, gint count, gint n_rules)
+{
+  MsgInfo **msgs;
+  GSList **hlists;
+  FilterInfo *fltinfo;
+  gchar *path;
+  guint64 matched = 0;
+  gint i;
+
+  msgs = g_new (MsgInfo *, count);
+  hlists = g_new (GSList *, count);
+
+  path = folder_item_get_path (item);
+  for (i = 0; i < count; i++)
+    {
+      MsgFlags flags = { 0, 0 };
+      gchar *file;
+
+      file = g_strdup_printf ("%s%c%d", path, G_DIR_SEPARATOR, i + 1);
+      msgs[i] = procheader_parse_file (file, flags, TRUE);
+      msgs[i]->folder = item;
+      msgs[i]->msgnum = i + 1;
+      hlists[i] = procheader_get_header_list_from_file (file);
+      g_free (file);
+    }
+  g_free (path);
+
+  fltinfo = filter_info_new ();
+
+  bench_start ();
+  for (i = 0; i < count; i++)
+    {
+      GSList *cur;
+
+      for (cur = fltlist; cur != NULL; cur = cur->next)
+        {
+          if (filter_match_rule ((FilterRule *) cur->data, msgs[i], hlists[i], fltinfo))
+            matched++;
+        }
+    }
+  bench_report ("filter_match_rule", (guint64) count * n_rules, 0);
+  debug_print ("%" G_GUINT64_FORMAT " matches\n", matched);
+
+  filter_info_free (fltinfo);
+
+  for (i = 0; i < count; i++)
+    {
+      procmsg_msginfo_free (msgs[i]);
+      procheader_header_list_destroy (hlists[i]);
+    }
+  g_free (msgs);
+  g_free (hlists);
+}
+
+int
+main (int argc, char *argv[])
+{
+  FolderItem *item;
+  GSList *fltlist;
+  gint count, n_rules;
+
+  bench_init (argc, argv);
+
+  count = bench_count (N_MESSAGES);
+  n_rules = bench_count (N_RULES);
+
+  item = bench_make_mh_folder ("Filter", count);
+  fltlist = make_filter_list (n_rules);
+
+  bench_filter_load (fltlist, n_rules);
+  bench_filter_match (item, fltlist, count, n_rules);
+
+  filter_rule_list_free (fltlist);
+
+  bench_cleanup ();
+
+  return 0;
+}
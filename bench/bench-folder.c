@@ -0,0 +1,334 @@
+/*
+ * LibYAM -- E-Mail client library
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* folder scanning, cache loading, header parsing, sorting, threading and
+   mbox import */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "folder.h"
+#include "procmsg.h"
+#include "procheader.h"
+#include "mbox.h"
+#include "utils.h"
+
+#define N_MESSAGES	5000
+#define N_CACHE_LOADS	10
+#define N_VECTOR_MSGS	500000
+#define N_THREAD_MSGS	200000
+#define N_MBOX_MSGS	5000
+
+static guint64
+get_dir_size (const gchar * path, gint count)
+{
+  guint64 total = 0;
+  gint i;
+
+  for (i = 1; i <= count; i++)
+    {
+      gchar *file;
+
+      file = g_strdup_printf ("%s%c%d", path, G_DIR_SEPARATOR, i);
+      total += get_file_size (file);
+      g_free (file);
+    }
+
+  return total;
+}
+
+static void
+bench_folder_scan (FolderItem * item, gint count)
+{
+  GSList *mlist;
+  gchar *path;
+  guint64 bytes;
+  gint i;
+
+  path = folder_item_get_path (item);
+  bytes = get_dir_size (path, count);
+
+  /* no cache yet: every file is parsed and the cache is written */
+  bench_start ();
+  mlist = folder_item_get_msg_list (item, FALSE);
+  bench_report ("mh_scan_uncached", count, bytes);
+  procmsg_msg_list_free (mlist);
+
+  bench_start ();
+  for (i = 0; i < N_CACHE_LOADS; i++)
+    {
+      mlist = procmsg_read_cache (item, FALSE);
+      procmsg_msg_list_free (mlist);
+    }
+  bench_report ("procmsg_read_cache", (guint64) count * N_CACHE_LOADS, 0);
+
+  bench_start ();
+  for (i = 1; i <= count; i++)
+    {
+      MsgInfo *msginfo;
+      MsgFlags flags = { 0, 0 };
+      gchar *file;
+
+      file = g_strdup_printf ("%s%c%d", path, G_DIR_SEPARATOR, i);
+      msginfo = procheader_parse_file (file, flags, FALSE);
+      procmsg_msginfo_free (msginfo);
+      g_free (file);
+    }
+  bench_report ("procheader_parse_file", count, bytes);
+
+  bench_start ();
+  for (i = 1; i <= count; i++)
+    {
+      MsgInfo *msginfo;
+      MsgFlags flags = { 0, 0 };
+      gchar *file;
+
+      file = g_strdup_printf ("%s%c%d", path, G_DIR_SEPARATOR, i);
+      msginfo = procheader_parse_file (file, flags, TRUE);
+      procmsg_msginfo_free (msginfo);
+      g_free (file);
+    }
+  bench_report ("procheader_parse_file_full", count, bytes);
+
+  g_free (path);
+}
+
+static void
+bench_msg_vector (gint count)
+{
+  GRand *rand = bench_get_rand ();
+  MsgVector *mvec;
+  GSList *mlist;
+  gchar **froms, **subjects;
+  gint n_strs = 1000;
+  gint i;
+  static const struct {
+    const gchar *name;
+    FolderSortKey key;
+  } sorts[] = {
+    {"msg_vector_sort_number", SORT_BY_NUMBER},
+    {"msg_vector_sort_date", SORT_BY_DATE},
+    {"msg_vector_sort_from", SORT_BY_FROM},
+    {"msg_vector_sort_subject", SORT_BY_SUBJECT},
+    {"msg_vector_sort_size", SORT_BY_SIZE}
+  };
+
+  /* a limited set of strings, like in a real mailbox */
+  froms = g_new (gchar *, n_strs);
+  subjects = g_new (gchar *, n_strs);
+  for (i = 0; i < n_strs; i++)
+    {
+      froms[i] = g_strdup_printf ("Sender %d <sender%d@example.com>", i, i);
+      subjects[i] = g_strdup_printf ("%sTopic number %d", i % 3 == 0 ? "Re: " : "", i);
+    }
+
+  bench_start ();
+  mvec = procmsg_msg_vector_new (0);
+  for (i = 0; i < count; i++)
+    {
+      MsgInfo *msginfo;
+      gint n = g_rand_int_range (rand, 0, n_strs);
+
+      msginfo = g_new0 (MsgInfo, 1);
+      msginfo->msgnum = count - i;
+      msginfo->size = g_rand_int_range (rand, 500, 200000);
+      msginfo->date_t = 1500000000 + g_rand_int_range (rand, 0, 100000000);
+      msginfo->from = procmsg_intern_str (froms[n]);
+      msginfo->fromname = procmsg_intern_str (froms[n]);
+      msginfo->subject = procmsg_intern_str (subjects[g_rand_int_range (rand, 0, n_strs)]);
+      procmsg_msg_vector_append (mvec, msginfo);
+    }
+  bench_report ("msg_vector_build", count, 0);
+
+  for (i = 0; i < G_N_ELEMENTS (sorts); i++)
+    {
+      bench_start ();
+      procmsg_msg_vector_sort (mvec, sorts[i].key, SORT_ASCENDING);
+      bench_report (sorts[i].name, count, 0);
+    }
+
+  bench_start ();
+  mlist = procmsg_msg_vector_to_list (mvec);
+  bench_report ("msg_vector_to_list", count, 0);
+
+  bench_start ();
+  mvec = procmsg_msg_vector_from_list (mlist);
+  bench_report ("msg_vector_from_list", count, 0);
+
+  procmsg_msg_vector_free (mvec, TRUE);
+
+  for (i = 0; i < n_strs; i++)
+    {
+      g_free (froms[i]);
+      g_free (subjects[i]);
+    }
+  g_free (froms);
+  g_free (subjects);
+}
+
+/* threading a large folder without the parent index, with it, and
+   after a few new messages arrived */
+static void
+bench_thread (FolderItem * item, gint count)
+{
+  GRand *rand = bench_get_rand ();
+  MsgInfo **msgs;
+  GSList *mlist = NULL, *tail;
+  GNode *root;
+  gchar *path, *file;
+  gint n_new = MAX (count / 200, 1);
+  gint total = item->total;
+  gint i;
+
+  msgs = g_new (MsgInfo *, count + n_new);
+  for (i = 0; i < count + n_new; i++)
+    {
+      MsgInfo *msginfo;
+      gchar *msgid;
+
+      msginfo = g_new0 (MsgInfo, 1);
+      msginfo->msgnum = i + 1;
+      msginfo->size = g_rand_int_range (rand, 500, 200000);
+      msginfo->mtime = 1500000000 + i;
+      msginfo->folder = item;
+      msgid = g_strdup_printf ("<%d.thread@bench.example.com>", i + 1);
+      msginfo->msgid = procmsg_intern_str_take (msgid);
+
+      /* most messages are replies to a recent one */
+      if (i > 0 && g_rand_int_range (rand, 0, 10) < 6)
+        {
+          MsgInfo *parent = msgs[i - 1 - g_rand_int_range (rand, 0, MIN (i, 2000))];
+          gint n_refs = 1, j;
+
+          while (parent->references && parent->references[n_refs - 1] && n_refs < 10)
+            n_refs++;
+          msginfo->inreplyto = procmsg_intern_str_ref (parent->msgid);
+          msginfo->references = g_new (gchar *, n_refs + 1);
+          msginfo->references[0] = procmsg_intern_str_ref (parent->msgid);
+          for (j = 1; j < n_refs; j++)
+            msginfo->references[j] = procmsg_intern_str_ref (parent->references[j - 1]);
+          msginfo->references[n_refs] = NULL;
+        }
+      msgs[i] = msginfo;
+    }
+
+  path = folder_item_get_path (item);
+  file = g_strconcat (path, G_DIR_SEPARATOR_S, THREAD_FILE, NULL);
+  g_unlink (file);
+
+  for (i = count - 1; i >= 0; i--)
+    mlist = g_slist_prepend (mlist, msgs[i]);
+  item->total = count;
+
+  bench_start ();
+  root = procmsg_get_thread_tree (mlist);
+  bench_report ("thread_tree_full", count, 0);
+  g_node_destroy (root);
+
+  bench_start ();
+  root = procmsg_get_thread_tree (mlist);
+  bench_report ("thread_tree_indexed", count, 0);
+  g_node_destroy (root);
+
+  tail = NULL;
+  for (i = count + n_new - 1; i >= count; i--)
+    tail = g_slist_prepend (tail, msgs[i]);
+  mlist = g_slist_concat (mlist, tail);
+  item->total = count + n_new;
+
+  bench_start ();
+  root = procmsg_get_thread_tree (mlist);
+  bench_report ("thread_tree_incremental", count + n_new, 0);
+  g_node_destroy (root);
+
+  item->total = total;
+  g_unlink (file);
+  g_free (file);
+  g_free (path);
+  procmsg_msg_list_free (mlist);
+  g_free (msgs);
+}
+
+static void
+bench_mbox_import (gint count)
+{
+  FolderItem *dest;
+  GString *mbox;
+  gchar *file;
+  gint i;
+
+  mbox = g_string_new (NULL);
+  for (i = 1; i <= count; i++)
+    {
+      gchar *msg;
+
+      msg = bench_make_message (i, g_rand_int_range (bench_get_rand (), 5, 60));
+      g_string_append (mbox, "From bench@example.com Sat Jan  1 00:00:00 2020\n");
+      g_string_append (mbox, msg);
+      g_string_append_c (mbox, '\n');
+      g_free (msg);
+    }
+
+  file = g_build_filename (bench_get_tmp_dir (), "bench.mbox", NULL);
+  if (bench_write_file (file, mbox->str, mbox->len) < 0)
+    exit (1);
+
+  dest = bench_make_mh_folder ("MboxImport", 0);
+
+  bench_start ();
+  if (proc_mbox_full (dest, file, NULL, FALSE, FALSE) < 0)
+    g_printerr ("proc_mbox_full failed\n");
+  bench_report ("mbox_import", count, mbox->len);
+
+  g_string_free (mbox, TRUE);
+  g_free (file);
+}
+
+int
+main (int argc, char *argv[])
+{
+  FolderItem *item;
+  gint count;
+
+  bench_init (argc, argv);
+
+  count = bench_count (N_MESSAGES);
+  item = bench_make_mh_folder ("Folder", count);
+  bench_folder_scan (item, count);
+
+  bench_msg_vector (bench_count (N_VECTOR_MSGS));
+
+  bench_thread (item, bench_count (N_THREAD_MSGS));
+
+  bench_mbox_import (bench_count (N_MBOX_MSGS));
+
+  bench_cleanup ();
+
+  return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * LibYAM -- E-Mail client library
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* XML reader on a large address book */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "xml.h"
+#include "utils.h"
+
+#define N_PERSONS	20000
+#define N_LOADS		5
+
+static const gchar *first_names[] = {
+  "Alice", "Bob", "Carol", "Dave", "Eve", "Frank", "Jürgen", "Zoë"
+};
+
+static const gchar *last_names[] = {
+  "Smith", "Johnson", "O'Brien", "Müller", "Nakamura", "Dupont", "Kowalski", "Ivanov"
+};
+
+/* the same layout as the address book files written by addrbook.c */
+static gchar *
+make_addressbook (gint n_persons)
+{
+  GRand *rand = bench_get_rand ();
+  gchar *file;
+  FILE *fp;
+  gint i;
+
+  file = g_build_filename (bench_get_tmp_dir (), "addrbook-000001.xml", NULL);
+  if ((fp = g_fopen (file, "wb")) == NULL)
+    {
+      FILE_OP_ERROR (file, "fopen");
+      exit (1);
+    }
+
+  xml_file_put_xml_decl (fp);
+  fputs ("<address-book name=\"Bench\" >\n", fp);
+
+  for (i = 0; i < n_persons; i++)
+    {
+      const gchar *first = first_names[g_rand_int_range (rand, 0, G_N_ELEMENTS (first_names))];
+      const gchar *last = last_names[g_rand_int_range (rand, 0, G_N_ELEMENTS (last_names))];
+      gchar *cn, *remarks;
+      gint n_addrs, j;
+
+      cn = g_strdup_printf ("%s %s", first, last);
+      remarks = g_strdup_printf ("met at <conf %d> & \"dinner\"", i % 97);
+
+      fprintf (fp, "  <person uid=\"%d\" first-name=\"", 100000 + i);
+      xml_file_put_escape_str (fp, first);
+      fputs ("\" last-name=\"", fp);
+      xml_file_put_escape_str (fp, last);
+      fprintf (fp, "\" nick-name=\"n%d\" cn=\"", i);
+      xml_file_put_escape_str (fp, cn);
+      fputs ("\" >\n    <address-list>\n", fp);
+
+      n_addrs = g_rand_int_range (rand, 1, 4);
+      for (j = 0; j < n_addrs; j++)
+        {
+          fprintf (fp, "      <address uid=\"%d\" alias=\"\" email=\"user%d.%d@example%d.org\" remarks=\"",
+                   200000 + i * 4 + j, i, j, i % 13);
+          xml_file_put_escape_str (fp, remarks);
+          fputs ("\" />\n", fp);
+        }
+
+      fputs ("    </address-list>\n    <attribute-list>\n", fp);
+      fprintf (fp, "      <attribute uid=\"%d\" name=\"phone\" >+1 555 %07d</attribute>\n", 300000 + i, i);
+      fputs ("      <attribute uid=\"0\" name=\"note\" >", fp);
+      xml_file_put_escape_str (fp, remarks);
+      fputs ("</attribute>\n    </attribute-list>\n  </person>\n", fp);
+
+      g_free (remarks);
+      g_free (cn);
+    }
+
+  fputs ("</address-book>\n", fp);
+  if (fclose (fp) == EOF)
+    {
+      FILE_OP_ERROR (file, "fclose");
+      exit (1);
+    }
+
+  return file;
+}
+
+static void
+bench_xml_parse_file (const gchar * file)
+{
+  guint64 n_nodes = 0;
+  gint i;
+
+  bench_start ();
+  for (i = 0; i < N_LOADS; i++)
+    {
+      GNode *node;
+
+      if ((node = xml_parse_file (file)) == NULL)
+        {
+          g_warning ("can't parse %s\n", file);
+          exit (1);
+        }
+      n_nodes += g_node_n_nodes (node, G_TRAVERSE_ALL);
+      xml_free_tree (node);
+    }
+  bench_report ("xml_parse_file", n_nodes, get_file_size (file) * N_LOADS);
+}
+
+/* walks the file tag by tag as the address book reader does */
+static void
+bench_xml_parse_next_tag (const gchar * file)
+{
+  guint64 n_tags = 0, n_attrs = 0;
+  gint i;
+
+  bench_start ();
+  for (i = 0; i < N_LOADS; i++)
+    {
+      XMLFile *xfile;
+
+      if ((xfile = xml_open_file (file)) == NULL || xml_get_dtd (xfile) != 0)
+        {
+          g_warning ("can't open %s\n", file);
+          exit (1);
+        }
+
+      do
+        {
+          GList *attr;
+
+          if (xml_parse_next_tag (xfile) < 0)
+            break;
+          n_tags++;
+          for (attr = xml_get_current_tag_attr (xfile); attr != NULL; attr = attr->next)
+            n_attrs++;
+          if (xml_compare_tag (xfile, "attribute"))
+            g_free (xml_get_element (xfile));
+        }
+      while (xfile->level > 0);
+
+      xml_close_file (xfile);
+    }
+  bench_report ("xml_parse_next_tag", n_tags, get_file_size (file) * N_LOADS);
+  debug_print ("%" G_GUINT64_FORMAT " attributes\n", n_attrs);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gchar *file;
+
+  bench_init (argc, argv);
+
+  file = make_addressbook (bench_count (N_PERSONS));
+
+  bench_xml_parse_file (file);
+  bench_xml_parse_next_tag (file);
+
+  g_unlink (file);
+  g_free (file);
+
+  bench_cleanup ();
+
+  return 0;
+}
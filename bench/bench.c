@@ -0,0 +1,363 @@
+/*
+ * LibYAM -- E-Mail client library
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "ymain.h"
+#include "folder.h"
+#include "prefs_common.h"
+#include "utils.h"
+
+static gchar *tmp_dir = NULL;
+static gdouble scale = 1.0;
+static GRand *bench_rand = NULL;
+
+static gint64 start_time;
+static guint start_allocs;
+
+/* count the allocations by wrapping the glibc allocator; every
+ * allocation made by libyam and glib goes through these */
+#ifdef __GLIBC__
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static gint n_allocs = 0;
+
+void *
+malloc (size_t size)
+{
+  g_atomic_int_inc (&n_allocs);
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+  g_atomic_int_inc (&n_allocs);
+  return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  g_atomic_int_inc (&n_allocs);
+  return __libc_realloc (ptr, size);
+}
+
+#define BENCH_GET_ALLOCS()	((guint) g_atomic_int_get (&n_allocs))
+#else
+#define BENCH_GET_ALLOCS()	0
+#endif
+
+static const gchar *names[] = {
+  "Alice Archer", "Bob Baker", "Carol Carter", "Dave Dalton",
+  "Eve Evans", "Frank Fisher", "Grace Gordon", "Heidi Hall",
+  "Ivan Irwin", "Judy Jones", "Mallory Moore", "Oscar Owens",
+  "Peggy Parker", "Trent Turner", "Victor Vance", "Walter White"
+};
+
+/* not localized, unlike strftime() */
+static const gchar *wdays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const gchar *months[] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static const gchar *words[] = {
+  "mail", "folder", "message", "filter", "account", "server", "cache",
+  "header", "subject", "release", "patch", "review", "meeting", "report",
+  "invoice", "update", "weekly", "status", "build", "question", "reply",
+  "draft", "queue", "archive", "newsletter", "offer", "urgent", "minutes"
+};
+
+void
+bench_init (gint argc, gchar * argv[])
+{
+  gchar *dir;
+  GError *error = NULL;
+
+  if (argc > 1)
+    {
+      scale = g_ascii_strtod (argv[1], NULL);
+      if (scale <= 0)
+        scale = 1.0;
+    }
+
+  tmp_dir = g_dir_make_tmp ("yam-bench-XXXXXX", &error);
+  if (!tmp_dir)
+    {
+      g_printerr ("can't create temporary directory: %s\n", error->message);
+      exit (1);
+    }
+
+  /* keep everything, including the mail base directory, private */
+  dir = g_build_filename (tmp_dir, "data", NULL);
+  g_setenv ("XDG_DATA_HOME", dir, TRUE);
+  make_dir_hier (dir);
+  g_free (dir);
+
+  yam_init ();
+  dir = g_build_filename (tmp_dir, "rc", NULL);
+  set_rc_dir (dir);
+  g_free (dir);
+  yam_app_create ();
+  if (yam_setup_rc_dir () < 0)
+    {
+      g_printerr ("can't set up rc directory\n");
+      exit (1);
+    }
+
+  prefs_common_read_config ();
+
+  bench_rand = g_rand_new_with_seed (20200101);
+}
+
+void
+bench_cleanup (void)
+{
+  yam_cleanup ();
+  g_rand_free (bench_rand);
+  if (change_dir (g_get_tmp_dir ()) == 0)
+    remove_dir_recursive (tmp_dir);
+  g_free (tmp_dir);
+}
+
+const gchar *
+bench_get_tmp_dir (void)
+{
+  return tmp_dir;
+}
+
+gint
+bench_count (gint count)
+{
+  return MAX ((gint) (count * scale), 1);
+}
+
+void
+bench_start (void)
+{
+  start_allocs = BENCH_GET_ALLOCS ();
+  start_time = g_get_monotonic_time ();
+}
+
+void
+bench_report (const gchar * name, guint64 ops, guint64 bytes)
+{
+  gdouble elapsed;
+  guint allocs;
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  elapsed = (g_get_monotonic_time () - start_time) / (gdouble) G_USEC_PER_SEC;
+  allocs = BENCH_GET_ALLOCS () - start_allocs;
+  if (elapsed <= 0)
+    elapsed = 1e-9;
+
+  /* g_ascii_formatd() keeps the output locale independent */
+  printf ("{\"benchmark\": \"%s\", \"ops\": %" G_GUINT64_FORMAT, name, ops);
+  printf (", \"seconds\": %s", g_ascii_formatd (buf, sizeof (buf), "%.6f", elapsed));
+  printf (", \"ops_per_sec\": %s", g_ascii_formatd (buf, sizeof (buf), "%.1f", ops / elapsed));
+  if (bytes > 0)
+    printf (", \"bytes\": %" G_GUINT64_FORMAT ", \"mb_per_sec\": %s", bytes,
+            g_ascii_formatd (buf, sizeof (buf), "%.2f", bytes / elapsed / (1024 * 1024)));
+#ifdef __GLIBC__
+  printf (", \"allocs_per_op\": %s", g_ascii_formatd (buf, sizeof (buf), "%.2f", ops ? (gdouble) allocs / ops : 0));
+#else
+  printf (", \"allocs_per_op\": null");
+#endif
+  printf ("}\n");
+  fflush (stdout);
+}
+
+GRand *
+bench_get_rand (void)
+{
+  return bench_rand;
+}
+
+static const gchar *
+random_word (void)
+{
+  return words[g_rand_int_range (bench_rand, 0, G_N_ELEMENTS (words))];
+}
+
+gchar *
+bench_make_message (gint num, gint n_lines)
+{
+  GString *str;
+  const gchar *from, *to;
+  gchar date[64];
+  GDateTime *dt;
+  gint i, j;
+
+  str = g_string_sized_new (1024 + n_lines * 72);
+
+  from = names[g_rand_int_range (bench_rand, 0, G_N_ELEMENTS (names))];
+  to = names[g_rand_int_range (bench_rand, 0, G_N_ELEMENTS (names))];
+  /* spread over about three years */
+  dt = g_date_time_new_from_unix_utc (1500000000 + g_rand_int_range (bench_rand, 0, 100000000));
+  g_snprintf (date, sizeof (date), "%s, %d %s %d %02d:%02d:%02d +0000",
+              wdays[g_date_time_get_day_of_week (dt) % 7], g_date_time_get_day_of_month (dt),
+              months[g_date_time_get_month (dt) - 1], g_date_time_get_year (dt),
+              g_date_time_get_hour (dt), g_date_time_get_minute (dt), g_date_time_get_second (dt));
+  g_date_time_unref (dt);
+
+  g_string_append_printf (str, "Date: %s\n", date);
+  g_string_append_printf (str, "From: %s <%s@example.com>\n", from, random_word ());
+  g_string_append_printf (str, "To: %s <%s@example.org>\n", to, random_word ());
+  if (g_rand_boolean (bench_rand))
+    g_string_append_printf (str, "Cc: %s <%s@example.net>\n",
+                            names[g_rand_int_range (bench_rand, 0, G_N_ELEMENTS (names))], random_word ());
+  g_string_append_printf (str, "Subject: %s%s %s %d\n", g_rand_int_range (bench_rand, 0, 4) == 0 ? "Re: " : "",
+                          random_word (), random_word (), g_rand_int_range (bench_rand, 0, 1000));
+  g_string_append_printf (str, "Message-ID: <%d.%u@bench.example.com>\n", num, g_rand_int (bench_rand));
+  if (num > 1 && g_rand_boolean (bench_rand))
+    {
+      gint parent = g_rand_int_range (bench_rand, 1, num);
+
+      g_string_append_printf (str, "In-Reply-To: <%d.0@bench.example.com>\n", parent);
+      g_string_append_printf (str, "References: <%d.0@bench.example.com>\n", parent);
+    }
+  g_string_append (str, "MIME-Version: 1.0\n");
+  g_string_append (str, "Content-Type: text/plain; charset=UTF-8\n");
+  g_string_append (str, "Content-Transfer-Encoding: 8bit\n");
+  g_string_append (str, "\n");
+
+  for (i = 0; i < n_lines; i++)
+    {
+      for (j = 0; j < 10; j++)
+        {
+          g_string_append (str, random_word ());
+          g_string_append_c (str, j < 9 ? ' ' : '\n');
+        }
+    }
+
+  return g_string_free (str, FALSE);
+}
+
+/* a newsletter-like HTML body */
+gchar *
+bench_make_html (gint n_paragraphs)
+{
+  GString *str;
+  gint i, j;
+
+  str = g_string_sized_new (n_paragraphs * 512);
+
+  g_string_append (str, "<html><head><style>p { margin: 0; }\n.x { color: red; }</style></head>\n<body>\n");
+
+  for (i = 0; i < n_paragraphs; i++)
+    {
+      if (i % 20 == 0)
+        g_string_append_printf (str, "<h2>Section %d</h2>\n<table><tr><td>", i / 20);
+      g_string_append (str, "<p>");
+      for (j = 0; j < 40; j++)
+        {
+          switch (g_rand_int_range (bench_rand, 0, 12))
+            {
+            case 0:
+              g_string_append_printf (str, "<a href=\"https://example.com/?a=%d&amp;b=%s\">%s</a> ",
+                                      j, random_word (), random_word ());
+              break;
+            case 1:
+              g_string_append_printf (str, "<b>%s</b> ", random_word ());
+              break;
+            case 2:
+              g_string_append (str, "&nbsp;&copy;&eacute;&#8212; ");
+              break;
+            default:
+              g_string_append (str, random_word ());
+              g_string_append_c (str, j % 12 == 11 ? '\n' : ' ');
+            }
+        }
+      g_string_append (str, "</p>\n");
+      if (i % 20 == 19)
+        g_string_append (str, "</td></tr></table>\n");
+    }
+
+  g_string_append (str, "</body></html>\n");
+
+  return g_string_free (str, FALSE);
+}
+
+gint
+bench_write_file (const gchar * file, const gchar * data, gssize len)
+{
+  GError *error = NULL;
+
+  if (!g_file_set_contents (file, data, len, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return -1;
+    }
+
+  return 0;
+}
+
+FolderItem *
+bench_make_mh_folder (const gchar * name, gint count)
+{
+  Folder *folder;
+  FolderItem *item;
+  gchar *path;
+  gint i;
+
+  path = g_build_filename (tmp_dir, name, NULL);
+  folder = folder_new (F_MH, name, path);
+  g_free (path);
+
+  if (folder->klass->create_tree (folder) < 0)
+    {
+      g_printerr ("can't create MH folder %s\n", name);
+      exit (1);
+    }
+  folder_add (folder);
+  folder->klass->scan_tree (folder);
+
+  item = folder->inbox;
+  g_return_val_if_fail (item != NULL, NULL);
+
+  path = folder_item_get_path (item);
+  for (i = 1; i <= count; i++)
+    {
+      gchar *file, *msg;
+
+      file = g_strdup_printf ("%s%c%d", path, G_DIR_SEPARATOR, i);
+      msg = bench_make_message (i, g_rand_int_range (bench_rand, 5, 60));
+      if (bench_write_file (file, msg, -1) < 0)
+        exit (1);
+      g_free (msg);
+      g_free (file);
+    }
+  g_free (path);
+
+  return item;
+}
@@ -0,0 +1,48 @@
+/*
+ * LibYAM -- E-Mail client library
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <glib.h>
+
+#include "folder.h"
+
+/* sets up a private rc and mail directory; argv[1] scales the sizes */
+void bench_init (gint argc, gchar * argv[]);
+void bench_cleanup (void);
+
+const gchar *bench_get_tmp_dir (void);
+/* default count multiplied by the scale factor */
+gint bench_count (gint count);
+
+void bench_start (void);
+/* stop the timer and print one JSON line with the result */
+void bench_report (const gchar * name, guint64 ops, guint64 bytes);
+
+/* deterministic synthetic data */
+GRand *bench_get_rand (void);
+gchar *bench_make_message (gint num, gint n_lines);
+gchar *bench_make_html (gint n_paragraphs);
+gint bench_write_file (const gchar * file, const gchar * data, gssize len);
+
+/* an MH folder under the temporary directory holding count messages */
+FolderItem *bench_make_mh_folder (const gchar * name, gint count);
+
+#endif /* __BENCH_H__ */
@@ -0,0 +1,519 @@
+/*
+ * LibYAM -- E-Mail client library
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "bodycache.h"
+#include "folder.h"
+#include "procmsg.h"
+#include "prefs_common.h"
+#include "prefs_account.h"
+#include "utils.h"
+
+/* seconds between two passes */
+#define BODY_CACHE_CHECK_INTERVAL	(30 * 60)
+/* first pass after startup, and delay of the pass triggered by new
+ * bodies, so that a large download is checked once in a while only */
+#define BODY_CACHE_STARTUP_DELAY	60
+#define BODY_CACHE_EVICT_DELAY		10
+/* what was read in the last ten minutes may still be on display */
+#define BODY_CACHE_KEEP_RECENT		(10 * 60)
+/* evict down to 90% of the limit */
+#define BODY_CACHE_LOW_WATERMARK	90
+
+typedef struct _BodyCacheDir BodyCacheDir;
+typedef struct _BodyCacheFile BodyCacheFile;
+typedef struct _BodyCacheJob BodyCacheJob;
+
+struct _BodyCacheDir {
+  gchar *path;
+  gchar *mark_file;
+  gint account_id;
+  gboolean pin_all;
+  guint64 size;
+};
+
+struct _BodyCacheFile {
+  gchar *file;
+  BodyCacheDir *dir;
+  guint64 size;
+  gint64 atime;
+};
+
+struct _BodyCacheJob {
+  GPtrArray *dirs;
+  guint64 limit;
+  guint64 total;
+  guint64 freed;
+  gint n_files;
+  gint n_removed;
+};
+
+/* protected by the body_cache lock */
+static GHashTable *access_table = NULL;
+static GHashTable *account_table = NULL;
+static guint64 total_size = 0;
+G_LOCK_DEFINE_STATIC (body_cache);
+
+#define S_LOCK(name)	G_LOCK(name)
+#define S_UNLOCK(name)	G_UNLOCK(name)
+
+/* main thread only */
+static GThreadPool *body_cache_pool = NULL;
+static BodyCacheJob *running_job = NULL;
+static gboolean check_pending = FALSE;
+static guint check_timer_id = 0;
+static guint startup_timer_id = 0;
+
+static gint check_scheduled = 0;
+
+static guint64 *
+account_size_get (gint account_id)
+{
+  guint64 *size;
+
+  size = g_hash_table_lookup (account_table, GINT_TO_POINTER (account_id));
+  if (!size)
+    {
+      size = g_new0 (guint64, 1);
+      g_hash_table_insert (account_table, GINT_TO_POINTER (account_id), size);
+    }
+
+  return size;
+}
+
+static void
+access_table_set (const gchar * file, gint64 atime)
+{
+  gint64 *val;
+
+  val = g_hash_table_lookup (access_table, file);
+  if (!val)
+    {
+      val = g_new (gint64, 1);
+      g_hash_table_insert (access_table, g_strdup (file), val);
+    }
+  *val = atime;
+}
+
+static gboolean
+body_cache_delayed_check_cb (gpointer data)
+{
+  g_atomic_int_set (&check_scheduled, 0);
+  body_cache_check ();
+  return FALSE;
+}
+
+void
+body_cache_add (gint account_id, const gchar * file)
+{
+  GStatBuf s;
+  guint64 limit;
+  gboolean over;
+
+  g_return_if_fail (file != NULL);
+
+  if (g_stat (file, &s) < 0)
+    return;
+
+  S_LOCK (body_cache);
+  if (!access_table)
+    {
+      S_UNLOCK (body_cache);
+      return;
+    }
+  access_table_set (file, time (NULL));
+  *account_size_get (account_id) += s.st_size;
+  total_size += s.st_size;
+  limit = (guint64) prefs_common.remote_cache_limit * 1024 * 1024;
+  over = limit > 0 && total_size > limit;
+  S_UNLOCK (body_cache);
+
+  if (over && g_atomic_int_compare_and_exchange (&check_scheduled, 0, 1))
+    g_timeout_add_seconds (BODY_CACHE_EVICT_DELAY, body_cache_delayed_check_cb, NULL);
+}
+
+void
+body_cache_touch (const gchar * file)
+{
+  g_return_if_fail (file != NULL);
+
+  S_LOCK (body_cache);
+  if (access_table)
+    access_table_set (file, time (NULL));
+  S_UNLOCK (body_cache);
+}
+
+guint64
+body_cache_get_size (void)
+{
+  guint64 size;
+
+  S_LOCK (body_cache);
+  size = total_size;
+  S_UNLOCK (body_cache);
+
+  return size;
+}
+
+guint64
+body_cache_get_account_size (gint account_id)
+{
+  guint64 *size = NULL;
+  guint64 ret;
+
+  S_LOCK (body_cache);
+  if (account_table)
+    size = g_hash_table_lookup (account_table, GINT_TO_POINTER (account_id));
+  ret = size ? *size : 0;
+  S_UNLOCK (body_cache);
+
+  return ret;
+}
+
+/* the messages which may go: read and not flagged ones.  messages
+   missing from the mark file count as new, so they stay.  the main
+   thread may be rewriting the file; if it can't be read in full,
+   returns NULL and the whole folder stays. */
+static GHashTable *
+body_cache_read_unpinned (const gchar * mark_file)
+{
+  GHashTable *unpinned;
+  FILE *fp;
+  guint32 rec[2];
+  gsize n;
+
+  if ((fp = procmsg_open_data_file (mark_file, MARK_VERSION, DATA_READ, NULL, 0)) == NULL)
+    return NULL;
+
+  unpinned = g_hash_table_new (NULL, NULL);
+
+  while ((n = fread (rec, 1, sizeof (rec), fp)) == sizeof (rec))
+    {
+      if ((rec[1] & (MSG_UNREAD | MSG_MARKED)) != 0)
+        g_hash_table_remove (unpinned, GUINT_TO_POINTER (rec[0]));
+      else
+        g_hash_table_add (unpinned, GUINT_TO_POINTER (rec[0]));
+    }
+
+  if (n != 0 || ferror (fp))
+    {
+      debug_print ("body_cache: %s is truncated, keeping the folder\n", mark_file);
+      g_hash_table_destroy (unpinned);
+      unpinned = NULL;
+    }
+
+  fclose (fp);
+
+  return unpinned;
+}
+
+static void
+body_cache_scan_dir (BodyCacheJob * job, BodyCacheDir * dir, GPtrArray * files)
+{
+  GDir *dp;
+  const gchar *name;
+  GHashTable *unpinned = NULL;
+
+  if ((dp = g_dir_open (dir->path, 0, NULL)) == NULL)
+    return;
+
+  if (!dir->pin_all)
+    unpinned = body_cache_read_unpinned (dir->mark_file);
+
+  while ((name = g_dir_read_name (dp)) != NULL)
+    {
+      BodyCacheFile *entry;
+      GStatBuf s;
+      gint64 *atime;
+      gchar *file;
+      guint num;
+
+      if ((num = to_unumber (name)) == 0)
+        continue;
+
+      file = g_strconcat (dir->path, G_DIR_SEPARATOR_S, name, NULL);
+      if (g_stat (file, &s) < 0 || !S_ISREG (s.st_mode))
+        {
+          g_free (file);
+          continue;
+        }
+
+      dir->size += s.st_size;
+      job->total += s.st_size;
+      job->n_files++;
+
+      if (!unpinned || !g_hash_table_contains (unpinned, GUINT_TO_POINTER (num)))
+        {
+          g_free (file);
+          continue;
+        }
+
+      entry = g_new (BodyCacheFile, 1);
+      entry->file = file;
+      entry->dir = dir;
+      entry->size = s.st_size;
+      /* atime is not updated on every mount; the in-memory time wins */
+      entry->atime = MAX (s.st_atime, s.st_mtime);
+      S_LOCK (body_cache);
+      if ((atime = g_hash_table_lookup (access_table, file)) != NULL)
+        entry->atime = MAX (entry->atime, *atime);
+      S_UNLOCK (body_cache);
+
+      g_ptr_array_add (files, entry);
+    }
+
+  g_dir_close (dp);
+  if (unpinned)
+    g_hash_table_destroy (unpinned);
+}
+
+static gint
+body_cache_file_compare (gconstpointer a, gconstpointer b)
+{
+  const BodyCacheFile *fa = *(const BodyCacheFile **) a;
+  const BodyCacheFile *fb = *(const BodyCacheFile **) b;
+
+  return fa->atime < fb->atime ? -1 : fa->atime > fb->atime ? 1 : 0;
+}
+
+static void
+body_cache_file_free (gpointer data)
+{
+  BodyCacheFile *entry = (BodyCacheFile *) data;
+
+  g_free (entry->file);
+  g_free (entry);
+}
+
+static void
+body_cache_job_free (BodyCacheJob * job)
+{
+  guint i;
+
+  for (i = 0; i < job->dirs->len; i++)
+    {
+      BodyCacheDir *dir = g_ptr_array_index (job->dirs, i);
+
+      g_free (dir->path);
+      g_free (dir->mark_file);
+      g_free (dir);
+    }
+  g_ptr_array_free (job->dirs, TRUE);
+  g_free (job);
+}
+
+static gboolean
+body_cache_job_done (gpointer data)
+{
+  BodyCacheJob *job = (BodyCacheJob *) data;
+
+  debug_print ("body_cache: %d files, %" G_GUINT64_FORMAT " bytes; removed %d files, %" G_GUINT64_FORMAT " bytes\n",
+               job->n_files, job->total, job->n_removed, job->freed);
+
+  body_cache_job_free (job);
+  running_job = NULL;
+
+  if (check_pending)
+    {
+      check_pending = FALSE;
+      body_cache_check ();
+    }
+
+  return FALSE;
+}
+
+/* thread function: measures the cache and removes the least recently
+ * used unpinned bodies until it is below the low watermark */
+static void
+body_cache_job_run (gpointer data, gpointer user_data)
+{
+  BodyCacheJob *job = (BodyCacheJob *) data;
+  GPtrArray *files;
+  gint64 keep_time;
+  guint64 target;
+  guint i;
+
+  files = g_ptr_array_new_with_free_func (body_cache_file_free);
+
+  for (i = 0; i < job->dirs->len; i++)
+    body_cache_scan_dir (job, g_ptr_array_index (job->dirs, i), files);
+
+  if (job->limit > 0 && job->total > job->limit)
+    {
+      target = job->limit / 100 * BODY_CACHE_LOW_WATERMARK;
+      keep_time = time (NULL) - BODY_CACHE_KEEP_RECENT;
+
+      g_ptr_array_sort (files, body_cache_file_compare);
+      for (i = 0; i < files->len && job->total - job->freed > target; i++)
+        {
+          BodyCacheFile *entry = g_ptr_array_index (files, i);
+
+          if (entry->atime > keep_time)
+            break;
+          if (g_unlink (entry->file) < 0)
+            {
+              FILE_OP_ERROR (entry->file, "unlink");
+              continue;
+            }
+          entry->dir->size -= entry->size;
+          job->freed += entry->size;
+          job->n_removed++;
+
+          S_LOCK (body_cache);
+          g_hash_table_remove (access_table, entry->file);
+          S_UNLOCK (body_cache);
+        }
+    }
+
+  /* the scan replaces the running totals, which drift as messages are
+   * removed on the server or by "remove all" */
+  S_LOCK (body_cache);
+  g_hash_table_remove_all (account_table);
+  for (i = 0; i < job->dirs->len; i++)
+    {
+      BodyCacheDir *dir = g_ptr_array_index (job->dirs, i);
+
+      *account_size_get (dir->account_id) += dir->size;
+    }
+  total_size = job->total - job->freed;
+  S_UNLOCK (body_cache);
+
+  g_ptr_array_free (files, TRUE);
+
+  g_idle_add (body_cache_job_done, job);
+}
+
+static gboolean
+body_cache_add_dir_func (GNode * node, gpointer data)
+{
+  BodyCacheJob *job = (BodyCacheJob *) data;
+  FolderItem *item = FOLDER_ITEM (node->data);
+  BodyCacheDir *dir;
+
+  if (!item->path || item->stype == F_VIRTUAL)
+    return FALSE;
+
+  dir = g_new0 (BodyCacheDir, 1);
+  dir->path = folder_item_get_path (item);
+  dir->mark_file = folder_item_get_mark_file (item);
+  dir->account_id = item->folder->account ? item->folder->account->account_id : 0;
+  /* the summary may be showing any of them */
+  dir->pin_all = item->opened;
+  g_ptr_array_add (job->dirs, dir);
+
+  return FALSE;
+}
+
+void
+body_cache_check (void)
+{
+  BodyCacheJob *job;
+  GList *cur;
+
+  if (!body_cache_pool)
+    return;
+
+  /* offline, the cached bodies are the only copies we can read */
+  if (!prefs_common.online_mode)
+    return;
+
+  if (running_job)
+    {
+      check_pending = TRUE;
+      return;
+    }
+
+  job = g_new0 (BodyCacheJob, 1);
+  job->dirs = g_ptr_array_new ();
+  job->limit = (guint64) MAX (prefs_common.remote_cache_limit, 0) * 1024 * 1024;
+
+  for (cur = folder_get_list (); cur != NULL; cur = cur->next)
+    {
+      Folder *folder = FOLDER (cur->data);
+
+      if (FOLDER_IS_REMOTE (folder))
+        g_node_traverse (folder->node, G_PRE_ORDER, G_TRAVERSE_ALL, -1, body_cache_add_dir_func, job);
+    }
+
+  running_job = job;
+  g_thread_pool_push (body_cache_pool, job, NULL);
+}
+
+static gboolean
+body_cache_timer_cb (gpointer data)
+{
+  if (data)
+    startup_timer_id = 0;
+  body_cache_check ();
+  return data == NULL;
+}
+
+void
+body_cache_init (void)
+{
+  if (body_cache_pool)
+    return;
+
+  S_LOCK (body_cache);
+  access_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  account_table = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  S_UNLOCK (body_cache);
+
+  body_cache_pool = g_thread_pool_new (body_cache_job_run, NULL, 1, FALSE, NULL);
+
+  startup_timer_id = g_timeout_add_seconds (BODY_CACHE_STARTUP_DELAY, body_cache_timer_cb, GINT_TO_POINTER (1));
+  check_timer_id = g_timeout_add_seconds (BODY_CACHE_CHECK_INTERVAL, body_cache_timer_cb, NULL);
+}
+
+void
+body_cache_cleanup (void)
+{
+  if (!body_cache_pool)
+    return;
+
+  if (startup_timer_id)
+    g_source_remove (startup_timer_id);
+  if (check_timer_id)
+    g_source_remove (check_timer_id);
+  startup_timer_id = check_timer_id = 0;
+
+  /* let a running pass finish its unlink() calls */
+  g_thread_pool_free (body_cache_pool, FALSE, TRUE);
+  body_cache_pool = NULL;
+  check_pending = FALSE;
+
+  S_LOCK (body_cache);
+  g_hash_table_destroy (access_table);
+  g_hash_table_destroy (account_table);
+  access_table = account_table = NULL;
+  total_size = 0;
+  S_UNLOCK (body_cache);
+}
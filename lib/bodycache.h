@@ -0,0 +1,44 @@
+/*
+ * LibYAM -- E-Mail client library
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __BODYCACHE_H__
+#define __BODYCACHE_H__
+
+#include <glib.h>
+
+/* size bound for the message bodies cached from IMAP and news folders.
+ * The cache directories are rescanned in a worker thread, and when
+ * prefs_common.remote_cache_limit (MB) is exceeded the least recently
+ * used bodies are removed.  Unread and flagged messages, and messages
+ * of opened folders, are never removed. */
+
+void body_cache_init (void);
+void body_cache_cleanup (void);
+
+/* both can be called from any thread */
+void body_cache_add (gint account_id, const gchar * file);
+void body_cache_touch (const gchar * file);
+
+/* start an eviction pass (main thread) */
+void body_cache_check (void);
+
+guint64 body_cache_get_size (void);
+guint64 body_cache_get_account_size (gint account_id);
+
+#endif /* __BODYCACHE_H__ */
@@ -60,14 +60,21 @@
 #define UIDL_DIR		    "uidl"
 #define PLUGIN_DIR		    "plugins"
 #define NEWSGROUP_LIST		".newsgroup_list"
+#define NEWSGROUP_INDEX		".newsgroup_index"
 #define ADDRESS_BOOK		"addressbook.xml"
 #define FOLDER_LIST		    "folderlist.xml"
 #define CACHE_FILE		    ".yam_cache"
 #define MARK_FILE		    ".yam_mark"
+#define MIME_CACHE_FILE		".yam_mime"
+#define MAILDIR_UID_FILE	".yam_uidlist"
+#define THREAD_FILE		    ".yam_thread"
 #define SEARCH_CACHE		"search_cache"
 #define CACHE_VERSION		0x21
 #define MARK_VERSION		2
+#define MIME_CACHE_VERSION	1
+#define THREAD_VERSION		1
 #define SEARCH_CACHE_VERSION	1
+#define NEWSGROUP_INDEX_VERSION	1
 
 #define DEFAULT_SIGNATURE	".signature"
 #define DEFAULT_INC_PATH	"/usr/bin/mh/inc"
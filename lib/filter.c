@@ -30,6 +30,10 @@
 #include <strings.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
 #if HAVE_REGEX_H
 #include <regex.h>
 #endif
@@ -45,6 +49,7 @@
 #include "prefs_common.h"
 #include "prefs_account.h"
 #include "account.h"
+#include "metrics.h"
 
 typedef enum {
   FLT_O_CONTAIN = 1 << 0,
@@ -54,6 +59,21 @@ typedef enum {
 
 static FilterInAddressBookFunc default_addrbook_func = NULL;
 
+/* long-lived junk classifier fed with one message path per line */
+typedef struct _FilterClassifier {
+  gchar *cmdline;
+  GPid pid;
+  gint in_fd;
+  gint out_fd;
+  GString *buf;
+  gboolean failed;
+} FilterClassifier;
+
+#define FLT_CLASSIFIER_TIMEOUT	60000
+
+static FilterClassifier classifier = { NULL, 0, -1, -1, NULL, FALSE };
+G_LOCK_DEFINE_STATIC (classifier);
+
 static gboolean filter_match_cond (FilterCond * cond, MsgInfo * msginfo, GSList * hlist, FilterInfo * fltinfo);
 static gboolean filter_match_header_cond (FilterCond * cond, GSList * hlist);
 static gboolean filter_match_in_addressbook (FilterCond * cond, GSList * hlist, FilterInfo * fltinfo);
@@ -96,6 +116,7 @@ filter_apply_msginfo (GSList * fltlist, MsgInfo * msginfo, FilterInfo * fltinfo)
   gchar *file;
   GSList *hlist, *cur;
   FilterRule *rule;
+  MetricsTimer timer;
   gint ret = 0;
 
   g_return_val_if_fail (msginfo != NULL, -1);
@@ -116,6 +137,7 @@ filter_apply_msginfo (GSList * fltlist, MsgInfo * msginfo, FilterInfo * fltinfo)
       return 0;
     }
 
+  metrics_timer_start (&timer, "filter_apply_msginfo", NULL);
   procmsg_set_auto_decrypt_message (FALSE);
 
   for (cur = fltlist; cur != NULL; cur = cur->next)
@@ -145,6 +167,7 @@ filter_apply_msginfo (GSList * fltlist, MsgInfo * msginfo, FilterInfo * fltinfo)
     }
 
   procmsg_set_auto_decrypt_message (TRUE);
+  metrics_timer_stop (&timer);
 
   procheader_header_list_destroy (hlist);
   g_free (file);
@@ -237,6 +260,23 @@ filter_action_exec (FilterRule * rule, MsgInfo * msginfo, const gchar * file, Fi
         {
         case FLT_ACTION_MOVE:
         case FLT_ACTION_COPY:
+          if (fltinfo->defer_add && !msginfo->folder)
+            {
+              FilterDeferredAdd *add;
+
+              debug_print ("filter_action_exec(): %s: deferred: %s\n",
+                           action->type == FLT_ACTION_COPY ? "copy" : "move", action->str_value);
+              add = g_new (FilterDeferredAdd, 1);
+              add->type = action->type;
+              add->dest_id = g_strdup (action->str_value);
+              add->flags = fltinfo->flags;
+              fltinfo->add_list = g_slist_append (fltinfo->add_list, add);
+              fltinfo->actions[action->type] = TRUE;
+              if (action->type == FLT_ACTION_MOVE)
+                fltinfo->drop_done = TRUE;
+              break;
+            }
+
           dest_folder = folder_find_item_from_identifier (action->str_value);
           if (!dest_folder)
             {
@@ -462,6 +502,252 @@ filter_match_rule (FilterRule * rule, MsgInfo * msginfo, GSList * hlist, FilterI
   return FALSE;
 }
 
+static void
+filter_classifier_stop (gboolean kill_child)
+{
+  if (classifier.pid == 0)
+    return;
+
+  debug_print ("filter_classifier_stop: %s\n", classifier.cmdline);
+
+  close (classifier.in_fd);
+  close (classifier.out_fd);
+  if (kill_child)
+    kill (classifier.pid, SIGTERM);
+  waitpid (classifier.pid, NULL, 0);
+  g_spawn_close_pid (classifier.pid);
+
+  classifier.pid = 0;
+  classifier.in_fd = classifier.out_fd = -1;
+  g_string_truncate (classifier.buf, 0);
+}
+
+static gboolean
+filter_classifier_start (const gchar * cmdline)
+{
+  gchar **argv;
+  GError *error = NULL;
+  gboolean ret;
+
+  argv = strsplit_with_quote (cmdline, " ", 0);
+  ret = g_spawn_async_with_pipes (NULL, argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                                  NULL, NULL, &classifier.pid, &classifier.in_fd, &classifier.out_fd, NULL,
+                                  &error);
+  g_strfreev (argv);
+  if (!ret)
+    {
+      g_warning ("filter_classifier_start: can't execute %s: %s", cmdline, error->message);
+      g_error_free (error);
+      classifier.pid = 0;
+      return FALSE;
+    }
+
+  debug_print ("filter_classifier_start: %s (pid %d)\n", cmdline, (gint) classifier.pid);
+  return TRUE;
+}
+
+static gchar *
+filter_classifier_read_line (void)
+{
+  gchar buf[BUFFSIZE];
+  gchar *p;
+  GPollFD pfd;
+  gssize n;
+
+  while ((p = memchr (classifier.buf->str, '\n', classifier.buf->len)) == NULL)
+    {
+      pfd.fd = classifier.out_fd;
+      pfd.events = G_IO_IN | G_IO_HUP | G_IO_ERR;
+      pfd.revents = 0;
+      if (g_poll (&pfd, 1, FLT_CLASSIFIER_TIMEOUT) <= 0)
+        {
+          g_warning ("filter_classifier: no answer from %s", classifier.cmdline);
+          return NULL;
+        }
+      n = read (classifier.out_fd, buf, sizeof (buf));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return NULL;
+      g_string_append_len (classifier.buf, buf, n);
+    }
+
+  p = g_strndup (classifier.buf->str, p - classifier.buf->str);
+  g_string_erase (classifier.buf, 0, strlen (p) + 1);
+
+  return p;
+}
+
+static gboolean
+filter_classifier_argv_has (gchar ** argv, const gchar * arg)
+{
+  gint i;
+
+  for (i = 1; argv[i] != NULL; i++)
+    {
+      if (!strcmp (argv[i], arg))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* builds the batch command line from the options of the classifying
+   command, so that options such as "-d dir" are kept.  a trailing
+   option of cmdline (like "-I") takes the file name and is left out.
+   returns NULL if the batch command belongs to another program. */
+static gchar *
+filter_classifier_get_batch_cmdline (const gchar * batch_cmd, const gchar * cmdline)
+{
+  gchar **batch_argv, **argv;
+  GString *str;
+  gint argc, i;
+
+  if (!batch_cmd || !*batch_cmd)
+    return NULL;
+
+  batch_argv = strsplit_with_quote (batch_cmd, " ", 0);
+  argv = strsplit_with_quote (cmdline, " ", 0);
+  if (!batch_argv[0] || !argv[0] || strcmp (batch_argv[0], argv[0]) != 0)
+    {
+      g_strfreev (batch_argv);
+      g_strfreev (argv);
+      return NULL;
+    }
+
+  argc = g_strv_length (argv);
+  if (argc > 1 && argv[argc - 1][0] == '-' && !filter_classifier_argv_has (batch_argv, argv[argc - 1]))
+    argc--;
+
+  str = g_string_new (argv[0]);
+  for (i = 1; i < argc; i++)
+    {
+      /* the quoting is lost by the split */
+      if (strchr (argv[i], ' '))
+        break;
+      if (*argv[i])
+        g_string_append_printf (str, " %s", argv[i]);
+    }
+  if (i < argc)
+    {
+      g_string_free (str, TRUE);
+      g_strfreev (batch_argv);
+      g_strfreev (argv);
+      return NULL;
+    }
+  for (i = 1; batch_argv[i] != NULL; i++)
+    {
+      if (*batch_argv[i] && !filter_classifier_argv_has (argv, batch_argv[i]))
+        g_string_append_printf (str, " %s", batch_argv[i]);
+    }
+
+  g_strfreev (batch_argv);
+  g_strfreev (argv);
+
+  return g_string_free (str, FALSE);
+}
+
+/* returns the exit status the classifying command would have returned
+   for file (0: junk, 1: not junk, 2: unsure), or -1 if the batch
+   command is not usable */
+static gint
+filter_classifier_classify (const gchar * cmdline, const gchar * file)
+{
+  gchar *line, *verdict, *req;
+  gsize len, done;
+  gssize n;
+  gint ret = -1;
+
+  if (strchr (file, '\n'))
+    return -1;
+
+  G_LOCK (classifier);
+
+  if (!classifier.buf)
+    classifier.buf = g_string_new (NULL);
+
+  if (!classifier.cmdline || strcmp (classifier.cmdline, cmdline) != 0)
+    {
+      filter_classifier_stop (FALSE);
+      g_free (classifier.cmdline);
+      classifier.cmdline = g_strdup (cmdline);
+      classifier.failed = FALSE;
+    }
+
+  if (classifier.failed || (classifier.pid == 0 && !filter_classifier_start (cmdline)))
+    {
+      classifier.failed = TRUE;
+      G_UNLOCK (classifier);
+      return -1;
+    }
+
+  req = g_strconcat (file, "\n", NULL);
+  len = strlen (req);
+  for (done = 0; done < len; done += n)
+    {
+      n = write (classifier.in_fd, req + done, len - done);
+      if (n < 0 && errno == EINTR)
+        n = 0;
+      else if (n < 0)
+        break;
+    }
+  g_free (req);
+
+  line = done == len ? filter_classifier_read_line () : NULL;
+  if (line)
+    {
+      /* the answer may repeat the path in front of the verdict */
+      verdict = line;
+      if (g_str_has_prefix (verdict, file) && g_ascii_isspace (verdict[strlen (file)]))
+        verdict += strlen (file);
+      while (g_ascii_isspace (*verdict))
+        verdict++;
+
+      switch (g_ascii_toupper (*verdict))
+        {
+        case 'S':
+        case '0':
+          ret = 0;
+          break;
+        case 'H':
+        case '1':
+          ret = 1;
+          break;
+        case 'U':
+        case '2':
+          ret = 2;
+          break;
+        default:
+          g_warning ("filter_classifier: unknown answer from %s: %s", cmdline, line);
+          break;
+        }
+      g_free (line);
+    }
+
+  if (ret < 0)
+    {
+      filter_classifier_stop (TRUE);
+      classifier.failed = TRUE;
+    }
+
+  G_UNLOCK (classifier);
+
+  return ret;
+}
+
+void
+filter_junk_classifier_close (void)
+{
+  G_LOCK (classifier);
+  filter_classifier_stop (FALSE);
+  g_free (classifier.cmdline);
+  classifier.cmdline = NULL;
+  if (classifier.buf)
+    g_string_free (classifier.buf, TRUE);
+  classifier.buf = NULL;
+  G_UNLOCK (classifier);
+}
+
 static gboolean
 filter_match_cond (FilterCond * cond, MsgInfo * msginfo, GSList * hlist, FilterInfo * fltinfo)
 {
@@ -494,13 +780,32 @@ filter_match_cond (FilterCond * cond, MsgInfo * msginfo, GSList * hlist, FilterI
       file = procmsg_get_message_file (msginfo);
       if (!file)
         return FALSE;
-      cmdline = g_strconcat (cond->str_value, " \"", file, "\"", NULL);
-      ret = execute_command_line_async_wait (cmdline);
+      ret = -1;
+      /* the junk classifier may be kept running in batch mode.  the
+         main thread waits for the answer with the main loop running
+         instead, as the batch classifier blocks. */
+      if (prefs_common.junk_classify_cmd && !strcmp (cond->str_value, prefs_common.junk_classify_cmd) &&
+          !g_main_context_is_owner (g_main_context_default ()))
+        {
+          gchar *batch_cmdline;
+
+          batch_cmdline = filter_classifier_get_batch_cmdline (prefs_common.junk_classify_batch_cmd, cond->str_value);
+          if (batch_cmdline)
+            {
+              ret = filter_classifier_classify (batch_cmdline, file);
+              g_free (batch_cmdline);
+            }
+        }
+      if (ret < 0)
+        {
+          cmdline = g_strconcat (cond->str_value, " \"", file, "\"", NULL);
+          ret = execute_command_line_async_wait (cmdline);
+          g_free (cmdline);
+        }
       fltinfo->last_exec_exit_status = ret;
       matched = (ret == 0);
       if (ret == -1)
         fltinfo->error = FLT_ERROR_EXEC_FAILED;
-      g_free (cmdline);
       g_free (file);
       break;
     case FLT_COND_SIZE_GREATER:
@@ -1918,6 +2223,59 @@ filter_get_keyword_from_msg (MsgInfo * msginfo, gchar ** header, gchar ** key, F
     }
 }
 
+GSList *
+filter_rule_list_copy (GSList * fltlist)
+{
+  GSList *copy = NULL;
+  GSList *cur;
+
+  for (cur = fltlist; cur != NULL; cur = cur->next)
+    copy = g_slist_prepend (copy, filter_rule_copy ((FilterRule *) cur->data));
+
+  return g_slist_reverse (copy);
+}
+
+FilterRule *
+filter_rule_copy (FilterRule * rule)
+{
+  FilterRule *new_rule;
+  GSList *cur;
+
+  g_return_val_if_fail (rule != NULL, NULL);
+
+  new_rule = g_new (FilterRule, 1);
+  *new_rule = *rule;
+  new_rule->name = g_strdup (rule->name);
+  new_rule->target_folder = g_strdup (rule->target_folder);
+  new_rule->cond_list = NULL;
+  new_rule->action_list = NULL;
+
+  for (cur = rule->cond_list; cur != NULL; cur = cur->next)
+    {
+      FilterCond *cond = (FilterCond *) cur->data;
+      FilterCond *new_cond;
+
+      new_cond = g_new (FilterCond, 1);
+      *new_cond = *cond;
+      new_cond->header_name = g_strdup (cond->header_name);
+      new_cond->str_value = g_strdup (cond->str_value);
+      new_rule->cond_list = g_slist_append (new_rule->cond_list, new_cond);
+    }
+
+  for (cur = rule->action_list; cur != NULL; cur = cur->next)
+    {
+      FilterAction *action = (FilterAction *) cur->data;
+      FilterAction *new_action;
+
+      new_action = g_new (FilterAction, 1);
+      *new_action = *action;
+      new_action->str_value = g_strdup (action->str_value);
+      new_rule->action_list = g_slist_append (new_rule->action_list, new_action);
+    }
+
+  return new_rule;
+}
+
 void
 filter_rule_list_free (GSList * fltlist)
 {
@@ -1981,6 +2339,16 @@ filter_action_free (FilterAction * action)
 void
 filter_info_free (FilterInfo * fltinfo)
 {
+  GSList *cur;
+
+  for (cur = fltinfo->add_list; cur != NULL; cur = cur->next)
+    {
+      FilterDeferredAdd *add = (FilterDeferredAdd *) cur->data;
+
+      g_free (add->dest_id);
+      g_free (add);
+    }
+  g_slist_free (fltinfo->add_list);
   g_slist_free (fltinfo->dest_list);
   g_free (fltinfo);
 }
@@ -31,6 +31,7 @@ typedef struct _FilterCond FilterCond;
 typedef struct _FilterAction FilterAction;
 typedef struct _FilterRule FilterRule;
 typedef struct _FilterInfo FilterInfo;
+typedef struct _FilterDeferredAdd FilterDeferredAdd;
 
 typedef enum {
   FLT_TIMING_ANY,
@@ -153,6 +154,17 @@ struct _FilterInfo {
 
   FilterErrorValue error;
   gint last_exec_exit_status;
+
+  /* if set, move / copy of a received message only records the
+     destination in add_list; the caller performs it */
+  gboolean defer_add;
+  GSList *add_list;
+};
+
+struct _FilterDeferredAdd {
+  FilterActionType type;
+  gchar *dest_id;
+  MsgFlags flags;
 };
 
 gint filter_apply (GSList * fltlist, const gchar * file, FilterInfo * fltinfo);
@@ -164,6 +176,8 @@ gboolean filter_match_rule (FilterRule * rule, MsgInfo * msginfo, GSList * hlist
 
 gboolean filter_rule_requires_full_headers (FilterRule * rule);
 
+void filter_junk_classifier_close (void);
+
 /* read / write config */
 GSList *filter_xml_node_to_filter_list (GNode * node);
 GSList *filter_read_file (const gchar * file);
@@ -197,6 +211,9 @@ void filter_rule_match_type_str_to_enum (const gchar * type_str, FilterMatchType
 
 void filter_get_keyword_from_msg (MsgInfo * msginfo, gchar ** header, gchar ** key, FilterCreateType type);
 
+GSList *filter_rule_list_copy (GSList * fltlist);
+FilterRule *filter_rule_copy (FilterRule * rule);
+
 void filter_rule_list_free (GSList * fltlist);
 void filter_rule_free (FilterRule * rule);
 void filter_cond_list_free (GSList * cond_list);
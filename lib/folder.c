@@ -35,6 +35,7 @@
 #include "imap.h"
 #include "news.h"
 #include "mh.h"
+#include "maildir.h"
 #include "virtual.h"
 #include "utils.h"
 #include "xml.h"
@@ -43,6 +44,7 @@
 #include "account.h"
 #include "prefs_account.h"
 #include "ymain.h"
+#include "metrics.h"
 
 typedef struct _FolderPrivData FolderPrivData;
 
@@ -79,6 +81,9 @@ folder_new (FolderType type, const gchar * name, const gchar * path)
     case F_MH:
       folder = mh_get_class ()->folder_new (name, path);
       break;
+    case F_MAILDIR:
+      folder = maildir_get_class ()->folder_new (name, path);
+      break;
     case F_IMAP:
       folder = imap_get_class ()->folder_new (name, path);
       break;
@@ -494,6 +499,18 @@ folder_get_ui_func2 (Folder * folder)
   return NULL;
 }
 
+gpointer
+folder_get_ui_func2_data (Folder * folder)
+{
+  FolderPrivData *priv;
+
+  priv = folder_get_priv (folder);
+  if (priv)
+    return priv->ui_func2_data;
+
+  return NULL;
+}
+
 gboolean
 folder_call_ui_func2 (Folder * folder, FolderItem * item, guint count, guint total)
 {
@@ -553,14 +570,20 @@ folder_add (Folder * folder)
           if (FOLDER_TYPE (cur_folder) != F_MH)
             break;
         }
+      else if (FOLDER_TYPE (folder) == F_MAILDIR)
+        {
+          if (FOLDER_TYPE (cur_folder) != F_MH && FOLDER_TYPE (cur_folder) != F_MAILDIR)
+            break;
+        }
       else if (FOLDER_TYPE (folder) == F_IMAP)
         {
-          if (FOLDER_TYPE (cur_folder) != F_MH && FOLDER_TYPE (cur_folder) != F_IMAP)
+          if (FOLDER_TYPE (cur_folder) != F_MH &&
+              FOLDER_TYPE (cur_folder) != F_MAILDIR && FOLDER_TYPE (cur_folder) != F_IMAP)
             break;
         }
       else if (FOLDER_TYPE (folder) == F_NEWS)
         {
-          if (FOLDER_TYPE (cur_folder) != F_MH &&
+          if (FOLDER_TYPE (cur_folder) != F_MH && FOLDER_TYPE (cur_folder) != F_MAILDIR &&
               FOLDER_TYPE (cur_folder) != F_IMAP && FOLDER_TYPE (cur_folder) != F_NEWS)
             break;
         }
@@ -750,7 +773,8 @@ folder_find_from_path (const gchar * path)
   for (list = folder_list; list != NULL; list = list->next)
     {
       folder = list->data;
-      if (FOLDER_TYPE (folder) == F_MH && !path_cmp (LOCAL_FOLDER (folder)->rootpath, path))
+      if ((FOLDER_TYPE (folder) == F_MH || FOLDER_TYPE (folder) == F_MAILDIR) &&
+          !path_cmp (LOCAL_FOLDER (folder)->rootpath, path))
         return folder;
     }
 
@@ -1136,7 +1160,7 @@ folder_set_missing_folders (void)
   for (list = folder_list; list != NULL; list = list->next)
     {
       folder = list->data;
-      if (FOLDER_TYPE (folder) != F_MH)
+      if (FOLDER_TYPE (folder) != F_MH && FOLDER_TYPE (folder) != F_MAILDIR)
         continue;
       rootitem = FOLDER_ITEM (folder->node->data);
       g_return_if_fail (rootitem != NULL);
@@ -1206,7 +1230,7 @@ folder_get_path (Folder * folder)
 
   g_return_val_if_fail (folder != NULL, NULL);
 
-  if (FOLDER_TYPE (folder) == F_MH)
+  if (FOLDER_TYPE (folder) == F_MH || FOLDER_TYPE (folder) == F_MAILDIR)
     {
       path = g_filename_from_utf8 (LOCAL_FOLDER (folder)->rootpath, -1, NULL, NULL, NULL);
       if (!path)
@@ -1285,11 +1309,17 @@ gint
 folder_item_scan (FolderItem * item)
 {
   Folder *folder;
+  MetricsTimer timer;
+  gint ret;
 
   g_return_val_if_fail (item != NULL, -1);
 
   folder = item->folder;
-  return folder->klass->scan (folder, item);
+  metrics_timer_start (&timer, "folder_item_scan", item->path);
+  ret = folder->klass->scan (folder, item);
+  metrics_timer_stop (&timer);
+
+  return ret;
 }
 
 static void
@@ -1354,6 +1384,7 @@ folder_item_fetch_all_msg (FolderItem * item)
   GSList *mlist;
   GSList *cur;
   gint num = 0;
+  gint total;
   gint ret = 0;
 
   g_return_val_if_fail (item != NULL, -1);
@@ -1367,6 +1398,15 @@ folder_item_fetch_all_msg (FolderItem * item)
 
   mlist = folder_item_get_msg_list (item, TRUE);
 
+  if (folder->klass->fetch_msgs)
+    {
+      ret = folder->klass->fetch_msgs (folder, item, mlist);
+      procmsg_msg_list_free (mlist);
+      return ret;
+    }
+
+  total = g_slist_length (mlist);
+
   for (cur = mlist; cur != NULL; cur = cur->next)
     {
       MsgInfo *msginfo = (MsgInfo *) cur->data;
@@ -1375,6 +1415,12 @@ folder_item_fetch_all_msg (FolderItem * item)
       num++;
       if (folder->ui_func)
         folder->ui_func (folder, item, folder->ui_func_data ? folder->ui_func_data : GINT_TO_POINTER (num));
+      if (folder_call_ui_func2 (folder, item, num, total) == FALSE)
+        {
+          debug_print ("fetching cancelled.\n");
+          ret = -2;
+          break;
+        }
 
       msg = folder_item_fetch_msg (item, msginfo->msgnum);
       if (!msg)
@@ -2012,7 +2058,7 @@ folder_write_list_recursive (GNode * node, gpointer data)
       fprintf (fp, "<folder type=\"%s\"", folder_type_str[FOLDER_TYPE (folder)]);
       if (folder->name)
         PUT_ESCAPE_STR (fp, "name", folder->name);
-      if (FOLDER_TYPE (folder) == F_MH)
+      if (FOLDER_TYPE (folder) == F_MH || FOLDER_TYPE (folder) == F_MAILDIR)
         PUT_ESCAPE_STR (fp, "path", LOCAL_FOLDER (folder)->rootpath);
       if (item->collapsed && node->children)
         fputs (" collapsed=\"1\"", fp);
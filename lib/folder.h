@@ -35,7 +35,6 @@ typedef struct _LocalFolder LocalFolder;
 typedef struct _RemoteFolder RemoteFolder;
 #if 0
 typedef struct _MboxFolder MboxFolder;
-typedef struct _MaildirFolder MaildirFolder;
 #endif
 
 typedef struct _FolderItem FolderItem;
@@ -55,7 +54,6 @@ typedef struct _FolderItem FolderItem;
 
 #if 0
 #define MBOX_FOLDER(obj)	((MboxFolder *)obj)
-#define MAILDIR_FOLDER(obj)	((MaildirFolder *)obj)
 #endif
 
 #define FOLDER_ITEM(obj)	((FolderItem *)obj)
@@ -156,6 +154,8 @@ struct _FolderClass {
   GSList *(*get_uncached_msg_list) (Folder * folder, FolderItem * item);
   /* return value is filename encoding */
   gchar *(*fetch_msg) (Folder * folder, FolderItem * item, gint num);
+  /* optional: fetch many messages into the cache at once */
+    gint (*fetch_msgs) (Folder * folder, FolderItem * item, GSList * msglist);
   MsgInfo *(*get_msginfo) (Folder * folder, FolderItem * item, gint num);
     gint (*add_msg) (Folder * folder, FolderItem * dest, const gchar * file, MsgFlags * flags, gboolean remove_source);
     gint (*add_msgs) (Folder * folder, FolderItem * dest, GSList * file_list, gboolean remove_source, gint * first);
@@ -200,10 +200,6 @@ struct _RemoteFolder {
 struct _MboxFolder {
   LocalFolder lfolder;
 };
-
-struct _MaildirFolder {
-  LocalFolder lfolder;
-};
 #endif
 
 struct _FolderItem {
@@ -292,6 +288,7 @@ gint folder_item_compare (FolderItem * item_a, FolderItem * item_b);
 void folder_set_ui_func (Folder * folder, FolderUIFunc func, gpointer data);
 void folder_set_ui_func2 (Folder * folder, FolderUIFunc2 func, gpointer data);
 FolderUIFunc2 folder_get_ui_func2 (Folder * folder);
+gpointer folder_get_ui_func2_data (Folder * folder);
 gboolean folder_call_ui_func2 (Folder * folder, FolderItem * item, guint count, guint total);
 
 void folder_set_name (Folder * folder, const gchar * name);
@@ -340,6 +337,7 @@ GSList *folder_item_get_msg_list (FolderItem * item, gboolean use_cache);
 GSList *folder_item_get_uncached_msg_list (FolderItem * item);
 /* return value is filename encoding */
 gchar *folder_item_fetch_msg (FolderItem * item, gint num);
+/* returns -2 if cancelled through ui_func2 */
 gint folder_item_fetch_all_msg (FolderItem * item);
 MsgInfo *folder_item_get_msginfo (FolderItem * item, gint num);
 gint folder_item_add_msg (FolderItem * dest, const gchar * file, MsgFlags * flags, gboolean remove_source);
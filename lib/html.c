@@ -28,6 +28,8 @@
 #include "utils.h"
 
 #define HTMLBUFSIZE	8192
+/* input is read and converted in blocks of this size */
+#define HTMLREADSIZE	65536
 #define HR_STR		"------------------------------------------------"
 
 typedef struct _HTMLSymbol HTMLSymbol;
@@ -168,9 +170,19 @@ static HTMLSymbol other_symbol_list[] = {
   {"&fnof;", "\xc6\x92"},
 };
 
-static GHashTable *default_symbol_table;
+typedef struct _HTMLSymbolNode HTMLSymbolNode;
 
-static HTMLState html_read_line (HTMLParser * parser);
+/* trie of the entity names, indexed by their first character */
+struct _HTMLSymbolNode {
+  gchar ch;
+  const gchar *val;
+  HTMLSymbolNode *child;
+  HTMLSymbolNode *next;
+};
+
+static HTMLSymbolNode *symbol_trie[128];
+
+static HTMLState html_read_block (HTMLParser * parser);
 
 static void html_append_char (HTMLParser * parser, gchar ch);
 static void html_append_str (HTMLParser * parser, const gchar * str, gint len);
@@ -185,6 +197,80 @@ static void html_get_parenthesis (HTMLParser * parser, gchar * buf, gint len);
 
 static gchar *html_unescape_str (HTMLParser * parser, const gchar * str);
 
+static void
+html_symbol_trie_add (const HTMLSymbol * list, gint n)
+{
+  gint i;
+
+  for (i = 0; i < n; i++)
+    {
+      HTMLSymbolNode **nodep;
+      const gchar *p;
+
+      /* skip the leading `&' */
+      p = list[i].key + 1;
+      nodep = &symbol_trie[(guchar) * p & 0x7f];
+
+      for (; *p != '\0'; p++)
+        {
+          HTMLSymbolNode *node;
+
+          for (node = *nodep; node != NULL; node = node->next)
+            if (node->ch == *p)
+              break;
+          if (!node)
+            {
+              node = g_new0 (HTMLSymbolNode, 1);
+              node->ch = *p;
+              node->next = *nodep;
+              *nodep = node;
+            }
+          if (p[1] == '\0')
+            node->val = list[i].val;
+          nodep = &node->child;
+        }
+    }
+}
+
+static void
+html_symbol_trie_init (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      html_symbol_trie_add (symbol_list, G_N_ELEMENTS (symbol_list));
+      html_symbol_trie_add (latin_symbol_list, G_N_ELEMENTS (latin_symbol_list));
+      html_symbol_trie_add (other_symbol_list, G_N_ELEMENTS (other_symbol_list));
+      g_once_init_leave (&initialized, 1);
+    }
+}
+
+/* name is `&foo;' and len its length */
+static const gchar *
+html_lookup_symbol (const gchar * name, gint len)
+{
+  HTMLSymbolNode *node;
+  gint i;
+
+  if (len < 3 || (guchar) name[1] >= 128)
+    return NULL;
+
+  node = symbol_trie[(guchar) name[1]];
+  for (i = 1; i < len; i++)
+    {
+      while (node != NULL && node->ch != name[i])
+        node = node->next;
+      if (!node)
+        return NULL;
+      if (i == len - 1)
+        return node->val;
+      node = node->child;
+    }
+
+  return NULL;
+}
+
 
 HTMLParser *
 html_parser_new (FILE * fp, CodeConverter * conv)
@@ -200,6 +286,7 @@ html_parser_new (FILE * fp, CodeConverter * conv)
   parser->str = g_string_new (NULL);
   parser->buf = g_string_new (NULL);
   parser->bufp = parser->buf->str;
+  parser->rawbuf = g_string_sized_new (HTMLREADSIZE);
   parser->state = HTML_NORMAL;
   parser->href = NULL;
   parser->newline = TRUE;
@@ -208,25 +295,7 @@ html_parser_new (FILE * fp, CodeConverter * conv)
   parser->pre = FALSE;
   parser->blockquote = 0;
 
-#define SYMBOL_TABLE_ADD(table, list) \
-{ \
-	gint i; \
- \
-	for (i = 0; i < sizeof(list) / sizeof(list[0]); i++) \
-		g_hash_table_insert(table, list[i].key, list[i].val); \
-}
-
-  if (!default_symbol_table)
-    {
-      default_symbol_table = g_hash_table_new (g_str_hash, g_str_equal);
-      SYMBOL_TABLE_ADD (default_symbol_table, symbol_list);
-      SYMBOL_TABLE_ADD (default_symbol_table, latin_symbol_list);
-      SYMBOL_TABLE_ADD (default_symbol_table, other_symbol_list);
-    }
-
-#undef SYMBOL_TABLE_ADD
-
-  parser->symbol_table = default_symbol_table;
+  html_symbol_trie_init ();
 
   return parser;
 }
@@ -236,6 +305,7 @@ html_parser_destroy (HTMLParser * parser)
 {
   g_string_free (parser->str, TRUE);
   g_string_free (parser->buf, TRUE);
+  g_string_free (parser->rawbuf, TRUE);
   g_free (parser->href);
   g_free (parser);
 }
@@ -250,12 +320,14 @@ html_parse (HTMLParser * parser)
     {
       g_string_truncate (parser->buf, 0);
       parser->bufp = parser->buf->str;
-      if (html_read_line (parser) == HTML_EOF)
+      if (html_read_block (parser) == HTML_EOF)
         return NULL;
     }
 
   while (*parser->bufp != '\0')
     {
+      gsize len;
+
       switch (*parser->bufp)
         {
         case '<':
@@ -282,9 +354,13 @@ html_parse (HTMLParser * parser)
               parser->bufp++;
               break;
             }
-          /* fallthrough */
-        default:
           html_append_char (parser, *parser->bufp++);
+          break;
+        default:
+          /* plain text up to the next markup or white space */
+          len = strcspn (parser->bufp, "<& \t\r\n");
+          html_append_str (parser, parser->bufp, len);
+          parser->bufp += len;
         }
     }
 
@@ -292,32 +368,61 @@ html_parse (HTMLParser * parser)
 }
 
 static HTMLState
-html_read_line (HTMLParser * parser)
+html_read_block (HTMLParser * parser)
 {
-  gchar buf[HTMLBUFSIZE];
+  GString *raw = parser->rawbuf;
+  gsize rest, n, len;
   gchar *conv_str;
+  gchar saved;
   gint index;
+  HTMLState state = HTML_NORMAL;
+
+  rest = raw->len;
+  g_string_set_size (raw, rest + HTMLREADSIZE);
+  n = fread (raw->str + rest, 1, HTMLREADSIZE, parser->fp);
+  g_string_set_size (raw, rest + n);
 
-  if (fgets (buf, sizeof (buf), parser->fp) == NULL)
+  if (raw->len == 0)
     {
       parser->state = HTML_EOF;
       return HTML_EOF;
     }
 
-  conv_str = conv_convert (parser->conv, buf);
-  if (!conv_str)
+  /* convert up to a line break (or at least a tag end or a space) so
+     that no multibyte character is split; keep the rest for later */
+  len = raw->len;
+  if (n > 0)
     {
-      index = parser->bufp - parser->buf->str;
+      const gchar *breaks = "\n> ";
+      gint i;
 
-      conv_str = conv_utf8todisp (buf, NULL);
-      g_string_append (parser->buf, conv_str);
-      g_free (conv_str);
+      for (i = 0; breaks[i] != '\0'; i++)
+        {
+          gsize j;
 
-      parser->bufp = parser->buf->str + index;
+          for (j = raw->len; j > 0 && raw->str[j - 1] != breaks[i]; j--)
+            ;
+          if (j > 0)
+            {
+              len = j;
+              break;
+            }
+        }
+    }
+
+  saved = raw->str[len];
+  raw->str[len] = '\0';
 
-      return HTML_CONV_FAILED;
+  conv_str = conv_convert (parser->conv, raw->str);
+  if (!conv_str)
+    {
+      conv_str = conv_utf8todisp (raw->str, NULL);
+      state = HTML_CONV_FAILED;
     }
 
+  raw->str[len] = saved;
+  g_string_erase (raw, 0, len);
+
   index = parser->bufp - parser->buf->str;
 
   g_string_append (parser->buf, conv_str);
@@ -325,7 +430,7 @@ html_read_line (HTMLParser * parser)
 
   parser->bufp = parser->buf->str + index;
 
-  return HTML_NORMAL;
+  return state;
 }
 
 static void
@@ -410,7 +515,7 @@ html_find_char (HTMLParser * parser, gchar ch)
 
   while ((p = strchr (parser->bufp, ch)) == NULL)
     {
-      if (html_read_line (parser) == HTML_EOF)
+      if (html_read_block (parser) == HTML_EOF)
         return NULL;
     }
 
@@ -424,7 +529,7 @@ html_find_str (HTMLParser * parser, const gchar * str)
 
   while ((p = strstr (parser->bufp, str)) == NULL)
     {
-      if (html_read_line (parser) == HTML_EOF)
+      if (html_read_block (parser) == HTML_EOF)
         return NULL;
     }
 
@@ -438,7 +543,7 @@ html_find_str_case (HTMLParser * parser, const gchar * str)
 
   while ((p = strcasestr (parser->bufp, str)) == NULL)
     {
-      if (html_read_line (parser) == HTML_EOF)
+      if (html_read_block (parser) == HTML_EOF)
         return NULL;
     }
 
@@ -710,7 +815,7 @@ html_parse_special (HTMLParser * parser)
   g_return_if_fail (*parser->bufp == '&');
 
   /* &foo; */
-  for (n = 0; parser->bufp[n] != '\0' && parser->bufp[n] != ';'; n++)
+  for (n = 0; n < 8 && parser->bufp[n] != '\0' && parser->bufp[n] != ';'; n++)
     ;
   if (n > 7 || parser->bufp[n] != ';')
     {
@@ -722,7 +827,7 @@ html_parse_special (HTMLParser * parser)
   strncpy2 (symbol_name, parser->bufp, n + 2);
   parser->bufp += n + 1;
 
-  if ((val = g_hash_table_lookup (parser->symbol_table, symbol_name)) != NULL)
+  if ((val = html_lookup_symbol (symbol_name, n + 1)) != NULL)
     {
       html_append_str (parser, val, -1);
       parser->state = HTML_NORMAL;
@@ -826,7 +931,7 @@ html_unescape_str (HTMLParser * parser, const gchar * str)
       switch (*p)
         {
         case '&':
-          for (n = 0; p[n] != '\0' && p[n] != ';'; n++)
+          for (n = 0; n < 8 && p[n] != '\0' && p[n] != ';'; n++)
             ;
           if (n > 7 || p[n] != ';')
             {
@@ -836,7 +941,7 @@ html_unescape_str (HTMLParser * parser, const gchar * str)
           strncpy2 (symbol_name, p, n + 2);
           p += n + 1;
 
-          if ((val = g_hash_table_lookup (parser->symbol_table, symbol_name)) != NULL)
+          if ((val = html_lookup_symbol (symbol_name, n + 1)) != NULL)
             {
               gint len = strlen (val);
               if (len <= n + 1)
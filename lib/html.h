@@ -50,10 +50,10 @@ struct _HTMLParser {
   FILE *fp;
   CodeConverter *conv;
 
-  GHashTable *symbol_table;
-
   GString *str;
   GString *buf;
+  /* read but not yet converted input */
+  GString *rawbuf;
 
   gchar *bufp;
 
@@ -51,6 +51,8 @@
 #include "utils.h"
 #include "prefs_common.h"
 #include "virtual.h"
+#include "metrics.h"
+#include "bodycache.h"
 
 #define IMAP4_PORT	143
 #if USE_SSL
@@ -58,8 +60,15 @@
 #endif
 
 #define IMAP_COPY_LIMIT	200
+#define IMAP_APPEND_LIMIT	100	/* messages per MULTIAPPEND */
+#define IMAP_APPEND_SIZE_LIMIT	(16 * 1024 * 1024)
+#define IMAP_LITERAL_MINUS_MAX	4096	/* RFC 7888 */
 #define IMAP_CMD_LIMIT	1000
 
+#define IMAP_PREFETCH_LIMIT	100	/* messages per UID FETCH */
+#define IMAP_PREFETCH_DEPTH	2	/* commands in flight per connection */
+#define IMAP_PREFETCH_MAX_CONN	8
+
 #define QUOTE_IF_REQUIRED(out, str)					\
 {									\
 	if (!str || *str == '\0') {					\
@@ -100,8 +109,28 @@ typedef struct _IMAPRealSession {
   gint prog_total;
   gint flag;
   gint retval;
+  gboolean capability_checked;  /* capability known after login */
 } IMAPRealSession;
 
+typedef struct _IMAPAppendMsg {
+  MsgFileInfo *fileinfo;
+  IMAPFlags flags;
+  guint32 new_uid;
+  FILE *fp;
+  gint size;
+  gchar date_time[64];
+} IMAPAppendMsg;
+
+typedef struct _IMAPPrefetchData {
+  gchar *path;                  /* cache directory of the folder */
+  gint account_id;
+  GSList *seq_list;             /* pending UID sequence sets */
+  GMutex lock;                  /* protects seq_list */
+  gint count;
+  gint serial;
+  gint cancelled;
+} IMAPPrefetchData;
+
 static GList *session_list = NULL;
 
 static void imap_folder_init (Folder * folder, const gchar * name, const gchar * path);
@@ -120,6 +149,7 @@ static gint imap_fetch_flags (IMAPSession * session, GArray ** uids, GHashTable
 static GSList *imap_get_msg_list (Folder * folder, FolderItem * item, gboolean use_cache);
 static GSList *imap_get_uncached_msg_list (Folder * folder, FolderItem * item);
 static gchar *imap_fetch_msg (Folder * folder, FolderItem * item, gint uid);
+static gint imap_fetch_msgs (Folder * folder, FolderItem * item, GSList * msglist);
 static MsgInfo *imap_get_msginfo (Folder * folder, FolderItem * item, gint uid);
 static gint imap_add_msg (Folder * folder,
                           FolderItem * dest, const gchar * file, MsgFlags * flags, gboolean remove_source);
@@ -206,9 +236,11 @@ static MsgInfo *imap_parse_envelope (IMAPSession * session, FolderItem * item, G
 
 static gboolean imap_has_capability (IMAPSession * session, const gchar * capability);
 static void imap_capability_free (IMAPSession * session);
+static void imap_capability_parse (IMAPSession * session, const gchar * str);
 
 /* low-level IMAP4rev1 commands */
 static gint imap_cmd_capability (IMAPSession * session);
+static void imap_update_capability (IMAPSession * session);
 static gint imap_cmd_authenticate (IMAPSession * session, const gchar * user, const gchar * pass, IMAPAuthType type);
 static gint imap_cmd_login (IMAPSession * session, const gchar * user, const gchar * pass);
 static gint imap_cmd_logout (IMAPSession * session);
@@ -216,6 +248,9 @@ static gint imap_cmd_noop (IMAPSession * session);
 #if USE_SSL
 static gint imap_cmd_starttls (IMAPSession * session);
 #endif
+#if USE_ZLIB
+static gint imap_cmd_compress (IMAPSession * session);
+#endif
 static gint imap_cmd_namespace (IMAPSession * session, gchar ** ns_str);
 static gint imap_cmd_list (IMAPSession * session, const gchar * ref, const gchar * mailbox, GPtrArray * argbuf);
 static gint imap_cmd_do_select (IMAPSession * session,
@@ -232,8 +267,8 @@ static gint imap_cmd_delete (IMAPSession * session, const gchar * folder);
 static gint imap_cmd_subscribe (IMAPSession * session, const gchar * folder);
 static gint imap_cmd_envelope (IMAPSession * session, const gchar * seq_set);
 static gint imap_cmd_fetch (IMAPSession * session, guint32 uid, const gchar * filename);
-static gint imap_cmd_append (IMAPSession * session,
-                             const gchar * destfolder, const gchar * file, IMAPFlags flags, guint32 * new_uid);
+static gint imap_cmd_prefetch (IMAPSession * session, gpointer data);
+static gint imap_cmd_append (IMAPSession * session, const gchar * destfolder, IMAPAppendMsg * msgs, gint n);
 static gint imap_cmd_copy (IMAPSession * session, const gchar * seq_set, const gchar * destfolder);
 static gint imap_cmd_store (IMAPSession * session, const gchar * seq_set, const gchar * sub_cmd);
 static gint imap_cmd_expunge (IMAPSession * session);
@@ -262,6 +297,8 @@ static void imap_seq_set_free (GSList * seq_list);
 
 static gboolean imap_rename_folder_func (GNode * node, gpointer data);
 
+static gboolean imap_thread_start (IMAPSession * session, IMAPThreadFunc func, gpointer data);
+static gint imap_thread_finish (IMAPSession * session);
 static gint imap_thread_run (IMAPSession * session, IMAPThreadFunc func, gpointer data);
 static gint imap_thread_run_progress (IMAPSession * session,
                                       IMAPThreadFunc func, IMAPProgressFunc progress_func, gpointer data);
@@ -278,6 +315,7 @@ static FolderClass imap_class = {
   imap_get_msg_list,
   imap_get_uncached_msg_list,
   imap_fetch_msg,
+  imap_fetch_msgs,
   imap_get_msginfo,
   imap_add_msg,
   imap_add_msgs,
@@ -599,6 +637,8 @@ imap_session_connect (IMAPSession * session)
     }
 #endif
 
+  /* the login response may carry the new capabilities */
+  ((IMAPRealSession *) session)->capability_checked = session->authenticated;
   if (!session->authenticated && imap_auth (session, account->userid, pass, account->imap_auth_type) != IMAP_SUCCESS)
     {
       if (account->tmp_pass)
@@ -610,6 +650,32 @@ imap_session_connect (IMAPSession * session)
       return IMAP_AUTHFAIL;
     }
 
+  if (imap_has_capability (session, "UIDPLUS"))
+    session->uidplus = TRUE;
+
+#if USE_ZLIB
+  if (account->imap_compress && !sock_is_compressed (sock))
+    {
+      /* servers usually announce COMPRESS only after login */
+      if (!imap_has_capability (session, "COMPRESS=DEFLATE"))
+        imap_update_capability (session);
+      if (imap_has_capability (session, "COMPRESS=DEFLATE"))
+        {
+          gint ok;
+
+          ok = imap_cmd_compress (session);
+          if (ok == IMAP_SUCCESS)
+            {
+              if (sock_enable_compress (sock) < 0)
+                return IMAP_SOCKET;
+              log_message (_("IMAP4 connection to %s is compressed\n"), SESSION (session)->server);
+            }
+          else if (ok == IMAP_SOCKET)
+            return ok;
+        }
+    }
+#endif
+
   return IMAP_SUCCESS;
 }
 
@@ -621,6 +687,7 @@ imap_session_reconnect (IMAPSession * session)
   session_disconnect (SESSION (session));
 
   imap_capability_free (session);
+  ((IMAPRealSession *) session)->capability_checked = FALSE;
   session->uidplus = FALSE;
   g_free (session->mbox);
   session->mbox = NULL;
@@ -844,7 +911,8 @@ imap_get_msg_list_full (Folder * folder, FolderItem * item, gboolean use_cache,
               if (MSG_IS_UNREAD (msginfo->flags))
                 item->unread--;
               item->total--;
-              mlist = g_slist_remove (mlist, msginfo);
+              /* unlinked after the loop in one pass */
+              cur->data = NULL;
               procmsg_msginfo_free (msginfo);
               item->cache_dirty = TRUE;
               item->mark_dirty = TRUE;
@@ -916,6 +984,7 @@ imap_get_msg_list_full (Folder * folder, FolderItem * item, gboolean use_cache,
               item->mark_dirty = TRUE;
             }
         }
+      mlist = g_slist_remove_all (mlist, NULL);
 
       /* check for the first new message */
       msg_table = procmsg_msg_hash_table_create (mlist);
@@ -1054,6 +1123,7 @@ imap_fetch_msg (Folder * folder, FolderItem * item, gint uid)
   if (is_file_exist (filename) && get_file_size (filename) > 0)
     {
       debug_print ("message %u has been already cached.\n", uid32);
+      body_cache_touch (filename);
       return filename;
     }
 
@@ -1083,9 +1153,157 @@ imap_fetch_msg (Folder * folder, FolderItem * item, gint uid)
       return NULL;
     }
 
+  body_cache_add (folder->account->account_id, filename);
+
   return filename;
 }
 
+static gint
+imap_fetch_msgs (Folder * folder, FolderItem * item, GSList * msglist)
+{
+  IMAPSession *sessions[IMAP_PREFETCH_MAX_CONN];
+  IMAPPrefetchData pf;
+  GSList *uncached = NULL;
+  GSList *cur;
+  gchar *path;
+  gint n_sessions = 1;
+  gint n_started;
+  gint max_sessions;
+  gint total, prev_count = 0, count;
+  gboolean running;
+  gint ok, ret = 0;
+  gint i;
+
+  g_return_val_if_fail (folder != NULL, -1);
+  g_return_val_if_fail (item != NULL, -1);
+
+  path = folder_item_get_path (item);
+  if (!is_dir_exist (path))
+    make_dir_hier (path);
+
+  /* skip messages already cached, so that an interrupted download
+     resumes where it stopped */
+  for (cur = msglist; cur != NULL; cur = cur->next)
+    {
+      MsgInfo *msginfo = (MsgInfo *) cur->data;
+      gchar nstr[16];
+      gchar *file;
+
+      g_snprintf (nstr, sizeof (nstr), "%u", msginfo->msgnum);
+      file = g_strconcat (path, G_DIR_SEPARATOR_S, nstr, NULL);
+      if (!is_file_exist (file) || get_file_size (file) <= 0)
+        uncached = g_slist_prepend (uncached, msginfo);
+      g_free (file);
+    }
+
+  total = g_slist_length (uncached);
+  debug_print ("imap_fetch_msgs: %d of %d messages not cached\n", total, g_slist_length (msglist));
+  if (total == 0)
+    {
+      g_free (path);
+      return 0;
+    }
+
+  sessions[0] = imap_session_get (folder);
+  if (!sessions[0])
+    {
+      g_slist_free (uncached);
+      g_free (path);
+      return -1;
+    }
+
+  ok = imap_select (sessions[0], IMAP_FOLDER (folder), item->path, NULL, NULL, NULL, NULL);
+  if (ok != IMAP_SUCCESS)
+    {
+      g_warning ("can't select mailbox %s\n", item->path);
+      g_slist_free (uncached);
+      g_free (path);
+      return -1;
+    }
+
+  memset (&pf, 0, sizeof (pf));
+  pf.path = path;
+  pf.account_id = folder->account->account_id;
+  pf.seq_list = imap_get_seq_set_from_msglist (uncached, IMAP_PREFETCH_LIMIT);
+  g_mutex_init (&pf.lock);
+  g_slist_free (uncached);
+
+  /* additional connections only pay off with more than one batch */
+  max_sessions = CLAMP (folder->account->imap_max_connections, 1, IMAP_PREFETCH_MAX_CONN);
+  max_sessions = MIN (max_sessions, (gint) g_slist_length (pf.seq_list));
+  while (n_sessions < max_sessions)
+    {
+      IMAPSession *session;
+
+      session = IMAP_SESSION (imap_session_new (folder->account));
+      if (!session)
+        break;
+      if (imap_select (session, IMAP_FOLDER (folder), item->path, NULL, NULL, NULL, NULL) != IMAP_SUCCESS)
+        {
+          session_destroy (SESSION (session));
+          break;
+        }
+      sessions[n_sessions++] = session;
+    }
+  debug_print ("imap_fetch_msgs: using %d connection(s)\n", n_sessions);
+
+  for (n_started = 0; n_started < n_sessions; n_started++)
+    {
+      if (!imap_thread_start (sessions[n_started], imap_cmd_prefetch, &pf))
+        break;
+    }
+
+  status_print (_("Getting messages in %s"), item->path);
+
+  do
+    {
+      event_loop_iterate ();
+
+      count = g_atomic_int_get (&pf.count);
+      if (count != prev_count)
+        {
+          progress_show (count, total);
+          if (folder_call_ui_func2 (folder, item, count, total) == FALSE)
+            g_atomic_int_set (&pf.cancelled, 1);
+          prev_count = count;
+        }
+
+      running = FALSE;
+      for (i = 0; i < n_started; i++)
+        {
+          if (g_atomic_int_get (&((IMAPRealSession *) sessions[i])->flag) == 0)
+            running = TRUE;
+        }
+    }
+  while (running);
+
+  if (n_started == 0)
+    ret = -1;
+  for (i = 0; i < n_started; i++)
+    {
+      ok = imap_thread_finish (sessions[i]);
+      if (ok != IMAP_SUCCESS)
+        {
+          log_warning (_("error occurred while getting messages.\n"));
+          ret = -1;
+        }
+    }
+  for (i = 1; i < n_sessions; i++)
+    session_destroy (SESSION (sessions[i]));
+
+  progress_show (0, 0);
+
+  if (ret == 0 && pf.cancelled)
+    ret = -2;
+  debug_print ("imap_fetch_msgs: %d message(s) fetched\n", pf.count);
+
+  imap_seq_set_free (pf.seq_list);
+  g_mutex_clear (&pf.lock);
+  g_free (path);
+
+  return ret;
+}
+
 static MsgInfo *
 imap_get_msginfo (Folder * folder, FolderItem * item, gint uid)
 {
@@ -1141,8 +1359,12 @@ imap_add_msgs (Folder * folder, FolderItem * dest, GSList * file_list, gboolean
   guint32 last_uid = 0;
   GSList *cur;
   MsgFileInfo *fileinfo;
-  gint count = 1;
+  IMAPAppendMsg *msgs;
+  gint count = 0;
   gint total;
+  gint limit;
+  off_t size;
+  gint i, n;
   gint ok;
   struct timespec tv_prev, tv_cur;
 
@@ -1154,6 +1376,9 @@ imap_add_msgs (Folder * folder, FolderItem * dest, GSList * file_list, gboolean
   if (!session)
     return -1;
 
+  /* for MULTIAPPEND */
+  imap_update_capability (session);
+
   clock_gettime (CLOCK_MONOTONIC, &tv_prev);
   ui_update ();
 
@@ -1173,68 +1398,89 @@ imap_add_msgs (Folder * folder, FolderItem * dest, GSList * file_list, gboolean
 
   total = g_slist_length (file_list);
 
-  for (cur = file_list; cur != NULL; cur = cur->next)
+  /* with MULTIAPPEND many messages go in one command */
+  limit = imap_has_capability (session, "MULTIAPPEND") ? IMAP_APPEND_LIMIT : 1;
+  msgs = g_new (IMAPAppendMsg, MIN (limit, total));
+
+  for (cur = file_list; cur != NULL;)
     {
-      IMAPFlags iflags = 0;
-      guint32 new_uid = 0;
+      for (n = 0, size = 0; cur != NULL && n < limit; cur = cur->next, n++)
+        {
+          IMAPFlags iflags = 0;
 
-      fileinfo = (MsgFileInfo *) cur->data;
+          fileinfo = (MsgFileInfo *) cur->data;
 
-      if (fileinfo->flags)
-        {
-          if (MSG_IS_MARKED (*fileinfo->flags))
-            iflags |= IMAP_FLAG_FLAGGED;
-          if (MSG_IS_REPLIED (*fileinfo->flags))
-            iflags |= IMAP_FLAG_ANSWERED;
-          if (!MSG_IS_UNREAD (*fileinfo->flags))
+          /* a failed command fails all of its messages */
+          size += get_file_size (fileinfo->file);
+          if (n > 0 && size > IMAP_APPEND_SIZE_LIMIT)
+            break;
+
+          if (fileinfo->flags)
+            {
+              if (MSG_IS_MARKED (*fileinfo->flags))
+                iflags |= IMAP_FLAG_FLAGGED;
+              if (MSG_IS_REPLIED (*fileinfo->flags))
+                iflags |= IMAP_FLAG_ANSWERED;
+              if (!MSG_IS_UNREAD (*fileinfo->flags))
+                iflags |= IMAP_FLAG_SEEN;
+            }
+
+          if (dest->stype == F_OUTBOX || dest->stype == F_QUEUE || dest->stype == F_DRAFT)
             iflags |= IMAP_FLAG_SEEN;
-        }
 
-      if (dest->stype == F_OUTBOX || dest->stype == F_QUEUE || dest->stype == F_DRAFT)
-        iflags |= IMAP_FLAG_SEEN;
+          msgs[n].fileinfo = fileinfo;
+          msgs[n].flags = iflags;
+        }
 
       clock_gettime (CLOCK_MONOTONIC, &tv_cur);
       if (tv_cur.tv_sec > tv_prev.tv_sec || tv_cur.tv_nsec - tv_prev.tv_nsec > PROGRESS_UPDATE_INTERVAL * 1000)
         {
-          status_print (_("Appending messages to %s (%d / %d)"), dest->path, count, total);
-          progress_show (count, total);
+          status_print (_("Appending messages to %s (%d / %d)"), dest->path, count + 1, total);
+          progress_show (count + 1, total);
           ui_update ();
           tv_prev = tv_cur;
         }
-      ++count;
+      count += n;
 
-      ok = imap_cmd_append (session, destdir, fileinfo->file, iflags, &new_uid);
+      ok = imap_cmd_append (session, destdir, msgs, n);
 
       if (ok != IMAP_SUCCESS)
         {
-          g_warning ("can't append message %s\n", fileinfo->file);
+          g_warning ("can't append messages to %s\n", destdir);
+          g_free (msgs);
           g_free (destdir);
           progress_show (0, 0);
           return -1;
         }
 
-      if (yam_app_get ())
-        g_signal_emit_by_name (yam_app_get (), "add-msg", dest, fileinfo->file, new_uid);
+      for (i = 0; i < n; i++)
+        {
+          fileinfo = msgs[i].fileinfo;
 
-      if (!session->uidplus)
-        last_uid++;
-      else if (last_uid < new_uid)
-        last_uid = new_uid;
+          if (yam_app_get ())
+            g_signal_emit_by_name (yam_app_get (), "add-msg", dest, fileinfo->file, msgs[i].new_uid);
 
-      dest->last_num = last_uid;
-      dest->total++;
-      dest->updated = TRUE;
+          if (!session->uidplus)
+            last_uid++;
+          else if (last_uid < msgs[i].new_uid)
+            last_uid = msgs[i].new_uid;
 
-      if (fileinfo->flags)
-        {
-          if (MSG_IS_UNREAD (*fileinfo->flags))
+          dest->last_num = last_uid;
+          dest->total++;
+          dest->updated = TRUE;
+
+          if (fileinfo->flags)
+            {
+              if (MSG_IS_UNREAD (*fileinfo->flags))
+                dest->unread++;
+            }
+          else
             dest->unread++;
         }
-      else
-        dest->unread++;
     }
 
   progress_show (0, 0);
+  g_free (msgs);
   g_free (destdir);
 
   if (remove_source)
@@ -3767,6 +4013,45 @@ imap_capability_free (IMAPSession * session)
     }
 }
 
+/* STR is the list after "CAPABILITY ", up to a ']' if any */
+static void
+imap_capability_parse (IMAPSession * session, const gchar * str)
+{
+  gchar *caps, *p;
+
+  caps = g_strdup (str);
+  if ((p = strchr (caps, ']')) != NULL)
+    *p = '\0';
+  g_strstrip (caps);
+
+  imap_capability_free (session);
+  session->capability = g_strsplit (caps, " ", -1);
+  ((IMAPRealSession *) session)->capability_checked = TRUE;
+
+  g_free (caps);
+}
+
+/* servers usually announce more capabilities after login.  Ask once if
+ * the login response didn't carry them; a failure only leaves the ones
+ * from before login */
+static void
+imap_update_capability (IMAPSession * session)
+{
+  IMAPRealSession *real = (IMAPRealSession *) session;
+
+  if (real->capability_checked)
+    return;
+  real->capability_checked = TRUE;
+
+  if (imap_cmd_capability (session) != IMAP_SUCCESS)
+    {
+      debug_print ("imap_update_capability: CAPABILITY failed\n");
+      return;
+    }
+  if (imap_has_capability (session, "UIDPLUS"))
+    session->uidplus = TRUE;
+}
+
 
 /* low-level IMAP4rev1 commands */
 
@@ -3950,6 +4235,18 @@ imap_cmd_starttls (IMAPSession * session)
 }
 #endif
 
+#if USE_ZLIB
+static gint
+imap_cmd_compress (IMAPSession * session)
+{
+  gint ok;
+
+  if ((ok = imap_cmd_gen_send (session, "COMPRESS DEFLATE")) != IMAP_SUCCESS)
+    return ok;
+  return imap_cmd_ok (session, NULL);
+}
+#endif
+
 #define THROW(err) { ok = err; goto catch; }
 
 static gint
@@ -4147,8 +4444,6 @@ typedef struct _IMAPCmdFetchData {
   const gchar *filename;
 } IMAPCmdFetchData;
 
-#define THROW(err) { ok = err; goto catch; }
-
 static gint
 imap_cmd_fetch_func (IMAPSession * session, gpointer data)
 {
@@ -4237,6 +4532,195 @@ imap_cmd_fetch (IMAPSession * session, guint32 uid, const gchar * filename)
   return ok;
 }
 
+#define THROW(err) { ok = err; goto catch; }
+
+static gint
+imap_prefetch_recv_body (IMAPSession * session, IMAPPrefetchData * pf, const gchar * buf)
+{
+  gchar *line;
+  gchar size_str[32];
+  gchar nstr[16];
+  gchar *tmp_file, *file;
+  gchar *p;
+  glong size_num;
+  guint32 uid = 0;
+  gint ok = IMAP_SUCCESS;
+
+  p = strrchr_with_skip_quote (buf, '"', '{');
+  p = strchr_cpy (p + 1, '}', size_str, sizeof (size_str));
+  size_num = atol (size_str);
+  if (p == NULL || *p != '\0' || size_num < 0)
+    return IMAP_ERROR;
+
+  /* UID may come either before or after the literal */
+  if ((p = strstr (buf, "UID ")) != NULL)
+    sscanf (p + 4, "%u", &uid);
+
+  tmp_file = g_strdup_printf ("%s%c.prefetch.%d", pf->path, G_DIR_SEPARATOR, g_atomic_int_add (&pf->serial, 1));
+  if (recv_bytes_write_to_file (SESSION (session)->sock, size_num, tmp_file) == -2)
+    THROW (IMAP_SOCKET);
+
+  if ((ok = imap_cmd_gen_recv (session, &line)) != IMAP_SUCCESS)
+    THROW (ok);
+  if (uid == 0 && (p = strstr (line, "UID ")) != NULL)
+    sscanf (p + 4, "%u", &uid);
+  g_free (line);
+
+  /* the stream is still in sync here, so just skip this one */
+  if (uid == 0 || !is_file_exist (tmp_file))
+    {
+      log_warning (_("can't get message body\n"));
+      THROW (IMAP_IOERR);
+    }
+
+  g_snprintf (nstr, sizeof (nstr), "%u", uid);
+  file = g_strconcat (pf->path, G_DIR_SEPARATOR_S, nstr, NULL);
+  if (rename_force (tmp_file, file) < 0)
+    {
+      FILE_OP_ERROR (file, "rename");
+      ok = IMAP_IOERR;
+    }
+  else
+    {
+      body_cache_add (pf->account_id, file);
+      /* only messages which made it into the cache count */
+      g_atomic_int_inc (&pf->count);
+      g_main_context_wakeup (NULL);
+    }
+  g_free (file);
+
+catch:
+  if (is_file_exist (tmp_file))
+    g_unlink (tmp_file);
+  g_free (tmp_file);
+  return ok;
+}
+
+static gint
+imap_prefetch_recv (IMAPSession * session, IMAPPrefetchData * pf, guint tag)
+{
+  gchar *buf;
+  gchar *p;
+  gchar obuf[32];
+  gchar cmd_status[IMAPBUFSIZE + 1];
+  guint cmd_num;
+  gchar *literal;
+  gint len;
+  gboolean io_error = FALSE;
+  gint ok;
+
+  while ((ok = imap_cmd_gen_recv (session, &buf)) == IMAP_SUCCESS)
+    {
+      if (buf[0] != '*' || buf[1] != ' ')
+        break;
+
+      if ((p = strrchr_with_skip_quote (buf, '"', '{')) == NULL)
+        {
+          g_free (buf);
+          continue;
+        }
+
+      if (strstr (buf, "FETCH") != NULL && strstr (buf, "BODY[]") != NULL)
+        {
+          ok = imap_prefetch_recv_body (session, pf, buf);
+          g_free (buf);
+          if (ok == IMAP_IOERR)
+            io_error = TRUE;
+          else if (ok != IMAP_SUCCESS)
+            return ok;
+          continue;
+        }
+
+      /* unrelated literal: skip it and the rest of the response */
+      p = strchr_cpy (p + 1, '}', obuf, sizeof (obuf));
+      len = atoi (obuf);
+      g_free (buf);
+      if (len < 0 || p == NULL || *p != '\0')
+        return IMAP_ERROR;
+      if ((literal = recv_bytes (SESSION (session)->sock, len)) == NULL)
+        return IMAP_SOCKET;
+      g_free (literal);
+      if ((ok = imap_cmd_gen_recv (session, &buf)) != IMAP_SUCCESS)
+        return ok;
+      g_free (buf);
+    }
+  if (ok != IMAP_SUCCESS)
+    return ok;
+
+  if (sscanf (buf, "%u %" Xstr (IMAPBUFSIZE) "s", &cmd_num, cmd_status) < 2 ||
+      cmd_num != tag || strcmp (cmd_status, "OK") != 0)
+    ok = IMAP_ERROR;
+  g_free (buf);
+
+  if (ok == IMAP_SUCCESS && io_error)
+    ok = IMAP_IOERR;
+
+  return ok;
+}
+
+static gchar *
+imap_prefetch_next_seq_set (IMAPPrefetchData * pf)
+{
+  gchar *seq_set = NULL;
+
+  if (g_atomic_int_get (&pf->cancelled))
+    return NULL;
+
+  g_mutex_lock (&pf->lock);
+  if (pf->seq_list)
+    {
+      seq_set = (gchar *) pf->seq_list->data;
+      pf->seq_list = g_slist_delete_link (pf->seq_list, pf->seq_list);
+    }
+  g_mutex_unlock (&pf->lock);
+
+  return seq_set;
+}
+
+/* thread function: keeps up to IMAP_PREFETCH_DEPTH UID FETCH commands
+   in flight on one connection and streams the bodies into the cache */
+static gint
+imap_cmd_prefetch (IMAPSession * session, gpointer data)
+{
+  IMAPPrefetchData *pf = (IMAPPrefetchData *) data;
+  guint tags[IMAP_PREFETCH_DEPTH];
+  gint n_tags = 0;
+  gchar *seq_set;
+  gint ok = IMAP_SUCCESS;
+  gint ret;
+
+  for (;;)
+    {
+      while (ok == IMAP_SUCCESS && n_tags < IMAP_PREFETCH_DEPTH && (seq_set = imap_prefetch_next_seq_set (pf)) != NULL)
+        {
+          ok = imap_cmd_gen_send (session, "UID FETCH %s (UID BODY.PEEK[])", seq_set);
+          g_free (seq_set);
+          if (ok == IMAP_SUCCESS)
+            tags[n_tags++] = session->cmd_count;
+        }
+      if (n_tags == 0)
+        break;
+
+      ret = imap_prefetch_recv (session, pf, tags[0]);
+      if (ret != IMAP_SUCCESS)
+        {
+          ok = ret;
+          /* the connection is out of sync now */
+          if (ret == IMAP_SOCKET || ret == IMAP_ERROR)
+            break;
+        }
+      memmove (tags, tags + 1, (--n_tags) * sizeof (guint));
+    }
+
+  if (ok != IMAP_SUCCESS)
+    g_atomic_int_set (&pf->cancelled, 1);
+  session_set_access_time (SESSION (session));
+
+  return ok;
+}
+
+#undef THROW
+
 static void
 imap_get_date_time (gchar * buf, size_t len, stime_t timer)
 {
@@ -4256,97 +4740,223 @@ imap_get_date_time (gchar * buf, size_t len, stime_t timer)
     }
 }
 
+/* gets the Date: header of fp as the internal date of APPEND */
+static void
+imap_get_append_date_time (FILE * fp, gchar * buf, size_t len)
+{
+  HeaderEntry hentry[] = { {"Date:", NULL, FALSE},
+  {NULL, NULL, FALSE}
+  };
+  stime_t date;
+
+  buf[0] = '\0';
+  procheader_get_header_fields (fp, hentry);
+  if (hentry[0].body)
+    {
+      date = procheader_date_parse (NULL, hentry[0].body, 0);
+      if (date > 0)
+        imap_get_date_time (buf, len, date);
+      g_free (hentry[0].body);
+    }
+}
+
+/* returns the size of fp with bare LFs turned into CRLFs and a line
+   break at the end, as written by imap_write_canonical_stream() */
 static gint
-imap_cmd_append (IMAPSession * session, const gchar * destfolder,
-                 const gchar * file, IMAPFlags flags, guint32 * new_uid)
+imap_get_canonical_size (FILE * fp)
 {
-  gint ok;
-  MsgInfo *msginfo;
-  MsgFlags flags_ = { 0, 0 };
-  gchar date_time[64] = "";
-  gint size;
-  gchar *destfolder_;
-  gchar *flag_str;
-  guint new_uid_;
-  gchar *ret = NULL;
   gchar buf[BUFFSIZE];
-  FILE *fp;
-  FILE *tmp;
-  size_t read_len;
-  GPtrArray *argbuf;
-  gchar *resp_str;
-
-  g_return_val_if_fail (file != NULL, IMAP_ERROR);
+  size_t len, i;
+  gint size = 0;
+  gchar prev = '\0';
 
-  if ((fp = g_fopen (file, "rb")) == NULL)
+  while ((len = fread (buf, 1, sizeof (buf), fp)) > 0)
     {
-      FILE_OP_ERROR (file, "fopen");
-      return -1;
+      for (i = 0; i < len; i++)
+        {
+          if (buf[i] == '\n' && prev != '\r')
+            size++;
+          prev = buf[i];
+        }
+      size += len;
     }
+  if (ferror (fp))
+    return -1;
+  if (size > 0 && prev != '\n')
+    size += 2;
 
-  /* use Date: header as received date */
-  msginfo = procheader_parse_stream (fp, flags_, FALSE);
-  imap_get_date_time (date_time, sizeof (date_time), msginfo->date_t);
-  procmsg_msginfo_free (msginfo);
+  return size;
+}
 
-  rewind (fp);
-  tmp = canonicalize_file_stream (fp, &size);
-  fclose (fp);
-  if (!tmp)
+/* sends fp canonicalized without going through a temporary file */
+static gint
+imap_write_canonical_stream (SockInfo * sock, FILE * fp)
+{
+  gchar buf[BUFFSIZE];
+  gchar obuf[BUFFSIZE * 2];
+  size_t len, i, olen;
+  gboolean empty = TRUE;
+  gchar prev = '\0';
+
+  while ((len = fread (buf, 1, sizeof (buf), fp)) > 0)
+    {
+      for (i = 0, olen = 0; i < len; i++)
+        {
+          if (buf[i] == '\n' && prev != '\r')
+            obuf[olen++] = '\r';
+          obuf[olen++] = buf[i];
+          prev = buf[i];
+        }
+      if (sock_write_all (sock, obuf, olen) < 0)
+        return -1;
+      empty = FALSE;
+    }
+  if (ferror (fp))
     return -1;
+  if (!empty && prev != '\n' && sock_write_all (sock, "\r\n", 2) < 0)
+    return -1;
+
+  return 0;
+}
+
+/* fills uids with the UIDs of an APPENDUID set such as "4:6,9" */
+static void
+imap_parse_uid_set (const gchar * set, guint32 * uids, gint n)
+{
+  gchar **ranges;
+  guint32 uid, first, last;
+  gint i, j = 0;
+
+  ranges = g_strsplit (set, ",", -1);
+  for (i = 0; ranges[i] != NULL && j < n; i++)
+    {
+      if (sscanf (ranges[i], "%u:%u", &first, &last) == 2)
+        {
+          for (uid = first; uid <= last && j < n; uid++)
+            uids[j++] = uid;
+        }
+      else if (sscanf (ranges[i], "%u", &first) == 1)
+        uids[j++] = first;
+    }
+  g_strfreev (ranges);
+}
+
+/* appends n messages.  with MULTIAPPEND (RFC 3502) they go in one
+   command, and with LITERAL+ or LITERAL- (RFC 7888) the literals are
+   sent without waiting for continuations, so the whole batch costs a
+   single round trip. */
+static gint
+imap_cmd_append (IMAPSession * session, const gchar * destfolder, IMAPAppendMsg * msgs, gint n)
+{
+  SockInfo *sock = SESSION (session)->sock;
+  gboolean literal_plus, literal_minus;
+  gchar *destfolder_;
+  gchar *flag_str;
+  gchar *ret = NULL;
+  GPtrArray *argbuf;
+  gchar *resp_str;
+  gint ok = IMAP_SUCCESS;
+  gint i;
+
+  g_return_val_if_fail (msgs != NULL, IMAP_ERROR);
+  g_return_val_if_fail (n > 0, IMAP_ERROR);
 
   QUOTE_IF_REQUIRED (destfolder_, destfolder);
-  flag_str = imap_get_flag_str (flags);
-  if (date_time[0])
-    ok = imap_cmd_gen_send (session, "APPEND %s (%s) \"%s\" {%d}", destfolder_, flag_str, date_time, size);
-  else
-    ok = imap_cmd_gen_send (session, "APPEND %s (%s) {%d}", destfolder_, flag_str, size);
-  g_free (flag_str);
+
+  /* sizes are needed in advance, so read everything before sending
+     anything */
+  for (i = 0; i < n; i++)
+    {
+      msgs[i].new_uid = 0;
+      msgs[i].fp = g_fopen (msgs[i].fileinfo->file, "rb");
+      if (!msgs[i].fp)
+        {
+          FILE_OP_ERROR (msgs[i].fileinfo->file, "fopen");
+          ok = IMAP_ERROR;
+          break;
+        }
+      imap_get_append_date_time (msgs[i].fp, msgs[i].date_time, sizeof (msgs[i].date_time));
+      rewind (msgs[i].fp);
+      msgs[i].size = imap_get_canonical_size (msgs[i].fp);
+      rewind (msgs[i].fp);
+      if (msgs[i].size < 0)
+        {
+          FILE_OP_ERROR (msgs[i].fileinfo->file, "fread");
+          fclose (msgs[i].fp);
+          ok = IMAP_ERROR;
+          break;
+        }
+    }
   if (ok != IMAP_SUCCESS)
     {
-      log_warning (_("can't append %s to %s\n"), file, destfolder_);
-      fclose (tmp);
+      while (--i >= 0)
+        fclose (msgs[i].fp);
       return ok;
     }
 
-  ok = imap_cmd_gen_recv (session, &ret);
-  if (ok != IMAP_SUCCESS || ret[0] != '+')
+  literal_plus = imap_has_capability (session, "LITERAL+");
+  literal_minus = imap_has_capability (session, "LITERAL-");
+
+  for (i = 0; i < n && ok == IMAP_SUCCESS; i++)
     {
-      log_warning (_("can't append %s to %s\n"), file, destfolder_);
-      g_free (ret);
-      fclose (tmp);
-      return IMAP_ERROR;
-    }
-  g_free (ret);
+      gboolean sync;
+      gchar *arg;
 
-  log_print ("IMAP4> %s\n", _("(sending file...)"));
+      sync = !literal_plus && !(literal_minus && msgs[i].size <= IMAP_LITERAL_MINUS_MAX);
 
-  while ((read_len = fread (buf, 1, sizeof (buf), tmp)) > 0)
-    {
-      if (read_len < sizeof (buf) && ferror (tmp))
+      flag_str = imap_get_flag_str (msgs[i].flags);
+      if (msgs[i].date_time[0])
+        arg = g_strdup_printf ("(%s) \"%s\" {%d%s}", flag_str, msgs[i].date_time, msgs[i].size, sync ? "" : "+");
+      else
+        arg = g_strdup_printf ("(%s) {%d%s}", flag_str, msgs[i].size, sync ? "" : "+");
+      g_free (flag_str);
+
+      if (i == 0)
+        ok = imap_cmd_gen_send (session, "APPEND %s %s", destfolder_, arg);
+      else
+        {
+          log_print ("IMAP4> %s\n", arg);
+          if (sock_write_all (sock, " ", 1) < 0 || sock_puts (sock, arg) < 0)
+            ok = IMAP_SOCKET;
+        }
+      g_free (arg);
+      if (ok != IMAP_SUCCESS)
         break;
-      if (sock_write_all (SESSION (session)->sock, buf, read_len) < 0)
+
+      if (sync)
         {
-          fclose (tmp);
-          return -1;
+          ok = imap_cmd_gen_recv (session, &ret);
+          if (ok != IMAP_SUCCESS || ret[0] != '+')
+            {
+              if (ok == IMAP_SUCCESS)
+                ok = IMAP_ERROR;
+              g_free (ret);
+              break;
+            }
+          g_free (ret);
         }
-    }
 
-  if (ferror (tmp))
-    {
-      FILE_OP_ERROR (file, "fread");
-      fclose (tmp);
-      return -1;
+      log_print ("IMAP4> %s\n", _("(sending file...)"));
+
+      if (imap_write_canonical_stream (sock, msgs[i].fp) < 0)
+        {
+          FILE_OP_ERROR (msgs[i].fileinfo->file, "fread");
+          ok = IMAP_SOCKET;
+        }
     }
 
-  sock_puts (SESSION (session)->sock, "");
+  for (i = 0; i < n; i++)
+    fclose (msgs[i].fp);
 
-  fclose (tmp);
+  if (ok != IMAP_SUCCESS)
+    {
+      log_warning (_("can't append messages to %s\n"), destfolder_);
+      return ok;
+    }
 
-  if (new_uid != NULL)
-    *new_uid = 0;
+  sock_puts (sock, "");
 
-  if (new_uid != NULL && session->uidplus)
+  if (session->uidplus)
     {
       argbuf = g_ptr_array_new ();
 
@@ -4355,10 +4965,17 @@ imap_cmd_append (IMAPSession * session, const gchar * destfolder,
         log_warning (_("can't append message to %s\n"), destfolder_);
       else if (argbuf->len > 0)
         {
+          gchar uid_set[IMAPBUFSIZE + 1];
+          guint32 *uids;
+
           resp_str = g_ptr_array_index (argbuf, argbuf->len - 1);
-          if (resp_str && sscanf (resp_str, "%*u OK [APPENDUID %*u %u]", &new_uid_) == 1)
+          if (resp_str && sscanf (resp_str, "%*u OK [APPENDUID %*u %" Xstr (IMAPBUFSIZE) "[0-9:,]]", uid_set) == 1)
             {
-              *new_uid = new_uid_;
+              uids = g_new0 (guint32, n);
+              imap_parse_uid_set (uid_set, uids, n);
+              for (i = 0; i < n; i++)
+                msgs[i].new_uid = uids[i];
+              g_free (uids);
             }
         }
 
@@ -4501,6 +5118,8 @@ imap_cmd_ok_real (IMAPSession * session, GPtrArray * argbuf)
 
       if (str->str[0] == '*' && str->str[1] == ' ')
         {
+          if (!g_ascii_strncasecmp (str->str + 2, "CAPABILITY ", 11))
+            imap_capability_parse (session, str->str + 13);
           if (argbuf)
             g_ptr_array_add (argbuf, g_strdup (str->str + 2));
 
@@ -4511,6 +5130,8 @@ imap_cmd_ok_real (IMAPSession * session, GPtrArray * argbuf)
         ok = IMAP_ERROR;
       else if (cmd_num == session->cmd_count && !strcmp (cmd_status, "OK"))
         {
+          if ((p = strstr (str->str, "[CAPABILITY ")) != NULL)
+            imap_capability_parse (session, p + 12);
           if (argbuf)
             g_ptr_array_add (argbuf, g_strdup (str->str));
         }
@@ -5093,14 +5714,66 @@ static void
 imap_thread_run_proxy (gpointer push_data, gpointer data)
 {
   IMAPRealSession *real = (IMAPRealSession *) data;
+  MetricsTimer timer;
 
   debug_print ("imap_thread_run_proxy (%p): calling thread_func\n", g_thread_self ());
+  metrics_timer_start (&timer, "imap_thread_run", SESSION (real)->server);
   real->retval = real->thread_func (IMAP_SESSION (real), real->thread_data);
+  metrics_timer_stop (&timer);
   g_atomic_int_set (&real->flag, 1);
   g_main_context_wakeup (NULL);
   debug_print ("imap_thread_run_proxy (%p): thread_func done\n", g_thread_self ());
 }
 
+static gboolean
+imap_thread_start (IMAPSession * session, IMAPThreadFunc func, gpointer data)
+{
+  IMAPRealSession *real = (IMAPRealSession *) session;
+
+  if (real->is_running)
+    {
+      g_warning ("imap_thread_start: thread is already running");
+      return FALSE;
+    }
+
+  if (!real->pool)
+    {
+      real->pool = g_thread_pool_new (imap_thread_run_proxy, real, -1, FALSE, NULL);
+      if (!real->pool)
+        return FALSE;
+    }
+
+  real->is_running = TRUE;
+  real->thread_func = func;
+  real->thread_data = data;
+  real->flag = 0;
+  real->retval = 0;
+
+  g_thread_pool_push (real->pool, real, NULL);
+
+  return TRUE;
+}
+
+static gint
+imap_thread_finish (IMAPSession * session)
+{
+  IMAPRealSession *real = (IMAPRealSession *) session;
+  gint ret;
+
+  while (g_atomic_int_get (&real->flag) == 0)
+    event_loop_iterate ();
+
+  real->is_running = FALSE;
+  real->thread_func = NULL;
+  real->thread_data = NULL;
+  real->flag = 0;
+  ret = real->retval;
+  real->retval = 0;
+  log_flush ();
+
+  return ret;
+}
+
 static gint
 imap_thread_run (IMAPSession * session, IMAPThreadFunc func, gpointer data)
 {
@@ -0,0 +1,2021 @@
+/*
+ * LibYAM -- E-Mail client library
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ymain.h"
+#include "folder.h"
+#include "maildir.h"
+#include "mh.h"
+#include "procmsg.h"
+#include "procheader.h"
+#include "utils.h"
+
+/* Every folder is a maildir (cur/, new/ and tmp/) and sub folders are
+ * plain sub directories, the same hierarchy as the MH folders.
+ *
+ * Messages have no numbers in a maildir, but the summary cache and the
+ * mark file are indexed by them.  A message is therefore known by the
+ * unique part of its file name (everything before ":2,") and the
+ * numbers are assigned on first sight and kept in MAILDIR_UID_FILE.
+ * Numbers are never reused, and nothing else is needed from external
+ * delivery agents: they write to tmp/ and move the file into new/
+ * without any locking. */
+
+G_LOCK_DEFINE_STATIC (maildir);
+#define S_LOCK(name)	G_LOCK(name)
+#define S_UNLOCK(name)	G_UNLOCK(name)
+
+#define MAILDIR_INFO_SEP	":2,"
+
+typedef struct _MaildirEntry MaildirEntry;
+typedef struct _MaildirUidList MaildirUidList;
+
+struct _MaildirEntry {
+  gint num;
+  gchar *key;
+  gchar *file;                  /* "new/<name>" or "cur/<name>" */
+
+  guint scan_id;
+  guint renamed:1;              /* renamed by someone else since the last scan */
+};
+
+struct _MaildirUidList {
+  GHashTable *key_table;
+  GHashTable *num_table;
+  gint last_num;
+  guint scan_id;
+
+  GString *pending;             /* lines to be appended to the uid file */
+  gboolean dirty;               /* the uid file needs to be rewritten */
+};
+
+/* FolderItem * -> MaildirUidList * */
+static GHashTable *maildir_uid_lists = NULL;
+
+static Folder *maildir_folder_new (const gchar * name, const gchar * path);
+static void maildir_folder_destroy (Folder * folder);
+
+static GSList *maildir_get_msg_list (Folder * folder, FolderItem * item, gboolean use_cache);
+static GSList *maildir_get_uncached_msg_list (Folder * folder, FolderItem * item);
+static gchar *maildir_fetch_msg (Folder * folder, FolderItem * item, gint num);
+static MsgInfo *maildir_get_msginfo (Folder * folder, FolderItem * item, gint num);
+static gint maildir_add_msg (Folder * folder,
+                             FolderItem * dest, const gchar * file, MsgFlags * flags, gboolean remove_source);
+static gint maildir_add_msgs (Folder * folder,
+                              FolderItem * dest, GSList * file_list, gboolean remove_source, gint * first);
+static gint maildir_add_msg_msginfo (Folder * folder, FolderItem * dest, MsgInfo * msginfo, gboolean remove_source);
+static gint maildir_add_msgs_msginfo (Folder * folder,
+                                      FolderItem * dest, GSList * msglist, gboolean remove_source, gint * first);
+static gint maildir_move_msg (Folder * folder, FolderItem * dest, MsgInfo * msginfo);
+static gint maildir_move_msgs (Folder * folder, FolderItem * dest, GSList * msglist);
+static gint maildir_copy_msg (Folder * folder, FolderItem * dest, MsgInfo * msginfo);
+static gint maildir_copy_msgs (Folder * folder, FolderItem * dest, GSList * msglist);
+static gint maildir_remove_msg (Folder * folder, FolderItem * item, MsgInfo * msginfo);
+static gint maildir_remove_msgs (Folder * folder, FolderItem * item, GSList * msglist);
+static gint maildir_remove_all_msg (Folder * folder, FolderItem * item);
+static gboolean maildir_is_msg_changed (Folder * folder, FolderItem * item, MsgInfo * msginfo);
+static gint maildir_close (Folder * folder, FolderItem * item);
+
+static gint maildir_scan_folder (Folder * folder, FolderItem * item);
+static gint maildir_scan_tree (Folder * folder);
+
+static gint maildir_create_tree (Folder * folder);
+static FolderItem *maildir_create_folder (Folder * folder, FolderItem * parent, const gchar * name);
+static gint maildir_rename_folder (Folder * folder, FolderItem * item, const gchar * name);
+static gint maildir_move_folder (Folder * folder, FolderItem * item, FolderItem * new_parent);
+static gint maildir_remove_folder (Folder * folder, FolderItem * item);
+
+static MaildirUidList *maildir_get_uid_list (FolderItem * item);
+static gint maildir_scan_entries (MaildirUidList * list, const gchar * path);
+static void maildir_uid_list_save (MaildirUidList * list, FolderItem * item);
+static void maildir_sync_flags (FolderItem * item, MaildirUidList * list, GSList * mlist, gboolean update_msgs);
+static gint maildir_count_msgs (const gchar * path);
+
+/* directories of a maildir folder that are not sub folders */
+static const gchar *const maildir_subdirs[] = { "cur", "new", "tmp", NULL };
+
+static FolderClass maildir_class = {
+  F_MAILDIR,
+
+  maildir_folder_new,
+  maildir_folder_destroy,
+
+  maildir_scan_tree,
+  maildir_create_tree,
+
+  maildir_get_msg_list,
+  maildir_get_uncached_msg_list,
+  maildir_fetch_msg,
+  NULL,
+  maildir_get_msginfo,
+  maildir_add_msg,
+  maildir_add_msgs,
+  maildir_add_msg_msginfo,
+  maildir_add_msgs_msginfo,
+  maildir_move_msg,
+  maildir_move_msgs,
+  maildir_copy_msg,
+  maildir_copy_msgs,
+  maildir_remove_msg,
+  maildir_remove_msgs,
+  maildir_remove_all_msg,
+  maildir_is_msg_changed,
+  maildir_close,
+  maildir_scan_folder,
+
+  maildir_create_folder,
+  maildir_rename_folder,
+  maildir_move_folder,
+  maildir_remove_folder,
+};
+
+
+FolderClass *
+maildir_get_class (void)
+{
+  return &maildir_class;
+}
+
+static gboolean
+maildir_is_dir_exist (const gchar * path, const gchar * subdir)
+{
+  gchar *dir;
+  gboolean ret;
+
+  if (g_path_is_absolute (path))
+    dir = g_strconcat (path, G_DIR_SEPARATOR_S, subdir, NULL);
+  else
+    dir = g_strconcat (get_mail_base_dir (), G_DIR_SEPARATOR_S, path, G_DIR_SEPARATOR_S, subdir, NULL);
+  ret = is_dir_exist (dir);
+  g_free (dir);
+
+  return ret;
+}
+
+/* returns TRUE if path (relative to the mail base directory) already
+   holds a tree of maildir folders */
+gboolean
+maildir_is_maildir_tree (const gchar * path)
+{
+  g_return_val_if_fail (path != NULL, FALSE);
+
+  return maildir_is_dir_exist (path, INBOX_DIR G_DIR_SEPARATOR_S "cur");
+}
+
+/* returns TRUE if path is a single maildir (like ~/Maildir delivered
+   to by an MDA), which can't be used as the root of a mailbox */
+gboolean
+maildir_is_maildir (const gchar * path)
+{
+  g_return_val_if_fail (path != NULL, FALSE);
+
+  return maildir_is_dir_exist (path, "cur") && maildir_is_dir_exist (path, "new");
+}
+
+static Folder *
+maildir_folder_new (const gchar * name, const gchar * path)
+{
+  Folder *folder;
+
+  folder = (Folder *) g_new0 (MaildirFolder, 1);
+  folder->klass = maildir_get_class ();
+  folder_local_folder_init (folder, name, path);
+
+  return folder;
+}
+
+static gboolean
+maildir_uid_list_remove_folder_func (gpointer key, gpointer value, gpointer data)
+{
+  return FOLDER_ITEM (key)->folder == FOLDER (data);
+}
+
+static void
+maildir_folder_destroy (Folder * folder)
+{
+  S_LOCK (maildir);
+  if (maildir_uid_lists)
+    g_hash_table_foreach_remove (maildir_uid_lists, maildir_uid_list_remove_folder_func, folder);
+  S_UNLOCK (maildir);
+
+  folder_local_folder_destroy (LOCAL_FOLDER (folder));
+}
+
+static gint
+maildir_make_subdirs (const gchar * path)
+{
+  gchar *dir;
+  gint i;
+
+  for (i = 0; maildir_subdirs[i] != NULL; i++)
+    {
+      dir = g_strconcat (path, G_DIR_SEPARATOR_S, maildir_subdirs[i], NULL);
+      if (!is_dir_exist (dir) && make_dir_hier (dir) < 0)
+        {
+          g_free (dir);
+          return -1;
+        }
+      g_free (dir);
+    }
+
+  return 0;
+}
+
+/* file names */
+
+static gchar *
+maildir_get_key (const gchar * name)
+{
+  const gchar *p;
+
+  if ((p = strrchr (name, '/')) != NULL)
+    name = p + 1;
+  if ((p = strchr (name, ':')) != NULL)
+    return g_strndup (name, p - name);
+
+  return g_strdup (name);
+}
+
+/* returns a name that is unique across hosts and processes, as
+   suggested by the maildir specification: time.MusecPpidQcount.host */
+static gchar *
+maildir_new_key (void)
+{
+  static gchar *host = NULL;
+  static gint count = 0;
+  gint64 now;
+
+  if (!host)
+    {
+      GString *str;
+      const gchar *p;
+
+      str = g_string_new (NULL);
+      for (p = g_get_host_name (); *p != '\0'; p++)
+        {
+          if (*p == '/')
+            g_string_append (str, "\\057");
+          else if (*p == ':')
+            g_string_append (str, "\\072");
+          else
+            g_string_append_c (str, *p);
+        }
+      host = g_string_free (str, FALSE);
+    }
+
+  now = g_get_real_time ();
+
+  return g_strdup_printf ("%" G_GINT64_FORMAT ".M%06dP%dQ%d.%s",
+                          now / G_USEC_PER_SEC, (gint) (now % G_USEC_PER_SEC),
+                          (gint) getpid (), g_atomic_int_add (&count, 1) + 1, host);
+}
+
+static MsgPermFlags
+maildir_get_perm_flags (const gchar * file)
+{
+  MsgPermFlags flags = MSG_UNREAD;
+  const gchar *p;
+
+  if (!strncmp (file, "new/", 4))
+    return MSG_NEW | MSG_UNREAD;
+
+  if ((p = strrchr (file, ':')) == NULL || strncmp (p, MAILDIR_INFO_SEP, 3) != 0)
+    return flags;
+
+  for (p += 3; *p != '\0'; p++)
+    {
+      switch (*p)
+        {
+        case 'F':
+          flags |= MSG_MARKED;
+          break;
+        case 'P':
+          flags |= MSG_FORWARDED;
+          break;
+        case 'R':
+          flags |= MSG_REPLIED;
+          break;
+        case 'S':
+          flags &= ~MSG_UNREAD;
+          break;
+        case 'T':
+          flags |= MSG_DELETED;
+          break;
+        default:
+          break;
+        }
+    }
+
+  return flags;
+}
+
+/* returns the file name for key with the flags.  unknown letters of
+   the old info (flags of other clients) are kept.  messages stay in
+   new/ while they are new, and never go back there. */
+static gchar *
+maildir_get_flagged_file (const gchar * key, const gchar * old_file, MsgPermFlags flags)
+{
+  gboolean letters[128] = { FALSE };
+  GString *str;
+  const gchar *p;
+  gint c;
+
+  if (flags & MSG_NEW)
+    {
+      if (!old_file)
+        return g_strconcat ("new/", key, NULL);
+      if (!strncmp (old_file, "new/", 4))
+        return g_strdup (old_file);
+    }
+
+  if (old_file && (p = strrchr (old_file, ':')) != NULL && !strncmp (p, MAILDIR_INFO_SEP, 3))
+    {
+      for (p += 3; *p != '\0'; p++)
+        if ((guchar) * p < 128)
+          letters[(guchar) * p] = TRUE;
+    }
+
+  letters['F'] = (flags & MSG_MARKED) != 0;
+  letters['P'] = (flags & MSG_FORWARDED) != 0;
+  letters['R'] = (flags & MSG_REPLIED) != 0;
+  letters['S'] = (flags & MSG_UNREAD) == 0;
+  letters['T'] = (flags & MSG_DELETED) != 0;
+
+  str = g_string_new ("cur/");
+  g_string_append (str, key);
+  g_string_append (str, MAILDIR_INFO_SEP);
+  for (c = 33; c < 127; c++)
+    {
+      if (letters[c])
+        g_string_append_c (str, c);
+    }
+
+  return g_string_free (str, FALSE);
+}
+
+/* writes srcfile to tmp/ and moves it to its final place in one step,
+   so that other readers never see a partial message */
+static gint
+maildir_deliver (const gchar * path, const gchar * srcfile, const gchar * key, const gchar * file)
+{
+  gchar *tmpfile;
+  gchar *destfile;
+
+  tmpfile = g_strconcat (path, G_DIR_SEPARATOR_S, "tmp", G_DIR_SEPARATOR_S, key, NULL);
+  if (yam_link (srcfile, tmpfile) < 0 && copy_file (srcfile, tmpfile, FALSE) < 0)
+    {
+      g_warning (_("can't copy message %s to %s\n"), srcfile, tmpfile);
+      g_unlink (tmpfile);
+      g_free (tmpfile);
+      return -1;
+    }
+
+  destfile = g_strconcat (path, G_DIR_SEPARATOR_S, file, NULL);
+  if (g_rename (tmpfile, destfile) < 0)
+    {
+      FILE_OP_ERROR (tmpfile, "rename");
+      g_unlink (tmpfile);
+      g_free (destfile);
+      g_free (tmpfile);
+      return -1;
+    }
+
+  g_free (destfile);
+  g_free (tmpfile);
+
+  return 0;
+}
+
+/* uid list */
+
+static void
+maildir_entry_free (MaildirEntry * entry)
+{
+  g_free (entry->key);
+  g_free (entry->file);
+  g_free (entry);
+}
+
+static MaildirUidList *
+maildir_uid_list_new (void)
+{
+  MaildirUidList *list;
+
+  list = g_new0 (MaildirUidList, 1);
+  list->key_table = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) maildir_entry_free);
+  list->num_table = g_hash_table_new (NULL, g_direct_equal);
+  list->pending = g_string_new (NULL);
+
+  return list;
+}
+
+static void
+maildir_uid_list_free (MaildirUidList * list)
+{
+  g_hash_table_destroy (list->num_table);
+  g_hash_table_destroy (list->key_table);
+  g_string_free (list->pending, TRUE);
+  g_free (list);
+}
+
+/* takes the ownership of key and file */
+static MaildirEntry *
+maildir_uid_list_add (MaildirUidList * list, gint num, gchar * key, gchar * file)
+{
+  MaildirEntry *entry;
+
+  entry = g_new0 (MaildirEntry, 1);
+  entry->num = num > 0 ? num : ++list->last_num;
+  entry->key = key;
+  entry->file = file;
+  entry->scan_id = list->scan_id;
+  if (list->last_num < entry->num)
+    list->last_num = entry->num;
+
+  g_hash_table_insert (list->key_table, entry->key, entry);
+  g_hash_table_insert (list->num_table, GINT_TO_POINTER (entry->num), entry);
+
+  if (num <= 0)
+    g_string_append_printf (list->pending, "%d %s\n", entry->num, entry->file);
+
+  return entry;
+}
+
+static void
+maildir_uid_list_remove (MaildirUidList * list, MaildirEntry * entry)
+{
+  g_hash_table_remove (list->num_table, GINT_TO_POINTER (entry->num));
+  g_hash_table_remove (list->key_table, entry->key);
+  list->dirty = TRUE;
+}
+
+/* the uid file only has to map the number to the key; the file name
+   in it is a hint, which maildir_lookup_entry() and the next scan
+   correct.  so a rename for the flags doesn't rewrite the file. */
+static void
+maildir_entry_set_file (MaildirEntry * entry, gchar * file)
+{
+  g_free (entry->file);
+  entry->file = file;
+}
+
+static gchar *
+maildir_get_uid_file (FolderItem * item)
+{
+  gchar *path;
+  gchar *file;
+
+  path = folder_item_get_path (item);
+  g_return_val_if_fail (path != NULL, NULL);
+  file = g_strconcat (path, G_DIR_SEPARATOR_S, MAILDIR_UID_FILE, NULL);
+  g_free (path);
+
+  return file;
+}
+
+/* the uid file holds a "num file" line per message, with the file
+   name as it was when the line was written.  a line with a number only
+   records the last number handed out. */
+static MaildirUidList *
+maildir_uid_list_read (FolderItem * item)
+{
+  MaildirUidList *list;
+  MaildirEntry *entry;
+  gchar buf[BUFFSIZE];
+  gchar *file;
+  gchar *key;
+  gchar *p;
+  FILE *fp;
+  gint num;
+
+  list = maildir_uid_list_new ();
+
+  file = maildir_get_uid_file (item);
+  if (!file)
+    return list;
+  if ((fp = g_fopen (file, "rb")) == NULL)
+    {
+      if (ENOENT != errno)
+        FILE_OP_ERROR (file, "fopen");
+      g_free (file);
+      return list;
+    }
+  g_free (file);
+
+  while (fgets (buf, sizeof (buf), fp) != NULL)
+    {
+      strretchomp (buf);
+      num = atoi (buf);
+      if (num <= 0)
+        continue;
+      if ((p = strchr (buf, ' ')) == NULL)
+        {
+          if (list->last_num < num)
+            list->last_num = num;
+          continue;
+        }
+      p++;
+      if (strncmp (p, "new/", 4) != 0 && strncmp (p, "cur/", 4) != 0)
+        continue;
+      if (g_hash_table_lookup (list->num_table, GINT_TO_POINTER (num)))
+        continue;
+
+      /* a later line for the same message wins */
+      key = maildir_get_key (p);
+      entry = g_hash_table_lookup (list->key_table, key);
+      if (entry)
+        maildir_uid_list_remove (list, entry);
+      maildir_uid_list_add (list, num, key, g_strdup (p));
+    }
+
+  fclose (fp);
+
+  return list;
+}
+
+static void
+maildir_uid_list_write_func (gpointer key, gpointer value, gpointer data)
+{
+  MaildirEntry *entry = (MaildirEntry *) value;
+
+  fprintf ((FILE *) data, "%d %s\n", entry->num, entry->file);
+}
+
+static void
+maildir_uid_list_save (MaildirUidList * list, FolderItem * item)
+{
+  gchar *file;
+  gchar *tmp;
+  FILE *fp;
+
+  if (!list->dirty && list->pending->len == 0)
+    return;
+
+  file = maildir_get_uid_file (item);
+  g_return_if_fail (file != NULL);
+
+  if (!list->dirty)
+    {
+      /* appending is enough while no message has gone */
+      if ((fp = g_fopen (file, "ab")) == NULL)
+        {
+          FILE_OP_ERROR (file, "fopen");
+        }
+      else
+        {
+          fwrite (list->pending->str, list->pending->len, 1, fp);
+          if (fclose (fp) == EOF)
+            FILE_OP_ERROR (file, "fclose");
+        }
+      g_string_truncate (list->pending, 0);
+      g_free (file);
+      return;
+    }
+
+  tmp = g_strconcat (file, ".tmp", NULL);
+  if ((fp = g_fopen (tmp, "wb")) == NULL)
+    {
+      FILE_OP_ERROR (tmp, "fopen");
+      g_free (tmp);
+      g_free (file);
+      return;
+    }
+  fprintf (fp, "%d\n", list->last_num);
+  g_hash_table_foreach (list->key_table, maildir_uid_list_write_func, fp);
+  if (fclose (fp) == EOF)
+    {
+      FILE_OP_ERROR (tmp, "fclose");
+      g_unlink (tmp);
+    }
+  else if (rename_force (tmp, file) < 0)
+    {
+      FILE_OP_ERROR (tmp, "rename");
+    }
+  else
+    {
+      g_string_truncate (list->pending, 0);
+      list->dirty = FALSE;
+    }
+
+  g_free (tmp);
+  g_free (file);
+}
+
+static MaildirUidList *
+maildir_get_uid_list (FolderItem * item)
+{
+  MaildirUidList *list;
+
+  if (!maildir_uid_lists)
+    maildir_uid_lists = g_hash_table_new_full (NULL, g_direct_equal, NULL, (GDestroyNotify) maildir_uid_list_free);
+
+  list = g_hash_table_lookup (maildir_uid_lists, item);
+  if (!list)
+    {
+      list = maildir_uid_list_read (item);
+      g_hash_table_insert (maildir_uid_lists, item, list);
+    }
+
+  return list;
+}
+
+static gint
+maildir_cmp_file_by_name (gconstpointer a, gconstpointer b)
+{
+  /* skip "new/" and "cur/" */
+  return strcmp (*(const gchar **) a + 4, *(const gchar **) b + 4);
+}
+
+static gboolean
+maildir_remove_unseen_func (gpointer key, gpointer value, gpointer data)
+{
+  MaildirEntry *entry = (MaildirEntry *) value;
+  MaildirUidList *list = (MaildirUidList *) data;
+
+  if (entry->scan_id == list->scan_id)
+    return FALSE;
+
+  g_hash_table_remove (list->num_table, GINT_TO_POINTER (entry->num));
+  list->dirty = TRUE;
+
+  return TRUE;
+}
+
+/* reads new/ and cur/ of path into list.  unknown messages get the
+   next numbers in the order of their names, which begin with the
+   delivery time.  returns the number of messages. */
+static gint
+maildir_scan_entries (MaildirUidList * list, const gchar * path)
+{
+  static const gchar *subdirs[] = { "new", "cur" };
+  GPtrArray *unknown;
+  MaildirEntry *entry;
+  const gchar *name;
+  gchar *dir;
+  gchar *file;
+  gchar *key;
+  GDir *dp;
+  gint n_msg = 0;
+  guint i, j;
+
+  list->scan_id++;
+  unknown = g_ptr_array_new ();
+
+  for (i = 0; i < G_N_ELEMENTS (subdirs); i++)
+    {
+      dir = g_strconcat (path, G_DIR_SEPARATOR_S, subdirs[i], NULL);
+      if ((dp = g_dir_open (dir, 0, NULL)) == NULL)
+        {
+          g_free (dir);
+          continue;
+        }
+      g_free (dir);
+
+      while ((name = g_dir_read_name (dp)) != NULL)
+        {
+          if (name[0] == '.')
+            continue;
+
+          file = g_strconcat (subdirs[i], "/", name, NULL);
+          key = maildir_get_key (name);
+          entry = g_hash_table_lookup (list->key_table, key);
+          g_free (key);
+          if (!entry)
+            {
+              g_ptr_array_add (unknown, file);
+              continue;
+            }
+          if (entry->scan_id == list->scan_id)
+            {
+              /* the same message in new/ and cur/ */
+              g_free (file);
+              continue;
+            }
+
+          entry->scan_id = list->scan_id;
+          if (strcmp (entry->file, file) != 0)
+            {
+              entry->renamed = TRUE;
+              maildir_entry_set_file (entry, file);
+            }
+          else
+            g_free (file);
+          n_msg++;
+        }
+
+      g_dir_close (dp);
+    }
+
+  g_hash_table_foreach_remove (list->key_table, maildir_remove_unseen_func, list);
+
+  g_ptr_array_sort (unknown, maildir_cmp_file_by_name);
+  for (j = 0; j < unknown->len; j++)
+    {
+      file = g_ptr_array_index (unknown, j);
+      key = maildir_get_key (file);
+      if (g_hash_table_lookup (list->key_table, key))
+        {
+          g_free (key);
+          g_free (file);
+          continue;
+        }
+      maildir_uid_list_add (list, 0, key, file);
+      n_msg++;
+    }
+  g_ptr_array_free (unknown, TRUE);
+
+  return n_msg;
+}
+
+/* renames the files of the messages in mlist after their flags.
+   flags changed by other clients since the last scan win over ours,
+   and are copied into mlist if update_msgs is TRUE. */
+static void
+maildir_sync_flags (FolderItem * item, MaildirUidList * list, GSList * mlist, gboolean update_msgs)
+{
+  gchar *path;
+  gchar *file;
+  gchar *src, *dest;
+  GSList *cur;
+
+  path = folder_item_get_path (item);
+  g_return_if_fail (path != NULL);
+
+  for (cur = mlist; cur != NULL; cur = cur->next)
+    {
+      MsgInfo *msginfo = (MsgInfo *) cur->data;
+      MaildirEntry *entry;
+
+      entry = g_hash_table_lookup (list->num_table, GINT_TO_POINTER (msginfo->msgnum));
+      if (!entry)
+        continue;
+
+      if (entry->renamed)
+        {
+          if (!update_msgs)
+            continue;
+          msginfo->flags.perm_flags &= ~(MSG_NEW | MSG_UNREAD | MSG_MARKED | MSG_FORWARDED | MSG_REPLIED | MSG_DELETED);
+          msginfo->flags.perm_flags |= maildir_get_perm_flags (entry->file);
+          entry->renamed = FALSE;
+          item->mark_dirty = TRUE;
+          continue;
+        }
+
+      file = maildir_get_flagged_file (entry->key, entry->file, msginfo->flags.perm_flags);
+      if (!strcmp (file, entry->file))
+        {
+          g_free (file);
+          continue;
+        }
+
+      src = g_strconcat (path, G_DIR_SEPARATOR_S, entry->file, NULL);
+      dest = g_strconcat (path, G_DIR_SEPARATOR_S, file, NULL);
+      if (g_rename (src, dest) < 0)
+        {
+          FILE_OP_ERROR (src, "rename");
+          g_free (file);
+        }
+      else
+        maildir_entry_set_file (entry, file);
+      g_free (dest);
+      g_free (src);
+    }
+
+  g_free (path);
+}
+
+/* messages */
+
+static MsgInfo *
+maildir_parse_msg (const gchar * path, MaildirEntry * entry, FolderItem * item)
+{
+  MsgInfo *msginfo;
+  MsgFlags flags;
+  gchar *file;
+
+  flags.perm_flags = maildir_get_perm_flags (entry->file);
+  flags.tmp_flags = 0;
+
+  if (item->stype == F_QUEUE)
+    {
+      MSG_SET_TMP_FLAGS (flags, MSG_QUEUED);
+    }
+  else if (item->stype == F_DRAFT)
+    {
+      MSG_SET_TMP_FLAGS (flags, MSG_DRAFT);
+    }
+
+  file = g_strconcat (path, G_DIR_SEPARATOR_S, entry->file, NULL);
+  msginfo = procheader_parse_file (file, flags, FALSE);
+  g_free (file);
+  if (!msginfo)
+    return NULL;
+
+  msginfo->msgnum = entry->num;
+  msginfo->folder = item;
+
+  return msginfo;
+}
+
+typedef struct _MaildirListData {
+  const gchar *path;
+  FolderItem *item;
+  GHashTable *msg_table;
+  GSList *newlist;
+} MaildirListData;
+
+static void
+maildir_get_uncached_msgs_func (gpointer key, gpointer value, gpointer data)
+{
+  MaildirEntry *entry = (MaildirEntry *) value;
+  MaildirListData *ldata = (MaildirListData *) data;
+  MsgInfo *msginfo;
+
+  if (ldata->msg_table)
+    {
+      msginfo = g_hash_table_lookup (ldata->msg_table, GINT_TO_POINTER (entry->num));
+      if (msginfo)
+        {
+          MSG_SET_TMP_FLAGS (msginfo->flags, MSG_CACHED);
+          return;
+        }
+    }
+
+  msginfo = maildir_parse_msg (ldata->path, entry, ldata->item);
+  if (msginfo)
+    ldata->newlist = g_slist_prepend (ldata->newlist, msginfo);
+}
+
+static GSList *
+maildir_get_msg_list_full (Folder * folder, FolderItem * item, gboolean use_cache, gboolean uncached_only)
+{
+  MaildirUidList *list;
+  MaildirListData ldata;
+  MsgVector *mvec;
+  GSList *mlist;
+  GSList *newlist;
+  gchar *path;
+  guint i, n_cached;
+
+  g_return_val_if_fail (item != NULL, NULL);
+
+  path = folder_item_get_path (item);
+  g_return_val_if_fail (path != NULL, NULL);
+
+  S_LOCK (maildir);
+
+  list = maildir_get_uid_list (item);
+  maildir_scan_entries (list, path);
+
+  ldata.path = path;
+  ldata.item = item;
+  ldata.msg_table = NULL;
+  ldata.newlist = NULL;
+
+  mvec = NULL;
+  if (use_cache)
+    mvec = procmsg_read_cache_vector (item, FALSE);
+  if (!mvec)
+    mvec = procmsg_msg_vector_new (0);
+  if (mvec->len > 0)
+    {
+      ldata.msg_table = g_hash_table_new (NULL, g_direct_equal);
+      for (i = 0; i < mvec->len; i++)
+        g_hash_table_insert (ldata.msg_table, GINT_TO_POINTER (mvec->msgs[i]->msgnum), mvec->msgs[i]);
+    }
+  g_hash_table_foreach (list->num_table, maildir_get_uncached_msgs_func, &ldata);
+  if (ldata.msg_table)
+    g_hash_table_destroy (ldata.msg_table);
+
+  newlist = g_slist_sort (ldata.newlist, (GCompareFunc) procmsg_cmp_msgnum_for_sort);
+  if (newlist || !use_cache)
+    item->cache_dirty = TRUE;
+
+  /* remove nonexistent messages */
+  for (i = 0; i < mvec->len; i++)
+    {
+      MsgInfo *msginfo = mvec->msgs[i];
+      if (!MSG_IS_CACHED (msginfo->flags))
+        {
+          debug_print ("removing nonexistent message %d from cache\n", msginfo->msgnum);
+          procmsg_msginfo_free (msginfo);
+          mvec->msgs[i] = NULL;
+          item->cache_dirty = TRUE;
+          item->mark_dirty = TRUE;
+        }
+    }
+  procmsg_msg_vector_compact (mvec);
+
+  n_cached = mvec->len;
+  procmsg_msg_vector_concat (mvec, procmsg_msg_vector_from_list (newlist));
+  mlist = procmsg_msg_vector_to_list (mvec);
+  /* newlist is the tail of mlist now */
+  newlist = g_slist_nth (mlist, n_cached);
+
+  procmsg_set_flags (mlist, item);
+  maildir_sync_flags (item, list, mlist, TRUE);
+  maildir_uid_list_save (list, item);
+  item->last_num = list->last_num;
+
+  if (!uncached_only)
+    mlist = procmsg_sort_msg_list (mlist, item->sort_key, item->sort_type);
+
+  if (item->mark_queue)
+    item->mark_dirty = TRUE;
+
+  debug_print ("cache_dirty: %d, mark_dirty: %d\n", item->cache_dirty, item->mark_dirty);
+
+  if (!item->opened)
+    {
+      if (item->cache_dirty)
+        procmsg_write_cache_list (item, mlist);
+      if (item->mark_dirty)
+        procmsg_write_flags_list (item, mlist);
+    }
+
+  S_UNLOCK (maildir);
+  g_free (path);
+
+  if (uncached_only)
+    {
+      GSList *cur;
+
+      if (newlist == NULL)
+        {
+          procmsg_msg_list_free (mlist);
+          return NULL;
+        }
+      if (mlist == newlist)
+        return newlist;
+      for (cur = mlist; cur != NULL; cur = cur->next)
+        {
+          if (cur->next == newlist)
+            {
+              cur->next = NULL;
+              procmsg_msg_list_free (mlist);
+              return newlist;
+            }
+        }
+      procmsg_msg_list_free (mlist);
+      return NULL;
+    }
+
+  return mlist;
+}
+
+static GSList *
+maildir_get_msg_list (Folder * folder, FolderItem * item, gboolean use_cache)
+{
+  return maildir_get_msg_list_full (folder, item, use_cache, FALSE);
+}
+
+static GSList *
+maildir_get_uncached_msg_list (Folder * folder, FolderItem * item)
+{
+  return maildir_get_msg_list_full (folder, item, TRUE, TRUE);
+}
+
+/* returns the entry of num, rescanning the folder once if the file is
+   not where it was seen last.  must be called with the lock held. */
+static MaildirEntry *
+maildir_lookup_entry (FolderItem * item, const gchar * path, gint num)
+{
+  MaildirUidList *list;
+  MaildirEntry *entry;
+  gchar *file;
+
+  list = maildir_get_uid_list (item);
+  entry = g_hash_table_lookup (list->num_table, GINT_TO_POINTER (num));
+  if (entry)
+    {
+      file = g_strconcat (path, G_DIR_SEPARATOR_S, entry->file, NULL);
+      if (is_file_exist (file))
+        {
+          g_free (file);
+          return entry;
+        }
+      g_free (file);
+    }
+
+  maildir_scan_entries (list, path);
+  maildir_uid_list_save (list, item);
+
+  return g_hash_table_lookup (list->num_table, GINT_TO_POINTER (num));
+}
+
+static gchar *
+maildir_fetch_msg (Folder * folder, FolderItem * item, gint num)
+{
+  MaildirEntry *entry;
+  gchar *path;
+  gchar *file = NULL;
+
+  g_return_val_if_fail (item != NULL, NULL);
+  g_return_val_if_fail (num > 0, NULL);
+
+  path = folder_item_get_path (item);
+  g_return_val_if_fail (path != NULL, NULL);
+
+  S_LOCK (maildir);
+  entry = maildir_lookup_entry (item, path, num);
+  if (entry)
+    file = g_strconcat (path, G_DIR_SEPARATOR_S, entry->file, NULL);
+  S_UNLOCK (maildir);
+
+  g_free (path);
+
+  return file;
+}
+
+static MsgInfo *
+maildir_get_msginfo (Folder * folder, FolderItem * item, gint num)
+{
+  MaildirEntry *entry;
+  MsgInfo *msginfo = NULL;
+  gchar *path;
+
+  g_return_val_if_fail (item != NULL, NULL);
+  g_return_val_if_fail (num > 0, NULL);
+
+  path = folder_item_get_path (item);
+  g_return_val_if_fail (path != NULL, NULL);
+
+  S_LOCK (maildir);
+  entry = maildir_lookup_entry (item, path, num);
+  if (entry)
+    msginfo = maildir_parse_msg (path, entry, item);
+  S_UNLOCK (maildir);
+
+  g_free (path);
+
+  return msginfo;
+}
+
+static MsgFlags
+maildir_get_dest_flags (FolderItem * dest, MsgFlags flags)
+{
+  if (FOLDER_ITEM_IS_SENT_FOLDER (dest))
+    {
+      MSG_UNSET_PERM_FLAGS (flags, MSG_NEW | MSG_UNREAD | MSG_DELETED);
+    }
+  else if (dest->stype == F_TRASH)
+    {
+      MSG_UNSET_PERM_FLAGS (flags, MSG_DELETED);
+    }
+
+  return flags;
+}
+
+/* records a message that has just been placed in dest */
+static void
+maildir_add_entry (FolderItem * dest, MaildirUidList * list, const gchar * destpath,
+                   gchar * key, gchar * file, MsgInfo * msginfo, MsgFlags flags, FILE * fp, GArray * notify)
+{
+  MaildirEntry *entry;
+  MsgFlags dest_flags;
+  gchar *destfile;
+
+  entry = maildir_uid_list_add (list, 0, key, file);
+  destfile = g_strconcat (destpath, G_DIR_SEPARATOR_S, entry->file, NULL);
+  mh_notify_append (notify, "add-msg", dest, destfile, entry->num);
+  g_free (destfile);
+
+  dest->last_num = entry->num;
+  dest->total++;
+  dest->updated = TRUE;
+  dest->mtime = 0;
+
+  if (MSG_IS_RECEIVED (flags))
+    {
+      /* resets new flags of existing messages on
+         received mode */
+      if (dest->unmarked_num == 0)
+        dest->new = 0;
+      dest->unmarked_num++;
+      procmsg_add_mark_queue (dest, entry->num, flags);
+    }
+  else
+    {
+      MsgInfo newmsginfo;
+
+      dest_flags = maildir_get_dest_flags (dest, flags);
+      newmsginfo.msgnum = entry->num;
+      newmsginfo.flags = dest_flags;
+      if (fp)
+        procmsg_write_flags (&newmsginfo, fp);
+      else
+        procmsg_add_mark_queue (dest, entry->num, dest_flags);
+    }
+  procmsg_add_cache_queue (dest, entry->num, msginfo);
+
+  if (MSG_IS_NEW (flags))
+    dest->new++;
+  if (MSG_IS_UNREAD (flags))
+    dest->unread++;
+}
+
+static gint
+maildir_add_msg (Folder * folder, FolderItem * dest, const gchar * file, MsgFlags * flags, gboolean remove_source)
+{
+  GSList file_list;
+  MsgFileInfo fileinfo;
+
+  g_return_val_if_fail (file != NULL, -1);
+
+  fileinfo.file = (gchar *) file;
+  fileinfo.flags = flags;
+  file_list.data = &fileinfo;
+  file_list.next = NULL;
+
+  return maildir_add_msgs (folder, dest, &file_list, remove_source, NULL);
+}
+
+static gint
+maildir_add_msgs (Folder * folder, FolderItem * dest, GSList * file_list, gboolean remove_source, gint * first)
+{
+  MaildirUidList *list;
+  MsgFileInfo *fileinfo;
+  MsgInfo *msginfo;
+  GArray *notify;
+  GSList *cur;
+  gchar *destpath;
+  gchar *key;
+  gchar *file;
+  gint first_ = 0;
+  gint ret = 0;
+  FILE *fp = NULL;
+
+  g_return_val_if_fail (dest != NULL, -1);
+  g_return_val_if_fail (file_list != NULL, -1);
+
+  destpath = folder_item_get_path (dest);
+  g_return_val_if_fail (destpath != NULL, -1);
+  if (maildir_make_subdirs (destpath) < 0)
+    {
+      g_free (destpath);
+      return -1;
+    }
+
+  S_LOCK (maildir);
+
+  list = maildir_get_uid_list (dest);
+  notify = mh_notify_new ();
+
+  if (!dest->opened)
+    {
+      if ((fp = procmsg_open_mark_file (dest, DATA_APPEND)) == NULL)
+        g_warning ("maildir_add_msgs: can't open mark file.");
+    }
+
+  for (cur = file_list; cur != NULL; cur = cur->next)
+    {
+      MsgFlags flags = { MSG_NEW | MSG_UNREAD, 0 };
+
+      fileinfo = (MsgFileInfo *) cur->data;
+      if (fileinfo->flags)
+        flags = *fileinfo->flags;
+      msginfo = procheader_parse_file (fileinfo->file, flags, 0);
+      if (!msginfo)
+        {
+          ret = -1;
+          break;
+        }
+
+      key = maildir_new_key ();
+      file = maildir_get_flagged_file (key, NULL, MSG_IS_RECEIVED (flags) ?
+                                       flags.perm_flags : maildir_get_dest_flags (dest, flags).perm_flags);
+      if (maildir_deliver (destpath, fileinfo->file, key, file) < 0)
+        {
+          g_free (file);
+          g_free (key);
+          procmsg_msginfo_free (msginfo);
+          ret = -1;
+          break;
+        }
+
+      maildir_add_entry (dest, list, destpath, key, file, msginfo, flags, fp, notify);
+      if (first_ == 0)
+        first_ = dest->last_num;
+      procmsg_msginfo_free (msginfo);
+    }
+
+  if (fp)
+    fclose (fp);
+
+  maildir_uid_list_save (list, dest);
+
+  if (ret == 0)
+    {
+      if (first)
+        *first = first_;
+
+      if (remove_source)
+        {
+          for (cur = file_list; cur != NULL; cur = cur->next)
+            {
+              fileinfo = (MsgFileInfo *) cur->data;
+              if (g_unlink (fileinfo->file) < 0)
+                FILE_OP_ERROR (fileinfo->file, "unlink");
+            }
+        }
+    }
+
+  S_UNLOCK (maildir);
+
+  g_free (destpath);
+  mh_notify_emit (notify);
+
+  return ret < 0 ? -1 : dest->last_num;
+}
+
+static gint
+maildir_add_msg_msginfo (Folder * folder, FolderItem * dest, MsgInfo * msginfo, gboolean remove_source)
+{
+  GSList msglist;
+
+  g_return_val_if_fail (msginfo != NULL, -1);
+
+  msglist.data = msginfo;
+  msglist.next = NULL;
+
+  return maildir_add_msgs_msginfo (folder, dest, &msglist, remove_source, NULL);
+}
+
+static gint
+maildir_add_msgs_msginfo (Folder * folder, FolderItem * dest, GSList * msglist, gboolean remove_source, gint * first)
+{
+  MaildirUidList *list;
+  MsgInfo *msginfo;
+  GArray *notify;
+  GSList *cur;
+  gchar *destpath;
+  gchar *srcfile;
+  gchar *key;
+  gchar *file;
+  gint first_ = 0;
+  gint ret = 0;
+  FILE *fp = NULL;
+
+  g_return_val_if_fail (dest != NULL, -1);
+  g_return_val_if_fail (msglist != NULL, -1);
+
+  destpath = folder_item_get_path (dest);
+  g_return_val_if_fail (destpath != NULL, -1);
+  if (maildir_make_subdirs (destpath) < 0)
+    {
+      g_free (destpath);
+      return -1;
+    }
+
+  /* the source may be a maildir folder as well */
+  srcfile = NULL;
+  notify = mh_notify_new ();
+
+  for (cur = msglist; cur != NULL; cur = cur->next)
+    {
+      msginfo = (MsgInfo *) cur->data;
+
+      srcfile = procmsg_get_message_file (msginfo);
+      if (!srcfile)
+        {
+          ret = -1;
+          break;
+        }
+
+      key = maildir_new_key ();
+      file = maildir_get_flagged_file (key, NULL, MSG_IS_RECEIVED (msginfo->flags) ?
+                                       msginfo->flags.perm_flags :
+                                       maildir_get_dest_flags (dest, msginfo->flags).perm_flags);
+      if (maildir_deliver (destpath, srcfile, key, file) < 0)
+        {
+          g_free (file);
+          g_free (key);
+          g_free (srcfile);
+          ret = -1;
+          break;
+        }
+      g_free (srcfile);
+
+      S_LOCK (maildir);
+      list = maildir_get_uid_list (dest);
+      if (!fp && !dest->opened)
+        {
+          if ((fp = procmsg_open_mark_file (dest, DATA_APPEND)) == NULL)
+            g_warning ("maildir_add_msgs_msginfo: can't open mark file.");
+        }
+      maildir_add_entry (dest, list, destpath, key, file, msginfo, msginfo->flags, fp, notify);
+      if (first_ == 0)
+        first_ = dest->last_num;
+      S_UNLOCK (maildir);
+    }
+
+  if (fp)
+    fclose (fp);
+
+  S_LOCK (maildir);
+  maildir_uid_list_save (maildir_get_uid_list (dest), dest);
+  S_UNLOCK (maildir);
+
+  if (ret == 0)
+    {
+      if (first)
+        *first = first_;
+
+      if (remove_source)
+        {
+          for (cur = msglist; cur != NULL; cur = cur->next)
+            {
+              msginfo = (MsgInfo *) cur->data;
+              srcfile = procmsg_get_message_file (msginfo);
+              if (srcfile && g_unlink (srcfile) < 0)
+                FILE_OP_ERROR (srcfile, "unlink");
+              g_free (srcfile);
+            }
+        }
+    }
+
+  g_free (destpath);
+  mh_notify_emit (notify);
+
+  return ret < 0 ? -1 : dest->last_num;
+}
+
+/* moves messages between the maildir folders of the same tree by
+   renaming them.  the unique part of the name is kept. */
+static gint
+maildir_do_move_msgs (Folder * folder, FolderItem * dest, GSList * msglist)
+{
+  FolderItem *src = NULL;
+  MaildirUidList *srclist = NULL;
+  MaildirUidList *destlist;
+  MaildirEntry *entry;
+  MsgInfo *msginfo;
+  GArray *notify;
+  GSList *cur;
+  gchar *srcpath = NULL;
+  gchar *destpath;
+  gchar *srcfile;
+  gchar *destfile;
+  gchar *file;
+  gint ret = 0;
+
+  destpath = folder_item_get_path (dest);
+  g_return_val_if_fail (destpath != NULL, -1);
+  if (maildir_make_subdirs (destpath) < 0)
+    {
+      g_free (destpath);
+      return -1;
+    }
+
+  S_LOCK (maildir);
+
+  destlist = maildir_get_uid_list (dest);
+  notify = mh_notify_new ();
+
+  for (cur = msglist; cur != NULL; cur = cur->next)
+    {
+      msginfo = (MsgInfo *) cur->data;
+
+      if (msginfo->folder == dest)
+        {
+          g_warning (_("the src folder is identical to the dest.\n"));
+          continue;
+        }
+      if (msginfo->folder != src)
+        {
+          if (srclist)
+            maildir_uid_list_save (srclist, src);
+          src = msginfo->folder;
+          srclist = maildir_get_uid_list (src);
+          g_free (srcpath);
+          srcpath = folder_item_get_path (src);
+          if (!srcpath)
+            {
+              ret = -1;
+              break;
+            }
+        }
+      debug_print ("Moving message %s/%d to %s ...\n", src->path, msginfo->msgnum, dest->path);
+
+      entry = maildir_lookup_entry (src, srcpath, msginfo->msgnum);
+      if (!entry)
+        {
+          ret = -1;
+          break;
+        }
+
+      file = maildir_get_flagged_file (entry->key, NULL, maildir_get_dest_flags (dest, msginfo->flags).perm_flags);
+      srcfile = g_strconcat (srcpath, G_DIR_SEPARATOR_S, entry->file, NULL);
+      destfile = g_strconcat (destpath, G_DIR_SEPARATOR_S, file, NULL);
+      if (g_rename (srcfile, destfile) < 0)
+        {
+          if (maildir_deliver (destpath, srcfile, entry->key, file) < 0)
+            {
+              g_free (destfile);
+              g_free (srcfile);
+              g_free (file);
+              ret = -1;
+              break;
+            }
+          if (g_unlink (srcfile) < 0)
+            FILE_OP_ERROR (srcfile, "unlink");
+        }
+
+      mh_notify_append (notify, "remove-msg", src, srcfile, msginfo->msgnum);
+      g_free (destfile);
+      g_free (srcfile);
+
+      maildir_add_entry (dest, destlist, destpath, g_strdup (entry->key), file, msginfo, msginfo->flags, NULL, notify);
+      maildir_uid_list_remove (srclist, entry);
+
+      src->total--;
+      src->updated = TRUE;
+      src->mtime = 0;
+      if (MSG_IS_NEW (msginfo->flags))
+        src->new--;
+      if (MSG_IS_UNREAD (msginfo->flags))
+        src->unread--;
+
+      MSG_SET_TMP_FLAGS (msginfo->flags, MSG_INVALID);
+    }
+
+  if (srclist)
+    maildir_uid_list_save (srclist, src);
+  maildir_uid_list_save (destlist, dest);
+
+  if (!dest->opened)
+    {
+      procmsg_flush_mark_queue (dest, NULL);
+      procmsg_flush_cache_queue (dest, NULL);
+    }
+
+  S_UNLOCK (maildir);
+
+  g_free (srcpath);
+  g_free (destpath);
+  mh_notify_emit (notify);
+
+  return ret < 0 ? -1 : dest->last_num;
+}
+
+static gint
+maildir_move_msg (Folder * folder, FolderItem * dest, MsgInfo * msginfo)
+{
+  GSList msglist;
+
+  g_return_val_if_fail (msginfo != NULL, -1);
+
+  msglist.data = msginfo;
+  msglist.next = NULL;
+
+  return maildir_move_msgs (folder, dest, &msglist);
+}
+
+static gint
+maildir_move_msgs (Folder * folder, FolderItem * dest, GSList * msglist)
+{
+  MsgInfo *msginfo;
+  gint ret;
+
+  g_return_val_if_fail (dest != NULL, -1);
+  g_return_val_if_fail (msglist != NULL, -1);
+
+  msginfo = (MsgInfo *) msglist->data;
+  if (folder == msginfo->folder->folder)
+    return maildir_do_move_msgs (folder, dest, msglist);
+
+  ret = maildir_add_msgs_msginfo (folder, dest, msglist, FALSE, NULL);
+
+  if (ret != -1)
+    ret = folder_item_remove_msgs (msginfo->folder, msglist);
+
+  return ret;
+}
+
+static gint
+maildir_copy_msg (Folder * folder, FolderItem * dest, MsgInfo * msginfo)
+{
+  GSList msglist;
+
+  g_return_val_if_fail (msginfo != NULL, -1);
+
+  msglist.data = msginfo;
+  msglist.next = NULL;
+
+  return maildir_copy_msgs (folder, dest, &msglist);
+}
+
+static gint
+maildir_copy_msgs (Folder * folder, FolderItem * dest, GSList * msglist)
+{
+  gint ret;
+
+  g_return_val_if_fail (dest != NULL, -1);
+  g_return_val_if_fail (msglist != NULL, -1);
+
+  /* maildir_deliver() links when it can, so this is as cheap as a
+     copy in MH folders */
+  ret = maildir_add_msgs_msginfo (folder, dest, msglist, FALSE, NULL);
+
+  if (!dest->opened)
+    {
+      procmsg_flush_mark_queue (dest, NULL);
+      procmsg_flush_cache_queue (dest, NULL);
+    }
+
+  return ret;
+}
+
+static gint
+maildir_remove_msg (Folder * folder, FolderItem * item, MsgInfo * msginfo)
+{
+  GSList msglist;
+
+  g_return_val_if_fail (msginfo != NULL, -1);
+
+  msglist.data = msginfo;
+  msglist.next = NULL;
+
+  return maildir_remove_msgs (folder, item, &msglist);
+}
+
+static gint
+maildir_remove_msgs (Folder * folder, FolderItem * item, GSList * msglist)
+{
+  MaildirUidList *list;
+  MaildirEntry *entry;
+  MsgInfo *msginfo;
+  GArray *notify;
+  GSList *cur;
+  gchar *path;
+  gchar *file;
+  gint ret = 0;
+
+  g_return_val_if_fail (item != NULL, -1);
+
+  path = folder_item_get_path (item);
+  g_return_val_if_fail (path != NULL, -1);
+
+  /* the handlers may still read the files, so notify first, as
+     mh_remove_msgs() does */
+  notify = mh_notify_new ();
+  S_LOCK (maildir);
+  list = maildir_get_uid_list (item);
+  for (cur = msglist; cur != NULL && notify; cur = cur->next)
+    {
+      msginfo = (MsgInfo *) cur->data;
+      entry = g_hash_table_lookup (list->num_table, GINT_TO_POINTER (msginfo->msgnum));
+      if (!entry)
+        continue;
+      file = g_strconcat (path, G_DIR_SEPARATOR_S, entry->file, NULL);
+      mh_notify_append (notify, "remove-msg", item, file, msginfo->msgnum);
+      g_free (file);
+    }
+  S_UNLOCK (maildir);
+  mh_notify_emit (notify);
+
+  S_LOCK (maildir);
+
+  list = maildir_get_uid_list (item);
+
+  for (cur = msglist; cur != NULL; cur = cur->next)
+    {
+      msginfo = (MsgInfo *) cur->data;
+      entry = g_hash_table_lookup (list->num_table, GINT_TO_POINTER (msginfo->msgnum));
+      if (!entry)
+        continue;
+
+      file = g_strconcat (path, G_DIR_SEPARATOR_S, entry->file, NULL);
+      if (g_unlink (file) < 0 && ENOENT != errno)
+        {
+          FILE_OP_ERROR (file, "unlink");
+          g_free (file);
+          ret = -1;
+          break;
+        }
+      g_free (file);
+      maildir_uid_list_remove (list, entry);
+
+      item->total--;
+      if (MSG_IS_NEW (msginfo->flags))
+        item->new--;
+      if (MSG_IS_UNREAD (msginfo->flags))
+        item->unread--;
+      MSG_SET_TMP_FLAGS (msginfo->flags, MSG_INVALID);
+    }
+
+  maildir_uid_list_save (list, item);
+  item->updated = TRUE;
+  item->mtime = 0;
+
+  S_UNLOCK (maildir);
+
+  g_free (path);
+
+  return ret;
+}
+
+static gint
+maildir_remove_all_msg (Folder * folder, FolderItem * item)
+{
+  MaildirUidList *list;
+  GList *entries, *cur;
+  gchar *path;
+  gchar *file;
+  gint val = 0;
+
+  g_return_val_if_fail (item != NULL, -1);
+
+  path = folder_item_get_path (item);
+  g_return_val_if_fail (path != NULL, -1);
+  if (yam_app_get ())
+    g_signal_emit_by_name (yam_app_get (), "remove-all-msg", item);
+
+  S_LOCK (maildir);
+
+  list = maildir_get_uid_list (item);
+  maildir_scan_entries (list, path);
+  entries = g_hash_table_get_values (list->key_table);
+  for (cur = entries; cur != NULL; cur = cur->next)
+    {
+      MaildirEntry *entry = (MaildirEntry *) cur->data;
+
+      file = g_strconcat (path, G_DIR_SEPARATOR_S, entry->file, NULL);
+      if (g_unlink (file) < 0 && ENOENT != errno)
+        {
+          FILE_OP_ERROR (file, "unlink");
+          val = -1;
+        }
+      else
+        maildir_uid_list_remove (list, entry);
+      g_free (file);
+    }
+  g_list_free (entries);
+  maildir_uid_list_save (list, item);
+
+  if (val == 0)
+    item->new = item->unread = item->total = 0;
+  item->updated = TRUE;
+  item->mtime = 0;
+
+  S_UNLOCK (maildir);
+
+  g_free (path);
+
+  return val;
+}
+
+static gboolean
+maildir_is_msg_changed (Folder * folder, FolderItem * item, MsgInfo * msginfo)
+{
+  MaildirEntry *entry;
+  GStatBuf s;
+  gchar *path;
+  gchar *file = NULL;
+
+  path = folder_item_get_path (item);
+  g_return_val_if_fail (path != NULL, TRUE);
+
+  S_LOCK (maildir);
+  entry = maildir_lookup_entry (item, path, msginfo->msgnum);
+  if (entry)
+    file = g_strconcat (path, G_DIR_SEPARATOR_S, entry->file, NULL);
+  S_UNLOCK (maildir);
+  g_free (path);
+
+  if (!file || g_stat (file, &s) < 0 || msginfo->size != s.st_size || msginfo->mtime != s.st_mtime)
+    {
+      g_free (file);
+      return TRUE;
+    }
+
+  g_free (file);
+  return FALSE;
+}
+
+static void
+maildir_mark_table_to_list_func (gpointer key, gpointer value, gpointer data)
+{
+  MsgInfo *msginfo;
+  GSList **mlist = (GSList **) data;
+
+  msginfo = g_new0 (MsgInfo, 1);
+  msginfo->msgnum = GPOINTER_TO_INT (key);
+  msginfo->flags.perm_flags = ((MsgFlags *) value)->perm_flags;
+  *mlist = g_slist_prepend (*mlist, msginfo);
+}
+
+/* the summary has written the mark file by now; carry its flags over
+   to the file names */
+static gint
+maildir_close (Folder * folder, FolderItem * item)
+{
+  MaildirUidList *list;
+  GHashTable *mark_table;
+  GSList *mlist = NULL;
+  GSList *cur;
+  gchar *path;
+
+  g_return_val_if_fail (item != NULL, -1);
+
+  if (!item->path)
+    return 0;
+
+  mark_table = procmsg_read_mark_file (item);
+  if (!mark_table)
+    return 0;
+  g_hash_table_foreach (mark_table, maildir_mark_table_to_list_func, &mlist);
+  hash_free_value_mem (mark_table);
+  g_hash_table_destroy (mark_table);
+
+  path = folder_item_get_path (item);
+
+  S_LOCK (maildir);
+  list = maildir_get_uid_list (item);
+  maildir_scan_entries (list, path);
+  maildir_sync_flags (item, list, mlist, FALSE);
+  maildir_uid_list_save (list, item);
+  S_UNLOCK (maildir);
+
+  g_free (path);
+  for (cur = mlist; cur != NULL; cur = cur->next)
+    g_free (cur->data);
+  g_slist_free (mlist);
+
+  return 0;
+}
+
+static gint
+maildir_scan_folder (Folder * folder, FolderItem * item)
+{
+  MaildirUidList *list;
+  gchar *path;
+  gint n_msg;
+
+  g_return_val_if_fail (item != NULL, -1);
+
+  debug_print ("maildir_scan_folder(): Scanning %s ...\n", item->path);
+
+  path = folder_item_get_path (item);
+  if (!path)
+    return -1;
+
+  if (folder->ui_func)
+    folder->ui_func (folder, item, folder->ui_func_data);
+
+  S_LOCK (maildir);
+
+  list = maildir_get_uid_list (item);
+  n_msg = maildir_scan_entries (list, path);
+  maildir_uid_list_save (list, item);
+  g_free (path);
+
+  if (n_msg == 0)
+    item->new = item->unread = item->total = 0;
+  else
+    {
+      gint new, unread, total, min, max;
+
+      procmsg_get_mark_sum (item, &new, &unread, &total, &min, &max, 0);
+
+      if (n_msg > total)
+        {
+          item->unmarked_num = new = n_msg - total;
+          unread += n_msg - total;
+        }
+      else
+        item->unmarked_num = 0;
+
+      item->new = new;
+      item->unread = unread;
+      item->total = n_msg;
+
+      if (item->cache_queue && !item->opened)
+        procmsg_flush_cache_queue (item, NULL);
+    }
+
+  item->updated = TRUE;
+  item->mtime = 0;
+  item->last_num = list->last_num;
+
+  S_UNLOCK (maildir);
+  return 0;
+}
+
+/* folders */
+
+static gboolean
+maildir_remove_missing_folder_items_func (GNode * node, gpointer data)
+{
+  FolderItem *item;
+  gchar *path;
+
+  g_return_val_if_fail (node->data != NULL, FALSE);
+
+  if (G_NODE_IS_ROOT (node))
+    return FALSE;
+
+  item = FOLDER_ITEM (node->data);
+
+  path = folder_item_get_path (item);
+  if (!is_dir_exist (path))
+    {
+      debug_print ("folder '%s' not found. removing...\n", path);
+      S_LOCK (maildir);
+      if (maildir_uid_lists)
+        g_hash_table_remove (maildir_uid_lists, item);
+      S_UNLOCK (maildir);
+      folder_item_remove (item);
+    }
+  g_free (path);
+
+  return FALSE;
+}
+
+static void
+maildir_remove_missing_folder_items (Folder * folder)
+{
+  g_return_if_fail (folder != NULL);
+
+  debug_print ("searching missing folders...\n");
+
+  g_node_traverse (folder->node, G_POST_ORDER, G_TRAVERSE_ALL, -1, maildir_remove_missing_folder_items_func, folder);
+}
+
+static gint
+maildir_scan_tree (Folder * folder)
+{
+  FolderItem *item;
+  gchar *rootpath;
+
+  g_return_val_if_fail (folder != NULL, -1);
+
+  if (!folder->node)
+    {
+      item = folder_item_new (folder->name, NULL);
+      item->folder = folder;
+      folder->node = item->node = g_node_new (item);
+    }
+  else
+    item = FOLDER_ITEM (folder->node->data);
+
+  if (maildir_create_tree (folder) < 0)
+    return -1;
+
+  rootpath = folder_item_get_path (item);
+  if (change_dir (rootpath) < 0)
+    {
+      g_free (rootpath);
+      return -1;
+    }
+  g_free (rootpath);
+
+  maildir_remove_missing_folder_items (folder);
+  mh_scan_tree_recursive_full (item, maildir_subdirs, maildir_count_msgs);
+
+  return 0;
+}
+
+static gint
+maildir_create_tree (Folder * folder)
+{
+  static const gchar *special_dirs[] = { INBOX_DIR, OUTBOX_DIR, QUEUE_DIR, DRAFT_DIR, TRASH_DIR, JUNK_DIR };
+  gint i;
+
+  g_return_val_if_fail (folder != NULL, -1);
+
+  if (maildir_is_maildir (LOCAL_FOLDER (folder)->rootpath))
+    {
+      g_warning ("%s is a maildir, not a tree of maildir folders\n", LOCAL_FOLDER (folder)->rootpath);
+      return -1;
+    }
+
+  /* the same tree as MH, with the maildir sub directories in each
+     special folder.  mh_create_tree() leaves us in the root. */
+  if (mh_get_class ()->create_tree (folder) < 0)
+    return -1;
+
+  for (i = 0; i < G_N_ELEMENTS (special_dirs); i++)
+    {
+      if (maildir_make_subdirs (special_dirs[i]) < 0)
+        return -1;
+    }
+
+  return 0;
+}
+
+static FolderItem *
+maildir_create_folder (Folder * folder, FolderItem * parent, const gchar * name)
+{
+  FolderItem *new_item;
+  gchar *path;
+
+  if (!strcmp (name, "cur") || !strcmp (name, "new") || !strcmp (name, "tmp"))
+    {
+      g_warning (_("`%s' is reserved in maildir folders.\n"), name);
+      return NULL;
+    }
+
+  new_item = mh_get_class ()->create_folder (folder, parent, name);
+  if (!new_item)
+    return NULL;
+
+  path = folder_item_get_path (new_item);
+  if (maildir_make_subdirs (path) < 0)
+    g_warning ("can't create maildir directories in `%s'\n", path);
+  g_free (path);
+
+  return new_item;
+}
+
+static gint
+maildir_rename_folder (Folder * folder, FolderItem * item, const gchar * name)
+{
+  return mh_get_class ()->rename_folder (folder, item, name);
+}
+
+static gint
+maildir_move_folder (Folder * folder, FolderItem * item, FolderItem * new_parent)
+{
+  return mh_get_class ()->move_folder (folder, item, new_parent);
+}
+
+static gboolean
+maildir_remove_uid_list_func (GNode * node, gpointer data)
+{
+  g_hash_table_remove (maildir_uid_lists, node->data);
+
+  return FALSE;
+}
+
+static gint
+maildir_remove_folder (Folder * folder, FolderItem * item)
+{
+  g_return_val_if_fail (item != NULL, -1);
+
+  S_LOCK (maildir);
+  if (maildir_uid_lists)
+    g_node_traverse (item->node, G_PRE_ORDER, G_TRAVERSE_ALL, -1, maildir_remove_uid_list_func, NULL);
+  S_UNLOCK (maildir);
+
+  return mh_get_class ()->remove_folder (folder, item);
+}
+
+static gint
+maildir_count_msgs (const gchar * path)
+{
+  static const gchar *subdirs[] = { "new", "cur" };
+  const gchar *name;
+  gchar *dir;
+  GDir *dp;
+  gint n_msg = 0;
+  gint i;
+
+  for (i = 0; i < G_N_ELEMENTS (subdirs); i++)
+    {
+      dir = g_strconcat (path, G_DIR_SEPARATOR_S, subdirs[i], NULL);
+      if ((dp = g_dir_open (dir, 0, NULL)) != NULL)
+        {
+          while ((name = g_dir_read_name (dp)) != NULL)
+            {
+              if (name[0] != '.')
+                n_msg++;
+            }
+          g_dir_close (dp);
+        }
+      g_free (dir);
+    }
+
+  return n_msg;
+}
@@ -0,0 +1,40 @@
+/*
+ * LibYAM -- E-Mail client library
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __MAILDIR_H__
+#define __MAILDIR_H__
+
+#include <glib.h>
+
+#include "folder.h"
+
+typedef struct _MaildirFolder MaildirFolder;
+
+#define MAILDIR_FOLDER(obj)	((MaildirFolder *)obj)
+
+struct _MaildirFolder {
+  LocalFolder lfolder;
+};
+
+FolderClass *maildir_get_class (void);
+
+gboolean maildir_is_maildir_tree (const gchar * path);
+gboolean maildir_is_maildir (const gchar * path);
+
+#endif /* __MAILDIR_H__ */
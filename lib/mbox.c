@@ -26,11 +26,14 @@
 
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <ctype.h>
 #include <time.h>
 
@@ -553,73 +556,486 @@ export_to_mbox (FolderItem * src, const gchar * mbox)
   return ret;
 }
 
-/* store MLIST into one MBOX file. */
-gint
-export_msgs_to_mbox (FolderItem * src, GSList * mlist, const gchar * mbox)
+/* export pipeline: the main thread resolves (and for remote folders
+ * fetches, a batch at a time) the message files, and a writer thread
+ * streams them into the mbox file or the destination directory */
+
+/* messages fetched at once */
+#define EXPORT_BATCH_SIZE	256
+/* how many batches the fetching may run ahead of the writer, so that
+ * fetched bodies are written long before the cache could evict them */
+#define EXPORT_MAX_BATCHES	2
+#define EXPORT_BUFSIZE		(1024 * 1024)
+#define EXPORT_PROGRESS_INTERVAL	(100 * 1000)
+
+typedef struct _ExportMsg ExportMsg;
+typedef struct _ExportData ExportData;
+
+struct _ExportMsg {
+  gchar *file;
+  gchar *from_line;             /* mbox only */
+  gchar *dest;                  /* directory export only */
+  gboolean skip_header;         /* queued message */
+};
+
+struct _ExportData {
+  GAsyncQueue *queue;
+  gint fd;                      /* mbox, or -1 */
+
+  gchar *inbuf;                 /* mbox only */
+  gchar *outbuf;                /* mbox only */
+  gsize outlen;
+
+  guint written;
+  gint cancelled;
+  gint error;
+  gint done;
+  gint64 last_wakeup;
+
+  /* progress reporting of the fetch */
+  FolderItem *src;
+  guint fetch_base;
+  guint shown;                  /* never goes back */
+  guint total;
+  FolderUIFunc2 ui_func2;
+  gpointer ui_func2_data;
+};
+
+static ExportMsg export_end;
+
+static void
+export_msg_free (ExportMsg * msg)
 {
-  GSList *cur;
-  MsgInfo *msginfo;
-  FILE *msg_fp;
-  FILE *mbox_fp;
-  gchar buf[BUFFSIZE];
-  PrefsAccount *cur_ac;
-  guint count = 0, length;
-  time_t date_t_;
+  g_free (msg->file);
+  g_free (msg->from_line);
+  g_free (msg->dest);
+  g_free (msg);
+}
 
-  g_return_val_if_fail (src != NULL, -1);
-  g_return_val_if_fail (src->folder != NULL, -1);
-  g_return_val_if_fail (mlist != NULL, -1);
-  g_return_val_if_fail (mbox != NULL, -1);
+static gint
+export_write_all (gint fd, const gchar * buf, gsize len)
+{
+  gssize n;
 
-  debug_print ("Exporting messages from %s into %s...\n", src->path, mbox);
+  while (len > 0)
+    {
+      n = write (fd, buf, len);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      buf += n;
+      len -= n;
+    }
 
-  if ((mbox_fp = g_fopen (mbox, "wb")) == NULL)
+  return 0;
+}
+
+static gint
+export_flush (ExportData * data)
+{
+  if (data->outlen > 0 && export_write_all (data->fd, data->outbuf, data->outlen) < 0)
+    return -1;
+  data->outlen = 0;
+
+  return 0;
+}
+
+static gint
+export_append (ExportData * data, const gchar * str, gsize len)
+{
+  if (data->outlen + len > EXPORT_BUFSIZE)
     {
-      FILE_OP_ERROR (mbox, "fopen");
-      return -1;
+      if (export_flush (data) < 0)
+        return -1;
+      if (len > EXPORT_BUFSIZE)
+        return export_write_all (data->fd, str, len);
     }
+  memcpy (data->outbuf + data->outlen, str, len);
+  data->outlen += len;
 
-  cur_ac = account_get_current_account ();
+  return 0;
+}
 
-  length = g_slist_length (mlist);
+/* copies one message, escaping "From " at the start of lines the way
+ * proc_mbox() unescapes it */
+static gint
+export_write_mbox_msg (ExportData * data, ExportMsg * msg)
+{
+  gint fd;
+  gssize n;
+  gsize keep = 0;
+  gboolean bol = TRUE, skip = msg->skip_header;
+  gchar last = '\n';
 
-  for (cur = mlist; cur != NULL; cur = cur->next)
+  if ((fd = g_open (msg->file, O_RDONLY, 0)) < 0)
     {
-      msginfo = (MsgInfo *) cur->data;
+      /* like procmsg_open_message() failing: skip it */
+      FILE_OP_ERROR (msg->file, "open");
+      return 0;
+    }
 
-      count++;
-      if (src->folder->ui_func)
-        src->folder->ui_func (src->folder, src,
-                              src->folder->ui_func_data ? src->folder->ui_func_data : GUINT_TO_POINTER (count));
-      if (folder_call_ui_func2 (src->folder, src, count, length) == FALSE)
+  if (export_append (data, msg->from_line, strlen (msg->from_line)) < 0)
+    {
+      close (fd);
+      return -1;
+    }
+
+  while ((n = read (fd, data->inbuf + keep, EXPORT_BUFSIZE - keep)) != 0)
+    {
+      gchar *p, *end, *nl;
+
+      if (n < 0)
         {
-          debug_print ("Export to mbox cancelled at %u/%u\n", count, length);
+          if (errno == EINTR)
+            continue;
+          FILE_OP_ERROR (msg->file, "read");
           break;
         }
 
-      msg_fp = procmsg_open_message (msginfo);
-      if (!msg_fp)
-        continue;
+      p = data->inbuf;
+      end = data->inbuf + keep + n;
+      keep = 0;
+
+      while (p < end)
+        {
+          /* a line start too short to tell: wait for more data */
+          if (bol && end - p < 5 && !strncmp (p, "From ", end - p))
+            {
+              keep = end - p;
+              memmove (data->inbuf, p, keep);
+              break;
+            }
+
+          nl = memchr (p, '\n', end - p);
+          if (skip)
+            {
+              /* queue headers end at the first empty line */
+              if (bol && (*p == '\r' || *p == '\n'))
+                skip = FALSE;
+            }
+          else
+            {
+              if (bol && !strncmp (p, "From ", 5) && export_append (data, ">", 1) < 0)
+                break;
+              if (export_append (data, p, nl ? nl + 1 - p : end - p) < 0)
+                break;
+              last = nl ? '\n' : end[-1];
+            }
+          bol = nl != NULL;
+          p = nl ? nl + 1 : end;
+        }
+      if (p < end && keep == 0)
+        {
+          close (fd);
+          return -1;
+        }
+    }
+
+  if (keep > 0 && !skip)
+    {
+      if (export_append (data, data->inbuf, keep) < 0)
+        {
+          close (fd);
+          return -1;
+        }
+      last = data->inbuf[keep - 1];
+    }
+  close (fd);
+
+  if (last != '\n' && export_append (data, "\n", 1) < 0)
+    return -1;
+
+  return export_append (data, "\n", 1);
+}
+
+/* export_msg_new() made sure that msg->dest doesn't exist yet */
+static gint
+export_write_file (ExportData * data, ExportMsg * msg)
+{
+  return copy_file (msg->file, msg->dest, FALSE);
+}
+
+static gpointer
+export_thread_func (gpointer data)
+{
+  ExportData *edata = (ExportData *) data;
+  ExportMsg *msg;
+  gint64 now;
+
+  while ((msg = g_async_queue_pop (edata->queue)) != &export_end)
+    {
+      /* drain the queue after an error or cancel */
+      if (!g_atomic_int_get (&edata->cancelled) && !g_atomic_int_get (&edata->error))
+        {
+          if ((edata->fd >= 0 ? export_write_mbox_msg (edata, msg) : export_write_file (edata, msg)) < 0)
+            g_atomic_int_set (&edata->error, 1);
+        }
+      export_msg_free (msg);
+      g_atomic_int_inc (&edata->written);
+
+      /* wake the main thread up for progress only now and then */
+      now = g_get_monotonic_time ();
+      if (now - edata->last_wakeup > EXPORT_PROGRESS_INTERVAL || g_async_queue_length (edata->queue) <= 0)
+        {
+          edata->last_wakeup = now;
+          g_main_context_wakeup (NULL);
+        }
+    }
+
+  if (edata->fd >= 0 && !g_atomic_int_get (&edata->error) && export_flush (edata) < 0)
+    g_atomic_int_set (&edata->error, 1);
+
+  g_atomic_int_set (&edata->done, 1);
+  g_main_context_wakeup (NULL);
+
+  return NULL;
+}
+
+/* the fetch runs ahead of the writer: show whichever got further */
+static guint
+export_progress (ExportData * data, guint count)
+{
+  data->shown = MAX (data->shown, count);
+
+  return data->shown;
+}
+
+static gboolean
+export_report_progress (ExportData * data)
+{
+  Folder *folder = data->src->folder;
+  guint written;
+
+  written = export_progress (data, g_atomic_int_get (&data->written));
+  if (folder->ui_func)
+    folder->ui_func (folder, data->src, folder->ui_func_data ? folder->ui_func_data : GUINT_TO_POINTER (written));
+  if (data->ui_func2 && !data->ui_func2 (folder, data->src, written, data->total, data->ui_func2_data))
+    {
+      debug_print ("Export cancelled at %u/%u\n", written, data->total);
+      g_atomic_int_set (&data->cancelled, 1);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* shows the fetch of a batch as part of the whole export */
+static gboolean
+export_fetch_ui_func (Folder * folder, FolderItem * item, guint count, guint total, gpointer data)
+{
+  ExportData *edata = (ExportData *) data;
+
+  if (edata->ui_func2)
+    return edata->ui_func2 (folder, item, export_progress (edata, edata->fetch_base + count), edata->total,
+                            edata->ui_func2_data);
+
+  return TRUE;
+}
+
+static ExportMsg *
+export_msg_new (ExportData * data, MsgInfo * msginfo, const gchar * dir, const gchar * ext, guint count)
+{
+  ExportMsg *msg;
+  gchar *file;
+
+  if (data->fd >= 0)
+    {
+      PrefsAccount *cur_ac;
+      gchar buf[BUFFSIZE];
+      time_t date_t_;
+
+      /* the same as procmsg_open_message() */
+      file = procmsg_get_message_file_path (msginfo);
+      if (!file || !is_file_exist (file))
+        {
+          g_free (file);
+          file = procmsg_get_message_file (msginfo);
+        }
+      if (!file)
+        return NULL;
+
+      msg = g_new0 (ExportMsg, 1);
+      msg->file = file;
+      msg->skip_header = MSG_IS_QUEUED (msginfo->flags);
 
+      cur_ac = account_get_current_account ();
       strncpy2 (buf,
                 msginfo->from ? msginfo->from : cur_ac && cur_ac->address ? cur_ac->address : "unknown", sizeof (buf));
       extract_address (buf);
-
       date_t_ = msginfo->date_t;
-      fprintf (mbox_fp, "From %s %s", buf, ctime (&date_t_));
+      msg->from_line = g_strdup_printf ("From %s %s", buf, ctime (&date_t_));
+    }
+  else
+    {
+      gchar *dest;
 
-      while (fgets (buf, sizeof (buf), msg_fp) != NULL)
+      dest = g_strdup_printf ("%s%c%u%s", dir, G_DIR_SEPARATOR, count, ext);
+      if (is_file_entry_exist (dest))
+        {
+          g_warning ("export_msgs_to_dir(): %s already exists.\n", dest);
+          g_free (dest);
+          return NULL;
+        }
+      if ((file = folder_item_fetch_msg (data->src, msginfo->msgnum)) == NULL)
         {
-          if (!strncmp (buf, "From ", 5))
-            fputc ('>', mbox_fp);
-          fputs (buf, mbox_fp);
+          g_free (dest);
+          return NULL;
         }
-      fputc ('\n', mbox_fp);
 
-      fclose (msg_fp);
+      msg = g_new0 (ExportMsg, 1);
+      msg->file = file;
+      msg->dest = dest;
     }
 
-  fclose (mbox_fp);
+  return msg;
+}
 
-  return 0;
+static gint
+export_msgs (FolderItem * src, GSList * mlist, gint fd, const gchar * dir, const gchar * ext)
+{
+  ExportData data;
+  Folder *folder = src->folder;
+  GThread *thread;
+  GSList *cur, *cur_msg, *batch;
+  guint count = 0;
+  gint ret = 0;
+  gint i;
+
+  memset (&data, 0, sizeof (data));
+  data.queue = g_async_queue_new ();
+  data.fd = fd;
+  if (fd >= 0)
+    {
+      data.inbuf = g_malloc (EXPORT_BUFSIZE);
+      data.outbuf = g_malloc (EXPORT_BUFSIZE);
+    }
+  data.src = src;
+  data.total = g_slist_length (mlist);
+  data.ui_func2 = folder_get_ui_func2 (folder);
+  data.ui_func2_data = folder_get_ui_func2_data (folder);
+
+  thread = g_thread_new ("export", export_thread_func, &data);
+
+  for (cur = mlist; cur != NULL && !g_atomic_int_get (&data.cancelled) && !g_atomic_int_get (&data.error);)
+    {
+      while (count - g_atomic_int_get (&data.written) > EXPORT_BATCH_SIZE * (EXPORT_MAX_BATCHES - 1) &&
+             !g_atomic_int_get (&data.error))
+        {
+          event_loop_iterate ();
+          if (!export_report_progress (&data))
+            break;
+        }
+      if (g_atomic_int_get (&data.cancelled) || g_atomic_int_get (&data.error))
+        break;
+
+      batch = NULL;
+      for (i = 0; i < EXPORT_BATCH_SIZE && cur != NULL; i++, cur = cur->next)
+        batch = g_slist_prepend (batch, cur->data);
+      batch = g_slist_reverse (batch);
+
+      /* several connections at once for IMAP */
+      if (FOLDER_IS_REMOTE (folder) && folder->klass->fetch_msgs)
+        {
+          data.fetch_base = count;
+          folder_set_ui_func2 (folder, export_fetch_ui_func, &data);
+          ret = folder->klass->fetch_msgs (folder, src, batch);
+          folder_set_ui_func2 (folder, data.ui_func2, data.ui_func2_data);
+          if (ret == -2)
+            g_atomic_int_set (&data.cancelled, 1);
+          ret = 0;
+        }
+
+      for (cur_msg = batch; cur_msg != NULL && !g_atomic_int_get (&data.cancelled); cur_msg = cur_msg->next)
+        {
+          ExportMsg *msg;
+
+          count++;
+          msg = export_msg_new (&data, (MsgInfo *) cur_msg->data, dir, ext, count);
+          if (!msg)
+            {
+              if (fd >= 0)
+                {
+                  g_atomic_int_inc (&data.written);
+                  continue;
+                }
+              g_atomic_int_set (&data.error, 1);
+              break;
+            }
+          g_async_queue_push (data.queue, msg);
+        }
+      g_slist_free (batch);
+
+      export_report_progress (&data);
+    }
+
+  g_async_queue_push (data.queue, &export_end);
+  while (!g_atomic_int_get (&data.done))
+    {
+      event_loop_iterate ();
+      if (!g_atomic_int_get (&data.cancelled))
+        export_report_progress (&data);
+    }
+  g_thread_join (thread);
+
+  if (g_atomic_int_get (&data.error))
+    ret = -1;
+  else if (g_atomic_int_get (&data.cancelled))
+    ret = -2;
+
+  g_async_queue_unref (data.queue);
+  g_free (data.inbuf);
+  g_free (data.outbuf);
+
+  return ret;
+}
+
+/* store MLIST into one MBOX file. */
+gint
+export_msgs_to_mbox (FolderItem * src, GSList * mlist, const gchar * mbox)
+{
+  gint fd;
+  gint ret;
+
+  g_return_val_if_fail (src != NULL, -1);
+  g_return_val_if_fail (src->folder != NULL, -1);
+  g_return_val_if_fail (mlist != NULL, -1);
+  g_return_val_if_fail (mbox != NULL, -1);
+
+  debug_print ("Exporting messages from %s into %s...\n", src->path, mbox);
+
+  /* the same mode as fopen(): up to the umask */
+  if ((fd = g_open (mbox, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+    {
+      FILE_OP_ERROR (mbox, "open");
+      return -1;
+    }
+
+  ret = export_msgs (src, mlist, fd, NULL, NULL);
+
+  if (close (fd) < 0)
+    {
+      FILE_OP_ERROR (mbox, "close");
+      ret = -1;
+    }
+
+  return ret;
+}
+
+/* store each message of MLIST into DIR as 1EXT, 2EXT, ... */
+gint
+export_msgs_to_dir (FolderItem * src, GSList * mlist, const gchar * dir, const gchar * ext)
+{
+  g_return_val_if_fail (src != NULL, -1);
+  g_return_val_if_fail (src->folder != NULL, -1);
+  g_return_val_if_fail (dir != NULL, -1);
+
+  if (!mlist)
+    return 0;
+
+  debug_print ("Exporting messages from %s into %s...\n", src->path, dir);
+
+  return export_msgs (src, mlist, -1, dir, ext ? ext : "");
 }
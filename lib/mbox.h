@@ -41,5 +41,6 @@ void empty_mbox (const gchar * mbox);
 
 gint export_to_mbox (FolderItem * src, const gchar * mbox);
 gint export_msgs_to_mbox (FolderItem * src, GSList * mlist, const gchar * mbox);
+gint export_msgs_to_dir (FolderItem * src, GSList * mlist, const gchar * dir, const gchar * ext);
 
 #endif /* __MBOX_H__ */
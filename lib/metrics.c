@@ -0,0 +1,465 @@
+/*
+ * LibYAM -- E-Mail client library
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "utils.h"
+
+static GHashTable *counter_table = NULL;
+static GHashTable *histogram_table = NULL;
+G_LOCK_DEFINE_STATIC (metrics);
+
+static FILE *trace_fp = NULL;
+static gint64 trace_start;
+static gboolean trace_first_event;
+G_LOCK_DEFINE_STATIC (trace_fp);
+
+#define S_LOCK(name)	G_LOCK(name)
+#define S_UNLOCK(name)	G_UNLOCK(name)
+
+/* counters are bumped on every socket read and write, so their values
+   are 64-bit atomics; the lock only guards the tables */
+#if defined (__GNUC__) && defined (__ATOMIC_RELAXED)
+#define COUNTER_ADD(p, v)	__atomic_fetch_add (p, v, __ATOMIC_RELAXED)
+#define COUNTER_GET(p)		__atomic_load_n (p, __ATOMIC_RELAXED)
+#define COUNTER_SET(p, v)	__atomic_store_n (p, v, __ATOMIC_RELAXED)
+#else
+G_LOCK_DEFINE_STATIC (counter_value);
+
+static void
+counter_value_add (gint64 * p, gint64 v)
+{
+  G_LOCK (counter_value);
+  *p += v;
+  G_UNLOCK (counter_value);
+}
+
+static gint64
+counter_value_get (gint64 * p)
+{
+  gint64 v;
+
+  G_LOCK (counter_value);
+  v = *p;
+  G_UNLOCK (counter_value);
+
+  return v;
+}
+
+static void
+counter_value_set (gint64 * p, gint64 v)
+{
+  G_LOCK (counter_value);
+  *p = v;
+  G_UNLOCK (counter_value);
+}
+
+#define COUNTER_ADD(p, v)	counter_value_add (p, v)
+#define COUNTER_GET(p)		counter_value_get (p)
+#define COUNTER_SET(p, v)	counter_value_set (p, v)
+#endif
+
+/* small sequential thread ids for the trace */
+static gint thread_id_seq = 0;
+static GPrivate thread_id_key;
+
+static gint
+get_thread_id (void)
+{
+  gint id;
+
+  id = GPOINTER_TO_INT (g_private_get (&thread_id_key));
+  if (id == 0)
+    {
+      id = g_atomic_int_add (&thread_id_seq, 1) + 1;
+      g_private_set (&thread_id_key, GINT_TO_POINTER (id));
+    }
+
+  return id;
+}
+
+MetricsCounter *
+metrics_counter_get (const gchar * name)
+{
+  MetricsCounter *counter;
+
+  g_return_val_if_fail (name != NULL, NULL);
+
+  S_LOCK (metrics);
+  if (!counter_table)
+    counter_table = g_hash_table_new (g_str_hash, g_str_equal);
+  counter = g_hash_table_lookup (counter_table, name);
+  if (!counter)
+    {
+      counter = g_new0 (MetricsCounter, 1);
+      counter->name = g_strdup (name);
+      g_hash_table_insert (counter_table, counter->name, counter);
+    }
+  S_UNLOCK (metrics);
+
+  return counter;
+}
+
+void
+metrics_counter_add (MetricsCounter * counter, gint64 value)
+{
+  g_return_if_fail (counter != NULL);
+
+  COUNTER_ADD (&counter->value, value);
+}
+
+gint64
+metrics_counter_get_value (MetricsCounter * counter)
+{
+  g_return_val_if_fail (counter != NULL, 0);
+
+  return COUNTER_GET (&counter->value);
+}
+
+MetricsHistogram *
+metrics_histogram_get (const gchar * name)
+{
+  MetricsHistogram *hist;
+
+  g_return_val_if_fail (name != NULL, NULL);
+
+  S_LOCK (metrics);
+  if (!histogram_table)
+    histogram_table = g_hash_table_new (g_str_hash, g_str_equal);
+  hist = g_hash_table_lookup (histogram_table, name);
+  if (!hist)
+    {
+      hist = g_new0 (MetricsHistogram, 1);
+      hist->name = g_strdup (name);
+      g_hash_table_insert (histogram_table, hist->name, hist);
+    }
+  S_UNLOCK (metrics);
+
+  return hist;
+}
+
+/* bucket 0 holds 0, bucket n holds [2^(n-1), 2^n) */
+static gint
+histogram_bucket (guint64 value)
+{
+  gint n = 0;
+
+  while (value != 0 && n < METRICS_HISTOGRAM_BUCKETS - 1)
+    {
+      value >>= 1;
+      n++;
+    }
+
+  return n;
+}
+
+void
+metrics_histogram_add (MetricsHistogram * hist, guint64 value)
+{
+  g_return_if_fail (hist != NULL);
+
+  S_LOCK (metrics);
+  if (hist->count == 0 || value < hist->min)
+    hist->min = value;
+  if (value > hist->max)
+    hist->max = value;
+  hist->count++;
+  hist->sum += value;
+  hist->buckets[histogram_bucket (value)]++;
+  S_UNLOCK (metrics);
+}
+
+/* upper bound of the bucket holding the given fraction of the values */
+static guint64
+histogram_percentile (MetricsHistogram * hist, gdouble fraction)
+{
+  guint64 n = 0, target;
+  gint i;
+
+  target = (guint64) (hist->count * fraction);
+  for (i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++)
+    {
+      n += hist->buckets[i];
+      if (n > target)
+        return MIN ((guint64) 1 << i, hist->max);
+    }
+
+  return hist->max;
+}
+
+static void
+trace_write_string (FILE * fp, const gchar * str)
+{
+  const gchar *p;
+
+  fputc ('"', fp);
+  for (p = str; *p != '\0'; p++)
+    {
+      switch (*p)
+        {
+        case '"':
+          fputs ("\\\"", fp);
+          break;
+        case '\\':
+          fputs ("\\\\", fp);
+          break;
+        case '\n':
+          fputs ("\\n", fp);
+          break;
+        default:
+          if ((guchar) * p < 0x20)
+            fprintf (fp, "\\u%04x", (guchar) * p);
+          else
+            fputc (*p, fp);
+        }
+    }
+  fputc ('"', fp);
+}
+
+static void
+trace_write_event (const gchar * name, const gchar * detail, gint64 start, gint64 duration)
+{
+  S_LOCK (trace_fp);
+  if (trace_fp)
+    {
+      fputs (trace_first_event ? "" : ",\n", trace_fp);
+      trace_first_event = FALSE;
+      fputs ("{\"name\": ", trace_fp);
+      trace_write_string (trace_fp, name);
+      fprintf (trace_fp, ", \"ph\": \"X\", \"pid\": %d, \"tid\": %d", (gint) getpid (), get_thread_id ());
+      fprintf (trace_fp, ", \"ts\": %" G_GINT64_FORMAT ", \"dur\": %" G_GINT64_FORMAT, start - trace_start, duration);
+      if (detail)
+        {
+          fputs (", \"args\": {\"detail\": ", trace_fp);
+          trace_write_string (trace_fp, detail);
+          fputc ('}', trace_fp);
+        }
+      fputc ('}', trace_fp);
+    }
+  S_UNLOCK (trace_fp);
+}
+
+void
+metrics_timer_start (MetricsTimer * timer, const gchar * name, const gchar * detail)
+{
+  g_return_if_fail (timer != NULL);
+  g_return_if_fail (name != NULL);
+
+  timer->name = name;
+  /* only needed for the trace; the caller's string may be gone at stop */
+  timer->detail = detail && metrics_trace_is_enabled ()? g_strdup (detail) : NULL;
+  timer->start = g_get_monotonic_time ();
+}
+
+gint64
+metrics_timer_stop (MetricsTimer * timer)
+{
+  gint64 duration;
+
+  g_return_val_if_fail (timer != NULL, 0);
+  g_return_val_if_fail (timer->name != NULL, 0);
+
+  duration = g_get_monotonic_time () - timer->start;
+  metrics_histogram_add (metrics_histogram_get (timer->name), duration);
+
+  if (metrics_trace_is_enabled ())
+    trace_write_event (timer->name, timer->detail, timer->start, duration);
+
+  g_free (timer->detail);
+  timer->detail = NULL;
+  timer->name = NULL;
+
+  return duration;
+}
+
+gint
+metrics_trace_open (const gchar * file)
+{
+  FILE *fp;
+
+  g_return_val_if_fail (file != NULL, -1);
+
+  if ((fp = g_fopen (file, "wb")) == NULL)
+    {
+      FILE_OP_ERROR (file, "fopen");
+      return -1;
+    }
+
+  metrics_trace_close ();
+
+  S_LOCK (trace_fp);
+  g_atomic_pointer_set (&trace_fp, fp);
+  trace_start = g_get_monotonic_time ();
+  trace_first_event = TRUE;
+  fputs ("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n", trace_fp);
+  S_UNLOCK (trace_fp);
+
+  debug_print ("metrics: writing trace to %s\n", file);
+
+  return 0;
+}
+
+/* the counter totals go in as counter events at the end of the trace */
+static void
+trace_write_counter (gpointer key, gpointer val, gpointer data)
+{
+  MetricsCounter *counter = (MetricsCounter *) val;
+  gint64 *now = (gint64 *) data;
+
+  fputs (trace_first_event ? "" : ",\n", trace_fp);
+  trace_first_event = FALSE;
+  fputs ("{\"name\": ", trace_fp);
+  trace_write_string (trace_fp, counter->name);
+  fprintf (trace_fp, ", \"ph\": \"C\", \"pid\": %d, \"ts\": %" G_GINT64_FORMAT
+           ", \"args\": {\"value\": %" G_GINT64_FORMAT "}}", (gint) getpid (), *now - trace_start,
+           (gint64) COUNTER_GET (&counter->value));
+}
+
+void
+metrics_trace_close (void)
+{
+  gint64 now;
+
+  S_LOCK (trace_fp);
+  if (trace_fp)
+    {
+      now = g_get_monotonic_time ();
+      S_LOCK (metrics);
+      if (counter_table)
+        g_hash_table_foreach (counter_table, trace_write_counter, &now);
+      S_UNLOCK (metrics);
+      fputs ("\n]}\n", trace_fp);
+      if (fclose (trace_fp) == EOF)
+        FILE_OP_ERROR ("trace file", "fclose");
+      g_atomic_pointer_set (&trace_fp, NULL);
+    }
+  S_UNLOCK (trace_fp);
+}
+
+gboolean
+metrics_trace_is_enabled (void)
+{
+  return g_atomic_pointer_get (&trace_fp) != NULL;
+}
+
+static gint
+metrics_name_compare (gconstpointer a, gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+static GPtrArray *
+metrics_get_sorted_values (GHashTable * table)
+{
+  GPtrArray *array;
+  GHashTableIter iter;
+  gpointer val;
+
+  array = g_ptr_array_new ();
+  if (table)
+    {
+      g_hash_table_iter_init (&iter, table);
+      while (g_hash_table_iter_next (&iter, NULL, &val))
+        g_ptr_array_add (array, val);
+    }
+  /* both structures start with the name */
+  g_ptr_array_sort (array, metrics_name_compare);
+
+  return array;
+}
+
+gchar *
+metrics_get_summary (void)
+{
+  GString *str;
+  GPtrArray *array;
+  guint i;
+
+  str = g_string_new (NULL);
+
+  S_LOCK (metrics);
+
+  array = metrics_get_sorted_values (counter_table);
+  for (i = 0; i < array->len; i++)
+    {
+      MetricsCounter *counter = g_ptr_array_index (array, i);
+
+      g_string_append_printf (str, "%-32s %" G_GINT64_FORMAT "\n", counter->name,
+                              (gint64) COUNTER_GET (&counter->value));
+    }
+  g_ptr_array_free (array, TRUE);
+
+  array = metrics_get_sorted_values (histogram_table);
+  for (i = 0; i < array->len; i++)
+    {
+      MetricsHistogram *hist = g_ptr_array_index (array, i);
+
+      if (hist->count == 0)
+        continue;
+      g_string_append_printf (str, "%-32s count %" G_GUINT64_FORMAT ", total %" G_GUINT64_FORMAT
+                              ", mean %" G_GUINT64_FORMAT ", min %" G_GUINT64_FORMAT
+                              ", p50 %" G_GUINT64_FORMAT ", p95 %" G_GUINT64_FORMAT
+                              ", max %" G_GUINT64_FORMAT "\n",
+                              hist->name, hist->count, hist->sum, hist->sum / hist->count, hist->min,
+                              histogram_percentile (hist, 0.5), histogram_percentile (hist, 0.95), hist->max);
+    }
+  g_ptr_array_free (array, TRUE);
+
+  S_UNLOCK (metrics);
+
+  return g_string_free (str, FALSE);
+}
+
+static void
+metrics_reset_counter (gpointer key, gpointer val, gpointer data)
+{
+  COUNTER_SET (&((MetricsCounter *) val)->value, 0);
+}
+
+static void
+metrics_reset_histogram (gpointer key, gpointer val, gpointer data)
+{
+  MetricsHistogram *hist = (MetricsHistogram *) val;
+  gchar *name = hist->name;
+
+  memset (hist, 0, sizeof (MetricsHistogram));
+  hist->name = name;
+}
+
+void
+metrics_reset (void)
+{
+  S_LOCK (metrics);
+  if (counter_table)
+    g_hash_table_foreach (counter_table, metrics_reset_counter, NULL);
+  if (histogram_table)
+    g_hash_table_foreach (histogram_table, metrics_reset_histogram, NULL);
+  S_UNLOCK (metrics);
+}
@@ -0,0 +1,87 @@
+/*
+ * LibYAM -- E-Mail client library
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <glib.h>
+
+/* number of log2 buckets of a histogram; the last one takes everything
+ * from 2^(METRICS_HISTOGRAM_BUCKETS - 2) up */
+#define METRICS_HISTOGRAM_BUCKETS	32
+
+typedef struct _MetricsCounter MetricsCounter;
+typedef struct _MetricsHistogram MetricsHistogram;
+typedef struct _MetricsTimer MetricsTimer;
+
+struct _MetricsCounter {
+  gchar *name;
+  gint64 value;
+};
+
+struct _MetricsHistogram {
+  gchar *name;
+  guint64 count;
+  guint64 sum;
+  guint64 min;
+  guint64 max;
+  guint64 buckets[METRICS_HISTOGRAM_BUCKETS];
+};
+
+/* lives on the caller's stack between metrics_timer_start() and
+ * metrics_timer_stop() */
+struct _MetricsTimer {
+  const gchar *name;
+  gchar *detail;
+  gint64 start;
+};
+
+/* counters and histograms are created on first use and never freed,
+ * so the returned pointers can be kept */
+MetricsCounter *metrics_counter_get (const gchar * name);
+void metrics_counter_add (MetricsCounter * counter, gint64 value);
+gint64 metrics_counter_get_value (MetricsCounter * counter);
+
+MetricsHistogram *metrics_histogram_get (const gchar * name);
+void metrics_histogram_add (MetricsHistogram * hist, guint64 value);
+
+/* durations are recorded in microseconds in the histogram of the same
+ * name, and written to the trace file if one is open */
+void metrics_timer_start (MetricsTimer * timer, const gchar * name, const gchar * detail);
+gint64 metrics_timer_stop (MetricsTimer * timer);
+
+/* Chrome trace event format, viewable in chrome://tracing or Perfetto */
+gint metrics_trace_open (const gchar * file);
+void metrics_trace_close (void);
+gboolean metrics_trace_is_enabled (void);
+
+gchar *metrics_get_summary (void);
+void metrics_reset (void);
+
+/* look the counter up once per call site */
+#define METRICS_COUNTER_ADD(name, value)					\
+{										\
+	static MetricsCounter *counter_ = NULL;					\
+										\
+	if (G_UNLIKELY (g_atomic_pointer_get (&counter_) == NULL))		\
+		g_atomic_pointer_set (&counter_, metrics_counter_get (name));	\
+	metrics_counter_add (g_atomic_pointer_get (&counter_), value);		\
+}
+
+#endif /* __METRICS_H__ */
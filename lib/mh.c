@@ -67,6 +67,7 @@ static gint mh_move_msgs (Folder * folder, FolderItem * dest, GSList * msglist);
 static gint mh_copy_msg (Folder * folder, FolderItem * dest, MsgInfo * msginfo);
 static gint mh_copy_msgs (Folder * folder, FolderItem * dest, GSList * msglist);
 static gint mh_remove_msg (Folder * folder, FolderItem * item, MsgInfo * msginfo);
+static gint mh_remove_msgs (Folder * folder, FolderItem * item, GSList * msglist);
 static gint mh_remove_all_msg (Folder * folder, FolderItem * item);
 static gboolean mh_is_msg_changed (Folder * folder, FolderItem * item, MsgInfo * msginfo);
 static gint mh_close (Folder * folder, FolderItem * item);
@@ -82,6 +83,8 @@ static gint mh_move_folder (Folder * folder, FolderItem * item, FolderItem * new
 static gint mh_remove_folder (Folder * folder, FolderItem * item);
 
 static gchar *mh_get_new_msg_filename (FolderItem * dest);
+static gchar *mh_reserve_msg_nums (FolderItem * dest, gint n, gboolean * reserved);
+static gchar *mh_get_reserved_msg_filename (FolderItem * dest, const gchar * destpath, gboolean reserved);
 
 static gint mh_do_move_msgs (Folder * folder, FolderItem * dest, GSList * msglist);
 
@@ -89,7 +92,6 @@ static time_t mh_get_mtime (FolderItem * item);
 static GSList *mh_get_uncached_msgs (GHashTable * msg_table, FolderItem * item);
 static MsgInfo *mh_parse_msg (const gchar * file, FolderItem * item);
 static void mh_remove_missing_folder_items (Folder * folder);
-static void mh_scan_tree_recursive (FolderItem * item);
 
 static gboolean mh_rename_folder_func (GNode * node, gpointer data);
 
@@ -105,6 +107,7 @@ static FolderClass mh_class = {
   mh_get_msg_list,
   mh_get_uncached_msg_list,
   mh_fetch_msg,
+  NULL,
   mh_get_msginfo,
   mh_add_msg,
   mh_add_msgs,
@@ -115,7 +118,7 @@ static FolderClass mh_class = {
   mh_copy_msg,
   mh_copy_msgs,
   mh_remove_msg,
-  NULL,
+  mh_remove_msgs,
   mh_remove_all_msg,
   mh_is_msg_changed,
   mh_close,
@@ -162,6 +165,7 @@ static GSList *
 mh_get_msg_list_full (Folder * folder, FolderItem * item, gboolean use_cache, gboolean uncached_only)
 {
   GSList *mlist;
+  MsgVector *mvec;
   GHashTable *msg_table;
   time_t cur_mtime;
   GSList *newlist = NULL;
@@ -192,14 +196,22 @@ mh_get_msg_list_full (Folder * folder, FolderItem * item, gboolean use_cache, gb
     }
   else if (use_cache)
     {
-      GSList *cur, *next;
       gboolean strict_cache_check = prefs_common.strict_cache_check;
+      guint i, n_cached;
 
       if (item->stype == F_QUEUE || item->stype == F_DRAFT)
         strict_cache_check = TRUE;
 
-      mlist = procmsg_read_cache (item, strict_cache_check);
-      msg_table = procmsg_msg_hash_table_create (mlist);
+      mvec = procmsg_read_cache_vector (item, strict_cache_check);
+      if (!mvec)
+        mvec = procmsg_msg_vector_new (0);
+      msg_table = NULL;
+      if (mvec->len > 0)
+        {
+          msg_table = g_hash_table_new (NULL, g_direct_equal);
+          for (i = 0; i < mvec->len; i++)
+            g_hash_table_insert (msg_table, GUINT_TO_POINTER (mvec->msgs[i]->msgnum), mvec->msgs[i]);
+        }
       newlist = mh_get_uncached_msgs (msg_table, item);
       if (newlist)
         item->cache_dirty = TRUE;
@@ -209,22 +221,26 @@ mh_get_msg_list_full (Folder * folder, FolderItem * item, gboolean use_cache, gb
       if (!strict_cache_check)
         {
           /* remove nonexistent messages */
-          for (cur = mlist; cur != NULL; cur = next)
+          for (i = 0; i < mvec->len; i++)
             {
-              MsgInfo *msginfo = (MsgInfo *) cur->data;
-              next = cur->next;
+              MsgInfo *msginfo = mvec->msgs[i];
               if (!MSG_IS_CACHED (msginfo->flags))
                 {
                   debug_print ("removing nonexistent message %d from cache\n", msginfo->msgnum);
-                  mlist = g_slist_remove (mlist, msginfo);
                   procmsg_msginfo_free (msginfo);
+                  mvec->msgs[i] = NULL;
                   item->cache_dirty = TRUE;
                   item->mark_dirty = TRUE;
                 }
             }
+          procmsg_msg_vector_compact (mvec);
         }
 
-      mlist = g_slist_concat (mlist, newlist);
+      n_cached = mvec->len;
+      procmsg_msg_vector_concat (mvec, procmsg_msg_vector_from_list (newlist));
+      mlist = procmsg_msg_vector_to_list (mvec);
+      /* newlist is the tail of mlist now */
+      newlist = g_slist_nth (mlist, n_cached);
     }
   else
     {
@@ -386,6 +402,96 @@ mh_get_new_msg_filename (FolderItem * dest)
   return destfile;
 }
 
+/* returns the path of dest after checking that the n numbers following
+   dest->last_num are free.  all files written by us go through
+   last_num, so only the ends of the range are probed; if one of them
+   is taken, *reserved is FALSE and each number has to be probed. */
+static gchar *
+mh_reserve_msg_nums (FolderItem * dest, gint n, gboolean * reserved)
+{
+  gchar *destpath;
+  gchar *file;
+
+  destpath = folder_item_get_path (dest);
+  g_return_val_if_fail (destpath != NULL, NULL);
+
+  if (!is_dir_exist (destpath))
+    make_dir_hier (destpath);
+
+  file = g_strdup_printf ("%s%c%d", destpath, G_DIR_SEPARATOR, dest->last_num + 1);
+  *reserved = !is_file_entry_exist (file);
+  g_free (file);
+  if (*reserved && n > 1)
+    {
+      file = g_strdup_printf ("%s%c%d", destpath, G_DIR_SEPARATOR, dest->last_num + n);
+      *reserved = !is_file_entry_exist (file);
+      g_free (file);
+    }
+
+  return destpath;
+}
+
+static gchar *
+mh_get_reserved_msg_filename (FolderItem * dest, const gchar * destpath, gboolean reserved)
+{
+  if (!reserved)
+    return mh_get_new_msg_filename (dest);
+
+  return g_strdup_printf ("%s%c%d", destpath, G_DIR_SEPARATOR, dest->last_num + 1);
+}
+
+/* "add-msg" / "remove-msg" notifications are collected during a batch
+   and emitted at once after the lock is released */
+typedef struct _MhNotify {
+  const gchar *signal;
+  FolderItem *item;
+  gchar *file;
+  gint num;
+} MhNotify;
+
+GArray *
+mh_notify_new (void)
+{
+  if (!yam_app_get ())
+    return NULL;
+
+  return g_array_new (FALSE, FALSE, sizeof (MhNotify));
+}
+
+void
+mh_notify_append (GArray * notify, const gchar * signal, FolderItem * item, const gchar * file, gint num)
+{
+  MhNotify n;
+
+  if (!notify)
+    return;
+
+  n.signal = signal;
+  n.item = item;
+  n.file = g_strdup (file);
+  n.num = num;
+  g_array_append_val (notify, n);
+}
+
+void
+mh_notify_emit (GArray * notify)
+{
+  guint i;
+
+  if (!notify)
+    return;
+
+  for (i = 0; i < notify->len; i++)
+    {
+      MhNotify *n = &g_array_index (notify, MhNotify, i);
+
+      g_signal_emit_by_name (yam_app_get (), n->signal, n->item, n->file, n->num);
+      g_free (n->file);
+    }
+
+  g_array_free (notify, TRUE);
+}
+
 #define SET_DEST_MSG_FLAGS(fp, dest, n, fl)				\
 {									\
 	MsgInfo newmsginfo;						\
@@ -426,11 +532,15 @@ mh_add_msg (Folder * folder, FolderItem * dest, const gchar * file, MsgFlags * f
 static gint
 mh_add_msgs (Folder * folder, FolderItem * dest, GSList * file_list, gboolean remove_source, gint * first)
 {
+  gchar *destpath;
   gchar *destfile;
   GSList *cur;
   MsgFileInfo *fileinfo;
   MsgInfo *msginfo;
+  GArray *notify;
+  gboolean reserved;
   gint first_ = 0;
+  gint ret = 0;
   FILE *fp = NULL;
 
   g_return_val_if_fail (dest != NULL, -1);
@@ -445,6 +555,14 @@ mh_add_msgs (Folder * folder, FolderItem * dest, GSList * file_list, gboolean re
 
   S_LOCK (mh);
 
+  destpath = mh_reserve_msg_nums (dest, g_slist_length (file_list), &reserved);
+  if (!destpath)
+    {
+      S_UNLOCK (mh);
+      return -1;
+    }
+  notify = mh_notify_new ();
+
   if (!dest->opened)
     {
       if ((fp = procmsg_open_mark_file (dest, DATA_APPEND)) == NULL)
@@ -461,17 +579,16 @@ mh_add_msgs (Folder * folder, FolderItem * dest, GSList * file_list, gboolean re
       msginfo = procheader_parse_file (fileinfo->file, flags, 0);
       if (!msginfo)
         {
-          if (fp)
-            fclose (fp);
-          S_UNLOCK (mh);
-          return -1;
+          ret = -1;
+          break;
         }
 
-      destfile = mh_get_new_msg_filename (dest);
+      destfile = mh_get_reserved_msg_filename (dest, destpath, reserved);
       if (destfile == NULL)
         {
-          S_UNLOCK (mh);
-          return -1;
+          procmsg_msginfo_free (msginfo);
+          ret = -1;
+          break;
         }
       if (first_ == 0 || first_ > dest->last_num + 1)
         first_ = dest->last_num + 1;
@@ -482,15 +599,13 @@ mh_add_msgs (Folder * folder, FolderItem * dest, GSList * file_list, gboolean re
             {
               g_warning (_("can't copy message %s to %s\n"), fileinfo->file, destfile);
               g_free (destfile);
-              if (fp)
-                fclose (fp);
-              S_UNLOCK (mh);
-              return -1;
+              procmsg_msginfo_free (msginfo);
+              ret = -1;
+              break;
             }
         }
 
-      if (yam_app_get ())
-        g_signal_emit_by_name (yam_app_get (), "add-msg", dest, destfile, dest->last_num + 1);
+      mh_notify_append (notify, "add-msg", dest, destfile, dest->last_num + 1);
 
       g_free (destfile);
       dest->last_num++;
@@ -512,6 +627,7 @@ mh_add_msgs (Folder * folder, FolderItem * dest, GSList * file_list, gboolean re
           SET_DEST_MSG_FLAGS (fp, dest, dest->last_num, flags);
         }
       procmsg_add_cache_queue (dest, dest->last_num, msginfo);
+      procmsg_msginfo_free (msginfo);
       if (MSG_IS_NEW (flags))
         dest->new++;
       if (MSG_IS_UNREAD (flags))
@@ -521,21 +637,28 @@ mh_add_msgs (Folder * folder, FolderItem * dest, GSList * file_list, gboolean re
   if (fp)
     fclose (fp);
 
-  if (first)
-    *first = first_;
-
-  if (remove_source)
+  if (ret == 0)
     {
-      for (cur = file_list; cur != NULL; cur = cur->next)
+      if (first)
+        *first = first_;
+
+      if (remove_source)
         {
-          fileinfo = (MsgFileInfo *) cur->data;
-          if (g_unlink (fileinfo->file) < 0)
-            FILE_OP_ERROR (fileinfo->file, "unlink");
+          for (cur = file_list; cur != NULL; cur = cur->next)
+            {
+              fileinfo = (MsgFileInfo *) cur->data;
+              if (g_unlink (fileinfo->file) < 0)
+                FILE_OP_ERROR (fileinfo->file, "unlink");
+            }
         }
     }
 
   S_UNLOCK (mh);
-  return dest->last_num;
+
+  g_free (destpath);
+  mh_notify_emit (notify);
+
+  return ret < 0 ? -1 : dest->last_num;
 }
 
 
@@ -558,8 +681,12 @@ mh_add_msgs_msginfo (Folder * folder, FolderItem * dest, GSList * msglist, gbool
   GSList *cur;
   MsgInfo *msginfo;
   gchar *srcfile;
+  gchar *destpath;
   gchar *destfile;
+  GArray *notify;
+  gboolean reserved;
   gint first_ = 0;
+  gint ret = 0;
   FILE *fp = NULL;
 
   g_return_val_if_fail (dest != NULL, -1);
@@ -574,6 +701,14 @@ mh_add_msgs_msginfo (Folder * folder, FolderItem * dest, GSList * msglist, gbool
 
   S_LOCK (mh);
 
+  destpath = mh_reserve_msg_nums (dest, g_slist_length (msglist), &reserved);
+  if (!destpath)
+    {
+      S_UNLOCK (mh);
+      return -1;
+    }
+  notify = mh_notify_new ();
+
   if (!dest->opened)
     {
       if ((fp = procmsg_open_mark_file (dest, DATA_APPEND)) == NULL)
@@ -584,13 +719,11 @@ mh_add_msgs_msginfo (Folder * folder, FolderItem * dest, GSList * msglist, gbool
     {
       msginfo = (MsgInfo *) cur->data;
 
-      destfile = mh_get_new_msg_filename (dest);
+      destfile = mh_get_reserved_msg_filename (dest, destpath, reserved);
       if (!destfile)
         {
-          if (fp)
-            fclose (fp);
-          S_UNLOCK (mh);
-          return -1;
+          ret = -1;
+          break;
         }
       if (first_ == 0 || first_ > dest->last_num + 1)
         first_ = dest->last_num + 1;
@@ -598,11 +731,9 @@ mh_add_msgs_msginfo (Folder * folder, FolderItem * dest, GSList * msglist, gbool
       srcfile = procmsg_get_message_file (msginfo);
       if (!srcfile)
         {
-          if (fp)
-            fclose (fp);
           g_free (destfile);
-          S_UNLOCK (mh);
-          return -1;
+          ret = -1;
+          break;
         }
       if (yam_link (srcfile, destfile) < 0)
         {
@@ -611,15 +742,12 @@ mh_add_msgs_msginfo (Folder * folder, FolderItem * dest, GSList * msglist, gbool
               g_warning ("mh_add_msgs_msginfo: can't copy message %s to %s", srcfile, destfile);
               g_free (srcfile);
               g_free (destfile);
-              if (fp)
-                fclose (fp);
-              S_UNLOCK (mh);
-              return -1;
+              ret = -1;
+              break;
             }
         }
 
-      if (yam_app_get ())
-        g_signal_emit_by_name (yam_app_get (), "add-msg", dest, destfile, dest->last_num + 1);
+      mh_notify_append (notify, "add-msg", dest, destfile, dest->last_num + 1);
 
       g_free (srcfile);
       g_free (destfile);
@@ -651,34 +779,45 @@ mh_add_msgs_msginfo (Folder * folder, FolderItem * dest, GSList * msglist, gbool
   if (fp)
     fclose (fp);
 
-  if (first)
-    *first = first_;
-
-  if (remove_source)
+  if (ret == 0)
     {
-      for (cur = msglist; cur != NULL; cur = cur->next)
+      if (first)
+        *first = first_;
+
+      if (remove_source)
         {
-          msginfo = (MsgInfo *) cur->data;
-          srcfile = procmsg_get_message_file (msginfo);
-          if (g_unlink (srcfile) < 0)
-            FILE_OP_ERROR (srcfile, "unlink");
-          g_free (srcfile);
+          for (cur = msglist; cur != NULL; cur = cur->next)
+            {
+              msginfo = (MsgInfo *) cur->data;
+              srcfile = procmsg_get_message_file (msginfo);
+              if (g_unlink (srcfile) < 0)
+                FILE_OP_ERROR (srcfile, "unlink");
+              g_free (srcfile);
+            }
         }
     }
 
   S_UNLOCK (mh);
-  return dest->last_num;
+
+  g_free (destpath);
+  mh_notify_emit (notify);
+
+  return ret < 0 ? -1 : dest->last_num;
 }
 
 
 static gint
 mh_do_move_msgs (Folder * folder, FolderItem * dest, GSList * msglist)
 {
-  FolderItem *src;
+  FolderItem *src = NULL;
+  gchar *srcpath = NULL;
   gchar *srcfile;
+  gchar *destpath;
   gchar *destfile;
   GSList *cur;
   MsgInfo *msginfo;
+  GArray *notify;
+  gboolean reserved;
 
   g_return_val_if_fail (dest != NULL, -1);
   g_return_val_if_fail (msglist != NULL, -1);
@@ -692,24 +831,40 @@ mh_do_move_msgs (Folder * folder, FolderItem * dest, GSList * msglist)
 
   S_LOCK (mh);
 
+  destpath = mh_reserve_msg_nums (dest, g_slist_length (msglist), &reserved);
+  if (!destpath)
+    {
+      S_UNLOCK (mh);
+      return -1;
+    }
+  notify = mh_notify_new ();
+
   for (cur = msglist; cur != NULL; cur = cur->next)
     {
       msginfo = (MsgInfo *) cur->data;
-      src = msginfo->folder;
 
-      if (src == dest)
+      if (msginfo->folder == dest)
         {
           g_warning (_("the src folder is identical to the dest.\n"));
           continue;
         }
+      if (msginfo->folder != src)
+        {
+          src = msginfo->folder;
+          g_free (srcpath);
+          srcpath = folder_item_get_path (src);
+          if (!srcpath)
+            break;
+        }
       debug_print ("Moving message %s/%d to %s ...\n", src->path, msginfo->msgnum, dest->path);
 
-      destfile = mh_get_new_msg_filename (dest);
+      destfile = mh_get_reserved_msg_filename (dest, destpath, reserved);
       if (!destfile)
         break;
-      srcfile = procmsg_get_message_file (msginfo);
-
-      /* g_signal_emit_by_name(yam_app_get(), "remove-msg", src, srcfile, msginfo->msgnum); */
+      if (msginfo->file_path)
+        srcfile = g_strdup (msginfo->file_path);
+      else
+        srcfile = g_strdup_printf ("%s%c%d", srcpath, G_DIR_SEPARATOR, msginfo->msgnum);
 
       if (move_file (srcfile, destfile, FALSE) < 0)
         {
@@ -718,11 +873,8 @@ mh_do_move_msgs (Folder * folder, FolderItem * dest, GSList * msglist)
           break;
         }
 
-      if (yam_app_get ())
-        {
-          g_signal_emit_by_name (yam_app_get (), "add-msg", dest, destfile, dest->last_num + 1);
-          g_signal_emit_by_name (yam_app_get (), "remove-msg", src, srcfile, msginfo->msgnum);
-        }
+      mh_notify_append (notify, "add-msg", dest, destfile, dest->last_num + 1);
+      mh_notify_append (notify, "remove-msg", src, srcfile, msginfo->msgnum);
 
       g_free (srcfile);
       g_free (destfile);
@@ -758,6 +910,11 @@ mh_do_move_msgs (Folder * folder, FolderItem * dest, GSList * msglist)
     }
 
   S_UNLOCK (mh);
+
+  g_free (srcpath);
+  g_free (destpath);
+  mh_notify_emit (notify);
+
   return dest->last_num;
 }
 
@@ -810,9 +967,12 @@ static gint
 mh_copy_msgs (Folder * folder, FolderItem * dest, GSList * msglist)
 {
   gchar *srcfile;
+  gchar *destpath;
   gchar *destfile;
   GSList *cur;
   MsgInfo *msginfo;
+  GArray *notify;
+  gboolean reserved;
 
   g_return_val_if_fail (dest != NULL, -1);
   g_return_val_if_fail (msglist != NULL, -1);
@@ -826,6 +986,14 @@ mh_copy_msgs (Folder * folder, FolderItem * dest, GSList * msglist)
 
   S_LOCK (mh);
 
+  destpath = mh_reserve_msg_nums (dest, g_slist_length (msglist), &reserved);
+  if (!destpath)
+    {
+      S_UNLOCK (mh);
+      return -1;
+    }
+  notify = mh_notify_new ();
+
   for (cur = msglist; cur != NULL; cur = cur->next)
     {
       msginfo = (MsgInfo *) cur->data;
@@ -837,12 +1005,14 @@ mh_copy_msgs (Folder * folder, FolderItem * dest, GSList * msglist)
         }
       debug_print ("Copying message %s/%d to %s ...\n", msginfo->folder->path, msginfo->msgnum, dest->path);
 
-      destfile = mh_get_new_msg_filename (dest);
+      destfile = mh_get_reserved_msg_filename (dest, destpath, reserved);
       if (!destfile)
         break;
       srcfile = procmsg_get_message_file (msginfo);
 
-      if (copy_file (srcfile, destfile, TRUE) < 0)
+      /* messages are never rewritten in place, so a link is as good
+         as a copy */
+      if (yam_link (srcfile, destfile) < 0 && copy_file (srcfile, destfile, TRUE) < 0)
         {
           FILE_OP_ERROR (srcfile, "copy");
           g_free (srcfile);
@@ -850,8 +1020,7 @@ mh_copy_msgs (Folder * folder, FolderItem * dest, GSList * msglist)
           break;
         }
 
-      if (yam_app_get ())
-        g_signal_emit_by_name (yam_app_get (), "add-msg", dest, destfile, dest->last_num + 1);
+      mh_notify_append (notify, "add-msg", dest, destfile, dest->last_num + 1);
 
       g_free (srcfile);
       g_free (destfile);
@@ -876,48 +1045,85 @@ mh_copy_msgs (Folder * folder, FolderItem * dest, GSList * msglist)
     }
 
   S_UNLOCK (mh);
+
+  g_free (destpath);
+  mh_notify_emit (notify);
+
   return dest->last_num;
 }
 
 static gint
 mh_remove_msg (Folder * folder, FolderItem * item, MsgInfo * msginfo)
 {
+  GSList msglist;
+
+  g_return_val_if_fail (msginfo != NULL, -1);
+
+  msglist.data = msginfo;
+  msglist.next = NULL;
+
+  return mh_remove_msgs (folder, item, &msglist);
+}
+
+static gint
+mh_remove_msgs (Folder * folder, FolderItem * item, GSList * msglist)
+{
+  gchar *path;
   gchar *file;
+  GSList *cur;
+  MsgInfo *msginfo;
+  GArray *notify;
+  gint ret = 0;
 
   g_return_val_if_fail (item != NULL, -1);
 
-  file = mh_fetch_msg (folder, item, msginfo->msgnum);
-  g_return_val_if_fail (file != NULL, -1);
+  path = folder_item_get_path (item);
+  g_return_val_if_fail (path != NULL, -1);
 
-  if (yam_app_get ())
-    g_signal_emit_by_name (yam_app_get (), "remove-msg", item, file, msginfo->msgnum);
+  /* the handlers may still read the files, so notify first */
+  notify = mh_notify_new ();
+  for (cur = msglist; cur != NULL; cur = cur->next)
+    {
+      msginfo = (MsgInfo *) cur->data;
+      file = g_strdup_printf ("%s%c%d", path, G_DIR_SEPARATOR, msginfo->msgnum);
+      mh_notify_append (notify, "remove-msg", item, file, msginfo->msgnum);
+      g_free (file);
+    }
+  mh_notify_emit (notify);
 
   S_LOCK (mh);
 
-  if (g_unlink (file) < 0)
+  for (cur = msglist; cur != NULL; cur = cur->next)
     {
-      FILE_OP_ERROR (file, "unlink");
+      msginfo = (MsgInfo *) cur->data;
+      file = g_strdup_printf ("%s%c%d", path, G_DIR_SEPARATOR, msginfo->msgnum);
+      if (g_unlink (file) < 0)
+        {
+          FILE_OP_ERROR (file, "unlink");
+          g_free (file);
+          ret = -1;
+          break;
+        }
       g_free (file);
-      S_UNLOCK (mh);
-      return -1;
+
+      item->total--;
+      if (MSG_IS_NEW (msginfo->flags))
+        item->new--;
+      if (MSG_IS_UNREAD (msginfo->flags))
+        item->unread--;
+      MSG_SET_TMP_FLAGS (msginfo->flags, MSG_INVALID);
     }
-  g_free (file);
 
-  item->total--;
+  /* last_num is kept, so numbers of removed messages are not handed
+     out again before the next scan */
   item->updated = TRUE;
   item->mtime = 0;
-  if (MSG_IS_NEW (msginfo->flags))
-    item->new--;
-  if (MSG_IS_UNREAD (msginfo->flags))
-    item->unread--;
-  MSG_SET_TMP_FLAGS (msginfo->flags, MSG_INVALID);
 
   S_UNLOCK (mh);
 
-  if (msginfo->msgnum == item->last_num)
-    mh_scan_folder_full (folder, item, FALSE);
+  g_free (path);
 
-  return 0;
+  return ret;
 }
 
 static gint
@@ -1092,7 +1298,7 @@ mh_scan_tree (Folder * folder)
 
   mh_create_tree (folder);
   mh_remove_missing_folder_items (folder);
-  mh_scan_tree_recursive (item);
+  mh_scan_tree_recursive_full (item, NULL, NULL);
 
   S_UNLOCK (mh);
   return 0;
@@ -1585,8 +1791,11 @@ mh_remove_missing_folder_items (Folder * folder)
 
 #define MAX_RECURSION_LEVEL	64
 
-static void
-mh_scan_tree_recursive (FolderItem * item)
+/* scans the folders below item.  the directories in skip_names are
+   not folders, and count_msgs (if set) counts the messages of a folder
+   instead of the numbered files. */
+void
+mh_scan_tree_recursive_full (FolderItem * item, const gchar * const *skip_names, MhCountMsgsFunc count_msgs)
 {
   Folder *folder;
   DIR *dp;
@@ -1598,6 +1807,7 @@ mh_scan_tree_recursive (FolderItem * item)
   gchar *utf8entry;
   gchar *utf8name;
   gint n_msg = 0;
+  gint i;
 
   g_return_if_fail (item != NULL);
   g_return_if_fail (item->folder != NULL);
@@ -1609,7 +1819,7 @@ mh_scan_tree_recursive (FolderItem * item)
 
   if (g_node_depth (item->node) >= MAX_RECURSION_LEVEL)
     {
-      g_warning ("mh_scan_tree_recursive(): max recursion level (%u) reached.", MAX_RECURSION_LEVEL);
+      g_warning ("mh_scan_tree_recursive_full(): max recursion level (%u) reached.", MAX_RECURSION_LEVEL);
       return;
     }
 
@@ -1627,13 +1837,19 @@ mh_scan_tree_recursive (FolderItem * item)
       g_free (fs_path);
       return;
     }
-  g_free (fs_path);
 
   while ((d = readdir (dp)) != NULL)
     {
       dir_name = d->d_name;
       if (dir_name[0] == '.')
         continue;
+      for (i = 0; skip_names && skip_names[i] != NULL; i++)
+        {
+          if (!strcmp (dir_name, skip_names[i]))
+            break;
+        }
+      if (skip_names && skip_names[i] != NULL)
+        continue;
 
       utf8name = g_filename_to_utf8 (dir_name, -1, NULL, NULL, NULL);
       if (!utf8name)
@@ -1726,9 +1942,9 @@ mh_scan_tree_recursive (FolderItem * item)
                 }
             }
 
-          mh_scan_tree_recursive (new_item);
+          mh_scan_tree_recursive_full (new_item, skip_names, count_msgs);
         }
-      else if (to_number (dir_name) > 0)
+      else if (!count_msgs && to_number (dir_name) > 0)
         n_msg++;
 
       g_free (entry);
@@ -1742,6 +1958,8 @@ mh_scan_tree_recursive (FolderItem * item)
     {
       gint new, unread, total, min, max;
 
+      if (count_msgs)
+        n_msg = count_msgs (fs_path);
       procmsg_get_mark_sum (item, &new, &unread, &total, &min, &max, 0);
       if (n_msg > total)
         {
@@ -1754,6 +1972,8 @@ mh_scan_tree_recursive (FolderItem * item)
       item->updated = TRUE;
       item->mtime = 0;
     }
+
+  g_free (fs_path);
 }
 
 static gboolean
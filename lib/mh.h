@@ -33,6 +33,15 @@ struct _MHFolder {
   LocalFolder lfolder;
 };
 
+typedef gint (*MhCountMsgsFunc) (const gchar * path);
+
 FolderClass *mh_get_class (void);
 
+/* shared with the maildir folder */
+GArray *mh_notify_new (void);
+void mh_notify_append (GArray * notify, const gchar * signal, FolderItem * item, const gchar * file, gint num);
+void mh_notify_emit (GArray * notify);
+
+void mh_scan_tree_recursive_full (FolderItem * item, const gchar * const *skip_names, MhCountMsgsFunc count_msgs);
+
 #endif /* __MH_H__ */
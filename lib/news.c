@@ -32,6 +32,7 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/stat.h>
 
 #include "news.h"
 #include "nntp.h"
@@ -45,6 +46,7 @@
 #include "utils.h"
 #include "prefs_common.h"
 #include "prefs_account.h"
+#include "bodycache.h"
 #if USE_SSL
 #include "ssl.h"
 #endif
@@ -104,6 +106,7 @@ static FolderClass news_class = {
   news_get_article_list,
   NULL,
   news_fetch_msg,
+  NULL,
   news_get_msginfo,
   NULL,
   NULL,
@@ -381,6 +384,7 @@ news_fetch_msg (Folder * folder, FolderItem * item, gint num)
   if (is_file_exist (filename) && get_file_size (filename) > 0)
     {
       debug_print ("article %d has been already cached.\n", num);
+      body_cache_touch (filename);
       return filename;
     }
 
@@ -417,6 +421,8 @@ news_fetch_msg (Folder * folder, FolderItem * item, gint num)
       return NULL;
     }
 
+  body_cache_add (folder->account->account_id, filename);
+
   return filename;
 }
 
@@ -539,25 +545,246 @@ news_group_info_compare (NewsGroupInfo * ginfo1, NewsGroupInfo * ginfo2)
   return g_ascii_strcasecmp (ginfo1->name, ginfo2->name);
 }
 
-GSList *
-news_get_group_list (Folder * folder)
+/* on-disk layout of NEWSGROUP_INDEX:
+ *   NewsGroupIndexHeader
+ *   NewsGroupIndexEntry[count], sorted by news_group_info_compare()
+ *   NUL-terminated group names referenced by NewsGroupIndexEntry.name */
+
+typedef struct _NewsGroupIndexHeader NewsGroupIndexHeader;
+typedef struct _NewsGroupIndexEntry NewsGroupIndexEntry;
+
+struct _NewsGroupIndexHeader {
+  guint32 version;
+  guint32 count;
+  gint64 date;
+  guint32 names_size;
+  guint32 reserved;
+};
+
+struct _NewsGroupIndexEntry {
+  guint32 name;
+  guint32 first;
+  guint32 last;
+  guint32 type;
+};
+
+struct _NewsGroupIndex {
+  GMappedFile *mapfile;
+  const NewsGroupIndexEntry *entries;
+  const gchar *names;
+  guint count;
+  stime_t date;
+};
+
+/* full LIST is redone when the index gets older than this */
+#define NEWSGROUP_INDEX_EXPIRE	(30 * 24 * 60 * 60)
+/* NEWGROUPS date is moved back by this to cover clock skew */
+#define NEWSGROUP_INDEX_SKEW	(24 * 60 * 60)
+
+#define INDEX_ENTRY_NAME(index, i)	((index)->names + (index)->entries[i].name)
+
+static gchar *
+news_get_group_list_file (Folder * folder, const gchar * name)
 {
   gchar *path, *filename;
-  FILE *fp;
-  GSList *list = NULL;
-  GSList *last = NULL;
-  gchar buf[NNTPBUFSIZE];
-
-  g_return_val_if_fail (folder != NULL, NULL);
-  g_return_val_if_fail (FOLDER_TYPE (folder) == F_NEWS, NULL);
 
   path = folder_item_get_path (FOLDER_ITEM (folder->node->data));
   if (!is_dir_exist (path))
     make_dir_hier (path);
-  filename = g_strconcat (path, G_DIR_SEPARATOR_S, NEWSGROUP_LIST, NULL);
+  filename = g_strconcat (path, G_DIR_SEPARATOR_S, name, NULL);
   g_free (path);
 
+  return filename;
+}
+
+/* parse LIST / NEWGROUPS response ("group last first type") */
+static GPtrArray *
+news_group_list_read (const gchar * filename)
+{
+  FILE *fp;
+  GPtrArray *array;
+  gchar buf[NNTPBUFSIZE];
+
   if ((fp = g_fopen (filename, "rb")) == NULL)
+    {
+      FILE_OP_ERROR (filename, "fopen");
+      return NULL;
+    }
+
+  array = g_ptr_array_new ();
+
+  while (fgets (buf, sizeof (buf), fp) != NULL)
+    {
+      gchar *p = buf;
+      gchar *name;
+      gint last_num;
+      gint first_num;
+      gchar type;
+
+      p = strchr (p, ' ');
+      if (!p)
+        {
+          strretchomp (buf);
+          log_warning ("invalid LIST response: %s\n", buf);
+          continue;
+        }
+      *p = '\0';
+      p++;
+      name = buf;
+
+      if (sscanf (p, "%d %d %c", &last_num, &first_num, &type) < 3)
+        {
+          strretchomp (p);
+          log_warning ("invalid LIST response: %s %s\n", name, p);
+          continue;
+        }
+
+      g_ptr_array_add (array, news_group_info_new (name, first_num, last_num, type));
+    }
+
+  fclose (fp);
+
+  return array;
+}
+
+static gint
+news_group_info_compare_ptr (gconstpointer a, gconstpointer b)
+{
+  return news_group_info_compare (*(NewsGroupInfo **) a, *(NewsGroupInfo **) b);
+}
+
+/* groups must be sorted with news_group_info_compare_ptr() */
+static gint
+news_group_index_write (const gchar * filename, GPtrArray * groups, stime_t date)
+{
+  NewsGroupIndexHeader header;
+  gchar *tmp;
+  FILE *fp;
+  guint32 offset = 0;
+  guint i;
+
+  tmp = g_strconcat (filename, ".tmp", NULL);
+  if ((fp = g_fopen (tmp, "wb")) == NULL)
+    {
+      FILE_OP_ERROR (tmp, "fopen");
+      g_free (tmp);
+      return -1;
+    }
+
+  memset (&header, 0, sizeof (header));
+  header.version = NEWSGROUP_INDEX_VERSION;
+  header.count = groups->len;
+  header.date = date;
+  for (i = 0; i < groups->len; i++)
+    header.names_size += strlen (((NewsGroupInfo *) g_ptr_array_index (groups, i))->name) + 1;
+  fwrite (&header, sizeof (header), 1, fp);
+
+  for (i = 0; i < groups->len; i++)
+    {
+      NewsGroupInfo *ginfo = g_ptr_array_index (groups, i);
+      NewsGroupIndexEntry entry;
+
+      entry.name = offset;
+      entry.first = ginfo->first;
+      entry.last = ginfo->last;
+      entry.type = (guchar) ginfo->type;
+      fwrite (&entry, sizeof (entry), 1, fp);
+      offset += strlen (ginfo->name) + 1;
+    }
+
+  for (i = 0; i < groups->len; i++)
+    {
+      NewsGroupInfo *ginfo = g_ptr_array_index (groups, i);
+
+      fwrite (ginfo->name, strlen (ginfo->name) + 1, 1, fp);
+    }
+
+  if (fclose (fp) == EOF)
+    {
+      FILE_OP_ERROR (tmp, "fclose");
+      g_unlink (tmp);
+      g_free (tmp);
+      return -1;
+    }
+
+  if (rename_force (tmp, filename) < 0)
+    {
+      FILE_OP_ERROR (tmp, "rename");
+      g_unlink (tmp);
+      g_free (tmp);
+      return -1;
+    }
+
+  g_free (tmp);
+
+  return 0;
+}
+
+static NewsGroupIndex *
+news_group_index_load (const gchar * filename)
+{
+  NewsGroupIndex *index;
+  NewsGroupIndexHeader header;
+  GMappedFile *mapfile;
+  GError *error = NULL;
+  const gchar *p;
+  gsize size;
+
+  mapfile = g_mapped_file_new (filename, FALSE, &error);
+  if (!mapfile)
+    {
+      if (error && error->code != G_FILE_ERROR_NOENT)
+        g_warning ("%s: cannot open newsgroup index: %s", filename, error->message);
+      if (error)
+        g_error_free (error);
+      return NULL;
+    }
+
+  p = g_mapped_file_get_contents (mapfile);
+  size = g_mapped_file_get_length (mapfile);
+  if (size < sizeof (header))
+    {
+      g_mapped_file_unref (mapfile);
+      return NULL;
+    }
+  memcpy (&header, p, sizeof (header));
+  if (header.version != NEWSGROUP_INDEX_VERSION ||
+      size != sizeof (header) + (gsize) header.count * sizeof (NewsGroupIndexEntry) + header.names_size)
+    {
+      debug_print ("%s: newsgroup index is invalid or of different version\n", filename);
+      g_mapped_file_unref (mapfile);
+      return NULL;
+    }
+
+  index = g_new0 (NewsGroupIndex, 1);
+  index->mapfile = mapfile;
+  index->count = header.count;
+  index->date = header.date;
+  index->entries = (const NewsGroupIndexEntry *) (p + sizeof (header));
+  index->names = p + sizeof (header) + header.count * sizeof (NewsGroupIndexEntry);
+
+  return index;
+}
+
+/* retrieve the whole group list with LIST and rebuild the index */
+static gint
+news_group_index_build (Folder * folder, const gchar * filename)
+{
+  gchar *list_file;
+  GPtrArray *groups;
+  stime_t date;
+  gint ret;
+
+  list_file = news_get_group_list_file (folder, NEWSGROUP_LIST);
+
+  /* reuse the plain list left over by older versions */
+  if (is_file_exist (list_file))
+    {
+      GStatBuf s;
+
+      date = g_stat (list_file, &s) == 0 ? s.st_mtime : 0;
+    }
+  else
     {
       NNTPSession *session;
       gint ok;
@@ -565,10 +792,11 @@ news_get_group_list (Folder * folder)
       session = news_session_get (folder);
       if (!session)
         {
-          g_free (filename);
-          return NULL;
+          g_free (list_file);
+          return -1;
         }
 
+      date = time (NULL);
       ok = nntp_list (session);
       if (ok != NN_SUCCESS)
         {
@@ -577,68 +805,320 @@ news_get_group_list (Folder * folder)
               session_destroy (SESSION (session));
               REMOTE_FOLDER (folder)->session = NULL;
             }
-          g_free (filename);
-          return NULL;
+          g_free (list_file);
+          return -1;
         }
-      if (recv_write_to_file (SESSION (session)->sock, filename) < 0)
+      if (recv_write_to_file (SESSION (session)->sock, list_file) < 0)
         {
           log_warning ("can't retrieve newsgroup list\n");
           session_destroy (SESSION (session));
           REMOTE_FOLDER (folder)->session = NULL;
-          g_free (filename);
-          return NULL;
+          g_free (list_file);
+          return -1;
         }
+    }
+
+  groups = news_group_list_read (list_file);
+  if (!groups)
+    {
+      g_free (list_file);
+      return -1;
+    }
+
+  g_ptr_array_sort (groups, news_group_info_compare_ptr);
+  ret = news_group_index_write (filename, groups, date);
+
+  g_ptr_array_foreach (groups, (GFunc) news_group_info_free, NULL);
+  g_ptr_array_free (groups, TRUE);
+
+  if (ret == 0)
+    g_unlink (list_file);
+  g_free (list_file);
+
+  return ret;
+}
+
+NewsGroupIndex *
+news_group_index_open (Folder * folder)
+{
+  NewsGroupIndex *index;
+  gchar *filename;
+
+  g_return_val_if_fail (folder != NULL, NULL);
+  g_return_val_if_fail (FOLDER_TYPE (folder) == F_NEWS, NULL);
+
+  filename = news_get_group_list_file (folder, NEWSGROUP_INDEX);
 
-      if ((fp = g_fopen (filename, "rb")) == NULL)
+  index = news_group_index_load (filename);
+  if (!index && news_group_index_build (folder, filename) == 0)
+    index = news_group_index_load (filename);
+
+  g_free (filename);
+
+  return index;
+}
+
+void
+news_group_index_close (NewsGroupIndex * index)
+{
+  if (!index)
+    return;
+
+  g_mapped_file_unref (index->mapfile);
+  g_free (index);
+}
+
+guint
+news_group_index_get_count (NewsGroupIndex * index)
+{
+  g_return_val_if_fail (index != NULL, 0);
+
+  return index->count;
+}
+
+/* first entry whose name is not less than prefix (case-insensitive) */
+static guint
+news_group_index_lower_bound (NewsGroupIndex * index, const gchar * prefix, gsize len, gboolean upper)
+{
+  guint lo = 0, hi = index->count;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      gint cmp;
+
+      cmp = g_ascii_strncasecmp (INDEX_ENTRY_NAME (index, mid), prefix, len);
+      if (cmp < 0 || (upper && cmp == 0))
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+const gchar *
+news_group_index_lookup (NewsGroupIndex * index, const gchar * name)
+{
+  guint i;
+
+  g_return_val_if_fail (index != NULL, NULL);
+  g_return_val_if_fail (name != NULL, NULL);
+
+  i = news_group_index_lower_bound (index, name, strlen (name) + 1, FALSE);
+  if (i < index->count && !g_ascii_strcasecmp (INDEX_ENTRY_NAME (index, i), name))
+    return INDEX_ENTRY_NAME (index, i);
+
+  return NULL;
+}
+
+/* returns a sorted list of NewsGroupInfo matching the glob pattern.
+   The literal part before the first wildcard is looked up with binary
+   search; "*string*" patterns are matched with a plain substring scan. */
+GSList *
+news_group_index_search (NewsGroupIndex * index, const gchar * pattern)
+{
+  GSList *list = NULL;
+  GPatternSpec *pspec = NULL;
+  gchar *substr = NULL;
+  gsize prefix_len;
+  gboolean prefix_only;
+  guint first, last, i;
+
+  g_return_val_if_fail (index != NULL, NULL);
+
+  if (!pattern || *pattern == '\0')
+    pattern = "*";
+
+  prefix_len = strcspn (pattern, "*?");
+  prefix_only = pattern[prefix_len] == '*' && pattern[prefix_len + 1] == '\0';
+
+  if (prefix_len > 0)
+    {
+      first = news_group_index_lower_bound (index, pattern, prefix_len, FALSE);
+      last = news_group_index_lower_bound (index, pattern, prefix_len, TRUE);
+    }
+  else
+    {
+      first = 0;
+      last = index->count;
+    }
+
+  if (!prefix_only)
+    {
+      gsize len = strlen (pattern);
+
+      if (prefix_len == 0 && len > 2 && pattern[0] == '*' && pattern[len - 1] == '*' &&
+          strcspn (pattern + 1, "*?") == len - 2)
+        substr = g_strndup (pattern + 1, len - 2);
+      else
+        pspec = g_pattern_spec_new (pattern);
+    }
+
+  /* build in reverse to avoid g_slist_append() */
+  for (i = last; i > first; i--)
+    {
+      const NewsGroupIndexEntry *entry = &index->entries[i - 1];
+      const gchar *name = index->names + entry->name;
+
+      if (prefix_only)
         {
-          FILE_OP_ERROR (filename, "fopen");
-          g_free (filename);
-          return NULL;
+          if (strncmp (name, pattern, prefix_len) != 0)
+            continue;
+        }
+      else if (substr)
+        {
+          if (!strstr (name, substr))
+            continue;
         }
+      else if (!g_pattern_match_string (pspec, name))
+        continue;
+
+      list = g_slist_prepend (list, news_group_info_new (name, entry->first, entry->last, (gchar) entry->type));
     }
 
-  while (fgets (buf, sizeof (buf), fp) != NULL)
+  g_free (substr);
+  if (pspec)
+    g_pattern_spec_free (pspec);
+
+  return list;
+}
+
+/* bring the index up to date.  Only groups created since the last
+   update are retrieved with NEWGROUPS; the full LIST is used when
+   there is no index yet, when it is too old, or when NEWGROUPS fails. */
+gint
+news_update_group_list (Folder * folder)
+{
+  NewsGroupIndex *index;
+  NNTPSession *session;
+  GHashTable *table;
+  GPtrArray *groups, *new_groups;
+  gchar *filename, *tmp;
+  stime_t date;
+  guint i;
+  gint ok, ret;
+
+  g_return_val_if_fail (folder != NULL, -1);
+  g_return_val_if_fail (FOLDER_TYPE (folder) == F_NEWS, -1);
+
+  filename = news_get_group_list_file (folder, NEWSGROUP_INDEX);
+
+  index = news_group_index_load (filename);
+  if (!index || time (NULL) - index->date > NEWSGROUP_INDEX_EXPIRE)
     {
-      gchar *p = buf;
-      gchar *name;
-      gint last_num;
-      gint first_num;
-      gchar type;
-      NewsGroupInfo *ginfo;
+      news_group_index_close (index);
+      ret = news_group_index_build (folder, filename);
+      g_free (filename);
+      return ret;
+    }
 
-      p = strchr (p, ' ');
-      if (!p)
+  session = news_session_get (folder);
+  if (!session)
+    {
+      news_group_index_close (index);
+      g_free (filename);
+      return -1;
+    }
+
+  date = time (NULL);
+  ok = nntp_newgroups (session, index->date - NEWSGROUP_INDEX_SKEW);
+  if (ok != NN_SUCCESS)
+    {
+      news_group_index_close (index);
+      if (ok == NN_SOCKET)
         {
-          strretchomp (buf);
-          log_warning ("invalid LIST response: %s\n", buf);
-          continue;
+          session_destroy (SESSION (session));
+          REMOTE_FOLDER (folder)->session = NULL;
+          g_free (filename);
+          return -1;
         }
-      *p = '\0';
-      p++;
-      name = buf;
+      log_warning (_("NEWGROUPS failed, retrieving the whole newsgroup list\n"));
+      ret = news_group_index_build (folder, filename);
+      g_free (filename);
+      return ret;
+    }
 
-      if (sscanf (p, "%d %d %c", &last_num, &first_num, &type) < 3)
+  tmp = g_strconcat (filename, ".new", NULL);
+  if (recv_write_to_file (SESSION (session)->sock, tmp) < 0)
+    {
+      log_warning ("can't retrieve new newsgroups\n");
+      session_destroy (SESSION (session));
+      REMOTE_FOLDER (folder)->session = NULL;
+      news_group_index_close (index);
+      g_free (tmp);
+      g_free (filename);
+      return -1;
+    }
+
+  new_groups = news_group_list_read (tmp);
+  g_unlink (tmp);
+  g_free (tmp);
+  if (!new_groups)
+    {
+      news_group_index_close (index);
+      g_free (filename);
+      return -1;
+    }
+
+  debug_print ("%u new newsgroups since last update\n", new_groups->len);
+
+  /* merge: entries from NEWGROUPS replace the indexed ones */
+  table = g_hash_table_new (g_str_hash, g_str_equal);
+  groups = g_ptr_array_sized_new (index->count + new_groups->len);
+
+  for (i = 0; i < new_groups->len; i++)
+    {
+      NewsGroupInfo *ginfo = g_ptr_array_index (new_groups, i);
+
+      if (g_hash_table_lookup (table, ginfo->name))
         {
-          strretchomp (p);
-          log_warning ("invalid LIST response: %s %s\n", name, p);
+          news_group_info_free (ginfo);
           continue;
         }
+      g_hash_table_insert (table, ginfo->name, ginfo);
+      g_ptr_array_add (groups, ginfo);
+    }
+  g_ptr_array_free (new_groups, TRUE);
 
-      ginfo = news_group_info_new (name, first_num, last_num, type);
+  for (i = 0; i < index->count; i++)
+    {
+      const NewsGroupIndexEntry *entry = &index->entries[i];
+      const gchar *name = index->names + entry->name;
 
-      if (!last)
-        last = list = g_slist_append (NULL, ginfo);
-      else
-        {
-          last = g_slist_append (last, ginfo);
-          last = last->next;
-        }
+      if (g_hash_table_lookup (table, name))
+        continue;
+      g_ptr_array_add (groups, news_group_info_new (name, entry->first, entry->last, (gchar) entry->type));
     }
 
-  fclose (fp);
+  g_hash_table_destroy (table);
+  news_group_index_close (index);
+
+  g_ptr_array_sort (groups, news_group_info_compare_ptr);
+  ret = news_group_index_write (filename, groups, date);
+
+  g_ptr_array_foreach (groups, (GFunc) news_group_info_free, NULL);
+  g_ptr_array_free (groups, TRUE);
   g_free (filename);
 
-  list = g_slist_sort (list, (GCompareFunc) news_group_info_compare);
+  return ret;
+}
+
+GSList *
+news_get_group_list (Folder * folder)
+{
+  NewsGroupIndex *index;
+  GSList *list;
+
+  g_return_val_if_fail (folder != NULL, NULL);
+  g_return_val_if_fail (FOLDER_TYPE (folder) == F_NEWS, NULL);
+
+  index = news_group_index_open (folder);
+  if (!index)
+    return NULL;
+
+  list = news_group_index_search (index, NULL);
+  news_group_index_close (index);
 
   return list;
 }
@@ -659,21 +1139,27 @@ news_group_list_free (GSList * group_list)
 void
 news_remove_group_list_cache (Folder * folder)
 {
+  const gchar *names[] = { NEWSGROUP_LIST, NEWSGROUP_INDEX };
   gchar *path, *filename;
+  guint i;
 
   g_return_if_fail (folder != NULL);
   g_return_if_fail (FOLDER_TYPE (folder) == F_NEWS);
 
   path = folder_item_get_path (FOLDER_ITEM (folder->node->data));
-  filename = g_strconcat (path, G_DIR_SEPARATOR_S, NEWSGROUP_LIST, NULL);
-  g_free (path);
 
-  if (is_file_exist (filename))
+  for (i = 0; i < G_N_ELEMENTS (names); i++)
     {
-      if (remove (filename) < 0)
-        FILE_OP_ERROR (filename, "remove");
+      filename = g_strconcat (path, G_DIR_SEPARATOR_S, names[i], NULL);
+      if (is_file_exist (filename))
+        {
+          if (remove (filename) < 0)
+            FILE_OP_ERROR (filename, "remove");
+        }
+      g_free (filename);
     }
-  g_free (filename);
+
+  g_free (path);
 }
 
 gint
@@ -906,7 +1392,7 @@ news_get_uncached_articles (NNTPSession * session, FolderItem * item, gint cache
       msginfo->folder = item;
       msginfo->flags.perm_flags = MSG_NEW | MSG_UNREAD;
       msginfo->flags.tmp_flags = MSG_NEWS;
-      msginfo->newsgroups = g_strdup (item->path);
+      msginfo->newsgroups = procmsg_intern_str (item->path);
 
       if (!newlist)
         llast = newlist = g_slist_append (newlist, msginfo);
@@ -950,7 +1436,7 @@ news_get_uncached_articles (NNTPSession * session, FolderItem * item, gint cache
         }
 
       msginfo = (MsgInfo *) llast->data;
-      msginfo->to = news_parse_xhdr (buf, msginfo);
+      msginfo->to = procmsg_intern_str_take (news_parse_xhdr (buf, msginfo));
 
       llast = llast->next;
     }
@@ -988,7 +1474,7 @@ news_get_uncached_articles (NNTPSession * session, FolderItem * item, gint cache
         }
 
       msginfo = (MsgInfo *) llast->data;
-      msginfo->cc = news_parse_xhdr (buf, msginfo);
+      msginfo->cc = procmsg_intern_str_take (news_parse_xhdr (buf, msginfo));
 
       llast = llast->next;
     }
@@ -1044,15 +1530,15 @@ news_parse_xover (const gchar * xover_str)
   msginfo->date = g_strdup (date);
   msginfo->date_t = procheader_date_parse (NULL, date, 0);
 
-  msginfo->from = conv_unmime_header (sender, NULL);
-  msginfo->fromname = procheader_get_fromname (msginfo->from);
+  msginfo->from = procmsg_intern_str_take (conv_unmime_header (sender, NULL));
+  msginfo->fromname = procmsg_intern_str_take (procheader_get_fromname (msginfo->from));
 
-  msginfo->subject = conv_unmime_header (subject, NULL);
+  msginfo->subject = procmsg_intern_str_take (conv_unmime_header (subject, NULL));
 
   extract_parenthesis (msgid, '<', '>');
   remove_space (msgid);
   if (*msgid != '\0')
-    msginfo->msgid = g_strdup (msgid);
+    msginfo->msgid = procmsg_intern_str (msgid);
 
   eliminate_parenthesis (ref, '(', ')');
   if ((p = strrchr (ref, '<')) != NULL)
@@ -1060,7 +1546,7 @@ news_parse_xover (const gchar * xover_str)
       extract_parenthesis (p, '<', '>');
       remove_space (p);
       if (*p != '\0')
-        msginfo->inreplyto = g_strdup (p);
+        msginfo->inreplyto = procmsg_intern_str (p);
     }
 
   return msginfo;
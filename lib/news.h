@@ -28,6 +28,7 @@
 
 typedef struct _NewsFolder NewsFolder;
 typedef struct _NewsGroupInfo NewsGroupInfo;
+typedef struct _NewsGroupIndex NewsGroupIndex;
 
 #define NEWS_FOLDER(obj)	((NewsFolder *)obj)
 
@@ -50,6 +51,13 @@ FolderClass *news_get_class (void);
 GSList *news_get_group_list (Folder * folder);
 void news_group_list_free (GSList * group_list);
 void news_remove_group_list_cache (Folder * folder);
+gint news_update_group_list (Folder * folder);
+
+NewsGroupIndex *news_group_index_open (Folder * folder);
+void news_group_index_close (NewsGroupIndex * index);
+guint news_group_index_get_count (NewsGroupIndex * index);
+const gchar *news_group_index_lookup (NewsGroupIndex * index, const gchar * name);
+GSList *news_group_index_search (NewsGroupIndex * index, const gchar * pattern);
 
 gint news_post (Folder * folder, const gchar * file);
 gint news_post_stream (Folder * folder, FILE * fp);
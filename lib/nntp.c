@@ -352,9 +352,16 @@ nntp_post (NNTPSession * session, FILE * fp)
 }
 
 gint
-nntp_newgroups (NNTPSession * session)
+nntp_newgroups (NNTPSession * session, stime_t since)
 {
-  return NN_SUCCESS;
+  gchar date[32];
+  time_t t = since;
+  struct tm tm;
+
+  if (!gmtime_r (&t, &tm) || strftime (date, sizeof (date), "%Y%m%d %H%M%S", &tm) == 0)
+    return NN_ERROR;
+
+  return nntp_gen_command (session, NULL, "NEWGROUPS %s GMT", date);
 }
 
 gint
@@ -78,7 +78,7 @@ gint nntp_xover (NNTPSession * session, gint first, gint last);
 gint nntp_xhdr (NNTPSession * session, const gchar * header, gint first, gint last);
 gint nntp_list (NNTPSession * session);
 gint nntp_post (NNTPSession * session, FILE * fp);
-gint nntp_newgroups (NNTPSession * session);
+gint nntp_newgroups (NNTPSession * session, stime_t since);
 gint nntp_newnews (NNTPSession * session);
 gint nntp_mode (NNTPSession * session, gboolean stream);
 
@@ -70,6 +70,7 @@ static void pop3_session_destroy (Session * session);
 gint pop3_write_msg_to_file (const gchar * file, FILE * src_fp, guint len);
 
 static Pop3State pop3_lookup_next (Pop3Session * session);
+static Pop3State pop3_lookup_deferred (Pop3Session * session);
 
 Pop3ErrorValue pop3_ok (Pop3Session * session, const gchar * msg);
 
@@ -283,7 +284,7 @@ pop3_getrange_uidl_recv (Pop3Session * session, const gchar * data, guint len)
 
       session->msg[num].uidl = g_strdup (id);
 
-      recv_time = GPOINTER_TO_INT (g_hash_table_lookup (session->uidl_table, id));
+      recv_time = pop3_uidl_store_lookup (session->uidl_store, id);
       session->msg[num].recv_time = recv_time;
 
       if (!session->ac_prefs->getall && recv_time != RECV_TIME_NONE)
@@ -382,8 +383,15 @@ pop3_retr_recv (Pop3Session * session, FILE * fp, guint len)
   session->cur_total_num++;
 
   session->msg[session->cur_msg].received = TRUE;
-  session->msg[session->cur_msg].recv_time =
-    drop_ok == DROP_DONT_RECEIVE ? RECV_TIME_KEEP : drop_ok == DROP_DELETE ? RECV_TIME_DELETE : session->current_time;
+  if (drop_ok == DROP_DEFERRED)
+    {
+      /* keep it on the server until drop_flush() decides */
+      session->msg[session->cur_msg].deferred = TRUE;
+      session->msg[session->cur_msg].recv_time = RECV_TIME_KEEP;
+    }
+  else
+    session->msg[session->cur_msg].recv_time =
+      drop_ok == DROP_DONT_RECEIVE ? RECV_TIME_KEEP : drop_ok == DROP_DELETE ? RECV_TIME_DELETE : session->current_time;
 
   return PS_SUCCESS;
 }
@@ -452,7 +460,7 @@ pop3_session_new (PrefsAccount * account)
 
   session->state = POP3_READY;
   session->ac_prefs = account;
-  session->uidl_table = pop3_get_uidl_table (account);
+  session->uidl_store = pop3_uidl_store_open (account);
   session->current_time = time (NULL);
   session->error_val = PS_SUCCESS;
   session->error_msg = NULL;
@@ -487,11 +495,7 @@ pop3_session_destroy (Session * session)
     g_free (pop3_session->msg[n].uidl);
   g_free (pop3_session->msg);
 
-  if (pop3_session->uidl_table)
-    {
-      hash_free_strings (pop3_session->uidl_table);
-      g_hash_table_destroy (pop3_session->uidl_table);
-    }
+  pop3_uidl_store_close (pop3_session->uidl_store);
 
   g_free (pop3_session->greeting);
   g_free (pop3_session->user);
@@ -499,37 +503,140 @@ pop3_session_destroy (Session * session)
   g_free (pop3_session->error_msg);
 }
 
-GHashTable *
-pop3_get_uidl_table (PrefsAccount * ac_prefs)
+/* on-disk layout of the UIDL store (UIDL_DIR/<server>-<user>.db):
+ *   Pop3UIDLHeader, with two commit slots
+ *   guint32 bucket[n_buckets]: offset of the newest record of the chain
+ *   Pop3UIDLRecord + UIDL (padded to 8 bytes), appended in order
+ * A newer record of a UIDL shadows the older ones, and a record with
+ * RECV_TIME_NONE removes the entry.
+ *
+ * Changes are made in place: the new records are appended and synced,
+ * then the buckets that change are rewritten, and last the commit slot
+ * not in use gets the new end of the data.  The valid slot with the
+ * newer generation wins, so an interrupted update leaves the previous
+ * state: records past its end are skipped, and their links lead back
+ * into it.  The file is rewritten with the entries still on the server
+ * once dead records outweigh live ones. */
+
+#define UIDL_STORE_MAGIC	0x4c444955
+#define UIDL_STORE_VERSION	2
+/* version 1 had no commit slots; it is read, and rewritten on the next
+   write */
+#define UIDL_STORE_V1_HEADER_SIZE	32
+#define UIDL_STORE_MIN_BUCKETS	1024
+#define UIDL_STORE_ALIGN(n)	(((n) + 7) & ~7)
+
+typedef struct _Pop3UIDLCommit Pop3UIDLCommit;
+typedef struct _Pop3UIDLHeader Pop3UIDLHeader;
+typedef struct _Pop3UIDLRecord Pop3UIDLRecord;
+
+struct _Pop3UIDLCommit {
+  guint32 generation;
+  guint32 n_records;
+  guint32 data_end;
+  guint32 check;
+};
+
+struct _Pop3UIDLHeader {
+  guint32 magic;
+  guint32 version;
+  guint32 n_buckets;
+  guint32 reserved;             /* n_records in version 1 */
+  Pop3UIDLCommit commit[2];
+};
+
+struct _Pop3UIDLRecord {
+  guint32 next;
+  guint32 hash;
+  gint64 recv_time;
+  guint32 len;
+  guint32 reserved;
+};
+
+struct _Pop3UIDLStore {
+  gchar *path;
+
+  GMappedFile *mapfile;
+  const gchar *data;
+  gsize size;
+  guint32 n_buckets;
+  const guint32 *buckets;
+  Pop3UIDLCommit commit;        /* the state in use */
+  gint slot;                    /* its slot, or -1 for version 1 */
+
+  /* UIDL -> stime_t *, not written yet */
+  GHashTable *changes;
+};
+
+static guint32
+pop3_uidl_hash (const gchar * uidl)
 {
-  GHashTable *table;
+  guint32 h = 2166136261U;
+
+  while (*uidl)
+    {
+      h ^= (guchar) * uidl++;
+      h *= 16777619U;
+    }
+
+  return h;
+}
+
+static guint32
+pop3_uidl_commit_check (const Pop3UIDLCommit * commit)
+{
+  const guchar *p = (const guchar *) commit;
+  guint32 h = 2166136261U;
+  gsize i;
+
+  for (i = 0; i < G_STRUCT_OFFSET (Pop3UIDLCommit, check); i++)
+    {
+      h ^= p[i];
+      h *= 16777619U;
+    }
+
+  return h;
+}
+
+static gchar *
+pop3_get_uidl_file (PrefsAccount * ac_prefs, const gchar * suffix)
+{
+  gchar *uid;
   gchar *path;
+
+  uid = uriencode_for_filename (ac_prefs->userid);
+  path = g_strconcat (get_rc_dir (), G_DIR_SEPARATOR_S,
+                      UIDL_DIR, G_DIR_SEPARATOR_S, ac_prefs->recv_server, "-", uid, suffix, NULL);
+  g_free (uid);
+
+  return path;
+}
+
+/* read the plain text list of older versions */
+static GHashTable *
+pop3_read_uidl_list (const gchar * path)
+{
+  GHashTable *table;
   FILE *fp;
   gchar buf[POPBUFSIZE];
   gchar uidl[POPBUFSIZE];
   time_t recv_time;
   time_t now;
-  gchar *uid;
-
-  table = g_hash_table_new (g_str_hash, g_str_equal);
 
-  uid = uriencode_for_filename (ac_prefs->userid);
-  path = g_strconcat (get_rc_dir (), G_DIR_SEPARATOR_S,
-                      UIDL_DIR, G_DIR_SEPARATOR_S, ac_prefs->recv_server, "-", uid, NULL);
-  g_free (uid);
   if ((fp = g_fopen (path, "rb")) == NULL)
     {
       if (ENOENT != errno)
         FILE_OP_ERROR (path, "fopen");
-      g_free (path);
-      return table;
+      return NULL;
     }
-  g_free (path);
 
+  table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
   now = time (NULL);
 
   while (fgets (buf, sizeof (buf), fp) != NULL)
     {
+      stime_t *val;
+
       strretchomp (buf);
       recv_time = RECV_TIME_NONE;
       if (sscanf (buf, "%s\t%ld", uidl, &recv_time) != 2)
@@ -541,52 +648,510 @@ pop3_get_uidl_table (PrefsAccount * ac_prefs)
         }
       if (recv_time == RECV_TIME_NONE)
         recv_time = RECV_TIME_RECEIVED;
-      g_hash_table_insert (table, g_strdup (uidl), GINT_TO_POINTER (recv_time));
+      val = g_new (stime_t, 1);
+      *val = recv_time;
+      g_hash_table_replace (table, g_strdup (uidl), val);
     }
 
   fclose (fp);
   return table;
 }
 
+static gint
+pop3_uidl_record_write (FILE * fp, const gchar * uidl, stime_t recv_time, guint32 hash, guint32 next)
+{
+  static const gchar pad[8];
+  Pop3UIDLRecord rec;
+  guint32 len;
+
+  len = strlen (uidl);
+  memset (&rec, 0, sizeof (rec));
+  rec.next = next;
+  rec.hash = hash;
+  rec.recv_time = recv_time;
+  rec.len = len;
+
+  if (fwrite (&rec, sizeof (rec), 1, fp) != 1 ||
+      fwrite (uidl, len, 1, fp) != 1 || fwrite (pad, UIDL_STORE_ALIGN (len) - len, 1, fp) > 1)
+    return -1;
+
+  return sizeof (rec) + UIDL_STORE_ALIGN (len);
+}
+
+static gint
+pop3_uidl_store_sync (FILE * fp, const gchar * path)
+{
+  if (fflush (fp) == EOF)
+    {
+      FILE_OP_ERROR (path, "fflush");
+      return -1;
+    }
+#if HAVE_FSYNC
+  if (fsync (fileno (fp)) < 0)
+    {
+      FILE_OP_ERROR (path, "fsync");
+      return -1;
+    }
+#endif
+
+  return 0;
+}
+
+/* flush @fp to disk and move the temporary file over @path, so that a
+ * crash leaves either the old or the new store */
+static gint
+pop3_uidl_store_commit (FILE * fp, const gchar * tmp, const gchar * path)
+{
+  if (pop3_uidl_store_sync (fp, tmp) < 0)
+    {
+      fclose (fp);
+      g_unlink (tmp);
+      return -1;
+    }
+  if (fclose (fp) == EOF)
+    {
+      FILE_OP_ERROR (tmp, "fclose");
+      g_unlink (tmp);
+      return -1;
+    }
+
+  if (rename_force (tmp, path) < 0)
+    {
+      FILE_OP_ERROR (tmp, "rename");
+      g_unlink (tmp);
+      return -1;
+    }
+
+  return 0;
+}
+
+/* write a fresh store from @table (UIDL -> stime_t *) */
+static gint
+pop3_uidl_store_write (const gchar * path, GHashTable * table)
+{
+  Pop3UIDLHeader header;
+  GHashTableIter iter;
+  gpointer key, value;
+  guint32 *buckets;
+  guint32 n_buckets = UIDL_STORE_MIN_BUCKETS;
+  guint32 offset;
+  gchar *tmp;
+  FILE *fp;
+  gint len = 0;
+
+  while (n_buckets < g_hash_table_size (table) * 2)
+    n_buckets <<= 1;
+
+  tmp = g_strconcat (path, ".tmp", NULL);
+  if ((fp = g_fopen (tmp, "wb")) == NULL)
+    {
+      FILE_OP_ERROR (tmp, "fopen");
+      g_free (tmp);
+      return -1;
+    }
+
+  memset (&header, 0, sizeof (header));
+  header.magic = UIDL_STORE_MAGIC;
+  header.version = UIDL_STORE_VERSION;
+  header.n_buckets = n_buckets;
+  buckets = g_new0 (guint32, n_buckets);
+
+  fwrite (&header, sizeof (header), 1, fp);
+  fwrite (buckets, sizeof (guint32), n_buckets, fp);
+  offset = sizeof (header) + n_buckets * sizeof (guint32);
+
+  g_hash_table_iter_init (&iter, table);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      const gchar *uidl = (const gchar *) key;
+      stime_t recv_time = *(stime_t *) value;
+      guint32 hash;
+
+      if (recv_time == RECV_TIME_NONE)
+        continue;
+      hash = pop3_uidl_hash (uidl);
+      if ((len = pop3_uidl_record_write (fp, uidl, recv_time, hash, buckets[hash & (n_buckets - 1)])) < 0)
+        break;
+      buckets[hash & (n_buckets - 1)] = offset;
+      offset += len;
+      header.commit[0].n_records++;
+    }
+
+  header.commit[0].generation = 1;
+  header.commit[0].data_end = offset;
+  header.commit[0].check = pop3_uidl_commit_check (&header.commit[0]);
+
+  if (len < 0 || fseek (fp, 0, SEEK_SET) < 0 ||
+      fwrite (&header, sizeof (header), 1, fp) != 1 || fwrite (buckets, sizeof (guint32), n_buckets, fp) != n_buckets)
+    {
+      FILE_OP_ERROR (tmp, "fwrite");
+      fclose (fp);
+      g_unlink (tmp);
+      g_free (buckets);
+      g_free (tmp);
+      return -1;
+    }
+  g_free (buckets);
+
+  if (pop3_uidl_store_commit (fp, tmp, path) < 0)
+    {
+      g_free (tmp);
+      return -1;
+    }
+
+  g_free (tmp);
+  return 0;
+}
+
+/* the first record of the chain at @offset that the commit in use
+ * covers, or 0 */
+static guint32
+pop3_uidl_store_skip_uncommitted (Pop3UIDLStore * store, guint32 offset)
+{
+  Pop3UIDLRecord rec;
+
+  while (offset >= store->commit.data_end)
+    {
+      if (offset + sizeof (rec) > store->size)
+        return 0;
+      memcpy (&rec, store->data + offset, sizeof (rec));
+      if (rec.next >= offset)
+        return 0;
+      offset = rec.next;
+    }
+
+  return offset;
+}
+
+/* append the pending changes in place, see the layout above */
+static gint
+pop3_uidl_store_append (Pop3UIDLStore * store)
+{
+  Pop3UIDLCommit commit = store->commit;
+  GHashTableIter iter;
+  gpointer key, value;
+  guint32 *buckets;
+  guint32 mask = store->n_buckets - 1;
+  gsize offset;
+  FILE *fp;
+  gint slot;
+  gint len = 0;
+  guint32 i;
+
+  g_return_val_if_fail (store->buckets != NULL && store->slot >= 0, -1);
+
+  if ((fp = g_fopen (store->path, "r+b")) == NULL)
+    {
+      FILE_OP_ERROR (store->path, "fopen");
+      return -1;
+    }
+
+  buckets = g_malloc (store->n_buckets * sizeof (guint32));
+  memcpy (buckets, store->buckets, store->n_buckets * sizeof (guint32));
+
+  /* an interrupted update may have left records which the next commit
+     would take in: unlink them */
+  if (store->size > commit.data_end)
+    {
+      for (i = 0; i < store->n_buckets; i++)
+        buckets[i] = pop3_uidl_store_skip_uncommitted (store, buckets[i]);
+    }
+
+  /* the records, synced before anything points to them */
+  offset = UIDL_STORE_ALIGN (store->size);
+  if (fseek (fp, offset, SEEK_SET) < 0)
+    len = -1;
+
+  g_hash_table_iter_init (&iter, store->changes);
+  while (len >= 0 && g_hash_table_iter_next (&iter, &key, &value))
+    {
+      const gchar *uidl = (const gchar *) key;
+      guint32 hash = pop3_uidl_hash (uidl);
+
+      if (offset > G_MAXUINT32 - POPBUFSIZE * 2)
+        {
+          len = -1;
+          break;
+        }
+      if ((len = pop3_uidl_record_write (fp, uidl, *(stime_t *) value, hash, buckets[hash & mask])) < 0)
+        break;
+      buckets[hash & mask] = offset;
+      offset += len;
+      commit.n_records++;
+    }
+
+  if (len < 0 || pop3_uidl_store_sync (fp, store->path) < 0)
+    goto error;
+
+  /* the buckets which changed */
+  for (i = 0; i < store->n_buckets; i++)
+    {
+      if (buckets[i] == store->buckets[i])
+        continue;
+      if (fseek (fp, sizeof (Pop3UIDLHeader) + (gsize) i * sizeof (guint32), SEEK_SET) < 0 ||
+          fwrite (&buckets[i], sizeof (guint32), 1, fp) != 1)
+        goto error;
+    }
+  if (pop3_uidl_store_sync (fp, store->path) < 0)
+    goto error;
+
+  /* and the commit */
+  slot = 1 - store->slot;
+  commit.generation++;
+  commit.data_end = offset;
+  commit.check = pop3_uidl_commit_check (&commit);
+  if (fseek (fp, G_STRUCT_OFFSET (Pop3UIDLHeader, commit) + slot * sizeof (Pop3UIDLCommit), SEEK_SET) < 0 ||
+      fwrite (&commit, sizeof (commit), 1, fp) != 1 || pop3_uidl_store_sync (fp, store->path) < 0)
+    goto error;
+
+  g_free (buckets);
+  if (fclose (fp) == EOF)
+    {
+      FILE_OP_ERROR (store->path, "fclose");
+      return -1;
+    }
+
+  return 0;
+
+error:
+  FILE_OP_ERROR (store->path, "fwrite");
+  g_free (buckets);
+  fclose (fp);
+  return -1;
+}
+
+static void
+pop3_uidl_store_load (Pop3UIDLStore * store)
+{
+  GError *error = NULL;
+  Pop3UIDLHeader header;
+  Pop3UIDLCommit commit;
+  gsize header_size;
+  gint slot;
+
+  store->mapfile = g_mapped_file_new (store->path, FALSE, &error);
+  if (!store->mapfile)
+    {
+      if (error && error->code != G_FILE_ERROR_NOENT)
+        g_warning ("%s: cannot open UIDL store: %s", store->path, error->message);
+      if (error)
+        g_error_free (error);
+      return;
+    }
+
+  store->data = g_mapped_file_get_contents (store->mapfile);
+  store->size = g_mapped_file_get_length (store->mapfile);
+
+  if (store->size < UIDL_STORE_V1_HEADER_SIZE)
+    goto invalid;
+  memset (&header, 0, sizeof (header));
+  memcpy (&header, store->data, MIN (store->size, sizeof (header)));
+  if (header.magic != UIDL_STORE_MAGIC || header.n_buckets == 0 || (header.n_buckets & (header.n_buckets - 1)) != 0)
+    goto invalid;
+
+  if (header.version == 1)
+    {
+      header_size = UIDL_STORE_V1_HEADER_SIZE;
+      memset (&commit, 0, sizeof (commit));
+      commit.n_records = header.reserved;
+      commit.data_end = MIN (store->size, G_MAXUINT32);
+      slot = -1;
+    }
+  else if (header.version == UIDL_STORE_VERSION && store->size >= sizeof (header))
+    {
+      gboolean valid0, valid1;
+
+      header_size = sizeof (header);
+      valid0 = header.commit[0].check == pop3_uidl_commit_check (&header.commit[0]);
+      valid1 = header.commit[1].check == pop3_uidl_commit_check (&header.commit[1]);
+      if (valid0 && valid1)
+        slot = (gint32) (header.commit[1].generation - header.commit[0].generation) > 0 ? 1 : 0;
+      else if (valid0 || valid1)
+        slot = valid1 ? 1 : 0;
+      else
+        goto invalid;
+      commit = header.commit[slot];
+    }
+  else
+    goto invalid;
+
+  if (commit.data_end < header_size + (gsize) header.n_buckets * sizeof (guint32) || commit.data_end > store->size)
+    goto invalid;
+
+  store->n_buckets = header.n_buckets;
+  store->buckets = (const guint32 *) (store->data + header_size);
+  store->commit = commit;
+  store->slot = slot;
+  return;
+
+invalid:
+  debug_print ("%s: UIDL store is invalid; it will be rebuilt\n", store->path);
+  g_mapped_file_unref (store->mapfile);
+  store->mapfile = NULL;
+  store->data = NULL;
+  store->size = 0;
+}
+
+static void
+pop3_uidl_store_unload (Pop3UIDLStore * store)
+{
+  if (store->mapfile)
+    g_mapped_file_unref (store->mapfile);
+  store->mapfile = NULL;
+  store->data = NULL;
+  store->size = 0;
+  store->n_buckets = 0;
+  store->buckets = NULL;
+  memset (&store->commit, 0, sizeof (store->commit));
+  store->slot = -1;
+  g_hash_table_remove_all (store->changes);
+}
+
+Pop3UIDLStore *
+pop3_uidl_store_open (PrefsAccount * ac_prefs)
+{
+  Pop3UIDLStore *store;
+
+  g_return_val_if_fail (ac_prefs != NULL, NULL);
+
+  store = g_new0 (Pop3UIDLStore, 1);
+  store->path = pop3_get_uidl_file (ac_prefs, ".db");
+  store->changes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  if (!is_file_exist (store->path))
+    {
+      gchar *old_path;
+      GHashTable *table;
+
+      old_path = pop3_get_uidl_file (ac_prefs, NULL);
+      if ((table = pop3_read_uidl_list (old_path)) != NULL)
+        {
+          debug_print ("converting %s (%u entries)\n", old_path, g_hash_table_size (table));
+          if (pop3_uidl_store_write (store->path, table) == 0)
+            g_unlink (old_path);
+          g_hash_table_destroy (table);
+        }
+      g_free (old_path);
+    }
+
+  pop3_uidl_store_load (store);
+
+  return store;
+}
+
+void
+pop3_uidl_store_close (Pop3UIDLStore * store)
+{
+  if (!store)
+    return;
+
+  pop3_uidl_store_unload (store);
+  g_hash_table_destroy (store->changes);
+  g_free (store->path);
+  g_free (store);
+}
+
+stime_t
+pop3_uidl_store_lookup (Pop3UIDLStore * store, const gchar * uidl)
+{
+  Pop3UIDLRecord rec;
+  stime_t *val;
+  guint32 hash;
+  guint32 offset;
+  gsize len;
+
+  g_return_val_if_fail (store != NULL, RECV_TIME_NONE);
+  g_return_val_if_fail (uidl != NULL, RECV_TIME_NONE);
+
+  if ((val = g_hash_table_lookup (store->changes, uidl)) != NULL)
+    return *val;
+
+  if (!store->buckets)
+    return RECV_TIME_NONE;
+
+  hash = pop3_uidl_hash (uidl);
+  len = strlen (uidl);
+  offset = pop3_uidl_store_skip_uncommitted (store, store->buckets[hash & (store->n_buckets - 1)]);
+
+  /* chains only point backwards, which also guards against loops */
+  while (offset != 0 && offset + sizeof (rec) <= store->commit.data_end)
+    {
+      memcpy (&rec, store->data + offset, sizeof (rec));
+      if (rec.hash == hash && rec.len == len && offset + sizeof (rec) + len <= store->commit.data_end &&
+          memcmp (store->data + offset + sizeof (rec), uidl, len) == 0)
+        return rec.recv_time;
+      if (rec.next >= offset)
+        break;
+      offset = rec.next;
+    }
+
+  return RECV_TIME_NONE;
+}
+
+static void
+pop3_uidl_store_set (Pop3UIDLStore * store, const gchar * uidl, stime_t recv_time)
+{
+  stime_t *val;
+
+  if (pop3_uidl_store_lookup (store, uidl) == recv_time)
+    return;
+
+  val = g_new (stime_t, 1);
+  *val = recv_time;
+  g_hash_table_replace (store->changes, g_strdup (uidl), val);
+}
+
 gint
 pop3_write_uidl_list (Pop3Session * session)
 {
-  gchar *path;
-  PrefFile *pfile;
+  Pop3UIDLStore *store = session->uidl_store;
+  GHashTable *live;
   Pop3MsgInfo *msg;
+  guint n_records;
+  gint ret = 0;
   gint n;
-  gchar *uid;
 
-  if (!session->uidl_is_valid)
+  if (!session->uidl_is_valid || !store)
     return 0;
 
-  uid = uriencode_for_filename (session->ac_prefs->userid);
-  path = g_strconcat (get_rc_dir (), G_DIR_SEPARATOR_S,
-                      UIDL_DIR, G_DIR_SEPARATOR_S, session->ac_prefs->recv_server, "-", uid, NULL);
-  g_free (uid);
-  if ((pfile = prefs_file_open (path)) == NULL)
-    {
-      g_free (path);
-      return -1;
-    }
-  prefs_file_set_backup_generation (pfile, 0);
+  live = g_hash_table_new (g_str_hash, g_str_equal);
 
   for (n = 1; n <= session->count; n++)
     {
       msg = &session->msg[n];
-      if (!msg->uidl || !msg->received)
+      if (!msg->uidl)
         continue;
-      if (session->state == POP3_DONE && msg->deleted)
-        continue;
-      fprintf (pfile->fp, "%s\t%ld\n", msg->uidl, msg->recv_time);
+      if (!msg->received || (session->state == POP3_DONE && msg->deleted))
+        {
+          pop3_uidl_store_set (store, msg->uidl, RECV_TIME_NONE);
+          continue;
+        }
+      pop3_uidl_store_set (store, msg->uidl, msg->recv_time);
+      g_hash_table_replace (live, msg->uidl, &msg->recv_time);
+    }
+
+  n_records = store->commit.n_records + g_hash_table_size (store->changes);
+
+  /* expire the entries of messages no longer on the server; this also
+     converts version 1 stores */
+  if (!store->buckets || store->slot < 0 ||
+      n_records > g_hash_table_size (live) * 2 + UIDL_STORE_MIN_BUCKETS || store->size > G_MAXUINT32 / 2)
+    {
+      debug_print ("rewriting UIDL store: %u live entries, %u records\n", g_hash_table_size (live), n_records);
+      ret = pop3_uidl_store_write (store->path, live);
     }
+  else if (g_hash_table_size (store->changes) > 0)
+    ret = pop3_uidl_store_append (store);
 
-  if (prefs_file_close (pfile) < 0)
-    g_warning ("%s: failed to write UIDL list.\n", path);
+  if (ret < 0)
+    g_warning ("%s: failed to write UIDL list.\n", store->path);
 
-  g_free (path);
+  g_hash_table_destroy (live);
 
-  return 0;
+  pop3_uidl_store_unload (store);
+  pop3_uidl_store_load (store);
+
+  return ret;
 }
 
 gint
@@ -694,10 +1259,7 @@ pop3_lookup_next (Pop3Session * session)
         {
           session->cur_total_bytes += size;
           if (session->cur_msg == session->count)
-            {
-              pop3_logout_send (session);
-              return POP3_LOGOUT;
-            }
+            return pop3_lookup_deferred (session);
           else
             session->cur_msg++;
         }
@@ -710,6 +1272,44 @@ pop3_lookup_next (Pop3Session * session)
   return POP3_RETR;
 }
 
+/* called after the last message was retrieved.  lets the deferred drops
+   finish, then deletes those that should not stay on the server. */
+static Pop3State
+pop3_lookup_deferred (Pop3Session * session)
+{
+  Pop3MsgInfo *msg;
+  PrefsAccount *ac = session->ac_prefs;
+
+  if (session->drop_flush && !session->drop_flushed)
+    {
+      session->drop_flushed = TRUE;
+      if (session->drop_flush (session) < 0)
+        {
+          session->error_val = PS_IOERR;
+          return POP3_ERROR;
+        }
+      session->cur_msg = 1;
+    }
+
+  for (; session->drop_flushed && session->cur_msg <= session->count; session->cur_msg++)
+    {
+      msg = &session->msg[session->cur_msg];
+      if (!msg->deferred || msg->deleted)
+        continue;
+      msg->deferred = FALSE;
+
+      if (msg->recv_time == RECV_TIME_DELETE ||
+          (ac->rmmail && ac->msg_leave_time == 0 && msg->recv_time != RECV_TIME_KEEP))
+        {
+          pop3_delete_send (session);
+          return POP3_DELETE;
+        }
+    }
+
+  pop3_logout_send (session);
+  return POP3_LOGOUT;
+}
+
 Pop3ErrorValue
 pop3_ok (Pop3Session * session, const gchar * msg)
 {
@@ -879,8 +1479,17 @@ pop3_session_recv_msg (Session * session, const gchar * msg)
       break;
     case POP3_DELETE:
       val = pop3_delete_recv (pop3_session);
-      if (pop3_session->cur_msg == pop3_session->count)
-        val = pop3_logout_send (pop3_session);
+      if (pop3_session->drop_flushed)
+        {
+          pop3_session->cur_msg++;
+          if (pop3_lookup_deferred (pop3_session) == POP3_ERROR)
+            return -1;
+        }
+      else if (pop3_session->cur_msg == pop3_session->count)
+        {
+          if (pop3_lookup_deferred (pop3_session) == POP3_ERROR)
+            return -1;
+        }
       else
         {
           pop3_session->cur_msg++;
@@ -965,7 +1574,10 @@ pop3_session_recv_data_as_file_finished (Session * session, FILE * fp, guint len
        pop3_session->msg[pop3_session->cur_msg].recv_time != RECV_TIME_KEEP))
     pop3_delete_send (pop3_session);
   else if (pop3_session->cur_msg == pop3_session->count)
-    pop3_logout_send (pop3_session);
+    {
+      if (pop3_lookup_deferred (pop3_session) == POP3_ERROR)
+        return -1;
+    }
   else
     {
       pop3_session->cur_msg++;
@@ -34,6 +34,7 @@
 
 typedef struct _Pop3MsgInfo Pop3MsgInfo;
 typedef struct _Pop3Session Pop3Session;
+typedef struct _Pop3UIDLStore Pop3UIDLStore;
 
 #define POP3_SESSION(obj)	((Pop3Session *)obj)
 
@@ -94,6 +95,7 @@ typedef enum {
   DROP_OK = 0,
   DROP_DONT_RECEIVE = 1,
   DROP_DELETE = 2,
+  DROP_DEFERRED = 3,
   DROP_ERROR = -1
 } Pop3DropValue;
 
@@ -103,6 +105,7 @@ struct _Pop3MsgInfo {
   stime_t recv_time;
   guint received:1;
   guint deleted:1;
+  guint deferred:1;
 };
 
 struct _Pop3Session {
@@ -125,7 +128,7 @@ struct _Pop3Session {
 
   Pop3MsgInfo *msg;
 
-  GHashTable *uidl_table;
+  Pop3UIDLStore *uidl_store;
 
   gboolean auth_only;
 
@@ -141,6 +144,10 @@ struct _Pop3Session {
 
   /* virtual method to drop message */
     gint (*drop_message) (Pop3Session * session, const gchar * file);
+  /* called after the last message if drop_message returned
+     DROP_DEFERRED; must set recv_time of the deferred messages */
+    gint (*drop_flush) (Pop3Session * session);
+  gboolean drop_flushed;
 };
 
 #define POPBUFSIZE	512
@@ -149,7 +156,9 @@ struct _Pop3Session {
 
 Session *pop3_session_new (PrefsAccount * account);
 
-GHashTable *pop3_get_uidl_table (PrefsAccount * account);
+Pop3UIDLStore *pop3_uidl_store_open (PrefsAccount * account);
+void pop3_uidl_store_close (Pop3UIDLStore * store);
+stime_t pop3_uidl_store_lookup (Pop3UIDLStore * store, const gchar * uidl);
 gint pop3_write_uidl_list (Pop3Session * session);
 
 #endif /* __POP_H__ */
@@ -154,6 +154,8 @@ static PrefParam param[] = {
   {"imap_directory", NULL, &tmp_ac_prefs.imap_dir, P_STRING},
   {"imap_clear_cache_on_exit", "FALSE",
    &tmp_ac_prefs.imap_clear_cache_on_exit, P_BOOL},
+  {"imap_compress", "TRUE", &tmp_ac_prefs.imap_compress, P_BOOL},
+  {"imap_max_connections", "2", &tmp_ac_prefs.imap_max_connections, P_INT},
   {"set_sent_folder", "FALSE", &tmp_ac_prefs.set_sent_folder, P_BOOL},
   {"sent_folder", NULL, &tmp_ac_prefs.sent_folder, P_STRING},
   {"set_draft_folder", "FALSE", &tmp_ac_prefs.set_draft_folder, P_BOOL},
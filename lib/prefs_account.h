@@ -147,6 +147,8 @@ struct _PrefsAccount {
 
   gchar *imap_dir;
   gboolean imap_clear_cache_on_exit;
+  gboolean imap_compress;
+  gint imap_max_connections;
 
   gboolean set_sent_folder;
   gchar *sent_folder;
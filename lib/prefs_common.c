@@ -283,6 +283,7 @@ static PrefParam param[] = {
   {"junk_learn_command", "bogofilter -N -s -I", &prefs_common.junk_learncmd, P_STRING},
   {"nojunk_learn_command", "bogofilter -n -S -I", &prefs_common.nojunk_learncmd, P_STRING},
   {"junk_classify_command", "bogofilter -I", &prefs_common.junk_classify_cmd, P_STRING},
+  {"junk_classify_batch_command", "bogofilter -b -T", &prefs_common.junk_classify_batch_cmd, P_STRING},
   {"junk_folder", NULL, &prefs_common.junk_folder, P_STRING},
   {"filter_junk_on_receive", "FALSE", &prefs_common.filter_junk_on_recv, P_BOOL},
   {"filter_junk_before", "FALSE", &prefs_common.filter_junk_before, P_BOOL},
@@ -352,6 +353,8 @@ static PrefParam param[] = {
   /* Advanced */
   {"strict_cache_check", "FALSE", &prefs_common.strict_cache_check, P_BOOL},
   {"io_timeout_secs", "60", &prefs_common.io_timeout_secs, P_INT},
+  {"receive_max_sessions", "4", &prefs_common.recv_max_sessions, P_INT},
+  {"remote_cache_size_limit", "1024", &prefs_common.remote_cache_limit, P_INT},
 
   /* File selector */
   {"filesel_prev_open_dir", NULL, &prefs_common.prev_open_dir, P_STRING},
@@ -224,6 +224,7 @@ struct _PrefsCommon {
   gchar *junk_learncmd;
   gchar *nojunk_learncmd;
   gchar *junk_classify_cmd;
+  gchar *junk_classify_batch_cmd;
   gchar *junk_folder;
   gboolean filter_junk_on_recv;
   gboolean filter_junk_before;
@@ -287,6 +288,8 @@ struct _PrefsCommon {
   /* Advanced */
   gboolean strict_cache_check;
   gint io_timeout_secs;
+  gint recv_max_sessions;
+  gint remote_cache_limit;
 
   /* Filtering */
   GSList *fltlist;
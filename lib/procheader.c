@@ -674,6 +674,8 @@ procheader_parse_stream (FILE * fp, MsgFlags flags, gboolean full)
   HeaderEntry *hentry;
   gint hnum;
   gchar *from = NULL, *to = NULL, *subject = NULL, *cc = NULL;
+  gchar *newsgroups = NULL;
+  GSList *references = NULL;
   gchar *charset = NULL;
 
   hentry = full ? hentry_full : hentry_short;
@@ -687,8 +689,6 @@ procheader_parse_stream (FILE * fp, MsgFlags flags, gboolean full)
 
   msginfo = g_new0 (MsgInfo, 1);
   msginfo->flags = flags;
-  msginfo->references = NULL;
-  msginfo->inreplyto = NULL;
 
   while ((hnum = procheader_get_one_field (buf, sizeof (buf), fp, hentry)) != -1)
     {
@@ -720,14 +720,14 @@ procheader_parse_stream (FILE * fp, MsgFlags flags, gboolean full)
             to = g_strdup (hp);
           break;
         case H_NEWSGROUPS:
-          if (msginfo->newsgroups)
+          if (newsgroups)
             {
-              p = msginfo->newsgroups;
-              msginfo->newsgroups = g_strconcat (p, ",", hp, NULL);
+              p = newsgroups;
+              newsgroups = g_strconcat (p, ",", hp, NULL);
               g_free (p);
             }
           else
-            msginfo->newsgroups = g_strdup (buf + 12);
+            newsgroups = g_strdup (buf + 12);
           break;
         case H_SUBJECT:
           if (msginfo->subject)
@@ -740,10 +740,10 @@ procheader_parse_stream (FILE * fp, MsgFlags flags, gboolean full)
 
           extract_parenthesis (hp, '<', '>');
           remove_space (hp);
-          msginfo->msgid = g_strdup (hp);
+          msginfo->msgid = procmsg_intern_str (hp);
           break;
         case H_REFERENCES:
-          msginfo->references = references_list_prepend (msginfo->references, hp);
+          references = references_list_prepend (references, hp);
           break;
         case H_IN_REPLY_TO:
           if (msginfo->inreplyto)
@@ -755,7 +755,7 @@ procheader_parse_stream (FILE * fp, MsgFlags flags, gboolean full)
               extract_parenthesis (p, '<', '>');
               remove_space (p);
               if (*p != '\0')
-                msginfo->inreplyto = g_strdup (p);
+                msginfo->inreplyto = procmsg_intern_str (p);
             }
           break;
         case H_CONTENT_TYPE:
@@ -799,34 +799,41 @@ procheader_parse_stream (FILE * fp, MsgFlags flags, gboolean full)
         }
     }
 
+  /* the strings are interned after they are converted */
   if (from)
     {
-      msginfo->from = conv_unmime_header (from, charset);
-      subst_control (msginfo->from, ' ');
-      msginfo->fromname = procheader_get_fromname (msginfo->from);
+      p = conv_unmime_header (from, charset);
+      subst_control (p, ' ');
+      msginfo->fromname = procmsg_intern_str_take (procheader_get_fromname (p));
+      msginfo->from = procmsg_intern_str_take (p);
       g_free (from);
     }
   if (to)
     {
-      msginfo->to = conv_unmime_header (to, charset);
-      subst_control (msginfo->to, ' ');
+      p = conv_unmime_header (to, charset);
+      subst_control (p, ' ');
+      msginfo->to = procmsg_intern_str_take (p);
       g_free (to);
     }
   if (subject)
     {
-      msginfo->subject = conv_unmime_header (subject, charset);
-      subst_control (msginfo->subject, ' ');
+      p = conv_unmime_header (subject, charset);
+      subst_control (p, ' ');
+      msginfo->subject = procmsg_intern_str_take (p);
       g_free (subject);
     }
   if (cc)
     {
-      msginfo->cc = conv_unmime_header (cc, charset);
-      subst_control (msginfo->cc, ' ');
+      p = conv_unmime_header (cc, charset);
+      subst_control (p, ' ');
+      msginfo->cc = procmsg_intern_str_take (p);
       g_free (cc);
     }
+  msginfo->newsgroups = procmsg_intern_str_take (newsgroups);
+  msginfo->references = procmsg_references_new (references);
 
   if (!msginfo->inreplyto && msginfo->references)
-    msginfo->inreplyto = g_strdup ((gchar *) msginfo->references->data);
+    msginfo->inreplyto = procmsg_intern_str_ref (msginfo->references[0]);
 
   if (MSG_IS_MIME (msginfo->flags))
     {
@@ -26,13 +26,19 @@
 
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <string.h>
 #include <locale.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include "procmime.h"
 #include "procheader.h"
+#include "procmsg.h"
+#include "folder.h"
 #include "base64.h"
 #include "quoted-printable.h"
 #include "uuencode.h"
@@ -54,6 +60,9 @@
 static GHashTable *procmime_get_mime_type_table (void);
 static GList *procmime_get_mime_type_list (const gchar * file);
 
+static MimeInfo *procmime_mime_cache_lookup (MsgInfo * msginfo);
+static void procmime_mime_cache_add (MsgInfo * msginfo, MimeInfo * mimeinfo);
+
 
 MimeInfo *
 procmime_mimeinfo_new (void)
@@ -85,6 +94,9 @@ procmime_mimeinfo_free_all (MimeInfo * mimeinfo)
       g_free (mimeinfo->sigstatus);
       g_free (mimeinfo->sigstatus_full);
 
+      if (mimeinfo->decoded_fp)
+        fclose (mimeinfo->decoded_fp);
+
       procmime_mimeinfo_free_all (mimeinfo->sub);
       procmime_mimeinfo_free_all (mimeinfo->children);
       procmime_mimeinfo_free_all (mimeinfo->plaintext);
@@ -159,6 +171,9 @@ procmime_scan_message (MsgInfo * msginfo)
 
   g_return_val_if_fail (msginfo != NULL, NULL);
 
+  if ((mimeinfo = procmime_mime_cache_lookup (msginfo)) != NULL)
+    return mimeinfo;
+
   if ((fp = procmsg_open_message_decrypted (msginfo, &mimeinfo)) == NULL)
     return NULL;
 
@@ -174,9 +189,524 @@ procmime_scan_message (MsgInfo * msginfo)
 
   fclose (fp);
 
+  if (mimeinfo)
+    procmime_mime_cache_add (msginfo, mimeinfo);
+
   return mimeinfo;
 }
 
+/* MIME structure cache.  The part trees of scanned messages are
+ * appended to MIME_CACHE_FILE in the folder directory, keyed by the
+ * message number and the size and mtime of the message file, so that
+ * they need not be scanned again.  A record is
+ *   guint32 msgnum, size, mtime, length of the tree data
+ * followed by the parts in the order of procmime_mime_cache_write_part().
+ * Later records replace earlier ones; the file is rewritten with the
+ * current messages only when the summary cache is written. */
+
+typedef struct _MimeCache MimeCache;
+
+struct _MimeCache {
+  gchar *file;
+  GMappedFile *mapfile;
+  gsize map_len;
+  /* records appended since the file was mapped, starting at tail_start */
+  GByteArray *tail;
+  guint64 tail_start;
+  /* msgnum -> guint64 *, offset of its latest record */
+  GHashTable *table;
+  gboolean stale;
+};
+
+#define MIME_CACHE_RECORD_HEADER	(sizeof (guint32) * 4)
+
+static MimeCache mime_cache;
+G_LOCK_DEFINE_STATIC (mime_cache);
+
+static gchar *
+procmime_get_mime_cache_file (FolderItem * item)
+{
+  gchar *path;
+  gchar *file;
+
+  path = folder_item_get_path (item);
+  if (!path)
+    return NULL;
+  file = g_strconcat (path, G_DIR_SEPARATOR_S, MIME_CACHE_FILE, NULL);
+  g_free (path);
+
+  return file;
+}
+
+/* returns TRUE if the structure of msginfo can be cached */
+static gboolean
+procmime_mime_cache_stat (MsgInfo * msginfo, GStatBuf * s)
+{
+  gchar *file;
+  gint ret;
+
+  /* encrypted messages are scanned after decryption every time */
+  if (!msginfo->folder || !msginfo->folder->path || msginfo->file_path || msginfo->encinfo ||
+      MSG_IS_ENCRYPTED (msginfo->flags) || MSG_IS_QUEUED (msginfo->flags))
+    return FALSE;
+
+  file = procmsg_get_message_file_path (msginfo);
+  if (!file)
+    return FALSE;
+  ret = g_stat (file, s);
+  g_free (file);
+
+  return ret == 0;
+}
+
+static void
+procmime_mime_cache_unload (void)
+{
+  if (mime_cache.mapfile)
+    g_mapped_file_unref (mime_cache.mapfile);
+  if (mime_cache.tail)
+    g_byte_array_free (mime_cache.tail, TRUE);
+  if (mime_cache.table)
+    g_hash_table_destroy (mime_cache.table);
+  g_free (mime_cache.file);
+  mime_cache.file = NULL;
+  mime_cache.mapfile = NULL;
+  mime_cache.map_len = 0;
+  mime_cache.tail = NULL;
+  mime_cache.tail_start = 0;
+  mime_cache.table = NULL;
+  mime_cache.stale = FALSE;
+}
+
+static void
+procmime_mime_cache_set_offset (guint32 msgnum, guint64 offset)
+{
+  guint64 *val;
+
+  val = g_new (guint64, 1);
+  *val = offset;
+  g_hash_table_replace (mime_cache.table, GUINT_TO_POINTER (msgnum), val);
+}
+
+/* returns the record at offset, and the bytes available from there */
+static const gchar *
+procmime_mime_cache_get_record (guint64 offset, gsize * len)
+{
+  if (mime_cache.mapfile && offset < mime_cache.map_len)
+    {
+      *len = mime_cache.map_len - offset;
+      return g_mapped_file_get_contents (mime_cache.mapfile) + offset;
+    }
+  if (mime_cache.tail && offset >= mime_cache.tail_start && offset - mime_cache.tail_start < mime_cache.tail->len)
+    {
+      *len = mime_cache.tail->len - (offset - mime_cache.tail_start);
+      return (const gchar *) mime_cache.tail->data + (offset - mime_cache.tail_start);
+    }
+
+  *len = 0;
+  return NULL;
+}
+
+static void
+procmime_mime_cache_load (FolderItem * item)
+{
+  GError *error = NULL;
+  const gchar *data;
+  const gchar *p, *endp;
+  guint32 ver;
+  gchar *file;
+
+  if ((file = procmime_get_mime_cache_file (item)) == NULL)
+    return;
+
+  if (mime_cache.file && !strcmp (mime_cache.file, file) && !mime_cache.stale)
+    {
+      g_free (file);
+      return;
+    }
+
+  procmime_mime_cache_unload ();
+  mime_cache.file = file;
+  mime_cache.table = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+  mime_cache.mapfile = g_mapped_file_new (file, FALSE, &error);
+  if (!mime_cache.mapfile)
+    {
+      if (error && error->code != G_FILE_ERROR_NOENT)
+        g_warning ("%s: cannot open MIME cache: %s\n", file, error->message);
+      if (error)
+        g_error_free (error);
+      return;
+    }
+
+  data = g_mapped_file_get_contents (mime_cache.mapfile);
+  mime_cache.map_len = g_mapped_file_get_length (mime_cache.mapfile);
+  endp = data + mime_cache.map_len;
+
+  if (endp - data < sizeof (ver) || (memcpy (&ver, data, sizeof (ver)), ver != MIME_CACHE_VERSION))
+    {
+      debug_print ("%s: MIME cache version is different. Discarding it.\n", file);
+      g_mapped_file_unref (mime_cache.mapfile);
+      mime_cache.mapfile = NULL;
+      mime_cache.map_len = 0;
+      return;
+    }
+
+  for (p = data + sizeof (ver); endp - p >= MIME_CACHE_RECORD_HEADER;)
+    {
+      guint32 rec[4];
+
+      memcpy (rec, p, sizeof (rec));
+      if (rec[3] > endp - p - MIME_CACHE_RECORD_HEADER)
+        {
+          g_warning ("%s: MIME cache is truncated\n", file);
+          break;
+        }
+      procmime_mime_cache_set_offset (rec[0], p - data);
+      p += MIME_CACHE_RECORD_HEADER + rec[3];
+    }
+}
+
+static void
+procmime_mime_cache_put_int (GByteArray * data, guint32 n)
+{
+  g_byte_array_append (data, (const guint8 *) &n, sizeof (n));
+}
+
+static void
+procmime_mime_cache_put_str (GByteArray * data, const gchar * str)
+{
+  guint32 len = str ? strlen (str) : 0;
+
+  procmime_mime_cache_put_int (data, len);
+  if (len > 0)
+    g_byte_array_append (data, (const guint8 *) str, len);
+}
+
+static gboolean
+procmime_mime_cache_get_int (const gchar ** p, const gchar * endp, guint32 * n)
+{
+  if (endp - *p < sizeof (*n))
+    return FALSE;
+  memcpy (n, *p, sizeof (*n));
+  *p += sizeof (*n);
+  return TRUE;
+}
+
+static gboolean
+procmime_mime_cache_get_str (const gchar ** p, const gchar * endp, gchar ** str)
+{
+  guint32 len;
+
+  if (!procmime_mime_cache_get_int (p, endp, &len) || len > endp - *p)
+    return FALSE;
+  *str = len > 0 ? g_strndup (*p, len) : NULL;
+  *p += len;
+  return TRUE;
+}
+
+static void
+procmime_mime_cache_write_part (GByteArray * data, MimeInfo * mimeinfo)
+{
+  MimeInfo *child;
+  guint32 n_children = 0;
+
+  procmime_mime_cache_put_str (data, mimeinfo->encoding);
+  procmime_mime_cache_put_str (data, mimeinfo->content_type);
+  procmime_mime_cache_put_str (data, mimeinfo->charset);
+  procmime_mime_cache_put_str (data, mimeinfo->name);
+  procmime_mime_cache_put_str (data, mimeinfo->boundary);
+  procmime_mime_cache_put_str (data, mimeinfo->content_disposition);
+  procmime_mime_cache_put_str (data, mimeinfo->filename);
+  procmime_mime_cache_put_int (data, mimeinfo->encoding_type);
+  procmime_mime_cache_put_int (data, mimeinfo->mime_type);
+  procmime_mime_cache_put_int (data, mimeinfo->fpos);
+  procmime_mime_cache_put_int (data, mimeinfo->size);
+  procmime_mime_cache_put_int (data, mimeinfo->content_size);
+  procmime_mime_cache_put_int (data, mimeinfo->level);
+
+  for (child = mimeinfo->children; child != NULL; child = child->next)
+    n_children++;
+  procmime_mime_cache_put_int (data, n_children);
+  procmime_mime_cache_put_int (data, mimeinfo->sub != NULL);
+
+  for (child = mimeinfo->children; child != NULL; child = child->next)
+    procmime_mime_cache_write_part (data, child);
+  if (mimeinfo->sub)
+    procmime_mime_cache_write_part (data, mimeinfo->sub);
+}
+
+static MimeInfo *
+procmime_mime_cache_read_part (const gchar ** p, const gchar * endp, MimeInfo * parent, gint depth)
+{
+  MimeInfo *mimeinfo;
+  MimeInfo *last = NULL;
+  guint32 encoding_type, mime_type, fpos, size, content_size, level;
+  guint32 n_children, has_sub;
+  guint32 i;
+
+  if (depth > MAX_MIME_LEVEL + 1)
+    return NULL;
+
+  mimeinfo = procmime_mimeinfo_new ();
+  mimeinfo->parent = parent;
+
+  if (!procmime_mime_cache_get_str (p, endp, &mimeinfo->encoding) ||
+      !procmime_mime_cache_get_str (p, endp, &mimeinfo->content_type) ||
+      !procmime_mime_cache_get_str (p, endp, &mimeinfo->charset) ||
+      !procmime_mime_cache_get_str (p, endp, &mimeinfo->name) ||
+      !procmime_mime_cache_get_str (p, endp, &mimeinfo->boundary) ||
+      !procmime_mime_cache_get_str (p, endp, &mimeinfo->content_disposition) ||
+      !procmime_mime_cache_get_str (p, endp, &mimeinfo->filename) ||
+      !procmime_mime_cache_get_int (p, endp, &encoding_type) ||
+      !procmime_mime_cache_get_int (p, endp, &mime_type) ||
+      !procmime_mime_cache_get_int (p, endp, &fpos) ||
+      !procmime_mime_cache_get_int (p, endp, &size) ||
+      !procmime_mime_cache_get_int (p, endp, &content_size) ||
+      !procmime_mime_cache_get_int (p, endp, &level) ||
+      !procmime_mime_cache_get_int (p, endp, &n_children) || !procmime_mime_cache_get_int (p, endp, &has_sub) ||
+      encoding_type > ENC_UNKNOWN || mime_type > MIME_UNKNOWN)
+    {
+      procmime_mimeinfo_free_all (mimeinfo);
+      return NULL;
+    }
+
+  mimeinfo->encoding_type = encoding_type;
+  mimeinfo->mime_type = mime_type;
+  mimeinfo->fpos = fpos;
+  mimeinfo->size = size;
+  mimeinfo->content_size = content_size;
+  mimeinfo->level = level;
+
+  for (i = 0; i < n_children; i++)
+    {
+      MimeInfo *child;
+
+      if ((child = procmime_mime_cache_read_part (p, endp, mimeinfo, depth + 1)) == NULL)
+        {
+          procmime_mimeinfo_free_all (mimeinfo);
+          return NULL;
+        }
+      if (last)
+        last->next = child;
+      else
+        mimeinfo->children = child;
+      last = child;
+    }
+
+  if (has_sub)
+    {
+      /* the capsulated message shares the parent of its part */
+      if ((mimeinfo->sub = procmime_mime_cache_read_part (p, endp, parent, depth + 1)) == NULL)
+        {
+          procmime_mimeinfo_free_all (mimeinfo);
+          return NULL;
+        }
+      mimeinfo->sub->main = mimeinfo;
+    }
+
+  return mimeinfo;
+}
+
+static MimeInfo *
+procmime_mime_cache_lookup (MsgInfo * msginfo)
+{
+  MimeInfo *mimeinfo = NULL;
+  GStatBuf s;
+  guint64 *offset;
+  const gchar *p;
+  gsize len;
+
+  if (!procmime_mime_cache_stat (msginfo, &s))
+    return NULL;
+
+  G_LOCK (mime_cache);
+
+  procmime_mime_cache_load (msginfo->folder);
+
+  if (mime_cache.table &&
+      (offset = g_hash_table_lookup (mime_cache.table, GUINT_TO_POINTER (msginfo->msgnum))) != NULL &&
+      (p = procmime_mime_cache_get_record (*offset, &len)) != NULL && len >= MIME_CACHE_RECORD_HEADER)
+    {
+      guint32 rec[4];
+
+      memcpy (rec, p, sizeof (rec));
+      if (rec[1] == (guint32) s.st_size && rec[2] == (guint32) s.st_mtime && rec[3] <= len - MIME_CACHE_RECORD_HEADER)
+        {
+          p += MIME_CACHE_RECORD_HEADER;
+          mimeinfo = procmime_mime_cache_read_part (&p, p + rec[3], NULL, 0);
+          if (!mimeinfo)
+            g_warning ("MIME cache data of message %u is corrupted\n", msginfo->msgnum);
+        }
+    }
+
+  G_UNLOCK (mime_cache);
+
+  return mimeinfo;
+}
+
+static void
+procmime_mime_cache_add (MsgInfo * msginfo, MimeInfo * mimeinfo)
+{
+  GByteArray *data;
+  GStatBuf s;
+  guint32 rec[4];
+  glong offset = -1;
+  gboolean ok = FALSE;
+  gchar *file;
+  FILE *fp;
+
+  if (!procmime_mime_cache_stat (msginfo, &s))
+    return;
+
+  if ((file = procmime_get_mime_cache_file (msginfo->folder)) == NULL)
+    return;
+
+  data = g_byte_array_new ();
+  procmime_mime_cache_write_part (data, mimeinfo);
+
+  rec[0] = msginfo->msgnum;
+  rec[1] = s.st_size;
+  rec[2] = s.st_mtime;
+  rec[3] = data->len;
+
+  G_LOCK (mime_cache);
+
+  if ((fp = procmsg_open_data_file (file, MIME_CACHE_VERSION, DATA_APPEND, NULL, 0)) != NULL)
+    {
+      if (fseek (fp, 0L, SEEK_END) == 0)
+        offset = ftell (fp);
+      ok = fwrite (rec, sizeof (rec), 1, fp) == 1 && fwrite (data->data, data->len, 1, fp) == 1;
+      if (fclose (fp) == EOF)
+        {
+          FILE_OP_ERROR (file, "fclose");
+          ok = FALSE;
+        }
+    }
+
+  /* keep the index of the loaded folder up to date instead of
+     mapping and indexing the whole file again */
+  if (mime_cache.file && !strcmp (mime_cache.file, file) && !mime_cache.stale)
+    {
+      if (!mime_cache.tail)
+        {
+          mime_cache.tail = g_byte_array_new ();
+          mime_cache.tail_start = offset;
+        }
+      if (ok && offset >= 0 && (guint64) offset == mime_cache.tail_start + mime_cache.tail->len &&
+          (guint64) offset >= mime_cache.map_len)
+        {
+          g_byte_array_append (mime_cache.tail, (const guint8 *) rec, sizeof (rec));
+          g_byte_array_append (mime_cache.tail, data->data, data->len);
+          procmime_mime_cache_set_offset (msginfo->msgnum, offset);
+        }
+      else
+        mime_cache.stale = TRUE;
+    }
+
+  G_UNLOCK (mime_cache);
+
+  g_byte_array_free (data, TRUE);
+  g_free (file);
+}
+
+/* drop the records of the messages that are not in mlist anymore */
+void
+procmime_mime_cache_prune (FolderItem * item, GSList * mlist)
+{
+  GHashTable *msg_table;
+  GHashTableIter iter;
+  gpointer key, value;
+  gsize live_size = sizeof (guint32);
+  gsize len;
+  gchar *file, *tmp;
+  GSList *cur;
+  FILE *fp;
+
+  g_return_if_fail (item != NULL);
+
+  if (!item->path)
+    return;
+
+  G_LOCK (mime_cache);
+
+  procmime_mime_cache_load (item);
+  if (!mime_cache.mapfile && !mime_cache.tail)
+    {
+      G_UNLOCK (mime_cache);
+      return;
+    }
+
+  msg_table = g_hash_table_new (NULL, NULL);
+  for (cur = mlist; cur != NULL; cur = cur->next)
+    {
+      MsgInfo *msginfo = (MsgInfo *) cur->data;
+      g_hash_table_insert (msg_table, GUINT_TO_POINTER (msginfo->msgnum), msginfo);
+    }
+
+  g_hash_table_iter_init (&iter, mime_cache.table);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      const gchar *p;
+      guint32 rec[4];
+
+      if (!g_hash_table_lookup (msg_table, key))
+        continue;
+      if ((p = procmime_mime_cache_get_record (*(guint64 *) value, &len)) == NULL || len < sizeof (rec))
+        continue;
+      memcpy (rec, p, sizeof (rec));
+      live_size += MIME_CACHE_RECORD_HEADER + rec[3];
+    }
+
+  if (live_size == mime_cache.map_len + (mime_cache.tail ? mime_cache.tail->len : 0))
+    {
+      g_hash_table_destroy (msg_table);
+      G_UNLOCK (mime_cache);
+      return;
+    }
+
+  debug_print ("Writing MIME cache (%s)\n", item->path);
+
+  file = procmime_get_mime_cache_file (item);
+  tmp = g_strconcat (file, ".tmp", NULL);
+
+  if ((fp = procmsg_open_data_file (tmp, MIME_CACHE_VERSION, DATA_WRITE, NULL, 0)) != NULL)
+    {
+      g_hash_table_iter_init (&iter, mime_cache.table);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          const gchar *p;
+          guint32 rec[4];
+
+          if (!g_hash_table_lookup (msg_table, key))
+            continue;
+          if ((p = procmime_mime_cache_get_record (*(guint64 *) value, &len)) == NULL || len < sizeof (rec))
+            continue;
+          memcpy (rec, p, sizeof (rec));
+          if (rec[3] > len - sizeof (rec))
+            continue;
+          fwrite (p, MIME_CACHE_RECORD_HEADER + rec[3], 1, fp);
+        }
+      if (fclose (fp) == EOF)
+        {
+          FILE_OP_ERROR (tmp, "fclose");
+          g_unlink (tmp);
+        }
+      else if (rename_force (tmp, file) < 0)
+        {
+          FILE_OP_ERROR (tmp, "rename");
+          g_unlink (tmp);
+        }
+      mime_cache.stale = TRUE;
+    }
+
+  g_free (tmp);
+  g_free (file);
+  g_hash_table_destroy (msg_table);
+
+  G_UNLOCK (mime_cache);
+}
+
 MimeInfo *
 procmime_scan_message_stream (FILE * fp)
 {
@@ -1622,6 +2152,8 @@ procmime_scan_mime_type (const gchar * mime_type)
 }
 
 static GList *mime_type_list = NULL;
+/* the table is built on first use, which may be on a worker thread */
+G_LOCK_DEFINE_STATIC (mime_type_table);
 
 gchar *
 procmime_get_mime_type (const gchar * filename)
@@ -1633,18 +2165,17 @@ procmime_get_mime_type (const gchar * filename)
   gchar ext[64];
   static gboolean no_mime_type_table = FALSE;
 
-  if (no_mime_type_table)
-    return NULL;
-
-  if (!mime_type_table)
+  G_LOCK (mime_type_table);
+  if (!mime_type_table && !no_mime_type_table)
     {
       mime_type_table = procmime_get_mime_type_table ();
       if (!mime_type_table)
-        {
-          no_mime_type_table = TRUE;
-          return NULL;
-        }
+        no_mime_type_table = TRUE;
     }
+  G_UNLOCK (mime_type_table);
+
+  if (no_mime_type_table)
+    return NULL;
 
   fname = g_path_get_basename (filename);
   p = strrchr (fname, '.');
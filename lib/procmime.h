@@ -117,6 +117,9 @@ struct _MimeInfo {
   gchar *sigstatus;
   gchar *sigstatus_full;
 
+  /* content decoded in advance, taken by the viewer */
+  FILE *decoded_fp;
+
   gint level;
 };
 
@@ -136,6 +139,7 @@ void procmime_mimeinfo_replace (MimeInfo * old, MimeInfo * new);
 MimeInfo *procmime_mimeinfo_next (MimeInfo * mimeinfo);
 
 MimeInfo *procmime_scan_message (MsgInfo * msginfo);
+void procmime_mime_cache_prune (FolderItem * item, GSList * mlist);
 MimeInfo *procmime_scan_message_stream (FILE * fp);
 void procmime_scan_multipart_message (MimeInfo * mimeinfo, FILE * fp);
 
@@ -34,6 +34,7 @@
 #include "prefs_common.h"
 #include "folder.h"
 #include "codeconv.h"
+#include "metrics.h"
 
 typedef struct _MsgFlagInfo {
   guint msgnum;
@@ -44,7 +45,6 @@ static GSList *procmsg_read_cache_queue (FolderItem * item, gboolean scan_file);
 
 static void mark_sum_func (gpointer key, gpointer value, gpointer data);
 
-static GHashTable *procmsg_read_mark_file (FolderItem * item);
 static void procmsg_write_mark_file (FolderItem * item, GHashTable * mark_table);
 
 static GMappedFile *procmsg_open_cache_file_mmap (FolderItem * item, DataOpenMode mode);
@@ -176,12 +176,45 @@ procmsg_read_cache_data_str_mem (const gchar ** p, const gchar * endp, gchar **
   return 0;
 }
 
+static gint
+procmsg_read_cache_data_str_mem_intern (const gchar ** p, const gchar * endp, gchar ** str)
+{
+  guint32 len;
+
+  if (endp - *p < sizeof (len))
+    return -1;
+
+  memcpy (&len, *p, sizeof (len));
+  *p += sizeof (len);
+  if (len > G_MAXINT || len > endp - *p)
+    return -1;
+
+  if (len > 0)
+    {
+      *str = procmsg_intern_str_len (*p, len);
+      *p += len;
+    }
+
+  return 0;
+}
+
 #define READ_CACHE_DATA(data)						\
 {									\
 	if (procmsg_read_cache_data_str_mem(&p, endp, &data) < 0) {	\
 		g_warning("Cache data is corrupted\n");			\
 		procmsg_msginfo_free(msginfo);				\
-		procmsg_msg_list_free(mlist);				\
+		procmsg_msg_vector_free(mvec, TRUE);			\
+		g_mapped_file_unref(mapfile);				\
+		return NULL;						\
+	}								\
+}
+
+#define READ_CACHE_DATA_INTERN(data)					\
+{									\
+	if (procmsg_read_cache_data_str_mem_intern(&p, endp, &data) < 0) { \
+		g_warning("Cache data is corrupted\n");			\
+		procmsg_msginfo_free(msginfo);				\
+		procmsg_msg_vector_free(mvec, TRUE);			\
 		g_mapped_file_unref(mapfile);				\
 		return NULL;						\
 	}								\
@@ -192,7 +225,7 @@ procmsg_read_cache_data_str_mem (const gchar ** p, const gchar * endp, gchar **
 	if (endp - p < sizeof(guint32)) {			\
 		g_warning("Cache data is corrupted\n");		\
 		procmsg_msginfo_free(msginfo);			\
-		procmsg_msg_list_free(mlist);			\
+		procmsg_msg_vector_free(mvec, TRUE);		\
 		g_mapped_file_unref(mapfile);			\
 		return NULL;					\
 	} else {						\
@@ -203,11 +236,10 @@ procmsg_read_cache_data_str_mem (const gchar ** p, const gchar * endp, gchar **
 	}							\
 }
 
-GSList *
-procmsg_read_cache (FolderItem * item, gboolean scan_file)
+MsgVector *
+procmsg_read_cache_vector (FolderItem * item, gboolean scan_file)
 {
-  GSList *mlist = NULL;
-  GSList *last = NULL;
+  MsgVector *mvec;
   GMappedFile *mapfile;
   const gchar *filep;
   gsize file_len;
@@ -224,7 +256,7 @@ procmsg_read_cache (FolderItem * item, gboolean scan_file)
 
   default_flags.perm_flags = MSG_NEW | MSG_UNREAD;
   default_flags.tmp_flags = 0;
-  if (type == F_MH || type == F_IMAP)
+  if (type == F_MH || type == F_MAILDIR || type == F_IMAP)
     {
       if (item->stype == F_QUEUE)
         {
@@ -271,6 +303,9 @@ procmsg_read_cache (FolderItem * item, gboolean scan_file)
   endp = filep + file_len;
   p = filep + sizeof (guint32); /* version */
 
+  /* a cache entry takes about 200 bytes */
+  mvec = procmsg_msg_vector_new (file_len / 200 + 1);
+
   while (endp - p >= sizeof (num))
     {
       msginfo = g_new0 (MsgInfo, 1);
@@ -282,26 +317,39 @@ procmsg_read_cache (FolderItem * item, gboolean scan_file)
       READ_CACHE_DATA_INT (msginfo->date_t);
       READ_CACHE_DATA_INT (msginfo->flags.tmp_flags);
 
-      READ_CACHE_DATA (msginfo->fromname);
+      READ_CACHE_DATA_INTERN (msginfo->fromname);
 
       READ_CACHE_DATA (msginfo->date);
-      READ_CACHE_DATA (msginfo->from);
-      READ_CACHE_DATA (msginfo->to);
-      READ_CACHE_DATA (msginfo->newsgroups);
-      READ_CACHE_DATA (msginfo->subject);
-      READ_CACHE_DATA (msginfo->msgid);
-      READ_CACHE_DATA (msginfo->inreplyto);
+      READ_CACHE_DATA_INTERN (msginfo->from);
+      READ_CACHE_DATA_INTERN (msginfo->to);
+      READ_CACHE_DATA_INTERN (msginfo->newsgroups);
+      READ_CACHE_DATA_INTERN (msginfo->subject);
+      READ_CACHE_DATA_INTERN (msginfo->msgid);
+      READ_CACHE_DATA_INTERN (msginfo->inreplyto);
 
       READ_CACHE_DATA_INT (refnum);
-      for (; refnum != 0; refnum--)
+      if (refnum > (endp - p) / sizeof (guint32))
         {
-          gchar *ref;
+          g_warning ("Cache data is corrupted\n");
+          procmsg_msginfo_free (msginfo);
+          procmsg_msg_vector_free (mvec, TRUE);
+          g_mapped_file_unref (mapfile);
+          return NULL;
+        }
+      if (refnum > 0)
+        {
+          guint n = 0;
+
+          msginfo->references = g_new0 (gchar *, refnum + 1);
+          for (; refnum != 0; refnum--)
+            {
+              gchar *ref = NULL;
 
-          READ_CACHE_DATA (ref);
-          msginfo->references = g_slist_prepend (msginfo->references, ref);
+              READ_CACHE_DATA_INTERN (ref);
+              if (ref)
+                msginfo->references[n++] = ref;
+            }
         }
-      if (msginfo->references)
-        msginfo->references = g_slist_reverse (msginfo->references);
 
       MSG_SET_PERM_FLAGS (msginfo->flags, default_flags.perm_flags);
       MSG_SET_TMP_FLAGS (msginfo->flags, default_flags.tmp_flags);
@@ -316,14 +364,7 @@ procmsg_read_cache (FolderItem * item, gboolean scan_file)
       else
         {
           msginfo->folder = item;
-
-          if (!mlist)
-            last = mlist = g_slist_append (NULL, msginfo);
-          else
-            {
-              last = g_slist_append (last, msginfo);
-              last = last->next;
-            }
+          procmsg_msg_vector_append (mvec, msginfo);
         }
     }
 
@@ -333,15 +374,31 @@ procmsg_read_cache (FolderItem * item, gboolean scan_file)
     {
       GSList *qlist;
       qlist = procmsg_read_cache_queue (item, scan_file);
-      mlist = g_slist_concat (mlist, qlist);
+      procmsg_msg_vector_concat (mvec, procmsg_msg_vector_from_list (qlist));
     }
 
   debug_print ("done.\n");
 
+  return mvec;
+}
+
+GSList *
+procmsg_read_cache (FolderItem * item, gboolean scan_file)
+{
+  MsgVector *mvec;
+  MetricsTimer timer;
+  GSList *mlist;
+
+  metrics_timer_start (&timer, "procmsg_read_cache", item ? item->path : NULL);
+  mvec = procmsg_read_cache_vector (item, scan_file);
+  mlist = mvec ? procmsg_msg_vector_to_list (mvec) : NULL;
+  metrics_timer_stop (&timer);
+
   return mlist;
 }
 
 #undef READ_CACHE_DATA
+#undef READ_CACHE_DATA_INTERN
 #undef READ_CACHE_DATA_INT
 
 static GSList *
@@ -534,8 +591,8 @@ procmsg_mark_all_read (FolderItem * item)
 
 static FolderSortType cmp_func_sort_type;
 
-GSList *
-procmsg_sort_msg_list (GSList * mlist, FolderSortKey sort_key, FolderSortType sort_type)
+static GCompareFunc
+procmsg_get_sort_func (FolderSortKey sort_key)
 {
   GCompareFunc cmp_func;
 
@@ -572,16 +629,61 @@ procmsg_sort_msg_list (GSList * mlist, FolderSortKey sort_key, FolderSortType so
       cmp_func = procmsg_cmp_by_to;
       break;
     default:
-      return mlist;
+      return NULL;
     }
 
+  return cmp_func;
+}
+
+static gint
+procmsg_msg_vector_cmp_func (gconstpointer a, gconstpointer b, gpointer data)
+{
+  GCompareFunc cmp_func = (GCompareFunc) data;
+
+  return cmp_func (*(MsgInfo **) a, *(MsgInfo **) b);
+}
+
+GSList *
+procmsg_sort_msg_list (GSList * mlist, FolderSortKey sort_key, FolderSortType sort_type)
+{
+  GCompareFunc cmp_func;
+  MsgVector *mvec;
+  GSList *cur;
+  guint i;
+
+  if ((cmp_func = procmsg_get_sort_func (sort_key)) == NULL)
+    return mlist;
+
   cmp_func_sort_type = sort_type;
 
-  mlist = g_slist_sort (mlist, cmp_func);
+  /* sort a contiguous copy and store the result back in the nodes */
+  mvec = procmsg_msg_vector_new (0);
+  for (cur = mlist; cur != NULL; cur = cur->next)
+    procmsg_msg_vector_append (mvec, (MsgInfo *) cur->data);
+  g_qsort_with_data (mvec->msgs, mvec->len, sizeof (MsgInfo *), procmsg_msg_vector_cmp_func, cmp_func);
+  for (cur = mlist, i = 0; cur != NULL; cur = cur->next, i++)
+    cur->data = mvec->msgs[i];
+  procmsg_msg_vector_free (mvec, FALSE);
 
   return mlist;
 }
 
+void
+procmsg_msg_vector_sort (MsgVector * mvec, FolderSortKey sort_key, FolderSortType sort_type)
+{
+  GCompareFunc cmp_func;
+
+  g_return_if_fail (mvec != NULL);
+
+  if ((cmp_func = procmsg_get_sort_func (sort_key)) == NULL)
+    return;
+
+  cmp_func_sort_type = sort_type;
+
+  /* stable, like g_slist_sort() */
+  g_qsort_with_data (mvec->msgs, mvec->len, sizeof (MsgInfo *), procmsg_msg_vector_cmp_func, cmp_func);
+}
+
 gint
 procmsg_get_last_num_in_msg_list (GSList * mlist)
 {
@@ -599,6 +701,112 @@ procmsg_get_last_num_in_msg_list (GSList * mlist)
   return last;
 }
 
+MsgVector *
+procmsg_msg_vector_new (guint reserve)
+{
+  MsgVector *mvec;
+
+  mvec = g_new (MsgVector, 1);
+  mvec->alloc = MAX (reserve, 16);
+  mvec->msgs = g_new (MsgInfo *, mvec->alloc);
+  mvec->len = 0;
+
+  return mvec;
+}
+
+void
+procmsg_msg_vector_append (MsgVector * mvec, MsgInfo * msginfo)
+{
+  if (mvec->len == mvec->alloc)
+    {
+      mvec->alloc *= 2;
+      mvec->msgs = g_renew (MsgInfo *, mvec->msgs, mvec->alloc);
+    }
+  mvec->msgs[mvec->len++] = msginfo;
+}
+
+/* moves the messages of src to the end of mvec and frees src */
+void
+procmsg_msg_vector_concat (MsgVector * mvec, MsgVector * src)
+{
+  if (!src)
+    return;
+
+  if (mvec->len + src->len > mvec->alloc)
+    {
+      mvec->alloc = MAX (mvec->alloc * 2, mvec->len + src->len);
+      mvec->msgs = g_renew (MsgInfo *, mvec->msgs, mvec->alloc);
+    }
+  memcpy (mvec->msgs + mvec->len, src->msgs, src->len * sizeof (MsgInfo *));
+  mvec->len += src->len;
+
+  procmsg_msg_vector_free (src, FALSE);
+}
+
+/* removes the NULL entries keeping the order.  callers remove messages
+ * in a loop by setting their entries to NULL */
+void
+procmsg_msg_vector_compact (MsgVector * mvec)
+{
+  guint i, n = 0;
+
+  for (i = 0; i < mvec->len; i++)
+    {
+      if (mvec->msgs[i])
+        mvec->msgs[n++] = mvec->msgs[i];
+    }
+  mvec->len = n;
+}
+
+/* takes the messages of mlist and frees the list */
+MsgVector *
+procmsg_msg_vector_from_list (GSList * mlist)
+{
+  MsgVector *mvec;
+  GSList *cur;
+
+  mvec = procmsg_msg_vector_new (0);
+  for (cur = mlist; cur != NULL; cur = cur->next)
+    procmsg_msg_vector_append (mvec, (MsgInfo *) cur->data);
+  g_slist_free (mlist);
+
+  return mvec;
+}
+
+/* returns the messages of mvec as a list and frees mvec */
+GSList *
+procmsg_msg_vector_to_list (MsgVector * mvec)
+{
+  GSList *mlist = NULL;
+  guint i;
+
+  if (!mvec)
+    return NULL;
+
+  for (i = mvec->len; i > 0; i--)
+    mlist = g_slist_prepend (mlist, mvec->msgs[i - 1]);
+  procmsg_msg_vector_free (mvec, FALSE);
+
+  return mlist;
+}
+
+void
+procmsg_msg_vector_free (MsgVector * mvec, gboolean free_msgs)
+{
+  guint i;
+
+  if (!mvec)
+    return;
+
+  if (free_msgs)
+    {
+      for (i = 0; i < mvec->len; i++)
+        procmsg_msginfo_free (mvec->msgs[i]);
+    }
+  g_free (mvec->msgs);
+  g_free (mvec);
+}
+
 void
 procmsg_msg_list_free (GSList * mlist)
 {
@@ -617,7 +825,8 @@ void
 procmsg_write_cache (MsgInfo * msginfo, FILE * fp)
 {
   MsgTmpFlags flags = msginfo->flags.tmp_flags & MSG_CACHED_FLAG_MASK;
-  GSList *cur;
+  guint refnum;
+  guint i;
 
   WRITE_CACHE_DATA_INT (msginfo->msgnum, fp);
   WRITE_CACHE_DATA_INT (msginfo->size, fp);
@@ -635,10 +844,11 @@ procmsg_write_cache (MsgInfo * msginfo, FILE * fp)
   WRITE_CACHE_DATA (msginfo->msgid, fp);
   WRITE_CACHE_DATA (msginfo->inreplyto, fp);
 
-  WRITE_CACHE_DATA_INT (g_slist_length (msginfo->references), fp);
-  for (cur = msginfo->references; cur != NULL; cur = cur->next)
+  refnum = msginfo->references ? g_strv_length (msginfo->references) : 0;
+  WRITE_CACHE_DATA_INT (refnum, fp);
+  for (i = 0; i < refnum; i++)
     {
-      WRITE_CACHE_DATA ((gchar *) cur->data, fp);
+      WRITE_CACHE_DATA (msginfo->references[i], fp);
     }
 }
 
@@ -676,6 +886,8 @@ procmsg_write_cache_list (FolderItem * item, GSList * mlist)
 
   fclose (fp);
   item->cache_dirty = FALSE;
+
+  procmime_mime_cache_prune (item, mlist);
 }
 
 void
@@ -890,7 +1102,7 @@ procmsg_flush_folder (FolderItem * item)
   g_return_val_if_fail (item != NULL, FALSE);
   g_return_val_if_fail (item->folder != NULL, FALSE);
 
-  if (FOLDER_TYPE (item->folder) != F_MH || item->last_num < 0)
+  if ((FOLDER_TYPE (item->folder) != F_MH && FOLDER_TYPE (item->folder) != F_MAILDIR) || item->last_num < 0)
     {
       folder_item_scan (item);
       return TRUE;
@@ -1010,7 +1222,7 @@ procmsg_get_mark_sum (FolderItem * item, gint * new, gint * unread, gint * total
     }
 }
 
-static GHashTable *
+GHashTable *
 procmsg_read_mark_file (FolderItem * item)
 {
   FILE *fp;
@@ -1303,66 +1515,407 @@ procmsg_clear_mark (FolderItem * item)
     fclose (fp);
 }
 
+/* Thread parent index.  The links resolved by procmsg_get_thread_tree()
+ * for a whole folder are kept in THREAD_FILE in the folder directory,
+ * so that only the messages added or changed since are resolved again.
+ * After the version, a record is
+ *   guint32 msgnum, size, mtime, parent
+ * in the order of the message numbers, where parent is the position of
+ * the parent record + 1, or 0 for a root.  A link is used only if the
+ * size and mtime of both messages are unchanged. */
+
+#define THREAD_RECORD_LEN	4
+
+static gchar *
+procmsg_get_thread_file (FolderItem * item)
+{
+  gchar *path;
+  gchar *file;
+
+  path = folder_item_get_path (item);
+  if (!path)
+    return NULL;
+  file = g_strconcat (path, G_DIR_SEPARATOR_S, THREAD_FILE, NULL);
+  g_free (path);
+
+  return file;
+}
+
+static gint
+procmsg_thread_num_cmp (gconstpointer a, gconstpointer b, gpointer data)
+{
+  MsgVector *mvec = (MsgVector *) data;
+  guint na = mvec->msgs[*(const gint *) a]->msgnum;
+  guint nb = mvec->msgs[*(const gint *) b]->msgnum;
+
+  return na < nb ? -1 : na > nb ? 1 : 0;
+}
+
+/* returns the positions of the messages in the order of their numbers */
+static gint *
+procmsg_thread_sort_by_num (MsgVector * mvec)
+{
+  gint *order;
+  gboolean sorted = TRUE;
+  gint i;
+
+  order = g_new (gint, mvec->len);
+  for (i = 0; i < mvec->len; i++)
+    {
+      order[i] = i;
+      if (i > 0 && mvec->msgs[i - 1]->msgnum > mvec->msgs[i]->msgnum)
+        sorted = FALSE;
+    }
+  if (!sorted)
+    g_qsort_with_data (order, mvec->len, sizeof (gint), procmsg_thread_num_cmp, mvec);
+
+  return order;
+}
+
+/* sets parent[] and known[] of the messages found unchanged in the
+ * index, and returns the number of records, or -1 if there is none */
+static gint
+procmsg_read_thread_index (FolderItem * item, MsgVector * mvec, const gint * order, gint * parent, guint8 * known)
+{
+  GMappedFile *mapfile;
+  const guint32 *data, *rec;
+  gchar *file;
+  gint *pos;
+  gint i, r, n_records;
+
+  if ((file = procmsg_get_thread_file (item)) == NULL)
+    return -1;
+  mapfile = g_mapped_file_new (file, FALSE, NULL);
+  g_free (file);
+  if (!mapfile)
+    return -1;
+
+  data = (const guint32 *) g_mapped_file_get_contents (mapfile);
+  n_records = g_mapped_file_get_length (mapfile) / sizeof (guint32);
+  if (n_records < 1 || data[0] != THREAD_VERSION)
+    {
+      g_mapped_file_unref (mapfile);
+      return -1;
+    }
+  data++;
+  n_records = (n_records - 1) / THREAD_RECORD_LEN;
+
+  /* both are in the order of the numbers, so merge them */
+  pos = g_new (gint, n_records);
+  for (r = 0, i = 0, rec = data; r < n_records; r++, rec += THREAD_RECORD_LEN)
+    {
+      MsgInfo *msginfo;
+
+      pos[r] = -1;
+      while (i < mvec->len && mvec->msgs[order[i]]->msgnum < rec[0])
+        i++;
+      if (i == mvec->len)
+        continue;
+      msginfo = mvec->msgs[order[i]];
+      if (msginfo->msgnum == rec[0] && rec[1] == (guint32) msginfo->size && rec[2] == (guint32) msginfo->mtime)
+        {
+          pos[r] = order[i];
+          known[order[i]] = TRUE;
+        }
+    }
+
+  for (r = 0, rec = data; r < n_records; r++, rec += THREAD_RECORD_LEN)
+    {
+      if ((i = pos[r]) < 0 || rec[3] == 0)
+        continue;
+      /* the parent was removed or changed */
+      if (rec[3] > n_records || pos[rec[3] - 1] < 0)
+        known[i] = FALSE;
+      else
+        parent[i] = pos[rec[3] - 1];
+    }
+
+  g_free (pos);
+  g_mapped_file_unref (mapfile);
+
+  return n_records;
+}
+
+static void
+procmsg_write_thread_index (FolderItem * item, MsgVector * mvec, const gint * order, const gint * parent)
+{
+  gchar *file;
+  FILE *fp;
+  guint32 *data, *rec;
+  gint *pos;
+  gint r, n = mvec->len;
+  gboolean err;
+
+  if ((file = procmsg_get_thread_file (item)) == NULL)
+    return;
+  if ((fp = procmsg_open_data_file (file, THREAD_VERSION, DATA_WRITE, NULL, 0)) == NULL)
+    {
+      g_free (file);
+      return;
+    }
+
+  pos = g_new (gint, n);
+  for (r = 0; r < n; r++)
+    pos[order[r]] = r;
+
+  data = g_new (guint32, n * THREAD_RECORD_LEN);
+  for (r = 0, rec = data; r < n; r++, rec += THREAD_RECORD_LEN)
+    {
+      MsgInfo *msginfo = mvec->msgs[order[r]];
+
+      rec[0] = msginfo->msgnum;
+      rec[1] = msginfo->size;
+      rec[2] = msginfo->mtime;
+      rec[3] = parent[order[r]] >= 0 ? pos[parent[order[r]]] + 1 : 0;
+    }
+
+  err = fwrite (data, sizeof (guint32) * THREAD_RECORD_LEN, n, fp) != n;
+  if (fclose (fp) == EOF)
+    err = TRUE;
+  if (err)
+    {
+      FILE_OP_ERROR (file, "procmsg_write_thread_index");
+      g_unlink (file);
+    }
+
+  g_free (data);
+  g_free (pos);
+  g_free (file);
+}
+
+/* returns the first message in the table among In-Reply-To and
+ * References (newest first), searching no further than stop */
+static gint
+procmsg_thread_lookup (GHashTable * table, MsgInfo * msginfo, const gchar * stop)
+{
+  gpointer val;
+  gchar **ref;
+
+  if (msginfo->inreplyto)
+    {
+      if (msginfo->inreplyto == stop)
+        return -1;
+      if ((val = g_hash_table_lookup (table, msginfo->inreplyto)) != NULL)
+        return GPOINTER_TO_INT (val) - 1;
+    }
+  for (ref = msginfo->references; ref && *ref; ref++)
+    {
+      if (*ref == stop)
+        return -1;
+      if ((val = g_hash_table_lookup (table, *ref)) != NULL)
+        return GPOINTER_TO_INT (val) - 1;
+    }
+
+  return -1;
+}
+
+/* message-ids are interned, so the pointers can be compared.  the
+ * values are index + 1, and the message with the lowest number wins
+ * so that the choice does not depend on the order of the list */
+static void
+procmsg_thread_table_add (GHashTable * table, MsgVector * mvec, gint i)
+{
+  MsgInfo *msginfo = mvec->msgs[i];
+  gpointer val;
+
+  if (!msginfo->msgid)
+    return;
+  val = g_hash_table_lookup (table, msginfo->msgid);
+  if (val == NULL || mvec->msgs[GPOINTER_TO_INT (val) - 1]->msgnum > msginfo->msgnum)
+    g_hash_table_insert (table, msginfo->msgid, GINT_TO_POINTER (i + 1));
+}
+
+/* returns the table of the messages the new messages refer to; with a
+ * few new messages this is much smaller than the table of the list */
+static GHashTable *
+procmsg_thread_ref_table (MsgVector * mvec, const guint8 * known)
+{
+  GHashTable *table;
+  MsgInfo *msginfo;
+  gchar **ref;
+  gint i;
+
+  table = g_hash_table_new (NULL, NULL);
+
+  for (i = 0; i < mvec->len; i++)
+    {
+      if (known[i])
+        continue;
+      msginfo = mvec->msgs[i];
+      if (msginfo->inreplyto)
+        g_hash_table_insert (table, msginfo->inreplyto, NULL);
+      for (ref = msginfo->references; ref && *ref; ref++)
+        g_hash_table_insert (table, *ref, NULL);
+    }
+
+  for (i = 0; i < mvec->len; i++)
+    {
+      msginfo = mvec->msgs[i];
+      if (msginfo->msgid && g_hash_table_lookup_extended (table, msginfo->msgid, NULL, NULL))
+        procmsg_thread_table_add (table, mvec, i);
+    }
+
+  return table;
+}
+
+/* drops one link of every cycle in a single pass; returns TRUE if a
+ * link was dropped */
+static gboolean
+procmsg_thread_break_cycles (gint * parent, gint n)
+{
+  guint8 *state;
+  gboolean dropped = FALSE;
+  gint i, j;
+
+  /* 0: not visited, 1: on the current path, 2: done */
+  state = g_new0 (guint8, n);
+
+  for (i = 0; i < n; i++)
+    {
+      for (j = i; j >= 0 && state[j] == 0; j = parent[j])
+        state[j] = 1;
+      if (j >= 0 && state[j] == 1)
+        {
+          parent[j] = -1;
+          dropped = TRUE;
+        }
+      for (j = i; j >= 0 && state[j] == 1; j = parent[j])
+        state[j] = 2;
+    }
+
+  g_free (state);
+
+  return dropped;
+}
+
 /* return the reversed thread tree */
+/* A message is attached to the first message found among its
+ * In-Reply-To and References (newest first), as in JWZ threading
+ * without the dummy containers, and a link that would make a cycle is
+ * dropped.  For a whole folder the links of the unchanged messages are
+ * taken from the parent index; only the new messages are resolved, and
+ * the others are checked against the new messages alone. */
 GNode *
 procmsg_get_thread_tree (GSList * mlist)
 {
-  GNode *root, *parent, *node, *next;
-  GHashTable *table;
-  MsgInfo *msginfo;
-  const gchar *msgid;
-  GSList *reflist;
+  GNode *root;
+  GNode **nodes;
+  MsgVector *mvec;
+  FolderItem *item = NULL;
+  gint *parent, *order = NULL;
+  guint8 *known;
+  gboolean changed;
+  gint i, n, n_new, n_records = -1;
 
   root = g_node_new (NULL);
-  table = g_hash_table_new (g_str_hash, g_str_equal);
 
+  mvec = procmsg_msg_vector_new (0);
   for (; mlist != NULL; mlist = mlist->next)
+    procmsg_msg_vector_append (mvec, (MsgInfo *) mlist->data);
+  n = mvec->len;
+
+  parent = g_new (gint, n);
+  known = g_new0 (guint8, n);
+  nodes = g_new (GNode *, n);
+  for (i = 0; i < n; i++)
+    parent[i] = -1;
+
+  /* the index is kept only for the whole list of a folder */
+  if (n > 0)
+    item = mvec->msgs[0]->folder;
+  for (i = 1; item != NULL && i < n; i++)
     {
-      msginfo = (MsgInfo *) mlist->data;
-      parent = root;
+      if (mvec->msgs[i]->folder != item)
+        item = NULL;
+    }
+  if (item && (!item->path || item->total != n))
+    item = NULL;
 
-      /* only look for the real parent first */
-      if (msginfo->inreplyto)
-        {
-          parent = g_hash_table_lookup (table, msginfo->inreplyto);
-          if (parent == NULL)
-            parent = root;
-        }
+  if (item)
+    {
+      order = procmsg_thread_sort_by_num (mvec);
+      n_records = procmsg_read_thread_index (item, mvec, order, parent, known);
+    }
 
-      node = g_node_insert_data_before (parent, parent == root ? parent->children : NULL, msginfo);
-      if ((msgid = msginfo->msgid) && g_hash_table_lookup (table, msgid) == NULL)
-        g_hash_table_insert (table, (gchar *) msgid, node);
+  n_new = 0;
+  for (i = 0; i < n; i++)
+    {
+      if (!known[i])
+        n_new++;
     }
+  changed = n_new > 0 || n_records != n;
 
-  /* complete the unfinished threads */
-  for (node = root->children; node != NULL;)
+  if (n_new > 0)
     {
-      next = node->next;
-      msginfo = (MsgInfo *) node->data;
-      parent = NULL;
+      GHashTable *table, *new_table = NULL;
 
-      if (msginfo->inreplyto)
-        parent = g_hash_table_lookup (table, msginfo->inreplyto);
+      if (n_new > n / 4)
+        {
+          table = g_hash_table_new (NULL, NULL);
+          for (i = 0; i < n; i++)
+            procmsg_thread_table_add (table, mvec, i);
+        }
+      else
+        table = procmsg_thread_ref_table (mvec, known);
 
-      /* try looking for the indirect parent */
-      if (!parent && msginfo->references)
+      if (n_new < n)
         {
-          for (reflist = msginfo->references; reflist != NULL; reflist = reflist->next)
-            if ((parent = g_hash_table_lookup (table, reflist->data)) != NULL)
-              break;
+          new_table = g_hash_table_new (NULL, NULL);
+          for (i = 0; i < n; i++)
+            {
+              if (!known[i])
+                procmsg_thread_table_add (new_table, mvec, i);
+            }
         }
 
-      /* node should not be the parent, and node should not
-         be an ancestor of parent (circular reference) */
-      if (parent && parent != node && !g_node_is_ancestor (node, parent))
+      for (i = 0; i < n; i++)
         {
-          g_node_unlink (node);
-          g_node_insert_before (parent, parent->children, node);
+          if (!known[i])
+            parent[i] = procmsg_thread_lookup (table, mvec->msgs[i], NULL);
+          else if (new_table)
+            {
+              /* a new message may be a better parent than the one
+                 in the index */
+              const gchar *stop = parent[i] >= 0 ? mvec->msgs[parent[i]]->msgid : NULL;
+              gint p = procmsg_thread_lookup (new_table, mvec->msgs[i], stop);
+
+              if (p >= 0)
+                parent[i] = p;
+            }
         }
-      node = next;
+
+      if (new_table)
+        g_hash_table_destroy (new_table);
+      g_hash_table_destroy (table);
     }
 
-  g_hash_table_destroy (table);
+  /* also guards against a damaged index */
+  if (procmsg_thread_break_cycles (parent, n))
+    changed = TRUE;
+
+  if (item && changed)
+    procmsg_write_thread_index (item, mvec, order, parent);
+
+  /* link the nodes, prepending is O(1); the replies keep the order
+     of the list */
+  for (i = 0; i < n; i++)
+    nodes[i] = g_node_new (mvec->msgs[i]);
+  for (i = n - 1; i >= 0; i--)
+    {
+      if (parent[i] >= 0)
+        g_node_prepend (nodes[parent[i]], nodes[i]);
+    }
+  for (i = 0; i < n; i++)
+    {
+      if (parent[i] < 0)
+        g_node_prepend (root, nodes[i]);
+    }
+
+  g_free (nodes);
+  g_free (order);
+  g_free (known);
+  g_free (parent);
+  procmsg_msg_vector_free (mvec, FALSE);
 
   return root;
 }
@@ -1697,7 +2250,9 @@ procmsg_open_message (MsgInfo * msginfo)
 }
 
 static DecryptMessageFunc decrypt_message_func = NULL;
-static gboolean auto_decrypt = TRUE;
+/* filtering may disable decryption on several threads at once */
+static gint auto_decrypt_disabled = 0;
+G_LOCK_DEFINE_STATIC (auto_decrypt);
 
 void
 procmsg_set_decrypt_message_func (DecryptMessageFunc func)
@@ -1708,7 +2263,12 @@ procmsg_set_decrypt_message_func (DecryptMessageFunc func)
 void
 procmsg_set_auto_decrypt_message (gboolean enabled)
 {
-  auto_decrypt = enabled;
+  G_LOCK (auto_decrypt);
+  if (!enabled)
+    auto_decrypt_disabled++;
+  else if (auto_decrypt_disabled > 0)
+    auto_decrypt_disabled--;
+  G_UNLOCK (auto_decrypt);
 }
 
 FILE *
@@ -1716,7 +2276,7 @@ procmsg_open_message_decrypted (MsgInfo * msginfo, MimeInfo ** mimeinfo)
 {
   FILE *fp;
 
-  if (decrypt_message_func && auto_decrypt)
+  if (decrypt_message_func && g_atomic_int_get (&auto_decrypt_disabled) == 0)
     return decrypt_message_func (msginfo, mimeinfo);
 
   *mimeinfo = NULL;
@@ -2365,7 +2925,7 @@ procmsg_get_msginfo (FolderItem * item, gint num)
     return NULL;
 
   type = FOLDER_TYPE (item->folder);
-  if (type == F_MH || type == F_IMAP)
+  if (type == F_MH || type == F_MAILDIR || type == F_IMAP)
     {
       if (item->stype == F_QUEUE)
         {
@@ -2385,7 +2945,7 @@ procmsg_get_msginfo (FolderItem * item, gint num)
       MSG_SET_TMP_FLAGS (msginfo->flags, MSG_NEWS);
     }
 
-  if (type == F_MH || type == F_NEWS)
+  if (type == F_MH || type == F_MAILDIR || type == F_NEWS)
     {
       MsgPermFlags flags = 0;
       if (procmsg_get_flags (item, num, &flags))
@@ -2395,6 +2955,97 @@ procmsg_get_msginfo (FolderItem * item, gint num)
   return msginfo;
 }
 
+/* Addresses, subjects and message-ids repeat across folders and
+ * threads, so the header strings of MsgInfo are kept once in the
+ * process-wide pool of reference counted strings.  The returned
+ * strings must not be modified and are released with
+ * procmsg_intern_str_free(). */
+
+gchar *
+procmsg_intern_str (const gchar * str)
+{
+  if (!str)
+    return NULL;
+
+  return g_ref_string_new_intern (str);
+}
+
+gchar *
+procmsg_intern_str_len (const gchar * str, gsize len)
+{
+  gchar buf[256];
+  gchar *tmp;
+  gchar *ret;
+
+  if (!str)
+    return NULL;
+
+  if (len < sizeof (buf))
+    {
+      memcpy (buf, str, len);
+      buf[len] = '\0';
+      return g_ref_string_new_intern (buf);
+    }
+
+  tmp = g_strndup (str, len);
+  ret = g_ref_string_new_intern (tmp);
+  g_free (tmp);
+
+  return ret;
+}
+
+/* interns str and frees it */
+gchar *
+procmsg_intern_str_take (gchar * str)
+{
+  gchar *ret;
+
+  if (!str)
+    return NULL;
+
+  ret = g_ref_string_new_intern (str);
+  g_free (str);
+
+  return ret;
+}
+
+gchar *
+procmsg_intern_str_ref (gchar * str)
+{
+  if (!str)
+    return NULL;
+
+  return g_ref_string_acquire (str);
+}
+
+void
+procmsg_intern_str_free (gchar * str)
+{
+  if (str)
+    g_ref_string_release (str);
+}
+
+/* converts the list of message-ids to the references array of MsgInfo.
+ * the list and its strings are freed */
+gchar **
+procmsg_references_new (GSList * list)
+{
+  gchar **refs;
+  GSList *cur;
+  guint i = 0;
+
+  if (!list)
+    return NULL;
+
+  refs = g_new (gchar *, g_slist_length (list) + 1);
+  for (cur = list; cur != NULL; cur = cur->next)
+    refs[i++] = procmsg_intern_str_take ((gchar *) cur->data);
+  refs[i] = NULL;
+  g_slist_free (list);
+
+  return refs;
+}
+
 MsgInfo *
 procmsg_msginfo_copy (MsgInfo * msginfo)
 {
@@ -2408,6 +3059,7 @@ procmsg_msginfo_copy (MsgInfo * msginfo)
 #define MEMBCOPY(mmb)	newmsginfo->mmb = msginfo->mmb
 #define MEMBDUP(mmb)	newmsginfo->mmb = msginfo->mmb ? \
 			g_strdup(msginfo->mmb) : NULL
+#define MEMBREF(mmb)	newmsginfo->mmb = procmsg_intern_str_ref(msginfo->mmb)
 
   MEMBCOPY (msgnum);
   MEMBCOPY (size);
@@ -2416,16 +3068,16 @@ procmsg_msginfo_copy (MsgInfo * msginfo)
 
   MEMBCOPY (flags);
 
-  MEMBDUP (fromname);
+  MEMBREF (fromname);
 
   MEMBDUP (date);
-  MEMBDUP (from);
-  MEMBDUP (to);
-  MEMBDUP (cc);
-  MEMBDUP (newsgroups);
-  MEMBDUP (subject);
-  MEMBDUP (msgid);
-  MEMBDUP (inreplyto);
+  MEMBREF (from);
+  MEMBREF (to);
+  MEMBREF (cc);
+  MEMBREF (newsgroups);
+  MEMBREF (subject);
+  MEMBREF (msgid);
+  MEMBREF (inreplyto);
 
   MEMBCOPY (folder);
   MEMBCOPY (to_folder);
@@ -2512,19 +3164,25 @@ procmsg_msginfo_free (MsgInfo * msginfo)
 
   g_free (msginfo->xface);
 
-  g_free (msginfo->fromname);
+  procmsg_intern_str_free (msginfo->fromname);
 
   g_free (msginfo->date);
-  g_free (msginfo->from);
-  g_free (msginfo->to);
-  g_free (msginfo->cc);
-  g_free (msginfo->newsgroups);
-  g_free (msginfo->subject);
-  g_free (msginfo->msgid);
-  g_free (msginfo->inreplyto);
-
-  slist_free_strings (msginfo->references);
-  g_slist_free (msginfo->references);
+  procmsg_intern_str_free (msginfo->from);
+  procmsg_intern_str_free (msginfo->to);
+  procmsg_intern_str_free (msginfo->cc);
+  procmsg_intern_str_free (msginfo->newsgroups);
+  procmsg_intern_str_free (msginfo->subject);
+  procmsg_intern_str_free (msginfo->msgid);
+  procmsg_intern_str_free (msginfo->inreplyto);
+
+  if (msginfo->references)
+    {
+      gchar **ref;
+
+      for (ref = msginfo->references; *ref != NULL; ref++)
+        procmsg_intern_str_free (*ref);
+      g_free (msginfo->references);
+    }
 
   g_free (msginfo->file_path);
 
@@ -34,6 +34,7 @@
 typedef struct _MsgInfo MsgInfo;
 typedef struct _MsgFlags MsgFlags;
 typedef struct _MsgFileInfo MsgFileInfo;
+typedef struct _MsgVector MsgVector;
 typedef struct _MsgEncryptInfo MsgEncryptInfo;
 
 #include "folder.h"
@@ -176,6 +177,8 @@ struct _MsgInfo {
 
   MsgFlags flags;
 
+  /* the strings below except date are interned with
+   * procmsg_intern_str() and shared between messages */
   gchar *fromname;
 
   gchar *date;
@@ -187,7 +190,8 @@ struct _MsgInfo {
   gchar *msgid;
   gchar *inreplyto;
 
-  GSList *references;
+  /* NULL-terminated, newest first */
+  gchar **references;
 
   FolderItem *folder;
   FolderItem *to_folder;
@@ -201,6 +205,14 @@ struct _MsgInfo {
   MsgEncryptInfo *encinfo;
 };
 
+/* contiguous array of MsgInfo pointers.  the vector functions that
+ * take another vector or list consume it */
+struct _MsgVector {
+  MsgInfo **msgs;
+  guint len;
+  guint alloc;
+};
+
 struct _MsgFileInfo {
   gchar *file;
   MsgFlags *flags;
@@ -221,6 +233,16 @@ GHashTable *procmsg_to_folder_hash_table_create (GSList * mlist);
 
 gint procmsg_read_cache_data_str (FILE * fp, gchar ** str);
 
+MsgVector *procmsg_msg_vector_new (guint reserve);
+void procmsg_msg_vector_append (MsgVector * mvec, MsgInfo * msginfo);
+void procmsg_msg_vector_concat (MsgVector * mvec, MsgVector * src);
+void procmsg_msg_vector_compact (MsgVector * mvec);
+void procmsg_msg_vector_sort (MsgVector * mvec, FolderSortKey sort_key, FolderSortType sort_type);
+MsgVector *procmsg_msg_vector_from_list (GSList * mlist);
+GSList *procmsg_msg_vector_to_list (MsgVector * mvec);
+void procmsg_msg_vector_free (MsgVector * mvec, gboolean free_msgs);
+
+MsgVector *procmsg_read_cache_vector (FolderItem * item, gboolean scan_file);
 GSList *procmsg_read_cache (FolderItem * item, gboolean scan_file);
 void procmsg_set_flags (GSList * mlist, FolderItem * item);
 void procmsg_mark_all_read (FolderItem * item);
@@ -248,6 +270,7 @@ void procmsg_add_flags (FolderItem * item, gint num, MsgFlags flags);
 
 void procmsg_get_mark_sum (FolderItem * item,
                            gint * new, gint * unread, gint * total, gint * min, gint * max, gint first);
+GHashTable *procmsg_read_mark_file (FolderItem * item);
 
 FILE *procmsg_open_data_file (const gchar * file, guint version, DataOpenMode mode, gchar * buf, size_t buf_size);
 
@@ -293,6 +316,13 @@ gint procmsg_concat_partial_messages (GSList * mlist, const gchar * file);
 
 MsgInfo *procmsg_get_msginfo (FolderItem * item, gint num);
 
+gchar *procmsg_intern_str (const gchar * str);
+gchar *procmsg_intern_str_len (const gchar * str, gsize len);
+gchar *procmsg_intern_str_take (gchar * str);
+gchar *procmsg_intern_str_ref (gchar * str);
+void procmsg_intern_str_free (gchar * str);
+gchar **procmsg_references_new (GSList * list);
+
 MsgInfo *procmsg_msginfo_copy (MsgInfo * msginfo);
 MsgInfo *procmsg_msginfo_get_full_info (MsgInfo * msginfo);
 gboolean procmsg_msginfo_equal (MsgInfo * msginfo_a, MsgInfo * msginfo_b);
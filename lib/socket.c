@@ -46,6 +46,9 @@
 #if HAVE_SYS_SELECT_H
 #include <sys/select.h>
 #endif
+#if USE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "socket.h"
 #if USE_SSL
@@ -53,6 +56,7 @@
 #endif
 
 #include "utils.h"
+#include "metrics.h"
 
 #define BUFFSIZE	8192
 
@@ -105,6 +109,25 @@ struct _SockSource {
   SockInfo *sock;
 };
 
+#if USE_ZLIB
+typedef struct _SockZStream SockZStream;
+
+/* RFC 4978 / RFC 8054: raw deflate in both directions, every write is
+   completed with Z_SYNC_FLUSH so that the peer sees whole commands */
+struct _SockZStream {
+  z_stream inflate;
+  z_stream deflate;
+  gboolean inflate_pending;     /* output buffer was filled up last time */
+
+  gchar inbuf[BUFFSIZE];        /* compressed data read from the wire */
+  gchar buf[BUFFSIZE * 4];      /* inflated data not consumed yet */
+  gint buf_start;
+  gint buf_end;
+};
+
+#define SOCK_ZSTREAM(sock)	((SockZStream *)(sock)->zstream)
+#endif
+
 static guint io_timeout = 60;
 
 static GList *sock_connect_data_list = NULL;
@@ -125,6 +148,13 @@ static SockInfo *sock_find_from_fd (gint fd);
 
 static gint sock_connect_with_timeout (gint sock, const struct sockaddr *serv_addr, gint addrlen, guint timeout_secs);
 
+#if USE_ZLIB
+static gint sock_zread (SockInfo * sock, gchar * buf, gint len, gboolean peek);
+static gint sock_zwrite_all (SockInfo * sock, const gchar * buf, gint len);
+static gint sock_zgets (SockInfo * sock, gchar * buf, gint len);
+static gint sock_zgetline (SockInfo * sock, gchar ** line);
+#endif
+
 #ifndef INET6
 static gint sock_info_connect_by_hostname (SockInfo * sock);
 #else
@@ -414,6 +444,19 @@ sock_check (GSource * source)
   fd_set fds;
   GIOCondition condition = sock->condition;
 
+#if USE_ZLIB
+  if ((condition & G_IO_IN) && sock->zstream)
+    {
+      SockZStream *z = SOCK_ZSTREAM (sock);
+
+      /* input held by zlib may not give any output yet (a partial
+         block), so only inflated data counts; the rest is up to the
+         fd poll below */
+      if (z->buf_start < z->buf_end || z->inflate_pending)
+        return TRUE;
+    }
+#endif
+
 #if USE_SSL
   if (sock->ssl)
     {
@@ -467,8 +510,8 @@ sock_add_watch (SockInfo * sock, GIOCondition condition, SockFunc func, gpointer
   sock->condition = condition;
   sock->data = data;
 
-#if USE_SSL
-  if (sock->ssl)
+  /* buffered SSL or inflated data is not visible to poll() */
+  if (sock->ssl || sock->zstream)
     {
       GSource *source;
 
@@ -478,7 +521,6 @@ sock_add_watch (SockInfo * sock, GIOCondition condition, SockFunc func, gpointer
       g_source_set_can_recurse (source, FALSE);
       return g_source_attach (source, NULL);
     }
-#endif
 
   return g_io_add_watch (sock->sock_ch, condition, sock_watch_cb, sock);
 }
@@ -1442,16 +1484,37 @@ sock_printf (SockInfo * sock, const gchar * format, ...)
   return sock_write_all (sock, buf, strlen (buf));
 }
 
+static gint
+sock_raw_read (SockInfo * sock, gchar * buf, gint len)
+{
+  gint ret;
+
+#if USE_SSL
+  if (sock->ssl)
+    ret = ssl_read (sock->ssl, buf, len);
+  else
+#endif
+    ret = fd_read (sock->sock, buf, len);
+
+  if (ret > 0)
+    {
+      sock->rx_bytes += ret;
+      METRICS_COUNTER_ADD ("socket.rx_bytes", ret);
+    }
+
+  return ret;
+}
+
 gint
 sock_read (SockInfo * sock, gchar * buf, gint len)
 {
   g_return_val_if_fail (sock != NULL, -1);
 
-#if USE_SSL
-  if (sock->ssl)
-    return ssl_read (sock->ssl, buf, len);
+#if USE_ZLIB
+  if (sock->zstream)
+    return sock_zread (sock, buf, len, FALSE);
 #endif
-  return fd_read (sock->sock, buf, len);
+  return sock_raw_read (sock, buf, len);
 }
 
 gint
@@ -1501,13 +1564,29 @@ ssl_read (SSL * ssl, gchar * buf, gint len)
 gint
 sock_write (SockInfo * sock, const gchar * buf, gint len)
 {
+  gint ret;
+
   g_return_val_if_fail (sock != NULL, -1);
 
+#if USE_ZLIB
+  if (sock->zstream)
+    return sock_zwrite_all (sock, buf, len);
+#endif
+
 #if USE_SSL
   if (sock->ssl)
-    return ssl_write (sock->ssl, buf, len);
+    ret = ssl_write (sock->ssl, buf, len);
+  else
 #endif
-  return fd_write (sock->sock, buf, len);
+    ret = fd_write (sock->sock, buf, len);
+
+  if (ret > 0)
+    {
+      sock->tx_bytes += ret;
+      METRICS_COUNTER_ADD ("socket.tx_bytes", ret);
+    }
+
+  return ret;
 }
 
 gint
@@ -1541,16 +1620,37 @@ ssl_write (SSL * ssl, const gchar * buf, gint len)
 }
 #endif
 
+static gint
+sock_raw_write_all (SockInfo * sock, const gchar * buf, gint len)
+{
+  gint ret;
+
+#if USE_SSL
+  if (sock->ssl)
+    ret = ssl_write_all (sock->ssl, buf, len);
+  else
+#endif
+    ret = fd_write_all (sock->sock, buf, len);
+
+  if (ret > 0)
+    {
+      sock->tx_bytes += ret;
+      METRICS_COUNTER_ADD ("socket.tx_bytes", ret);
+    }
+
+  return ret;
+}
+
 gint
 sock_write_all (SockInfo * sock, const gchar * buf, gint len)
 {
   g_return_val_if_fail (sock != NULL, -1);
 
-#if USE_SSL
-  if (sock->ssl)
-    return ssl_write_all (sock->ssl, buf, len);
+#if USE_ZLIB
+  if (sock->zstream)
+    return sock_zwrite_all (sock, buf, len);
 #endif
-  return fd_write_all (sock->sock, buf, len);
+  return sock_raw_write_all (sock, buf, len);
 }
 
 gint
@@ -1655,13 +1755,29 @@ ssl_gets (SSL * ssl, gchar * buf, gint len)
 gint
 sock_gets (SockInfo * sock, gchar * buf, gint len)
 {
+  gint ret;
+
   g_return_val_if_fail (sock != NULL, -1);
 
+#if USE_ZLIB
+  if (sock->zstream)
+    return sock_zgets (sock, buf, len);
+#endif
+
 #if USE_SSL
   if (sock->ssl)
-    return ssl_gets (sock->ssl, buf, len);
+    ret = ssl_gets (sock->ssl, buf, len);
+  else
 #endif
-  return fd_gets (sock->sock, buf, len);
+    ret = fd_gets (sock->sock, buf, len);
+
+  if (ret > 0)
+    {
+      sock->rx_bytes += ret;
+      METRICS_COUNTER_ADD ("socket.rx_bytes", ret);
+    }
+
+  return ret;
 }
 
 gint
@@ -1723,14 +1839,30 @@ ssl_getline (SSL * ssl, gchar ** line)
 gint
 sock_getline (SockInfo * sock, gchar ** line)
 {
+  gint ret;
+
   g_return_val_if_fail (sock != NULL, -1);
   g_return_val_if_fail (line != NULL, -1);
 
+#if USE_ZLIB
+  if (sock->zstream)
+    return sock_zgetline (sock, line);
+#endif
+
 #if USE_SSL
   if (sock->ssl)
-    return ssl_getline (sock->ssl, line);
+    ret = ssl_getline (sock->ssl, line);
+  else
 #endif
-  return fd_getline (sock->sock, line);
+    ret = fd_getline (sock->sock, line);
+
+  if (ret > 0)
+    {
+      sock->rx_bytes += ret;
+      METRICS_COUNTER_ADD ("socket.rx_bytes", ret);
+    }
+
+  return ret;
 }
 
 gint
@@ -1782,6 +1914,11 @@ sock_peek (SockInfo * sock, gchar * buf, gint len)
 {
   g_return_val_if_fail (sock != NULL, -1);
 
+#if USE_ZLIB
+  if (sock->zstream)
+    return sock_zread (sock, buf, len, TRUE);
+#endif
+
 #if USE_SSL
   if (sock->ssl)
     return ssl_peek (sock->ssl, buf, len);
@@ -1798,6 +1935,22 @@ sock_close (SockInfo * sock)
     return 0;
 
   debug_print ("sock_close: %s:%u (%p)\n", sock->hostname ? sock->hostname : "(none)", sock->port, sock);
+  debug_print ("sock_close: %" G_GUINT64_FORMAT " bytes received, %" G_GUINT64_FORMAT " bytes sent\n",
+               sock->rx_bytes, sock->tx_bytes);
+
+#if USE_ZLIB
+  if (sock->zstream)
+    {
+      SockZStream *z = SOCK_ZSTREAM (sock);
+
+      debug_print ("sock_close: uncompressed %lu bytes received, %lu bytes sent\n",
+                   z->inflate.total_out, z->deflate.total_in);
+      inflateEnd (&z->inflate);
+      deflateEnd (&z->deflate);
+      g_free (z);
+      sock->zstream = NULL;
+    }
+#endif
 
 #if USE_SSL
   if (sock->ssl)
@@ -1825,6 +1978,204 @@ sock_close (SockInfo * sock)
   return 0;
 }
 
+/* start RFC 4978 compression.  Must be called right after the server
+   has acknowledged the COMPRESS command, before anything else is read. */
+gint
+sock_enable_compress (SockInfo * sock)
+{
+#if USE_ZLIB
+  SockZStream *z;
+
+  g_return_val_if_fail (sock != NULL, -1);
+
+  if (sock->zstream)
+    return 0;
+
+  z = g_new0 (SockZStream, 1);
+  if (inflateInit2 (&z->inflate, -MAX_WBITS) != Z_OK)
+    {
+      g_warning ("sock_enable_compress: inflateInit2() failed\n");
+      g_free (z);
+      return -1;
+    }
+  if (deflateInit2 (&z->deflate, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      g_warning ("sock_enable_compress: deflateInit2() failed\n");
+      inflateEnd (&z->inflate);
+      g_free (z);
+      return -1;
+    }
+
+  sock->zstream = z;
+  debug_print ("sock_enable_compress: %s:%u: DEFLATE enabled\n", sock->hostname ? sock->hostname : "(none)",
+               sock->port);
+
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+gboolean
+sock_is_compressed (SockInfo * sock)
+{
+  g_return_val_if_fail (sock != NULL, FALSE);
+
+  return sock->zstream != NULL;
+}
+
+#if USE_ZLIB
+/* make sure that some inflated data is available */
+static gint
+sock_zfill (SockInfo * sock)
+{
+  SockZStream *z = SOCK_ZSTREAM (sock);
+  gint ret;
+
+  if (z->buf_start < z->buf_end)
+    return z->buf_end - z->buf_start;
+
+  z->buf_start = z->buf_end = 0;
+
+  for (;;)
+    {
+      if (z->inflate.avail_in == 0 && !z->inflate_pending)
+        {
+          gint n;
+
+          if ((n = sock_raw_read (sock, z->inbuf, sizeof (z->inbuf))) <= 0)
+            return n;
+          z->inflate.next_in = (Bytef *) z->inbuf;
+          z->inflate.avail_in = n;
+        }
+
+      z->inflate.next_out = (Bytef *) z->buf;
+      z->inflate.avail_out = sizeof (z->buf);
+      ret = inflate (&z->inflate, Z_SYNC_FLUSH);
+      if (ret == Z_STREAM_END)
+        return 0;
+      if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+          g_warning ("inflate() failed: %s\n", z->inflate.msg ? z->inflate.msg : "unknown error");
+          errno = EIO;
+          return -1;
+        }
+
+      z->inflate_pending = (z->inflate.avail_out == 0);
+      z->buf_end = sizeof (z->buf) - z->inflate.avail_out;
+      if (z->buf_end > 0)
+        return z->buf_end;
+    }
+}
+
+static gint
+sock_zread (SockInfo * sock, gchar * buf, gint len, gboolean peek)
+{
+  SockZStream *z = SOCK_ZSTREAM (sock);
+  gint n;
+
+  if ((n = sock_zfill (sock)) <= 0)
+    return n;
+
+  n = MIN (n, len);
+  memcpy (buf, z->buf + z->buf_start, n);
+  if (!peek)
+    z->buf_start += n;
+
+  return n;
+}
+
+static gint
+sock_zwrite_all (SockInfo * sock, const gchar * buf, gint len)
+{
+  SockZStream *z = SOCK_ZSTREAM (sock);
+  gchar outbuf[BUFFSIZE];
+  gint ret;
+
+  z->deflate.next_in = (Bytef *) buf;
+  z->deflate.avail_in = len;
+
+  do
+    {
+      gint n;
+
+      z->deflate.next_out = (Bytef *) outbuf;
+      z->deflate.avail_out = sizeof (outbuf);
+      ret = deflate (&z->deflate, Z_SYNC_FLUSH);
+      if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+          g_warning ("deflate() failed: %s\n", z->deflate.msg ? z->deflate.msg : "unknown error");
+          return -1;
+        }
+      n = sizeof (outbuf) - z->deflate.avail_out;
+      if (n > 0 && sock_raw_write_all (sock, outbuf, n) < 0)
+        return -1;
+    }
+  while (z->deflate.avail_out == 0 || z->deflate.avail_in > 0);
+
+  return len;
+}
+
+static gint
+sock_zgets (SockInfo * sock, gchar * buf, gint len)
+{
+  SockZStream *z = SOCK_ZSTREAM (sock);
+  gchar *newline, *bp = buf;
+  gint n;
+
+  if (--len < 1)
+    return -1;
+  do
+    {
+      if ((n = sock_zfill (sock)) <= 0)
+        {
+          /* hand out the unterminated last line first */
+          if (bp > buf)
+            break;
+          return -1;
+        }
+      n = MIN (n, len);
+      if ((newline = memchr (z->buf + z->buf_start, '\n', n)) != NULL)
+        n = newline - (z->buf + z->buf_start) + 1;
+      memcpy (bp, z->buf + z->buf_start, n);
+      z->buf_start += n;
+      bp += n;
+      len -= n;
+    }
+  while (!newline && len);
+
+  *bp = '\0';
+  return bp - buf;
+}
+
+static gint
+sock_zgetline (SockInfo * sock, gchar ** line)
+{
+  gchar buf[BUFFSIZE];
+  gchar *str = NULL;
+  gint len;
+  gulong size = 0;
+  gulong cur_offset = 0;
+
+  while ((len = sock_zgets (sock, buf, sizeof (buf))) > 0)
+    {
+      size += len;
+      str = g_realloc (str, size + 1);
+      memcpy (str + cur_offset, buf, len + 1);
+      cur_offset += len;
+      if (buf[len - 1] == '\n')
+        break;
+    }
+
+  *line = str;
+
+  if (!str)
+    return -1;
+  else
+    return (gint) size;
+}
+#endif /* USE_ZLIB */
+
 gint
 fd_close (gint fd)
 {
@@ -74,6 +74,13 @@ struct _SockInfo {
 
   SockFunc callback;
   GIOCondition condition;
+
+  /* COMPRESS=DEFLATE state (see sock_enable_compress()) */
+  gpointer zstream;
+
+  /* bytes actually transferred on the wire */
+  guint64 rx_bytes;
+  guint64 tx_bytes;
 };
 
 gint sock_set_io_timeout (guint sec);
@@ -101,6 +108,9 @@ gint sock_info_connect_async (SockInfo * sock, SockConnectFunc func, gpointer da
 gint sock_info_connect_async_thread (SockInfo * sock);
 gint sock_info_connect_async_thread_wait (gint id, SockInfo ** sock);
 
+gint sock_enable_compress (SockInfo * sock);
+gboolean sock_is_compressed (SockInfo * sock);
+
 /* Basic I/O functions */
 gint
 sock_printf (SockInfo * sock, const gchar * format, ...)
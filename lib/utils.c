@@ -39,6 +39,15 @@
 #if HAVE_SYS_WAIT_H
 #include <sys/wait.h>
 #endif
+#if HAVE_SYS_IOCTL_H
+#include <sys/ioctl.h>
+#endif
+#if HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+#if HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
 #include <dirent.h>
 #include <time.h>
 
@@ -3001,6 +3010,47 @@ rename_force (const gchar * oldpath, const gchar * newpath)
   return g_rename (oldpath, newpath);
 }
 
+/* lets the kernel copy srcfd to destfd: a reflink where the filesystem
+   can share extents, copy_file_range() otherwise.  returns 0 if the
+   copy is complete, or -1 if the rest has to be copied by the caller
+   from the current file offsets. */
+static gint
+copy_file_kernel (gint srcfd, gint destfd)
+{
+#if defined (FICLONE) || (HAVE_SYS_SYSCALL_H && defined (SYS_copy_file_range))
+  struct stat s;
+
+  if (fstat (srcfd, &s) < 0 || !S_ISREG (s.st_mode))
+    return -1;
+#endif
+
+#ifdef FICLONE
+  if (ioctl (destfd, FICLONE, srcfd) == 0)
+    return 0;
+#endif
+
+#if HAVE_SYS_SYSCALL_H && defined (SYS_copy_file_range)
+  {
+    off_t copied = 0;
+    glong n;
+
+    while (copied < s.st_size)
+      {
+        n = syscall (SYS_copy_file_range, srcfd, NULL, destfd, NULL, (size_t) (s.st_size - copied), 0);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          return -1;
+        copied += n;
+      }
+
+    return 0;
+  }
+#else
+  return -1;
+#endif
+}
+
 gint
 copy_file (const gchar * src, const gchar * dest, gboolean keep_backup)
 {
@@ -3008,6 +3058,7 @@ copy_file (const gchar * src, const gchar * dest, gboolean keep_backup)
   gint n_read;
   gchar buf[BUFFSIZE];
   gchar *dest_bak = NULL;
+  gboolean done;
   gboolean err = FALSE;
 
   if ((srcfd = g_open (src, O_RDONLY, 0600)) < 0)
@@ -3040,7 +3091,9 @@ copy_file (const gchar * src, const gchar * dest, gboolean keep_backup)
       return -1;
     }
 
-  while ((n_read = read (srcfd, buf, sizeof (buf))) > 0)
+  done = (copy_file_kernel (srcfd, destfd) == 0);
+
+  while (!done && (n_read = read (srcfd, buf, sizeof (buf))) > 0)
     {
       gchar *p = buf;
       const gchar *endp = buf + n_read;
@@ -4128,6 +4181,19 @@ execute_command_line_async_wait (const gchar * cmdline)
       g_free (utf8_cmdline);
     }
 
+  /* only the main loop needs to be kept running while waiting */
+  if (!g_main_context_is_owner (g_main_context_default ()))
+    {
+      gchar **argv;
+      gint ret;
+
+      argv = strsplit_with_quote (cmdline, " ", 0);
+      ret = execute_sync (argv);
+      g_strfreev (argv);
+
+      return ret;
+    }
+
   data.cmdline = cmdline;
   thread = g_thread_new ("exec", execute_command_line_async_func, &data);
   if (!thread)
@@ -4340,13 +4406,12 @@ stime_t
 tzoffset_sec (stime_t * now)
 {
   time_t now_ = *now;
-  struct tm gmt, *tmp, *lt;
+  struct tm gmt, lt_, *lt;
   gint off;
 
-  tmp = gmtime (&now_);
-  g_return_val_if_fail (tmp != NULL, -1);
-  gmt = *tmp;
-  lt = localtime (&now_);
+  /* also called when messages are parsed on worker threads */
+  g_return_val_if_fail (gmtime_r (&now_, &gmt) != NULL, -1);
+  lt = localtime_r (&now_, &lt_);
   g_return_val_if_fail (lt != NULL, -1);
 
   off = (lt->tm_hour - gmt.tm_hour) * 60 + lt->tm_min - gmt.tm_min;
@@ -35,17 +35,44 @@
 
 static StringTable *xml_string_table;
 
+/* the table is shared by the files parsed on the startup threads */
+G_LOCK_DEFINE_STATIC (xml_string_table);
+
 static void
 xml_string_table_create (void)
 {
+  G_LOCK (xml_string_table);
   if (xml_string_table == NULL)
     xml_string_table = string_table_new ();
+  G_UNLOCK (xml_string_table);
+}
+
+static gchar *
+xml_string_add (const gchar * str)
+{
+  gchar *ret;
+
+  G_LOCK (xml_string_table);
+  if (xml_string_table == NULL)
+    xml_string_table = string_table_new ();
+  ret = string_table_insert_string (xml_string_table, str);
+  G_UNLOCK (xml_string_table);
+
+  return ret;
+}
+
+static void
+xml_string_free (const gchar * str)
+{
+  G_LOCK (xml_string_table);
+  string_table_free_string (xml_string_table, str);
+  G_UNLOCK (xml_string_table);
 }
 
 #define XML_STRING_ADD(str) \
-	string_table_insert_string(xml_string_table, (str))
+	xml_string_add(str)
 #define XML_STRING_FREE(str) \
-	string_table_free_string(xml_string_table, (str))
+	xml_string_free(str)
 
 #define XML_STRING_TABLE_CREATE() \
 	xml_string_table_create()
@@ -62,7 +89,7 @@ xml_string_table_create (void)
 #endif /* SPARSE_MEMORY */
 
 static void xml_free_tag (XMLTag * tag);
-static gint xml_get_parenthesis (XMLFile * file, gchar * buf, gint len);
+static gchar *xml_get_parenthesis (XMLFile * file);
 
 XMLFile *
 xml_open_file (const gchar * path)
@@ -87,6 +114,7 @@ xml_open_file (const gchar * path)
 
   newfile->dtd = NULL;
   newfile->encoding = NULL;
+  newfile->is_utf8 = FALSE;
   newfile->tag_stack = NULL;
   newfile->level = 0;
   newfile->is_empty_element = FALSE;
@@ -171,14 +199,49 @@ xml_parse_file (const gchar * path)
   return node;
 }
 
+/* returns a newly allocated UTF-8 copy of str, which is in the
+ * encoding of the file */
+static gchar *
+xml_conv_str (XMLFile * file, const gchar * str)
+{
+  gchar *new_str;
+
+  if (file->is_utf8 && g_utf8_validate (str, -1, NULL))
+    return g_strdup (str);
+
+  new_str = conv_codeset_strdup (str, file->encoding, CS_INTERNAL);
+  if (!new_str)
+    new_str = g_strdup (str);
+
+  return new_str;
+}
+
+/* same as xml_conv_str(), but returns an interned string */
+static gchar *
+xml_conv_name (XMLFile * file, const gchar * str)
+{
+  gchar *utf8_str;
+  gchar *name;
+
+  if (file->is_utf8 && g_utf8_validate (str, -1, NULL))
+    return XML_STRING_ADD (str);
+
+  utf8_str = xml_conv_str (file, str);
+  name = XML_STRING_ADD (utf8_str);
+  g_free (utf8_str);
+
+  return name;
+}
+
 gint
 xml_get_dtd (XMLFile * file)
 {
-  gchar buf[XMLBUFSIZE];
-  gchar *bufp = buf;
+  gchar *buf;
+  gchar *bufp;
 
-  if (xml_get_parenthesis (file, buf, sizeof (buf)) < 0)
+  if ((buf = xml_get_parenthesis (file)) == NULL)
     return -1;
+  bufp = buf;
 
   if ((*bufp++ == '?') &&
       (bufp = strcasestr (bufp, "xml")) && (bufp = strcasestr (bufp + 3, "version")) && (bufp = strchr (bufp + 7, '?')))
@@ -196,18 +259,24 @@ xml_get_dtd (XMLFile * file)
   else
     {
       g_warning ("Can't get xml dtd\n");
+      xml_truncate_buf (file);
       return -1;
     }
 
+  /* UTF-8 and ASCII files need no conversion */
+  file->is_utf8 = !g_ascii_strcasecmp (file->encoding, CS_UTF_8) ||
+    !g_ascii_strcasecmp (file->encoding, "UTF8") || !g_ascii_strcasecmp (file->encoding, CS_US_ASCII);
+
+  xml_truncate_buf (file);
+
   return 0;
 }
 
 gint
 xml_parse_next_tag (XMLFile * file)
 {
-  gchar buf[XMLBUFSIZE];
-  gchar *bufp = buf;
-  gchar *tag_str;
+  gchar *buf;
+  gchar *bufp;
   XMLTag *tag;
   gint len;
 
@@ -218,21 +287,24 @@ xml_parse_next_tag (XMLFile * file)
       return 0;
     }
 
-  if (xml_get_parenthesis (file, buf, sizeof (buf)) < 0)
+  /* the tag is parsed in place in the read buffer */
+  if ((buf = xml_get_parenthesis (file)) == NULL)
     {
       g_warning ("xml_parse_next_tag(): Can't parse next tag\n");
       return -1;
     }
+  bufp = buf;
 
   /* end-tag */
   if (buf[0] == '/')
     {
-      if (strcmp (xml_get_current_tag (file)->tag, buf + 1) != 0)
+      if (!xml_get_current_tag (file) || strcmp (xml_get_current_tag (file)->tag, buf + 1) != 0)
         {
           g_warning ("xml_parse_next_tag(): Tag name mismatch: %s\n", buf);
           return -1;
         }
       xml_pop_tag (file);
+      xml_truncate_buf (file);
       return 0;
     }
 
@@ -246,7 +318,7 @@ xml_parse_next_tag (XMLFile * file)
       buf[len - 1] = '\0';
       g_strchomp (buf);
     }
-  if (strlen (buf) == 0)
+  if (buf[0] == '\0')
     {
       g_warning ("xml_parse_next_tag(): Tag name is empty\n");
       return -1;
@@ -254,30 +326,9 @@ xml_parse_next_tag (XMLFile * file)
 
   while (*bufp != '\0' && !g_ascii_isspace (*bufp))
     bufp++;
-  if (*bufp == '\0')
-    {
-      tag_str = conv_codeset_strdup (buf, file->encoding, CS_INTERNAL);
-      if (tag_str)
-        {
-          tag->tag = XML_STRING_ADD (tag_str);
-          g_free (tag_str);
-        }
-      else
-        tag->tag = XML_STRING_ADD (buf);
-      return 0;
-    }
-  else
-    {
-      *bufp++ = '\0';
-      tag_str = conv_codeset_strdup (buf, file->encoding, CS_INTERNAL);
-      if (tag_str)
-        {
-          tag->tag = XML_STRING_ADD (tag_str);
-          g_free (tag_str);
-        }
-      else
-        tag->tag = XML_STRING_ADD (buf);
-    }
+  if (*bufp != '\0')
+    *bufp++ = '\0';
+  tag->tag = xml_conv_name (file, buf);
 
   /* parse attributes ( name=value ) */
   while (*bufp)
@@ -285,8 +336,6 @@ xml_parse_next_tag (XMLFile * file)
       XMLAttr *attr;
       gchar *attr_name;
       gchar *attr_value;
-      gchar *utf8_attr_name;
-      gchar *utf8_attr_value;
       gchar *p;
       gchar quote;
 
@@ -321,19 +370,15 @@ xml_parse_next_tag (XMLFile * file)
 
       g_strchomp (attr_name);
       xml_unescape_str (attr_value);
-      utf8_attr_name = conv_codeset_strdup (attr_name, file->encoding, CS_INTERNAL);
-      utf8_attr_value = conv_codeset_strdup (attr_value, file->encoding, CS_INTERNAL);
-      if (!utf8_attr_name)
-        utf8_attr_name = g_strdup (attr_name);
-      if (!utf8_attr_value)
-        utf8_attr_value = g_strdup (attr_value);
-
-      attr = xml_attr_new (utf8_attr_name, utf8_attr_value);
-      xml_tag_add_attr (tag, attr);
-
-      g_free (utf8_attr_value);
-      g_free (utf8_attr_name);
+
+      attr = g_new (XMLAttr, 1);
+      attr->name = xml_conv_name (file, attr_name);
+      attr->value = xml_conv_str (file, attr_value);
+      tag->attr = g_list_prepend (tag->attr, attr);
     }
+  tag->attr = g_list_reverse (tag->attr);
+
+  xml_truncate_buf (file);
 
   return 0;
 }
@@ -389,10 +434,14 @@ xml_get_element (XMLFile * file)
   gchar *str;
   gchar *new_str;
   gchar *end;
+  gint offset = 0;
 
-  while ((end = strchr (file->bufp, '<')) == NULL)
-    if (xml_read_line (file) < 0)
-      return NULL;
+  while ((end = strchr (file->bufp + offset, '<')) == NULL)
+    {
+      offset = strlen (file->bufp);
+      if (xml_read_line (file) < 0)
+        return NULL;
+    }
 
   if (end == file->bufp)
     return NULL;
@@ -411,39 +460,44 @@ xml_get_element (XMLFile * file)
       return NULL;
     }
 
-  new_str = conv_codeset_strdup (str, file->encoding, CS_INTERNAL);
-  if (!new_str)
-    new_str = g_strdup (str);
+  if (file->is_utf8 && g_utf8_validate (str, -1, NULL))
+    return str;
+
+  new_str = xml_conv_str (file, str);
   g_free (str);
 
   return new_str;
 }
 
+/* reads the next block of the file into the buffer */
 gint
 xml_read_line (XMLFile * file)
 {
   gchar buf[XMLBUFSIZE];
   gint index;
+  size_t len;
 
-  if (fgets (buf, sizeof (buf), file->fp) == NULL)
+  if ((len = fread (buf, 1, sizeof (buf), file->fp)) == 0)
     return -1;
 
   index = file->bufp - file->buf->str;
 
-  g_string_append (file->buf, buf);
+  g_string_append_len (file->buf, buf, len);
 
   file->bufp = file->buf->str + index;
 
   return 0;
 }
 
+/* discards the parsed part of the buffer.  it is kept until it grows
+ * large so that the rest is not moved after each tag */
 void
 xml_truncate_buf (XMLFile * file)
 {
   gint len;
 
   len = file->bufp - file->buf->str;
-  if (len > 0)
+  if (len >= XMLBUFSIZE || (len > 0 && *file->bufp == '\0'))
     {
       g_string_erase (file->buf, 0, len);
       file->bufp = file->buf->str;
@@ -534,47 +588,53 @@ xml_copy_attr (XMLAttr * attr)
 gint
 xml_unescape_str (gchar * str)
 {
-  gchar *start;
-  gchar *end;
-  gchar *p = str;
-  gchar ch;
-  gint len;
+  gchar *p;
+  gchar *q;
 
-  while ((start = strchr (p, '&')) != NULL)
-    {
-      if ((end = strchr (start + 1, ';')) == NULL)
-        {
-          g_warning ("Unescaped `&' appeared\n");
-          p = start + 1;
-          continue;
-        }
-      len = end - start + 1;
-      if (len < 3)
-        {
-          p = end + 1;
-          continue;
-        }
+  if ((p = strchr (str, '&')) == NULL)
+    return 0;
 
-      if (!strncmp (start, "&lt;", 4))
-        ch = '<';
-      else if (!strncmp (start, "&gt;", 4))
-        ch = '>';
-      else if (!strncmp (start, "&amp;", 5))
-        ch = '&';
-      else if (!strncmp (start, "&apos;", 6))
-        ch = '\'';
-      else if (!strncmp (start, "&quot;", 6))
-        ch = '\"';
-      else
+  /* entities are replaced in a single pass */
+  for (q = p; *p != '\0';)
+    {
+      if (*p == '&')
         {
-          p = end + 1;
-          continue;
+          if (!strncmp (p, "&lt;", 4))
+            {
+              *q++ = '<';
+              p += 4;
+              continue;
+            }
+          else if (!strncmp (p, "&gt;", 4))
+            {
+              *q++ = '>';
+              p += 4;
+              continue;
+            }
+          else if (!strncmp (p, "&amp;", 5))
+            {
+              *q++ = '&';
+              p += 5;
+              continue;
+            }
+          else if (!strncmp (p, "&apos;", 6))
+            {
+              *q++ = '\'';
+              p += 6;
+              continue;
+            }
+          else if (!strncmp (p, "&quot;", 6))
+            {
+              *q++ = '\"';
+              p += 6;
+              continue;
+            }
+          else if (!strchr (p + 1, ';'))
+            g_warning ("Unescaped `&' appeared\n");
         }
-
-      *start = ch;
-      memmove (start + 1, end + 1, strlen (end + 1) + 1);
-      p = start + 1;
+      *q++ = *p++;
     }
+  *q = '\0';
 
   return 0;
 }
@@ -743,29 +803,58 @@ xml_free_tag (XMLTag * tag)
   g_free (tag);
 }
 
-static gint
-xml_get_parenthesis (XMLFile * file, gchar * buf, gint len)
+/* returns the content of the next tag, which is terminated and
+ * stripped in the read buffer.  it is valid until the buffer is
+ * read or truncated again */
+static gchar *
+xml_get_parenthesis (XMLFile * file)
 {
   gchar *start;
-  gchar *end;
-
-  buf[0] = '\0';
+  gchar *p;
+  gint offset;
+  gint pos;
+  gboolean is_markup;
+  gchar quote = '\0';
 
   while ((start = strchr (file->bufp, '<')) == NULL)
-    if (xml_read_line (file) < 0)
-      return -1;
+    {
+      /* the text before the tag is skipped */
+      file->bufp = file->buf->str + file->buf->len;
+      if (xml_read_line (file) < 0)
+        return NULL;
+    }
 
-  start++;
-  file->bufp = start;
+  file->bufp = start + 1;
+  offset = file->bufp - file->buf->str;
+  is_markup = *file->bufp == '!';
 
-  while ((end = strchr (file->bufp, '>')) == NULL)
-    if (xml_read_line (file) < 0)
-      return -1;
+  /* '>' in the attribute values does not close the tag */
+  for (p = file->bufp;;)
+    {
+      for (; *p != '\0'; p++)
+        {
+          if (quote)
+            {
+              if (*p == quote)
+                quote = '\0';
+            }
+          else if (*p == '>')
+            break;
+          else if ((*p == '"' || *p == '\'') && !is_markup)
+            quote = *p;
+        }
+      if (*p == '>')
+        break;
 
-  strncpy2 (buf, file->bufp, MIN (end - file->bufp + 1, len));
-  g_strstrip (buf);
-  file->bufp = end + 1;
-  xml_truncate_buf (file);
+      pos = p - file->buf->str;
+      if (xml_read_line (file) < 0)
+        return NULL;
+      p = file->buf->str + pos;
+    }
 
-  return 0;
+  start = file->buf->str + offset;
+  *p = '\0';
+  file->bufp = p + 1;
+
+  return g_strstrip (start);
 }
@@ -59,6 +59,8 @@ struct _XMLFile {
   guint level;
 
   gboolean is_empty_element;
+  /* the file needs no conversion to the internal code set */
+  gboolean is_utf8;
 };
 
 XMLFile *xml_open_file (const gchar * path);
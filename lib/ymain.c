@@ -44,6 +44,7 @@
 #include "socket.h"
 #include "codeconv.h"
 #include "utils.h"
+#include "metrics.h"
 
 #if USE_SSL
 #include "ssl.h"
@@ -103,6 +104,7 @@ yam_app_class_init (YamAppClass * klass)
                   0,
                   NULL, NULL,
                   yam_marshal_VOID__POINTER_STRING_UINT, G_TYPE_NONE, 3, G_TYPE_POINTER, G_TYPE_STRING, G_TYPE_UINT);
+  /* emitted while the file can still be read */
   app_signals[REMOVE_MSG] =
     g_signal_new ("remove-msg",
                   G_TYPE_FROM_CLASS (gobject_class),
@@ -164,6 +166,9 @@ yam_init (void)
 
   /* ignore SIGPIPE signal for preventing sudden death of program */
   signal (SIGPIPE, SIG_IGN);
+
+  if (g_getenv ("YAM_TRACE_FILE"))
+    metrics_trace_open (g_getenv ("YAM_TRACE_FILE"));
 }
 
 #define MAKE_DIR_IF_NOT_EXIST(dir)					\
@@ -237,6 +242,14 @@ yam_save_all_state (void)
 void
 yam_cleanup (void)
 {
+  gchar *summary;
+
+  summary = metrics_get_summary ();
+  if (*summary != '\0')
+    debug_print ("performance metrics:\n%s", summary);
+  g_free (summary);
+  metrics_trace_close ();
+
   /* remove temporary files */
   remove_all_files (get_tmp_dir ());
   remove_all_files (get_mime_tmp_dir ());
@@ -509,6 +509,7 @@ message_actions_execute (MessageView * msgview, guint action_nb, GSList * msg_li
   textview = messageview_get_current_textview (msgview);
   if (textview)
     {
+      textview_render_complete (textview);
       text = textview->text;
       body_pos = textview->body_pos;
     }
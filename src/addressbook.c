@@ -3265,6 +3265,12 @@ addressbook_read_file (void)
                   addrIndex->filePath, G_DIR_SEPARATOR, addrIndex->fileName);
       alertpanel_message (_("Address Book Error"), msg, ALERT_ERROR);
     }
+
+  /* the address book is read after startup; drop the tables built
+   * before it was available */
+  if (_addressIndex_)
+    addressbook_modified ();
+
   debug_print ("done.\n");
 }
 
@@ -243,12 +243,8 @@ static gint
 export_eml (FolderItem * src, GSList * sel_mlist, const gchar * path, gint type)
 {
   const gchar *ext = "";
-  GSList *mlist, *cur;
-  MsgInfo *msginfo;
-  gchar *file, *dest;
-  guint count = 0;
-  guint total;
-  gint ok = 0;
+  GSList *mlist;
+  gint ok;
 
   g_return_val_if_fail (src != NULL, -1);
   g_return_val_if_fail (path != NULL, -1);
@@ -279,44 +275,10 @@ export_eml (FolderItem * src, GSList * sel_mlist, const gchar * path, gint type)
       if (!mlist)
         return 0;
     }
-  total = g_slist_length (mlist);
-
-  for (cur = mlist; cur != NULL; cur = cur->next)
-    {
-      msginfo = (MsgInfo *) cur->data;
 
-      count++;
-      if (export_mbox_func (src->folder, src, count, total, NULL) == FALSE)
-        {
-          ok = -2;
-          break;
-        }
-
-      file = folder_item_fetch_msg (src, msginfo->msgnum);
-      if (!file)
-        {
-          ok = -1;
-          break;
-        }
-      dest = g_strdup_printf ("%s%c%u%s", path, G_DIR_SEPARATOR, count, ext);
-      if (g_file_test (dest, G_FILE_TEST_EXISTS))
-        {
-          g_warning ("export_eml(): %s already exists.", dest);
-          g_free (dest);
-          g_free (file);
-          ok = -1;
-          break;
-        }
-      if (copy_file (file, dest, FALSE) < 0)
-        {
-          g_free (dest);
-          g_free (file);
-          ok = -1;
-          break;
-        }
-      g_free (dest);
-      g_free (file);
-    }
+  folder_set_ui_func2 (src->folder, export_mbox_func, NULL);
+  ok = export_msgs_to_dir (src, mlist, path, ext);
+  folder_set_ui_func2 (src->folder, NULL, NULL);
 
   if (!sel_mlist)
     procmsg_msg_list_free (mlist);
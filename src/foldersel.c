@@ -355,6 +355,9 @@ foldersel_append_item (GtkTreeStore * store, FolderItem * item, GtkTreeIter * it
         case F_MH:
           sub = " (MH)";
           break;
+        case F_MAILDIR:
+          sub = " (Maildir)";
+          break;
         case F_IMAP:
           sub = " (IMAP4)";
           break;
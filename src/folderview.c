@@ -91,6 +91,9 @@ enum {
 
 static GList *folderview_list = NULL;
 
+static gboolean download_running = FALSE;
+static gboolean download_cancelled = FALSE;
+
 static GdkPixbuf *inbox_pixbuf = NULL;
 static GdkPixbuf *outbox_pixbuf = NULL;
 static GdkPixbuf *folder_pixbuf = NULL;
@@ -1162,6 +1165,9 @@ folderview_update_row (FolderView * folderview, GtkTreeIter * iter)
             case F_MH:
               name = " (MH)";
               break;
+            case F_MAILDIR:
+              name = " (Maildir)";
+              break;
             case F_IMAP:
               name = " (IMAP4)";
               break;
@@ -2163,6 +2169,21 @@ folderview_download_func (Folder * folder, FolderItem * item, gpointer data)
     }
 }
 
+static gboolean
+folderview_download_func2 (Folder * folder, FolderItem * item, guint count, guint total, gpointer data)
+{
+  GList *list;
+
+  for (list = folderview_list; list != NULL; list = list->next)
+    {
+      FolderView *folderview = (FolderView *) list->data;
+
+      main_window_progress_set (folderview->mainwin, count, total);
+    }
+
+  return !download_cancelled;
+}
+
 static void
 folderview_download_cb (FolderView * folderview, guint action, GtkWidget * widget)
 {
@@ -2197,11 +2218,14 @@ folderview_download_cb (FolderView * folderview, guint action, GtkWidget * widge
     return;
 
   main_window_cursor_wait (mainwin);
+  download_running = TRUE;
+  download_cancelled = FALSE;
   inc_lock ();
   main_window_lock (mainwin);
   gtk_widget_set_sensitive (folderview->treeview, FALSE);
   GTK_EVENTS_FLUSH ();
   folder_set_ui_func (item->folder, folderview_download_func, NULL);
+  folder_set_ui_func2 (item->folder, folderview_download_func2, NULL);
 
   if (item->parent == NULL)
     {
@@ -2228,7 +2252,7 @@ folderview_download_cb (FolderView * folderview, guint action, GtkWidget * widge
   else
     ret = folder_item_fetch_all_msg (item);
 
-  if (ret < 0)
+  if (ret == -1)
     {
       gchar *name;
 
@@ -2238,14 +2262,29 @@ folderview_download_cb (FolderView * folderview, guint action, GtkWidget * widge
     }
 
   folder_set_ui_func (item->folder, NULL, NULL);
+  folder_set_ui_func2 (item->folder, NULL, NULL);
   main_window_progress_off (mainwin);
   gtk_widget_set_sensitive (folderview->treeview, TRUE);
+  download_running = FALSE;
   main_window_unlock (mainwin);
   inc_unlock ();
   main_window_cursor_normal (mainwin);
   statusbar_pop_all ();
 }
 
+gboolean
+folderview_is_downloading (void)
+{
+  return download_running;
+}
+
+void
+folderview_cancel_download (void)
+{
+  if (download_running)
+    download_cancelled = TRUE;
+}
+
 static void
 folderview_update_tree_cb (FolderView * folderview, guint action, GtkWidget * widget)
 {
@@ -109,4 +109,7 @@ void folderview_check_new_selected (FolderView * folderview);
 void folderview_remove_mailbox (FolderView * folderview);
 void folderview_rebuild_tree (FolderView * folderview);
 
+gboolean folderview_is_downloading (void);
+void folderview_cancel_download (void);
+
 #endif /* __FOLDERVIEW_H__ */
@@ -76,8 +76,42 @@ struct _IncResult {
   GSList *msg_summaries;
 };
 
+typedef struct _IncDropJob {
+  IncSession *session;
+  gint msgnum;
+  gchar *file;
+
+  MsgInfo *msginfo;
+  FilterInfo *fltinfo;
+  gboolean is_junk;
+  gboolean exec_failed;
+
+  GSList *add_list;             /* IncDropAdd, in filter order */
+  gboolean add_error;
+
+  gboolean done;
+} IncDropJob;
+
+/* one folder addition of a received message */
+typedef struct _IncDropAdd {
+  IncDropJob *job;
+  FolderItem *dest;
+  MsgInfo *msginfo;             /* copy carrying the flags for dest */
+  FilterActionType type;        /* FLT_ACTION_NONE for the inbox */
+  gboolean failed;
+} IncDropAdd;
+
+/* received messages are parsed and filtered on a thread pool, and
+   committed to the folders in arrival order on the main thread */
+#define INC_DROP_MAX_PENDING	64
+
 static GList *inc_dialog_list = NULL;
 
+static GThreadPool *inc_drop_pool = NULL;
+static GMutex inc_drop_mutex;
+static GCond inc_drop_cond;
+static gint inc_drop_depth = 0;
+
 static gboolean inc_is_running = FALSE;
 
 static guint inc_lock_count = 0;
@@ -101,7 +135,9 @@ static void inc_progress_dialog_destroy (IncProgressDialog * inc_dialog);
 static IncSession *inc_session_new (PrefsAccount * account);
 static void inc_session_destroy (IncSession * session);
 static gint inc_start (IncProgressDialog * inc_dialog);
-static IncState inc_pop3_session_do (IncSession * session);
+static gboolean inc_session_finish (IncProgressDialog * inc_dialog, IncSession * session, IncState inc_state);
+static IncState inc_pop3_session_start (IncSession * session);
+static IncState inc_pop3_session_finish (IncSession * session);
 
 static void inc_progress_dialog_update (IncProgressDialog * inc_dialog, IncSession * inc_session);
 
@@ -117,6 +153,12 @@ static gint inc_recv_data_progressive (Session * session, guint cur_len, guint t
 static gint inc_recv_data_finished (Session * session, guint len, gpointer data);
 static gint inc_recv_message (Session * session, const gchar * msg, gpointer data);
 static gint inc_drop_message (Pop3Session * session, const gchar * file);
+static gint inc_drop_flush (Pop3Session * session);
+static void inc_drop_filter (IncDropJob * job);
+static void inc_drop_filter_func (gpointer data, gpointer user_data);
+static gint inc_drop_commit_queue (IncSession * inc_session, gboolean all);
+static void inc_drop_add_batch (GSList * batch, FolderItem * inbox);
+static gint inc_drop_commit (IncDropJob * job, FolderItem * inbox);
 
 static void inc_put_error (IncSession * session, IncState istate, const gchar * pop3_msg);
 
@@ -714,6 +756,7 @@ inc_progress_dialog_set_list (IncProgressDialog * inc_dialog)
       Pop3Session *pop3_session = POP3_SESSION (session->session);
 
       session->data = inc_dialog;
+      session->row = inc_dialog->cur_row++;
       progress_dialog_append (inc_dialog->dialog, NULL, pop3_session->ac_prefs->account_name, _("Standby"), "", NULL);
     }
 }
@@ -741,6 +784,33 @@ inc_progress_dialog_destroy (IncProgressDialog * inc_dialog)
   g_free (inc_dialog);
 }
 
+/* whether any rule runs an external command */
+static gboolean
+inc_filter_list_runs_command (GSList * fltlist)
+{
+  GSList *cur, *cur_;
+
+  for (cur = fltlist; cur != NULL; cur = cur->next)
+    {
+      FilterRule *rule = (FilterRule *) cur->data;
+
+      for (cur_ = rule->cond_list; cur_ != NULL; cur_ = cur_->next)
+        {
+          if (((FilterCond *) cur_->data)->type == FLT_COND_CMD_TEST)
+            return TRUE;
+        }
+      for (cur_ = rule->action_list; cur_ != NULL; cur_ = cur_->next)
+        {
+          FilterActionType type = ((FilterAction *) cur_->data)->type;
+
+          if (type == FLT_ACTION_EXEC || type == FLT_ACTION_EXEC_ASYNC)
+            return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
 static IncSession *
 inc_session_new (PrefsAccount * account)
 {
@@ -759,6 +829,7 @@ inc_session_new (PrefsAccount * account)
   session->session = pop3_session_new (account);
   session->session->data = session;
   POP3_SESSION (session->session)->drop_message = inc_drop_message;
+  POP3_SESSION (session->session)->drop_flush = inc_drop_flush;
   session_set_recv_message_notify (session->session, inc_recv_message, session);
   session_set_recv_data_progressive_notify (session->session, inc_recv_data_progressive, session);
   session_set_recv_data_notify (session->session, inc_recv_data_finished, session);
@@ -773,6 +844,11 @@ inc_session_new (PrefsAccount * account)
     session->junk_fltlist = g_slist_append (NULL, rule);
   else
     session->junk_fltlist = NULL;
+  /* the rules are evaluated on the thread pool, while the filter
+     setting may be edited on the main thread */
+  session->fltlist = filter_rule_list_copy (prefs_common.fltlist);
+  session->filter_serial = inc_filter_list_runs_command (session->fltlist);
+  session->drop_queue = g_queue_new ();
 
   session->cur_total_bytes = 0;
   session->new_msgs = 0;
@@ -795,6 +871,8 @@ inc_session_destroy (IncSession * session)
   g_hash_table_destroy (session->tmp_folder_table);
   if (session->junk_fltlist)
     filter_rule_list_free (session->junk_fltlist);
+  filter_rule_list_free (session->fltlist);
+  g_queue_free (session->drop_queue);
   g_free (session);
 }
 
@@ -810,11 +888,13 @@ inc_start (IncProgressDialog * inc_dialog)
 {
   IncSession *session;
   GList *qlist;
+  GList *waiting;
+  GList *running = NULL;
   Pop3Session *pop3_session;
   IncState inc_state;
-  gint error_num = 0;
+  gint max_sessions;
   gint new_msgs = 0;
-  gchar *msg;
+  gboolean fatal = FALSE;
   gchar *fin_msg;
 
   qlist = inc_dialog->queue_list;
@@ -852,114 +932,81 @@ inc_start (IncProgressDialog * inc_dialog)
       qlist = next;
     }
 
-#define SET_PIXMAP_AND_TEXT(pixbuf, status, progress)               \
-  {                                                                 \
-	progress_dialog_set_row_pixbuf(inc_dialog->dialog,              \
-                                   inc_dialog->cur_row, pixbuf);	\
-	progress_dialog_set_row_status(inc_dialog->dialog,              \
-                                   inc_dialog->cur_row, status);	\
-	if (progress)                                                   \
-      progress_dialog_set_row_progress(inc_dialog->dialog,          \
-                                       inc_dialog->cur_row,         \
-                                       progress);                   \
-  }
+  inc_progress_dialog_clear (inc_dialog);
 
-  for (; inc_dialog->queue_list != NULL; inc_dialog->cur_row++)
-    {
-      session = inc_dialog->queue_list->data;
-      pop3_session = POP3_SESSION (session->session);
+  /* the sessions are driven by the main loop, so several of them can
+     be run at once; received messages are still dropped one by one */
+  max_sessions = MAX (prefs_common.recv_max_sessions, 1);
+  waiting = g_list_copy (inc_dialog->queue_list);
 
-      if (session->inc_state == INC_CANCEL || pop3_session->pass == NULL)
+  for (;;)
+    {
+      while (waiting != NULL && (gint) g_list_length (running) < max_sessions)
         {
-          SET_PIXMAP_AND_TEXT (ok_pixbuf, _("Cancelled"), NULL);
-          inc_session_destroy (session);
-          inc_dialog->queue_list = g_list_remove (inc_dialog->queue_list, session);
-          continue;
-        }
-
-      inc_progress_dialog_clear (inc_dialog);
-      progress_dialog_scroll_to_row (inc_dialog->dialog, inc_dialog->cur_row);
+          session = waiting->data;
+          waiting = g_list_delete_link (waiting, waiting);
+          pop3_session = POP3_SESSION (session->session);
 
-      SET_PIXMAP_AND_TEXT (current_pixbuf, _("Retrieving"), NULL);
+          if (fatal || session->inc_state == INC_CANCEL || pop3_session->pass == NULL)
+            {
+              progress_dialog_set_row_pixbuf (inc_dialog->dialog, session->row, ok_pixbuf);
+              progress_dialog_set_row_status (inc_dialog->dialog, session->row, _("Cancelled"));
+              inc_session_destroy (session);
+              inc_dialog->queue_list = g_list_remove (inc_dialog->queue_list, session);
+              continue;
+            }
 
-      /* begin POP3 session */
-      inc_state = inc_pop3_session_do (session);
+          progress_dialog_scroll_to_row (inc_dialog->dialog, session->row);
+          progress_dialog_set_row_pixbuf (inc_dialog->dialog, session->row, current_pixbuf);
+          progress_dialog_set_row_status (inc_dialog->dialog, session->row, _("Retrieving"));
 
-      switch (inc_state)
-        {
-        case INC_SUCCESS:
-          if (pop3_session->cur_total_num > 0)
-            msg = g_strdup_printf
-              (_("%d message(s) (%s) received"),
-               pop3_session->cur_total_num, to_human_readable (pop3_session->cur_total_recv_bytes));
+          /* begin POP3 session */
+          inc_state = inc_pop3_session_start (session);
+          if (inc_state == INC_SUCCESS)
+            running = g_list_append (running, session);
           else
-            msg = g_strdup_printf (_("no new messages"));
-          SET_PIXMAP_AND_TEXT (ok_pixbuf, _("Done"), msg);
-          g_free (msg);
-          break;
-        case INC_LOOKUP_ERROR:
-          SET_PIXMAP_AND_TEXT (error_pixbuf, _("Server not found"), NULL);
-          break;
-        case INC_CONNECT_ERROR:
-          SET_PIXMAP_AND_TEXT (error_pixbuf, _("Connection failed"), NULL);
-          break;
-        case INC_AUTH_FAILED:
-          SET_PIXMAP_AND_TEXT (error_pixbuf, _("Auth failed"), NULL);
-          break;
-        case INC_LOCKED:
-          SET_PIXMAP_AND_TEXT (error_pixbuf, _("Locked"), NULL);
-          break;
-        case INC_ERROR:
-        case INC_NO_SPACE:
-        case INC_IO_ERROR:
-        case INC_SOCKET_ERROR:
-        case INC_EOF:
-          SET_PIXMAP_AND_TEXT (error_pixbuf, _("Error"), NULL);
-          break;
-        case INC_TIMEOUT:
-          SET_PIXMAP_AND_TEXT (error_pixbuf, _("Timeout"), NULL);
-          break;
-        case INC_CANCEL:
-          SET_PIXMAP_AND_TEXT (ok_pixbuf, _("Cancelled"), NULL);
-          break;
-        default:
-          break;
+            {
+              new_msgs += session->new_msgs;
+              if (inc_session_finish (inc_dialog, session, inc_state))
+                fatal = TRUE;
+            }
         }
 
-      if (inc_dialog->result)
-        inc_dialog->result->count_list =
-          inc_add_message_count (inc_dialog->result->count_list, pop3_session->ac_prefs, session->new_msgs);
-      new_msgs += session->new_msgs;
-
-      if (!prefs_common.scan_all_after_inc)
-        inc_update_folder_foreach (session->folder_table);
-
-      if (pop3_session->error_val == PS_AUTHFAIL && pop3_session->ac_prefs->tmp_pass)
+      for (qlist = running; qlist != NULL;)
         {
-          g_free (pop3_session->ac_prefs->tmp_pass);
-          pop3_session->ac_prefs->tmp_pass = NULL;
-        }
+          GList *next = qlist->next;
 
-      pop3_write_uidl_list (pop3_session);
+          session = qlist->data;
+          if (!session_is_connected (session->session) || session->inc_state == INC_CANCEL)
+            {
+              running = g_list_delete_link (running, qlist);
+              inc_state = inc_pop3_session_finish (session);
+              new_msgs += session->new_msgs;
+              if (inc_session_finish (inc_dialog, session, inc_state))
+                fatal = TRUE;
+            }
+          qlist = next;
+        }
 
-      if (inc_state != INC_SUCCESS && inc_state != INC_CANCEL)
+      if (fatal)
         {
-          error_num++;
-          if (inc_dialog->show_dialog)
-            manage_window_focus_in (inc_dialog->dialog->window, NULL, NULL);
-          inc_put_error (session, inc_state, pop3_session->error_msg);
-          if (inc_dialog->show_dialog)
-            manage_window_focus_out (inc_dialog->dialog->window, NULL, NULL);
-          if (inc_state == INC_NO_SPACE || inc_state == INC_IO_ERROR)
-            break;
+          for (qlist = running; qlist != NULL; qlist = qlist->next)
+            {
+              session = qlist->data;
+              if (session->inc_state != INC_CANCEL)
+                {
+                  session->inc_state = INC_CANCEL;
+                  session_disconnect (session->session);
+                }
+            }
         }
 
-      inc_session_destroy (session);
-      inc_dialog->queue_list = g_list_remove (inc_dialog->queue_list, session);
+      if (running != NULL)
+        gtk_main_iteration ();
+      else if (waiting == NULL)
+        break;
     }
 
-#undef SET_PIXMAP_AND_TEXT
-
   if (new_msgs > 0)
     fin_msg = g_strdup_printf (_("Finished (%d new message(s))"), new_msgs);
   else
@@ -987,8 +1034,104 @@ inc_start (IncProgressDialog * inc_dialog)
   return new_msgs;
 }
 
+/* reports the result of a finished session and destroys it.
+   returns TRUE if the error is fatal for the remaining sessions. */
+static gboolean
+inc_session_finish (IncProgressDialog * inc_dialog, IncSession * session, IncState inc_state)
+{
+  Pop3Session *pop3_session = POP3_SESSION (session->session);
+  gboolean fatal = FALSE;
+  gchar *msg;
+
+#define SET_PIXMAP_AND_TEXT(pixbuf, status, progress)               \
+  {                                                                 \
+	progress_dialog_set_row_pixbuf(inc_dialog->dialog,              \
+                                   session->row, pixbuf);           \
+	progress_dialog_set_row_status(inc_dialog->dialog,              \
+                                   session->row, status);           \
+	if (progress)                                                   \
+      progress_dialog_set_row_progress(inc_dialog->dialog,          \
+                                       session->row,                \
+                                       progress);                   \
+  }
+
+  switch (inc_state)
+    {
+    case INC_SUCCESS:
+      if (pop3_session->cur_total_num > 0)
+        msg = g_strdup_printf
+          (_("%d message(s) (%s) received"),
+           pop3_session->cur_total_num, to_human_readable (pop3_session->cur_total_recv_bytes));
+      else
+        msg = g_strdup_printf (_("no new messages"));
+      SET_PIXMAP_AND_TEXT (ok_pixbuf, _("Done"), msg);
+      g_free (msg);
+      break;
+    case INC_LOOKUP_ERROR:
+      SET_PIXMAP_AND_TEXT (error_pixbuf, _("Server not found"), NULL);
+      break;
+    case INC_CONNECT_ERROR:
+      SET_PIXMAP_AND_TEXT (error_pixbuf, _("Connection failed"), NULL);
+      break;
+    case INC_AUTH_FAILED:
+      SET_PIXMAP_AND_TEXT (error_pixbuf, _("Auth failed"), NULL);
+      break;
+    case INC_LOCKED:
+      SET_PIXMAP_AND_TEXT (error_pixbuf, _("Locked"), NULL);
+      break;
+    case INC_ERROR:
+    case INC_NO_SPACE:
+    case INC_IO_ERROR:
+    case INC_SOCKET_ERROR:
+    case INC_EOF:
+      SET_PIXMAP_AND_TEXT (error_pixbuf, _("Error"), NULL);
+      break;
+    case INC_TIMEOUT:
+      SET_PIXMAP_AND_TEXT (error_pixbuf, _("Timeout"), NULL);
+      break;
+    case INC_CANCEL:
+      SET_PIXMAP_AND_TEXT (ok_pixbuf, _("Cancelled"), NULL);
+      break;
+    default:
+      break;
+    }
+
+#undef SET_PIXMAP_AND_TEXT
+
+  if (inc_dialog->result)
+    inc_dialog->result->count_list =
+      inc_add_message_count (inc_dialog->result->count_list, pop3_session->ac_prefs, session->new_msgs);
+
+  if (!prefs_common.scan_all_after_inc)
+    inc_update_folder_foreach (session->folder_table);
+
+  if (pop3_session->error_val == PS_AUTHFAIL && pop3_session->ac_prefs->tmp_pass)
+    {
+      g_free (pop3_session->ac_prefs->tmp_pass);
+      pop3_session->ac_prefs->tmp_pass = NULL;
+    }
+
+  pop3_write_uidl_list (pop3_session);
+
+  if (inc_state != INC_SUCCESS && inc_state != INC_CANCEL)
+    {
+      if (inc_dialog->show_dialog)
+        manage_window_focus_in (inc_dialog->dialog->window, NULL, NULL);
+      inc_put_error (session, inc_state, pop3_session->error_msg);
+      if (inc_dialog->show_dialog)
+        manage_window_focus_out (inc_dialog->dialog->window, NULL, NULL);
+      if (inc_state == INC_NO_SPACE || inc_state == INC_IO_ERROR)
+        fatal = TRUE;
+    }
+
+  inc_session_destroy (session);
+  inc_dialog->queue_list = g_list_remove (inc_dialog->queue_list, session);
+
+  return fatal;
+}
+
 static IncState
-inc_pop3_session_do (IncSession * session)
+inc_pop3_session_start (IncSession * session)
 {
   Pop3Session *pop3_session = POP3_SESSION (session->session);
   IncProgressDialog *inc_dialog = (IncProgressDialog *) session->data;
@@ -1030,8 +1173,18 @@ inc_pop3_session_do (IncSession * session)
       return session->inc_state;
     }
 
-  while (session_is_connected (SESSION (pop3_session)) && session->inc_state != INC_CANCEL)
-    gtk_main_iteration ();
+  return INC_SUCCESS;
+}
+
+static IncState
+inc_pop3_session_finish (IncSession * session)
+{
+  Pop3Session *pop3_session = POP3_SESSION (session->session);
+
+  /* messages still being filtered when the session ended */
+  if (inc_drop_flush (pop3_session) < 0 && pop3_session->error_val == PS_SUCCESS)
+    pop3_session->error_val = PS_IOERR;
+
   log_window_flush ();
 
   debug_print ("inc_state: %d\n", session->inc_state);
@@ -1144,6 +1297,7 @@ inc_progress_dialog_set_progress (IncProgressDialog * inc_dialog, IncSession * i
 {
   gchar buf[BUFFSIZE];
   Pop3Session *pop3_session = POP3_SESSION (inc_session->session);
+  GList *list;
   gint64 cur_total;
   gint64 total;
   gint cur_num;
@@ -1177,6 +1331,19 @@ inc_progress_dialog_set_progress (IncProgressDialog * inc_dialog, IncSession * i
       progress_dialog_set_label (inc_dialog->dialog, buf);
     }
 
+  /* the progress bar covers all sessions running at the moment */
+  cur_total = total = 0;
+  for (list = inc_dialog->queue_list; list != NULL; list = list->next)
+    {
+      IncSession *cur_session = (IncSession *) list->data;
+      Pop3Session *cur_pop3 = POP3_SESSION (cur_session->session);
+
+      if (cur_session->retr_count == 0)
+        continue;
+      cur_total += cur_session->cur_total_bytes - cur_session->start_recv_bytes;
+      total += cur_pop3->total_bytes - cur_session->start_recv_bytes;
+    }
+
   if (total > 0)
     {
       gfloat cval = (gfloat) cur_total / (gfloat) total;
@@ -1188,7 +1355,7 @@ inc_progress_dialog_set_progress (IncProgressDialog * inc_dialog, IncSession * i
     {
       g_snprintf (buf, sizeof (buf), _("%d message(s) (%s) received"),
                   pop3_session->cur_total_num, to_human_readable (pop3_session->cur_total_recv_bytes));
-      progress_dialog_set_row_progress (inc_dialog->dialog, inc_dialog->cur_row, buf);
+      progress_dialog_set_row_progress (inc_dialog->dialog, inc_session->row, buf);
     }
 }
 
@@ -1369,81 +1536,166 @@ inc_recv_message (Session * session, const gchar * msg, gpointer data)
  * @file: Received message file.
  *
  * Callback function to drop received message into local mailbox.
+ * The message is filtered in the background; the result is set by
+ * inc_drop_flush().
  *
- * Return value: DROP_OK if succeeded. DROP_ERROR if error occurred.
- *   DROP_DONT_RECEIVE if the message should be skipped.
- *   DROP_DELETE if the message should be deleted.
+ * Return value: DROP_DEFERRED if the message was queued.
+ *   DROP_ERROR if error occurred.
  **/
 static gint
 inc_drop_message (Pop3Session * session, const gchar * file)
 {
-  FolderItem *inbox;
-  GSList *cur;
-  MsgInfo *msginfo;
-  FilterInfo *fltinfo;
   IncSession *inc_session = (IncSession *) (SESSION (session)->data);
-  gint val;
-  gboolean is_junk = FALSE;
-  gboolean is_counted = FALSE;
-  IncProgressDialog *inc_dialog;
+  IncDropJob *job;
 
   g_return_val_if_fail (inc_session != NULL, DROP_ERROR);
 
-  gdk_threads_enter ();
+  /* committing may iterate the main loop, so another session can get
+     here while messages are being added to the folders.  Such messages
+     are only queued, and committed by a later call. */
+  if (inc_drop_depth == 0)
+    {
+      gint ret;
 
-  inc_dialog = (IncProgressDialog *) inc_session->data;
+      inc_drop_depth++;
+      ret = inc_drop_commit_queue (inc_session, FALSE);
+      inc_drop_depth--;
+      if (ret < 0)
+        return DROP_ERROR;
+    }
 
-  if (session->ac_prefs->inbox)
+  job = g_new0 (IncDropJob, 1);
+  job->session = inc_session;
+  job->msgnum = session->cur_msg;
+  job->file = get_tmp_file ();
+  if (copy_file (file, job->file, FALSE) < 0)
     {
-      inbox = folder_find_item_from_identifier (session->ac_prefs->inbox);
-      if (!inbox)
-        inbox = folder_get_default_inbox ();
+      g_free (job->file);
+      g_free (job);
+      return DROP_ERROR;
     }
-  else
-    inbox = folder_get_default_inbox ();
-  if (!inbox)
+
+  /* commands run by the rules must see the messages one at a time,
+     in arrival order */
+  if (inc_session->filter_serial)
     {
-      gdk_threads_leave ();
-      return DROP_ERROR;
+      inc_drop_filter (job);
+      job->done = TRUE;
+      g_queue_push_tail (inc_session->drop_queue, job);
+      return DROP_DEFERRED;
     }
 
+  if (!inc_drop_pool)
+    inc_drop_pool = g_thread_pool_new (inc_drop_filter_func, NULL, g_get_num_processors (), FALSE, NULL);
+
+  g_queue_push_tail (inc_session->drop_queue, job);
+  g_thread_pool_push (inc_drop_pool, job, NULL);
+
+  return DROP_DEFERRED;
+}
+
+/* commits every queued message of the session and sets the receive
+   state of them, before the POP3 session deletes anything */
+static gint
+inc_drop_flush (Pop3Session * session)
+{
+  IncSession *inc_session = (IncSession *) (SESSION (session)->data);
+  gint ret;
+
+  g_return_val_if_fail (inc_session != NULL, -1);
+
+  inc_drop_depth++;
+  ret = inc_drop_commit_queue (inc_session, TRUE);
+  inc_drop_depth--;
+
+  return ret;
+}
+
+static void
+inc_drop_job_free (IncDropJob * job)
+{
+  GSList *cur;
+
+  for (cur = job->add_list; cur != NULL; cur = cur->next)
+    {
+      IncDropAdd *add = (IncDropAdd *) cur->data;
+
+      procmsg_msginfo_free (add->msginfo);
+      g_free (add);
+    }
+  g_slist_free (job->add_list);
+  if (job->msginfo)
+    procmsg_msginfo_free (job->msginfo);
+  if (job->fltinfo)
+    filter_info_free (job->fltinfo);
+  g_unlink (job->file);
+  g_free (job->file);
+  g_free (job);
+}
+
+static void
+inc_drop_job_wait (IncDropJob * job)
+{
+  g_mutex_lock (&inc_drop_mutex);
+  while (!job->done)
+    g_cond_wait (&inc_drop_cond, &inc_drop_mutex);
+  g_mutex_unlock (&inc_drop_mutex);
+}
+
+static gboolean
+inc_drop_job_is_done (IncDropJob * job)
+{
+  gboolean done;
+
+  g_mutex_lock (&inc_drop_mutex);
+  done = job->done;
+  g_mutex_unlock (&inc_drop_mutex);
+
+  return done;
+}
+
+/* runs on the thread pool: parses the message and evaluates the junk
+   and user filter rules.  nothing is written to the folders here. */
+static void
+inc_drop_filter (IncDropJob * job)
+{
+  IncSession *inc_session = job->session;
+  Pop3Session *session = POP3_SESSION (inc_session->session);
+  MsgInfo *msginfo;
+  FilterInfo *fltinfo;
+
   fltinfo = filter_info_new ();
   fltinfo->account = session->ac_prefs;
   fltinfo->flags.perm_flags = MSG_NEW | MSG_UNREAD;
   fltinfo->flags.tmp_flags = MSG_RECEIVED;
+  fltinfo->defer_add = TRUE;
+  job->fltinfo = fltinfo;
 
-  msginfo = procheader_parse_file (file, fltinfo->flags, FALSE);
+  msginfo = procheader_parse_file (job->file, fltinfo->flags, FALSE);
   if (!msginfo)
     {
       g_warning ("inc_drop_message: procheader_parse_file failed");
-      filter_info_free (fltinfo);
-      gdk_threads_leave ();
-      return DROP_ERROR;
+      return;
     }
   fltinfo->flags = msginfo->flags;
-  msginfo->file_path = g_strdup (file);
+  msginfo->file_path = g_strdup (job->file);
+  job->msginfo = msginfo;
 
   if (prefs_common.enable_junk &&
       prefs_common.filter_junk_on_recv && prefs_common.filter_junk_before && inc_session->junk_fltlist)
     {
       filter_apply_msginfo (inc_session->junk_fltlist, msginfo, fltinfo);
       if (fltinfo->drop_done)
-        is_junk = TRUE;
+        job->is_junk = TRUE;
       else if (fltinfo->error == FLT_ERROR_EXEC_FAILED || fltinfo->last_exec_exit_status >= 3)
         {
-          g_warning ("inc_drop_message: junk filter command returned %d", fltinfo->last_exec_exit_status);
-          alertpanel_error
-            (_("Execution of the junk filter command failed.\n" "Please check the junk mail control setting."));
-          procmsg_msginfo_free (msginfo);
-          filter_info_free (fltinfo);
-          inc_session->inc_state = INC_ERROR;
-          gdk_threads_leave ();
-          return DROP_ERROR;
+          job->exec_failed = TRUE;
+          return;
         }
     }
 
   if (!fltinfo->drop_done && session->ac_prefs->filter_on_recv)
-    filter_apply_msginfo (prefs_common.fltlist, msginfo, fltinfo);
+    filter_apply_msginfo (inc_session->fltlist, msginfo, fltinfo);
 
   if (!fltinfo->drop_done)
     {
@@ -1452,28 +1704,270 @@ inc_drop_message (Pop3Session * session, const gchar * file)
         {
           filter_apply_msginfo (inc_session->junk_fltlist, msginfo, fltinfo);
           if (fltinfo->drop_done)
-            is_junk = TRUE;
+            job->is_junk = TRUE;
           else if (fltinfo->error == FLT_ERROR_EXEC_FAILED || fltinfo->last_exec_exit_status >= 3)
+            job->exec_failed = TRUE;
+        }
+    }
+}
+
+static void
+inc_drop_filter_func (gpointer data, gpointer user_data)
+{
+  IncDropJob *job = (IncDropJob *) data;
+
+  inc_drop_filter (job);
+
+  g_mutex_lock (&inc_drop_mutex);
+  job->done = TRUE;
+  g_cond_broadcast (&inc_drop_cond);
+  g_mutex_unlock (&inc_drop_mutex);
+}
+
+/* commits the filtered messages at the head of the queue.  if all is
+   FALSE, stops at the first one still being filtered unless the queue
+   is full. */
+static gint
+inc_drop_commit_queue (IncSession * inc_session, gboolean all)
+{
+  Pop3Session *session = POP3_SESSION (inc_session->session);
+  Pop3MsgInfo *msg;
+  IncDropJob *job;
+  FolderItem *inbox = NULL;
+  GSList *batch = NULL;
+  GSList *cur;
+  gint ret = 0;
+  gint val;
+
+  while ((job = g_queue_peek_head (inc_session->drop_queue)) != NULL)
+    {
+      if (all || g_queue_get_length (inc_session->drop_queue) >= INC_DROP_MAX_PENDING)
+        inc_drop_job_wait (job);
+      else if (!inc_drop_job_is_done (job))
+        break;
+
+      g_queue_pop_head (inc_session->drop_queue);
+      batch = g_slist_prepend (batch, job);
+    }
+
+  if (!batch)
+    return 0;
+  batch = g_slist_reverse (batch);
+
+  if (session->ac_prefs->inbox)
+    {
+      inbox = folder_find_item_from_identifier (session->ac_prefs->inbox);
+      if (!inbox)
+        inbox = folder_get_default_inbox ();
+    }
+  else
+    inbox = folder_get_default_inbox ();
+
+  if (inbox)
+    inc_drop_add_batch (batch, inbox);
+
+  for (cur = batch; cur != NULL; cur = cur->next)
+    {
+      job = (IncDropJob *) cur->data;
+
+      val = inc_drop_commit (job, inbox);
+      msg = &session->msg[job->msgnum];
+      if (val < 0)
+        {
+          /* leave it on the server and receive it again next time */
+          log_warning (_("Can't drop message %d of %s.\n"), job->msgnum, session->ac_prefs->account_name);
+          msg->received = FALSE;
+          msg->deferred = FALSE;
+          msg->recv_time = RECV_TIME_NONE;
+          ret = -1;
+        }
+      else if (val == DROP_DONT_RECEIVE)
+        msg->recv_time = RECV_TIME_KEEP;
+      else if (val == DROP_DELETE)
+        msg->recv_time = RECV_TIME_DELETE;
+      else
+        msg->recv_time = session->current_time;
+
+      inc_drop_job_free (job);
+    }
+
+  g_slist_free (batch);
+
+  return ret;
+}
+
+static void
+inc_drop_add_append (IncDropJob * job, FolderItem * dest, FilterActionType type, MsgFlags flags,
+                     GHashTable * dest_table, GSList ** dests)
+{
+  IncDropAdd *add;
+  GSList *list;
+
+  add = g_new0 (IncDropAdd, 1);
+  add->job = job;
+  add->dest = dest;
+  add->msginfo = procmsg_msginfo_copy (job->msginfo);
+  add->msginfo->flags = flags;
+  add->type = type;
+  job->add_list = g_slist_append (job->add_list, add);
+
+  list = g_hash_table_lookup (dest_table, dest);
+  if (!list)
+    *dests = g_slist_prepend (*dests, dest);
+  g_hash_table_insert (dest_table, dest, g_slist_prepend (list, add));
+}
+
+/* main thread: adds the messages of the batch to their destination
+   folders, one folder_item_add_msgs_msginfo() call per folder.  the
+   result of each addition is left in the IncDropAdd of the job. */
+static void
+inc_drop_add_batch (GSList * batch, FolderItem * inbox)
+{
+  GHashTable *dest_table;
+  GSList *dests = NULL;
+  GSList *cur, *cur_;
+
+  dest_table = g_hash_table_new (NULL, NULL);
+
+  for (cur = batch; cur != NULL; cur = cur->next)
+    {
+      IncDropJob *job = (IncDropJob *) cur->data;
+      FilterInfo *fltinfo = job->fltinfo;
+
+      if (!job->msginfo || job->exec_failed)
+        continue;
+
+      for (cur_ = fltinfo->add_list; cur_ != NULL; cur_ = cur_->next)
+        {
+          FilterDeferredAdd *fadd = (FilterDeferredAdd *) cur_->data;
+          FolderItem *dest;
+
+          dest = folder_find_item_from_identifier (fadd->dest_id);
+          if (!dest)
             {
-              g_warning ("inc_drop_message: junk filter command returned %d", fltinfo->last_exec_exit_status);
-              alertpanel_error
-                (_("Execution of the junk filter command failed.\n" "Please check the junk mail control setting."));
-              procmsg_msginfo_free (msginfo);
-              filter_info_free (fltinfo);
-              inc_session->inc_state = INC_ERROR;
-              gdk_threads_leave ();
-              return DROP_ERROR;
+              g_warning ("dest folder '%s' not found\n", fadd->dest_id);
+              job->add_error = TRUE;
+              break;
             }
+          inc_drop_add_append (job, dest, fadd->type, fadd->flags, dest_table, &dests);
         }
+
+      if (!fltinfo->drop_done)
+        inc_drop_add_append (job, inbox, FLT_ACTION_NONE, fltinfo->flags, dest_table, &dests);
     }
 
-  if (!fltinfo->drop_done)
+  gdk_threads_enter ();
+
+  dests = g_slist_reverse (dests);
+  for (cur = dests; cur != NULL; cur = cur->next)
+    {
+      FolderItem *dest = (FolderItem *) cur->data;
+      GSList *list, *msglist = NULL;
+
+      list = g_hash_table_lookup (dest_table, dest);
+      for (cur_ = list; cur_ != NULL; cur_ = cur_->next)
+        msglist = g_slist_prepend (msglist, ((IncDropAdd *) cur_->data)->msginfo);
+
+      if (folder_item_add_msgs_msginfo (dest, msglist, FALSE, NULL) < 0)
+        {
+          for (cur_ = list; cur_ != NULL; cur_ = cur_->next)
+            ((IncDropAdd *) cur_->data)->failed = TRUE;
+        }
+
+      g_slist_free (msglist);
+      g_slist_free (list);
+    }
+
+  gdk_threads_leave ();
+
+  g_slist_free (dests);
+  g_hash_table_destroy (dest_table);
+}
+
+/* main thread: performs the folder additions decided by
+   inc_drop_filter() and updates the session counters */
+static gint
+inc_drop_commit (IncDropJob * job, FolderItem * inbox)
+{
+  IncSession *inc_session = job->session;
+  MsgInfo *msginfo = job->msginfo;
+  FilterInfo *fltinfo = job->fltinfo;
+  IncDropAdd *inbox_add = NULL;
+  GSList *cur;
+  gint val;
+  gboolean add_failed = job->add_error;
+  gboolean moved = FALSE;
+  gboolean is_counted = FALSE;
+  IncProgressDialog *inc_dialog;
+
+  if (!msginfo)
+    return DROP_ERROR;
+
+  gdk_threads_enter ();
+
+  inc_dialog = (IncProgressDialog *) inc_session->data;
+
+  if (job->exec_failed)
+    {
+      g_warning ("inc_drop_message: junk filter command returned %d", fltinfo->last_exec_exit_status);
+      if (inc_session->inc_state != INC_ERROR)
+        alertpanel_error
+          (_("Execution of the junk filter command failed.\n" "Please check the junk mail control setting."));
+      inc_session->inc_state = INC_ERROR;
+      gdk_threads_leave ();
+      return DROP_ERROR;
+    }
+
+  if (!inbox)
+    {
+      gdk_threads_leave ();
+      return DROP_ERROR;
+    }
+
+  /* a failed move or copy leaves the message in the inbox unless a
+     move has succeeded, and never deletes it */
+  for (cur = job->add_list; cur != NULL; cur = cur->next)
+    {
+      IncDropAdd *add = (IncDropAdd *) cur->data;
+
+      if (add->type == FLT_ACTION_NONE)
+        inbox_add = add;
+      else if (add->failed)
+        add_failed = TRUE;
+      else
+        {
+          fltinfo->dest_list = g_slist_append (fltinfo->dest_list, add->dest);
+          if (add->type == FLT_ACTION_MOVE)
+            {
+              fltinfo->move_dest = add->dest;
+              moved = TRUE;
+            }
+        }
+    }
+
+  if (add_failed)
+    {
+      g_warning ("inc_drop_message: filter action failed");
+      fltinfo->error = FLT_ERROR_ERROR;
+      fltinfo->drop_done = moved;
+      fltinfo->actions[FLT_ACTION_NOT_RECEIVE] = FALSE;
+      fltinfo->actions[FLT_ACTION_DELETE] = FALSE;
+    }
+
+  if (inbox_add)
+    {
+      if (inbox_add->failed)
+        {
+          gdk_threads_leave ();
+          return DROP_ERROR;
+        }
+      fltinfo->dest_list = g_slist_append (fltinfo->dest_list, inbox);
+    }
+  else if (!fltinfo->drop_done)
     {
       msginfo->flags = fltinfo->flags;
       if (folder_item_add_msg_msginfo (inbox, msginfo, FALSE) < 0)
         {
-          procmsg_msginfo_free (msginfo);
-          filter_info_free (fltinfo);
           gdk_threads_leave ();
           return DROP_ERROR;
         }
@@ -1500,7 +1994,7 @@ inc_drop_message (Pop3Session * session, const gchar * file)
   else
     {
       val = DROP_OK;
-      if (!is_junk && is_counted && fltinfo->actions[FLT_ACTION_MARK_READ] == FALSE)
+      if (!job->is_junk && is_counted && fltinfo->actions[FLT_ACTION_MARK_READ] == FALSE)
         {
           inc_session->new_msgs++;
 
@@ -1516,9 +2010,6 @@ inc_drop_message (Pop3Session * session, const gchar * file)
         }
     }
 
-  procmsg_msginfo_free (msginfo);
-  filter_info_free (fltinfo);
-
   gdk_threads_leave ();
   return val;
 }
@@ -76,6 +76,9 @@ struct _IncSession {
   GHashTable *tmp_folder_table; /* for progressive update */
 
   GSList *junk_fltlist;
+  GSList *fltlist;              /* copy of the filter rules for this session */
+  gboolean filter_serial;       /* rules run commands; filter on the main thread */
+  GQueue *drop_queue;           /* messages being filtered, in arrival order */
 
   gint64 cur_total_bytes;
   gint new_msgs;
@@ -85,6 +88,8 @@ struct _IncSession {
 
   gint retr_count;
 
+  gint row;                     /* row in the progress dialog */
+
   gpointer data;
 };
 
@@ -79,6 +79,8 @@
 #include "plugin_manager.h"
 #include "foldersel.h"
 #include "colorlabel.h"
+#include "metrics.h"
+#include "bodycache.h"
 
 #if USE_GPGME
 #include "rfc2015.h"
@@ -114,6 +116,7 @@ static struct RemoteCmd {
   gchar *open_msg;
   gboolean configdir;
   gboolean safe_mode;
+  gboolean profile_startup;
   gboolean exit;
   gboolean restart;
   gchar *argv0;
@@ -134,6 +137,12 @@ static struct RemoteCmd {
 
 static void parse_cmd_opt (int argc, char *argv[]);
 
+static void startup_trace (const gchar * phase);
+static void startup_trace_flush (void);
+static void startup_task_start (void);
+static void startup_task_wait (gint id);
+static gboolean startup_deferred_func (gpointer data);
+
 static void app_init (void);
 static void parse_gtkrc_files (void);
 static void setup_rc_dir (void);
@@ -175,6 +184,35 @@ static void send_queue (void);
       exit(val);                                \
   }
 
+/* startup trace enabled by --profile-startup */
+static GTimer *startup_timer;
+static gdouble startup_last_mark;
+static GString *startup_log;
+
+typedef struct _StartupTask StartupTask;
+
+struct _StartupTask {
+  const gchar *name;
+  void (*func) (void);
+  GThread *thread;
+  gdouble elapsed;
+};
+
+enum {
+  STARTUP_TASK_FILTER,
+  STARTUP_TASK_ACTIONS,
+  STARTUP_TASK_DISPLAY_HEADER,
+  N_STARTUP_TASKS
+};
+
+/* configuration files that only fill their own lists and can be
+ * read on worker threads while the main window is being built */
+static StartupTask startup_tasks[N_STARTUP_TASKS] = {
+  {"filter rules", filter_read_config, NULL, 0.0},
+  {"actions", prefs_actions_read_config, NULL, 0.0},
+  {"display headers", prefs_display_header_read_config, NULL, 0.0}
+};
+
 static void
 load_cb (GObject * obj, GModule * module, gpointer data)
 {
@@ -201,6 +239,12 @@ main (int argc, char *argv[])
   app_init ();
   parse_cmd_opt (argc, argv);
 
+  if (cmd.profile_startup)
+    {
+      startup_timer = g_timer_new ();
+      startup_log = g_string_new (NULL);
+    }
+
   /* check and create (unix domain) socket for remote operation */
   lock_socket = prohibit_duplicate_launch ();
   if (lock_socket < 0)
@@ -222,6 +266,7 @@ main (int argc, char *argv[])
 
   parse_gtkrc_files ();
   setup_rc_dir ();
+  startup_trace ("GTK+ initialization");
 
   if (is_file_exist ("yam.log"))
     {
@@ -241,10 +286,9 @@ main (int argc, char *argv[])
   CHDIR_EXIT_IF_FAIL (g_get_home_dir (), 1);
 
   prefs_common_read_config ();
+  startup_trace ("common preferences");
   filter_set_addressbook_func (addressbook_has_address);
-  filter_read_config ();
-  prefs_actions_read_config ();
-  prefs_display_header_read_config ();
+  startup_task_start ();
   colorlabel_read_config ();
 
   prefs_common.user_agent_str = g_strdup_printf
@@ -263,9 +307,12 @@ main (int argc, char *argv[])
   g_free (path);
 
   gtk_window_set_default_icon_name ("yam");
+  startup_trace ("GnuPG and icons");
 
+  startup_task_wait (STARTUP_TASK_ACTIONS);
   mainwin = main_window_create (prefs_common.sep_folder | prefs_common.sep_msg << 1);
   folderview = mainwin->folderview;
+  startup_trace ("main window");
 
   /* register the callback of socket input */
   if (lock_socket > 0)
@@ -279,34 +326,41 @@ main (int argc, char *argv[])
   account_read_config_all ();
   account_set_menu ();
   main_window_reflect_prefs_all ();
+  startup_trace ("accounts");
 
   if (folder_read_list () < 0)
     {
       setup_mailbox ();
       folder_write_list ();
     }
+  startup_trace ("folder list");
   if (!account_get_list ())
     new_account = setup_account ();
 
   account_set_menu ();
   main_window_reflect_prefs_all ();
 
+  startup_task_wait (STARTUP_TASK_DISPLAY_HEADER);
   account_set_missing_folder ();
   folder_set_missing_folders ();
   folderview_set (folderview);
   if (new_account && new_account->folder)
     folder_write_list ();
-
-  addressbook_read_file ();
+  startup_trace ("folder view");
 
   register_system_events ();
 
+  startup_task_wait (STARTUP_TASK_FILTER);
   inc_autocheck_timer_init (mainwin);
 
   plugin_init ();
+  startup_trace ("plug-ins");
 
   g_signal_emit_by_name (yam_app, "init-done");
 
+  /* the address book is not needed for the first frame */
+  g_idle_add_full (G_PRIORITY_LOW, startup_deferred_func, NULL, NULL);
+
   remote_command_exec ();
 
   gtk_main ();
@@ -430,6 +484,18 @@ parse_cmd_opt (int argc, char *argv[])
         }
       else if (!strncmp (argv[i], "--safe-mode", 11))
         cmd.safe_mode = TRUE;
+      else if (!strncmp (argv[i], "--profile-startup", 17))
+        cmd.profile_startup = TRUE;
+      else if (!strncmp (argv[i], "--trace", 7))
+        {
+          const gchar *p = argv[i + 1];
+
+          if (p && *p != '\0' && *p != '-')
+            {
+              metrics_trace_open (p);
+              i++;
+            }
+        }
       else if (!strncmp (argv[i], "--exit", 6))
         cmd.exit = TRUE;
       else if (!strncmp (argv[i], "--help", 6))
@@ -452,6 +518,10 @@ parse_cmd_opt (int argc, char *argv[])
           g_print ("%s\n", _("  --exit                 exit YAM"));
           g_print ("%s\n", _("  --debug                debug mode"));
           g_print ("%s\n", _("  --safe-mode            safe mode"));
+          g_print ("%s\n", _("  --profile-startup      write the time spent in each startup phase\n"
+                             "                         to the log"));
+          g_print ("%s\n", _("  --trace file           write a trace of folder, network and filter\n"
+                             "                         operations to file (Chrome trace format)"));
           g_print ("%s\n", _("  --help                 display this help and exit"));
           g_print ("%s\n", _("  --version              output version information and exit"));
 
@@ -490,6 +560,112 @@ parse_cmd_opt (int argc, char *argv[])
     cmd.argv0 = g_strdup (argv[0]);
 }
 
+static void
+startup_trace (const gchar * phase)
+{
+  gdouble now;
+
+  if (!startup_timer)
+    return;
+
+  now = g_timer_elapsed (startup_timer, NULL);
+  g_string_append_printf (startup_log, "startup: %-28s %8.1f ms (at %8.1f ms)\n",
+                          phase, (now - startup_last_mark) * 1000.0, now * 1000.0);
+  startup_last_mark = now;
+}
+
+static void
+startup_trace_flush (void)
+{
+  gchar **lines;
+  gint i;
+
+  if (!startup_timer)
+    return;
+
+  lines = g_strsplit (startup_log->str, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      if (*lines[i] != '\0')
+        log_print ("%s\n", lines[i]);
+    }
+  g_strfreev (lines);
+
+  g_string_free (startup_log, TRUE);
+  startup_log = NULL;
+  g_timer_destroy (startup_timer);
+  startup_timer = NULL;
+}
+
+static gpointer
+startup_task_thread_func (gpointer data)
+{
+  StartupTask *task = (StartupTask *) data;
+  GTimer *timer;
+
+  timer = g_timer_new ();
+  task->func ();
+  task->elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  return NULL;
+}
+
+static void
+startup_task_start (void)
+{
+  gint i;
+
+  for (i = 0; i < N_STARTUP_TASKS; i++)
+    {
+      StartupTask *task = &startup_tasks[i];
+
+      task->thread = g_thread_try_new (task->name, startup_task_thread_func, task, NULL);
+      /* fall back to reading it here */
+      if (!task->thread)
+        startup_task_thread_func (task);
+    }
+}
+
+static void
+startup_task_wait (gint id)
+{
+  StartupTask *task = &startup_tasks[id];
+  gchar *phase;
+
+  if (task->thread)
+    {
+      g_thread_join (task->thread);
+      task->thread = NULL;
+    }
+
+  if (startup_timer)
+    {
+      phase = g_strdup_printf ("%s (%.1f ms on worker)", task->name, task->elapsed * 1000.0);
+      startup_trace (phase);
+      g_free (phase);
+    }
+}
+
+static gboolean
+startup_deferred_func (gpointer data)
+{
+  gdk_threads_enter ();
+
+  startup_trace ("first frame");
+
+  addressbook_read_file ();
+  startup_trace ("address book (deferred)");
+
+  body_cache_init ();
+
+  startup_trace_flush ();
+
+  gdk_threads_leave ();
+
+  return FALSE;
+}
+
 static gint
 get_queued_message_num (void)
 {
@@ -635,8 +811,12 @@ app_will_exit (gboolean force)
         procmsg_remove_all_cached_messages (FOLDER (ac->folder));
     }
 
+  body_cache_cleanup ();
+
   yam_plugin_unload_all ();
 
+  filter_junk_classifier_close ();
+
   trayicon_destroy (mainwin->tray_icon);
 
   /* save all state before exiting */
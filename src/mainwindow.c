@@ -42,6 +42,7 @@
 #include "menu.h"
 #include "stock_pixmap.h"
 #include "folder.h"
+#include "maildir.h"
 #include "inc.h"
 #include "compose.h"
 #include "procmsg.h"
@@ -1351,7 +1352,9 @@ void
 main_window_add_mailbox (MainWindow * mainwin)
 {
   gchar *path;
+  gchar *base;
   Folder *folder;
+  FolderType type;
 
   path = input_dialog_with_filesel
     (_("Add mailbox"),
@@ -1366,14 +1369,50 @@ main_window_add_mailbox (MainWindow * mainwin)
       g_free (path);
       return;
     }
-  if (!strcmp (path, "Mail"))
-    folder = folder_new (F_MH, _("Mailbox"), path);
+  if (maildir_is_maildir (path))
+    {
+      alertpanel_error (_("`%s' is a single maildir.\n"
+                          "Only a tree of MH or maildir folders can be added as a mailbox."), path);
+      g_free (path);
+      return;
+    }
+  if (maildir_is_maildir_tree (path))
+    type = F_MAILDIR;
   else
     {
-      gchar *pn = g_path_get_basename (path);
-      folder = folder_new (F_MH, pn, path);
-      g_free (pn);
+      gchar *fullpath;
+      gboolean exist;
+
+      if (g_path_is_absolute (path))
+        fullpath = g_strdup (path);
+      else
+        fullpath = g_strconcat (get_mail_base_dir (), G_DIR_SEPARATOR_S, path, NULL);
+      exist = is_dir_exist (fullpath);
+      g_free (fullpath);
+      type = exist ? F_MH : F_UNKNOWN;
     }
+  if (type == F_UNKNOWN)
+    {
+      AlertValue val;
+
+      val = alertpanel (_("Add mailbox"), _("Select the format of the new mailbox."),
+                        _("_MH"), _("M_aildir"), "yam-cancel");
+      if (val == G_ALERTDEFAULT)
+        type = F_MH;
+      else if (val == G_ALERTALTERNATE)
+        type = F_MAILDIR;
+      else
+        {
+          g_free (path);
+          return;
+        }
+    }
+  base = g_path_get_basename (path);
+  if (!strcmp (path, "Mail"))
+    folder = folder_new (type, _("Mailbox"), path);
+  else
+    folder = folder_new (type, base, path);
+  g_free (base);
   g_free (path);
 
   if (folder->klass->create_tree (folder) < 0)
@@ -1486,7 +1525,7 @@ main_window_get_current_state (MainWindow * mainwin)
         state |= M_POP3_ACCOUNT;
     }
 
-  if (inc_is_active ())
+  if (inc_is_active () || folderview_is_downloading ())
     state |= M_INC_ACTIVE;
 
   if (prefs_common.enable_junk)
@@ -3006,6 +3045,7 @@ static void
 inc_stop_cb (MainWindow * mainwin, guint action, GtkWidget * widget)
 {
   inc_cancel_all ();
+  folderview_cancel_download ();
 }
 
 static void
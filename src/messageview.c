@@ -50,6 +50,7 @@
 #include "procmsg.h"
 #include "procheader.h"
 #include "procmime.h"
+#include "prefetch.h"
 #include "account.h"
 #include "action.h"
 #include "prefs_common.h"
@@ -436,10 +437,12 @@ messageview_show (MessageView * messageview, MsgInfo * msginfo, gboolean all_hea
 {
   gchar *file;
   MimeInfo *mimeinfo;
+  MsgInfo *full_msginfo = NULL;
 
   g_return_val_if_fail (msginfo != NULL, -1);
 
-  mimeinfo = procmime_scan_message (msginfo);
+  if (!prefetch_lookup (msginfo, &full_msginfo, &mimeinfo))
+    mimeinfo = procmime_scan_message (msginfo);
   if (!mimeinfo)
     {
       messageview_change_view_type (messageview, MVIEW_TEXT);
@@ -452,6 +455,7 @@ messageview_show (MessageView * messageview, MsgInfo * msginfo, gboolean all_hea
     {
       g_warning ("can't get message file path.\n");
       procmime_mimeinfo_free_all (mimeinfo);
+      procmsg_msginfo_free (full_msginfo);
       messageview_change_view_type (messageview, MVIEW_TEXT);
       textview_show_error (messageview->textview);
       return -1;
@@ -460,10 +464,15 @@ messageview_show (MessageView * messageview, MsgInfo * msginfo, gboolean all_hea
   if (messageview->msginfo != msginfo)
     {
       procmsg_msginfo_free (messageview->msginfo);
-      messageview->msginfo = procmsg_msginfo_get_full_info (msginfo);
+      if (full_msginfo)
+        messageview->msginfo = full_msginfo;
+      else
+        messageview->msginfo = procmsg_msginfo_get_full_info (msginfo);
       if (!messageview->msginfo)
         messageview->msginfo = procmsg_msginfo_copy (msginfo);
     }
+  else
+    procmsg_msginfo_free (full_msginfo);
   procmime_mimeinfo_free_all (messageview->mimeinfo);
   messageview->mimeinfo = mimeinfo;
   g_free (messageview->file);
@@ -90,6 +90,9 @@ static void mimeview_view_file (const gchar * filename, MimeInfo * partinfo, con
 static void mimeview_reply (MimeView * mimeview, guint action);
 
 #if USE_GPGME
+static gboolean mimeview_verify_signature (MimeView * mimeview, MimeInfo * mimeinfo, FILE * fp);
+static void mimeview_update_names (MimeView * mimeview);
+static void mimeview_update_signature_info (MimeView * mimeview);
 static void mimeview_check_signature (MimeView * mimeview);
 #endif
 
@@ -269,6 +272,45 @@ mimeview_is_signed (MimeView * mimeview)
   return FALSE;
 }
 
+static void
+mimeview_signature_checked (gpointer data)
+{
+  MimeView *mimeview = (MimeView *) data;
+  MessageView *messageview = mimeview->messageview;
+  FILE *fp;
+
+  if (!messageview->mimeinfo || !messageview->file)
+    return;
+
+  if ((fp = g_fopen (messageview->file, "rb")) == NULL)
+    {
+      FILE_OP_ERROR (messageview->file, "fopen");
+      return;
+    }
+  if (mimeview_verify_signature (mimeview, messageview->mimeinfo, fp))
+    {
+      mimeview_update_names (mimeview);
+      mimeview_update_signature_info (mimeview);
+      textview_show_message (messageview->textview, messageview->mimeinfo, messageview->file);
+    }
+  fclose (fp);
+}
+
+/* returns TRUE if the result is already there */
+static gboolean
+mimeview_verify_signature (MimeView * mimeview, MimeInfo * mimeinfo, FILE * fp)
+{
+  MessageView *messageview = mimeview->messageview;
+  const gchar *id = NULL;
+
+  if (messageview->msginfo && messageview->msginfo->msgid)
+    id = messageview->msginfo->msgid;
+  else
+    id = messageview->file;
+
+  return rfc2015_check_signature (mimeinfo, fp, id, mimeview_signature_checked, mimeview);
+}
+
 static void
 set_unchecked_signature (MimeInfo * mimeinfo)
 {
@@ -314,7 +356,7 @@ mimeview_show_message (MimeView * mimeview, MimeInfo * mimeinfo, const gchar * f
           FILE_OP_ERROR (file, "fopen");
           return;
         }
-      rfc2015_check_signature (mimeinfo, fp);
+      mimeview_verify_signature (mimeview, mimeinfo, fp);
       fclose (fp);
     }
   else
@@ -359,6 +401,10 @@ mimeview_clear (MimeView * mimeview)
 {
   g_signal_handlers_block_by_func (G_OBJECT (mimeview->selection), G_CALLBACK (mimeview_selection_changed), mimeview);
 
+#if USE_GPGME
+  rfc2015_cancel_check_signature (mimeview);
+#endif
+
   mimeview->has_attach_file = FALSE;
 
   gtk_tree_store_clear (mimeview->store);
@@ -377,6 +423,9 @@ mimeview_clear (MimeView * mimeview)
 void
 mimeview_destroy (MimeView * mimeview)
 {
+#if USE_GPGME
+  rfc2015_cancel_check_signature (mimeview);
+#endif
   textview_destroy (mimeview->textview);
   imageview_destroy (mimeview->imageview);
   g_object_unref (mimeview->popupfactory);
@@ -1371,7 +1420,10 @@ mimeview_check_signature (MimeView * mimeview)
       return;
     }
 
-  rfc2015_check_signature (mimeinfo, fp);
+  /* the keyring may have changed since the results were cached */
+  rfc2015_clear_signature_cache ();
+  rfc2015_cancel_check_signature (mimeview);
+  mimeview_verify_signature (mimeview, mimeinfo, fp);
   fclose (fp);
 
   mimeview_update_names (mimeview);
@@ -26,6 +26,7 @@
 #include "plugin.h"
 #include "utils.h"
 #include "folder.h"
+#include "metrics.h"
 #include "plugin-marshal.h"
 
 G_DEFINE_TYPE (YamPlugin, yam_plugin, G_TYPE_OBJECT);
@@ -1519,3 +1520,52 @@ yam_plugin_notification_window_close (void)
   GETFUNC ("notification_window_close");
   SAFE_CALL (func);
 }
+
+void
+yam_plugin_metrics_counter_add (const gchar * name, gint64 value)
+{
+  g_return_if_fail (name != NULL);
+
+  metrics_counter_add (metrics_counter_get (name), value);
+}
+
+void
+yam_plugin_metrics_histogram_add (const gchar * name, guint64 value)
+{
+  g_return_if_fail (name != NULL);
+
+  metrics_histogram_add (metrics_histogram_get (name), value);
+}
+
+gpointer
+yam_plugin_metrics_timer_start (const gchar * name, const gchar * detail)
+{
+  MetricsTimer *timer;
+
+  g_return_val_if_fail (name != NULL, NULL);
+
+  /* the name must outlive the timer */
+  timer = g_new0 (MetricsTimer, 1);
+  metrics_timer_start (timer, g_intern_string (name), detail);
+
+  return timer;
+}
+
+gint64
+yam_plugin_metrics_timer_stop (gpointer timer)
+{
+  gint64 duration;
+
+  g_return_val_if_fail (timer != NULL, 0);
+
+  duration = metrics_timer_stop ((MetricsTimer *) timer);
+  g_free (timer);
+
+  return duration;
+}
+
+gchar *
+yam_plugin_metrics_get_summary (void)
+{
+  return metrics_get_summary ();
+}
@@ -48,7 +48,7 @@ typedef void (*YamPluginLoadFunc) (void);
 typedef void (*YamPluginUnloadFunc) (void);
 typedef void (*YamPluginCallbackFunc) (void);
 
-#define YAM_PLUGIN_INTERFACE_VERSION	0x010a
+#define YAM_PLUGIN_INTERFACE_VERSION	0x010b
 
 struct _YamPlugin {
   GObject parent_instance;
@@ -295,4 +295,13 @@ gint yam_plugin_notification_window_open (const gchar * message, const gchar * s
 void yam_plugin_notification_window_set_message (const gchar * message, const gchar * submessage);
 void yam_plugin_notification_window_close (void);
 
+/* Performance metrics (see metrics.h) */
+void yam_plugin_metrics_counter_add (const gchar * name, gint64 value);
+void yam_plugin_metrics_histogram_add (const gchar * name, guint64 value);
+/* returns an opaque timer which is freed by yam_plugin_metrics_timer_stop() */
+gpointer yam_plugin_metrics_timer_start (const gchar * name, const gchar * detail);
+gint64 yam_plugin_metrics_timer_stop (gpointer timer);
+/* returned string must be freed */
+gchar *yam_plugin_metrics_get_summary (void);
+
 #endif /* __PLUGIN_H__ */
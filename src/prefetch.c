@@ -0,0 +1,305 @@
+/*
+ * YAM -- a GTK+ based, lightweight, and fast e-mail client
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "prefetch.h"
+#include "procmsg.h"
+#include "procmime.h"
+#include "procheader.h"
+#include "utils.h"
+
+/* number of parsed messages kept ready */
+#define PREFETCH_CACHE_SIZE	4
+/* larger text parts are decoded when they are shown */
+#define PREFETCH_DECODE_MAX	(1024 * 1024)
+
+typedef struct _PrefetchEntry PrefetchEntry;
+
+struct _PrefetchEntry {
+  FolderItem *item;
+  guint msgnum;
+  gchar *file;
+  MsgFlags flags;
+  goffset size;
+  stime_t mtime;
+
+  MsgInfo *full_msginfo;
+  MimeInfo *mimeinfo;
+
+  gboolean done;
+  gboolean cancelled;
+};
+
+static GThreadPool *prefetch_pool = NULL;
+/* most recently requested first */
+static GQueue prefetch_queue = G_QUEUE_INIT;
+static GMutex prefetch_mutex;
+
+static void
+prefetch_entry_free (PrefetchEntry * entry)
+{
+  procmsg_msginfo_free (entry->full_msginfo);
+  procmime_mimeinfo_free_all (entry->mimeinfo);
+  g_free (entry->file);
+  g_free (entry);
+}
+
+static PrefetchEntry *
+prefetch_find (FolderItem * item, guint msgnum)
+{
+  GList *cur;
+
+  for (cur = prefetch_queue.head; cur != NULL; cur = cur->next)
+    {
+      PrefetchEntry *entry = (PrefetchEntry *) cur->data;
+
+      if (entry->item == item && entry->msgnum == msgnum)
+        return entry;
+    }
+
+  return NULL;
+}
+
+/* decode the parts the text view will show */
+static void
+prefetch_decode_parts (MimeInfo * mimeinfo, FILE * fp)
+{
+  MimeInfo *partinfo;
+  gchar buf[BUFFSIZE];
+
+  for (partinfo = mimeinfo; partinfo != NULL; partinfo = procmime_mimeinfo_next (partinfo))
+    {
+      if (partinfo->mime_type != MIME_TEXT && partinfo->mime_type != MIME_TEXT_HTML)
+        continue;
+      if (partinfo->content_size > PREFETCH_DECODE_MAX)
+        continue;
+
+      if (fseek (fp, partinfo->fpos, SEEK_SET) < 0)
+        {
+          FILE_OP_ERROR ("prefetch_decode_parts", "fseek");
+          return;
+        }
+      while (fgets (buf, sizeof (buf), fp) != NULL)
+        if (buf[0] == '\r' || buf[0] == '\n')
+          break;
+
+      partinfo->decoded_fp = procmime_decode_content (NULL, fp, partinfo);
+    }
+}
+
+static void
+prefetch_thread_func (gpointer data, gpointer user_data)
+{
+  PrefetchEntry *entry = (PrefetchEntry *) data;
+  MsgInfo *full_msginfo = NULL;
+  MimeInfo *mimeinfo = NULL;
+  gboolean cancelled;
+  FILE *fp;
+
+  g_mutex_lock (&prefetch_mutex);
+  cancelled = entry->cancelled;
+  g_mutex_unlock (&prefetch_mutex);
+  if (cancelled)
+    {
+      prefetch_entry_free (entry);
+      return;
+    }
+
+  debug_print ("prefetch: parsing %s\n", entry->file);
+
+  if ((fp = g_fopen (entry->file, "rb")) != NULL)
+    {
+      mimeinfo = procmime_scan_message_stream (fp);
+      /* decryption may ask for a passphrase; leave it to the viewer */
+      if (mimeinfo && mimeinfo->mime_type == MIME_MULTIPART &&
+          !g_ascii_strcasecmp (mimeinfo->content_type, "multipart/encrypted"))
+        {
+          procmime_mimeinfo_free_all (mimeinfo);
+          mimeinfo = NULL;
+        }
+      if (mimeinfo)
+        prefetch_decode_parts (mimeinfo, fp);
+      fclose (fp);
+    }
+  else
+    FILE_OP_ERROR (entry->file, "fopen");
+
+  if (mimeinfo)
+    full_msginfo = procheader_parse_file (entry->file, entry->flags, TRUE);
+
+  g_mutex_lock (&prefetch_mutex);
+  entry->full_msginfo = full_msginfo;
+  entry->mimeinfo = mimeinfo;
+  entry->done = TRUE;
+  cancelled = entry->cancelled;
+  g_mutex_unlock (&prefetch_mutex);
+
+  if (cancelled)
+    prefetch_entry_free (entry);
+}
+
+void
+prefetch_message (MsgInfo * msginfo)
+{
+  PrefetchEntry *entry;
+  GStatBuf s;
+  gchar *file;
+
+  g_return_if_fail (msginfo != NULL);
+
+  if (!msginfo->folder || msginfo->encinfo ||
+      MSG_IS_ENCRYPTED (msginfo->flags) || MSG_IS_QUEUED (msginfo->flags))
+    return;
+
+  file = procmsg_get_message_file_path (msginfo);
+  if (!file)
+    return;
+  if (g_stat (file, &s) < 0 || !S_ISREG (s.st_mode))
+    {
+      g_free (file);
+      return;
+    }
+
+  g_mutex_lock (&prefetch_mutex);
+
+  if (prefetch_find (msginfo->folder, msginfo->msgnum))
+    {
+      g_mutex_unlock (&prefetch_mutex);
+      g_free (file);
+      return;
+    }
+
+  entry = g_new0 (PrefetchEntry, 1);
+  entry->item = msginfo->folder;
+  entry->msgnum = msginfo->msgnum;
+  entry->file = file;
+  entry->flags = msginfo->flags;
+  entry->size = s.st_size;
+  entry->mtime = s.st_mtime;
+  g_queue_push_head (&prefetch_queue, entry);
+
+  while (g_queue_get_length (&prefetch_queue) > PREFETCH_CACHE_SIZE)
+    {
+      PrefetchEntry *old = (PrefetchEntry *) g_queue_pop_tail (&prefetch_queue);
+
+      if (old->done)
+        prefetch_entry_free (old);
+      else
+        old->cancelled = TRUE;
+    }
+
+  g_mutex_unlock (&prefetch_mutex);
+
+  if (!prefetch_pool)
+    prefetch_pool = g_thread_pool_new (prefetch_thread_func, NULL, 1, FALSE, NULL);
+  g_thread_pool_push (prefetch_pool, entry, NULL);
+}
+
+gboolean
+prefetch_lookup (MsgInfo * msginfo, MsgInfo ** full_msginfo, MimeInfo ** mimeinfo)
+{
+  PrefetchEntry *entry;
+  GStatBuf s;
+  gchar *file;
+  gboolean valid;
+
+  g_return_val_if_fail (msginfo != NULL, FALSE);
+
+  g_mutex_lock (&prefetch_mutex);
+
+  entry = prefetch_find (msginfo->folder, msginfo->msgnum);
+  if (!entry)
+    {
+      g_mutex_unlock (&prefetch_mutex);
+      return FALSE;
+    }
+
+  g_queue_remove (&prefetch_queue, entry);
+  if (!entry->done)
+    {
+      /* don't wait for it: the viewer parses the message itself */
+      debug_print ("prefetch: %s is not ready\n", entry->file);
+      entry->cancelled = TRUE;
+      g_mutex_unlock (&prefetch_mutex);
+      return FALSE;
+    }
+
+  g_mutex_unlock (&prefetch_mutex);
+
+  /* the message may have been replaced or decrypted meanwhile */
+  file = procmsg_get_message_file_path (msginfo);
+  valid = entry->mimeinfo && entry->full_msginfo && !msginfo->encinfo &&
+    file && !strcmp (file, entry->file) &&
+    g_stat (file, &s) == 0 && s.st_size == entry->size && s.st_mtime == entry->mtime;
+  g_free (file);
+
+  if (!valid)
+    {
+      prefetch_entry_free (entry);
+      return FALSE;
+    }
+
+  debug_print ("prefetch: using %s\n", entry->file);
+
+  *full_msginfo = entry->full_msginfo;
+  (*full_msginfo)->msgnum = msginfo->msgnum;
+  (*full_msginfo)->size = msginfo->size;
+  (*full_msginfo)->mtime = msginfo->mtime;
+  (*full_msginfo)->folder = msginfo->folder;
+  (*full_msginfo)->to_folder = msginfo->to_folder;
+  (*full_msginfo)->flags = msginfo->flags;
+  (*full_msginfo)->file_path = g_strdup (msginfo->file_path);
+
+  *mimeinfo = entry->mimeinfo;
+
+  entry->full_msginfo = NULL;
+  entry->mimeinfo = NULL;
+  prefetch_entry_free (entry);
+
+  return TRUE;
+}
+
+void
+prefetch_clear (void)
+{
+  PrefetchEntry *entry;
+
+  g_mutex_lock (&prefetch_mutex);
+
+  while ((entry = (PrefetchEntry *) g_queue_pop_head (&prefetch_queue)) != NULL)
+    {
+      if (entry->done)
+        prefetch_entry_free (entry);
+      else
+        entry->cancelled = TRUE;
+    }
+
+  g_mutex_unlock (&prefetch_mutex);
+}
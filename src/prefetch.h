@@ -0,0 +1,34 @@
+/*
+ * YAM -- a GTK+ based, lightweight, and fast e-mail client
+ * Copyright (C) 2020 Victor Ananjevsky <victor@sanana.kiev.ua>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include <glib.h>
+
+#include "procmsg.h"
+#include "procmime.h"
+
+/* parse a locally available message in the background */
+void prefetch_message (MsgInfo * msginfo);
+/* take the result of prefetch_message() if it is ready */
+gboolean prefetch_lookup (MsgInfo * msginfo, MsgInfo ** full_msginfo, MimeInfo ** mimeinfo);
+void prefetch_clear (void);
+
+#endif /* __PREFETCH_H__ */
@@ -214,6 +214,8 @@ static struct Advanced {
   GtkWidget *imap_frame;
   GtkWidget *imapdir_entry;
   GtkWidget *clear_cache_chkbtn;
+  GtkWidget *compress_chkbtn;
+  GtkWidget *maxconn_spinbtn;
 
   GtkWidget *sent_folder_chkbtn;
   GtkWidget *sent_folder_entry;
@@ -340,6 +342,8 @@ static PrefsUIData ui_data[] = {
 
   {"imap_directory", &advanced.imapdir_entry, prefs_set_data_from_entry, prefs_set_entry},
   {"imap_clear_cache_on_exit", &advanced.clear_cache_chkbtn, prefs_set_data_from_toggle, prefs_set_toggle},
+  {"imap_compress", &advanced.compress_chkbtn, prefs_set_data_from_toggle, prefs_set_toggle},
+  {"imap_max_connections", &advanced.maxconn_spinbtn, prefs_set_data_from_spinbtn, prefs_set_spinbtn},
 
   {"set_sent_folder", &advanced.sent_folder_chkbtn, prefs_set_data_from_toggle, prefs_set_toggle},
   {"sent_folder", &advanced.sent_folder_entry, prefs_set_data_from_entry, prefs_set_entry},
@@ -1702,6 +1706,10 @@ prefs_account_advanced_create (void)
   GtkWidget *imapdir_label;
   GtkWidget *imapdir_entry;
   GtkWidget *clear_cache_chkbtn;
+  GtkWidget *compress_chkbtn;
+  GtkWidget *maxconn_label;
+  GtkWidget *maxconn_spinbtn;
+  GtkAdjustment *maxconn_spinbtn_adj;
   GtkWidget *desc_label;
   GtkWidget *folder_frame;
   GtkWidget *vbox3;
@@ -1784,6 +1792,19 @@ prefs_account_advanced_create (void)
   PACK_SMALL_LABEL (vbox3, desc_label, _("Only the subfolders of this directory will be displayed."));
 
   PACK_CHECK_BUTTON (vbox3, clear_cache_chkbtn, _("Clear all message caches on exit"));
+  PACK_CHECK_BUTTON (vbox3, compress_chkbtn, _("Use compression (COMPRESS=DEFLATE) if available"));
+
+  hbox1 = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
+  gtk_box_pack_start (GTK_BOX (vbox3), hbox1, FALSE, FALSE, 0);
+
+  maxconn_label = gtk_label_new (_("Maximum connections for downloading messages"));
+  gtk_box_pack_start (GTK_BOX (hbox1), maxconn_label, FALSE, FALSE, 0);
+
+  maxconn_spinbtn_adj = gtk_adjustment_new (2, 1, 8, 1, 1, 0);
+  maxconn_spinbtn = gtk_spin_button_new (GTK_ADJUSTMENT (maxconn_spinbtn_adj), 1, 0);
+  gtk_box_pack_start (GTK_BOX (hbox1), maxconn_spinbtn, FALSE, FALSE, 0);
+  gtk_widget_set_size_request (maxconn_spinbtn, 64, -1);
+  gtk_spin_button_set_numeric (GTK_SPIN_BUTTON (maxconn_spinbtn), TRUE);
 
   /* special folder setting (maybe these options are redundant) */
 
@@ -1841,6 +1862,8 @@ prefs_account_advanced_create (void)
   advanced.imap_frame = imap_frame;
   advanced.imapdir_entry = imapdir_entry;
   advanced.clear_cache_chkbtn = clear_cache_chkbtn;
+  advanced.compress_chkbtn = compress_chkbtn;
+  advanced.maxconn_spinbtn = maxconn_spinbtn;
 
   advanced.sent_folder_chkbtn = sent_folder_chkbtn;
   advanced.sent_folder_entry = sent_folder_entry;
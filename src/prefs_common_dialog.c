@@ -63,6 +63,7 @@
 #include "folder.h"
 #include "socket.h"
 #include "plugin.h"
+#include "bodycache.h"
 
 static PrefsDialog dialog;
 
@@ -192,6 +193,7 @@ static struct JunkMail {
   GtkWidget *entry_junk_learncmd;
   GtkWidget *entry_nojunk_learncmd;
   GtkWidget *entry_classify_cmd;
+  GtkWidget *entry_classify_batch_cmd;
   GtkWidget *entry_junkfolder;
   GtkWidget *chkbtn_filter_on_recv;
   GtkWidget *chkbtn_filter_before;
@@ -270,6 +272,12 @@ static struct Advanced {
 
   GtkWidget *spinbtn_iotimeout;
   GtkAdjustment *spinbtn_iotimeout_adj;
+
+  GtkWidget *spinbtn_maxsessions;
+  GtkAdjustment *spinbtn_maxsessions_adj;
+
+  GtkWidget *spinbtn_cachelimit;
+  GtkAdjustment *spinbtn_cachelimit_adj;
 } advanced;
 
 static struct MessageColorButtons {
@@ -400,6 +408,7 @@ static PrefsUIData ui_data[] = {
   {"junk_learn_command", &junk.entry_junk_learncmd, prefs_set_data_from_entry, prefs_set_entry},
   {"nojunk_learn_command", &junk.entry_nojunk_learncmd, prefs_set_data_from_entry, prefs_set_entry},
   {"junk_classify_command", &junk.entry_classify_cmd, prefs_set_data_from_entry, prefs_set_entry},
+  {"junk_classify_batch_command", &junk.entry_classify_batch_cmd, prefs_set_data_from_entry, prefs_set_entry},
   {"junk_folder", &junk.entry_junkfolder, prefs_set_data_from_entry, prefs_set_entry},
   {"filter_junk_on_receive", &junk.chkbtn_filter_on_recv, prefs_set_data_from_toggle, prefs_set_toggle},
   {"filter_junk_before", &junk.chkbtn_filter_before, prefs_set_data_from_toggle, prefs_set_toggle},
@@ -459,6 +468,8 @@ static PrefsUIData ui_data[] = {
   /* Advanced */
   {"strict_cache_check", &advanced.checkbtn_strict_cache_check, prefs_set_data_from_toggle, prefs_set_toggle},
   {"io_timeout_secs", &advanced.spinbtn_iotimeout, prefs_set_data_from_spinbtn, prefs_set_spinbtn},
+  {"receive_max_sessions", &advanced.spinbtn_maxsessions, prefs_set_data_from_spinbtn, prefs_set_spinbtn},
+  {"remote_cache_size_limit", &advanced.spinbtn_cachelimit, prefs_set_data_from_spinbtn, prefs_set_spinbtn},
 
   {NULL, NULL, NULL, NULL}
 };
@@ -1821,11 +1832,12 @@ static const struct {
   gchar *junk_cmd;
   gchar *nojunk_cmd;
   gchar *classify_cmd;
+  gchar *classify_batch_cmd;
 } junk_presets[] = {
-  {"bogofilter -N -s -I", "bogofilter -n -S -I", "bogofilter -I"},
-  {"bsfilter -C -s -u", "bsfilter -c -S -u", "bsfilter"},
-  {"sylfilter -j", "sylfilter -c", "sylfilter"},
-  {"true", "true", ""}
+  {"bogofilter -N -s -I", "bogofilter -n -S -I", "bogofilter -I", "bogofilter -b -T"},
+  {"bsfilter -C -s -u", "bsfilter -c -S -u", "bsfilter", ""},
+  {"sylfilter -j", "sylfilter -c", "sylfilter", ""},
+  {"true", "true", "", ""}
 };
 
 enum {
@@ -1847,6 +1859,7 @@ prefs_junk_preset_activated (GtkComboBox *widget, gpointer data)
       gtk_entry_set_text (GTK_ENTRY (junk.entry_junk_learncmd), junk_presets[i].junk_cmd);
       gtk_entry_set_text (GTK_ENTRY (junk.entry_nojunk_learncmd), junk_presets[i].nojunk_cmd);
       gtk_entry_set_text (GTK_ENTRY (junk.entry_classify_cmd), junk_presets[i].classify_cmd);
+      gtk_entry_set_text (GTK_ENTRY (junk.entry_classify_batch_cmd), junk_presets[i].classify_batch_cmd);
     }
 }
 
@@ -1863,6 +1876,7 @@ prefs_junk_create (void)
   GtkWidget *entry_junk_learncmd;
   GtkWidget *entry_nojunk_learncmd;
   GtkWidget *entry_classify_cmd;
+  GtkWidget *entry_classify_batch_cmd;
   GtkWidget *vbox3;
   GtkWidget *entry_junkfolder;
   GtkWidget *btn_folder;
@@ -1945,6 +1959,18 @@ prefs_junk_create (void)
   gtk_widget_show (entry_classify_cmd);
   gtk_box_pack_start (GTK_BOX (hbox), entry_classify_cmd, TRUE, TRUE, 0);
 
+  hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
+  gtk_widget_show (hbox);
+  gtk_box_pack_start (GTK_BOX (vbox2), hbox, FALSE, FALSE, 0);
+
+  label = gtk_label_new (_("Batch classifying command"));
+  gtk_widget_show (label);
+  gtk_box_pack_start (GTK_BOX (hbox), label, FALSE, FALSE, 0);
+
+  entry_classify_batch_cmd = gtk_entry_new ();
+  gtk_widget_show (entry_classify_batch_cmd);
+  gtk_box_pack_start (GTK_BOX (hbox), entry_classify_batch_cmd, TRUE, TRUE, 0);
+
   PACK_VSPACER (vbox2, vbox3, 0);
 
   PACK_SMALL_LABEL (vbox2, label, _("To classify junk mails automatically, both junk "
@@ -1994,6 +2020,7 @@ prefs_junk_create (void)
   junk.entry_junk_learncmd = entry_junk_learncmd;
   junk.entry_nojunk_learncmd = entry_nojunk_learncmd;
   junk.entry_classify_cmd = entry_classify_cmd;
+  junk.entry_classify_batch_cmd = entry_classify_batch_cmd;
   junk.entry_junkfolder = entry_junkfolder;
   junk.chkbtn_filter_on_recv = chkbtn_filter_on_recv;
   junk.chkbtn_filter_before = chkbtn_filter_before;
@@ -2556,6 +2583,12 @@ prefs_advanced_create (void)
   GtkWidget *label_iotimeout;
   GtkWidget *spinbtn_iotimeout;
   GtkAdjustment *spinbtn_iotimeout_adj;
+  GtkWidget *label_maxsessions;
+  GtkWidget *spinbtn_maxsessions;
+  GtkAdjustment *spinbtn_maxsessions_adj;
+  GtkWidget *label_cachelimit;
+  GtkWidget *spinbtn_cachelimit;
+  GtkAdjustment *spinbtn_cachelimit_adj;
 
   vbox1 = gtk_box_new (GTK_ORIENTATION_VERTICAL, VSPACING);
   gtk_widget_show (vbox1);
@@ -2589,6 +2622,40 @@ prefs_advanced_create (void)
   gtk_widget_show (label_iotimeout);
   gtk_box_pack_start (GTK_BOX (hbox1), label_iotimeout, FALSE, FALSE, 0);
 
+  hbox1 = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
+  gtk_widget_show (hbox1);
+  gtk_box_pack_start (GTK_BOX (vbox1), hbox1, FALSE, FALSE, 0);
+
+  label_maxsessions = gtk_label_new (_("Maximum number of accounts to receive at once:"));
+  gtk_widget_show (label_maxsessions);
+  gtk_box_pack_start (GTK_BOX (hbox1), label_maxsessions, FALSE, FALSE, 0);
+
+  spinbtn_maxsessions_adj = gtk_adjustment_new (4, 1, 32, 1, 4, 0);
+  spinbtn_maxsessions = gtk_spin_button_new (GTK_ADJUSTMENT (spinbtn_maxsessions_adj), 1, 0);
+  gtk_widget_show (spinbtn_maxsessions);
+  gtk_box_pack_start (GTK_BOX (hbox1), spinbtn_maxsessions, FALSE, FALSE, 0);
+  gtk_widget_set_size_request (spinbtn_maxsessions, 64, -1);
+  gtk_spin_button_set_numeric (GTK_SPIN_BUTTON (spinbtn_maxsessions), TRUE);
+
+  hbox1 = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
+  gtk_widget_show (hbox1);
+  gtk_box_pack_start (GTK_BOX (vbox1), hbox1, FALSE, FALSE, 0);
+
+  label_cachelimit = gtk_label_new (_("Maximum size of cached IMAP and news messages:"));
+  gtk_widget_show (label_cachelimit);
+  gtk_box_pack_start (GTK_BOX (hbox1), label_cachelimit, FALSE, FALSE, 0);
+
+  spinbtn_cachelimit_adj = gtk_adjustment_new (1024, 0, 1048576, 64, 1024, 0);
+  spinbtn_cachelimit = gtk_spin_button_new (GTK_ADJUSTMENT (spinbtn_cachelimit_adj), 64, 0);
+  gtk_widget_show (spinbtn_cachelimit);
+  gtk_box_pack_start (GTK_BOX (hbox1), spinbtn_cachelimit, FALSE, FALSE, 0);
+  gtk_widget_set_size_request (spinbtn_cachelimit, 80, -1);
+  gtk_spin_button_set_numeric (GTK_SPIN_BUTTON (spinbtn_cachelimit), TRUE);
+
+  label_cachelimit = gtk_label_new (_("MB (0: unlimited)"));
+  gtk_widget_show (label_cachelimit);
+  gtk_box_pack_start (GTK_BOX (hbox1), label_cachelimit, FALSE, FALSE, 0);
+
   vbox2 = gtk_box_new (GTK_ORIENTATION_VERTICAL, VSPACING_NARROW);
   gtk_widget_show (vbox2);
   gtk_box_pack_start (GTK_BOX (vbox1), vbox2, FALSE, FALSE, 0);
@@ -2598,6 +2665,12 @@ prefs_advanced_create (void)
   advanced.spinbtn_iotimeout = spinbtn_iotimeout;
   advanced.spinbtn_iotimeout_adj = spinbtn_iotimeout_adj;
 
+  advanced.spinbtn_maxsessions = spinbtn_maxsessions;
+  advanced.spinbtn_maxsessions_adj = spinbtn_maxsessions_adj;
+
+  advanced.spinbtn_cachelimit = spinbtn_cachelimit;
+  advanced.spinbtn_cachelimit_adj = spinbtn_cachelimit_adj;
+
   return vbox1;
 }
 
@@ -4011,6 +4084,7 @@ prefs_common_apply (void)
   colorlabel_write_config ();
   sock_set_io_timeout (prefs_common.io_timeout_secs);
   prefs_common_write_config ();
+  body_cache_check ();
 
   inc_autocheck_timer_remove ();
   inc_autocheck_timer_set ();
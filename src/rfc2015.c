@@ -200,20 +200,208 @@ sig_status_full (gpgme_ctx_t ctx, gpgme_verify_result_t result)
   return retval;
 }
 
+/* number of verification results kept */
+#define SIG_CACHE_SIZE	256
+
+typedef struct _SigCheckResult SigCheckResult;
+typedef struct _SigCheckJob SigCheckJob;
+
+struct _SigCheckResult {
+  gchar *status;
+  gchar *status_full;
+  gchar *popup_text;
+};
+
+struct _SigCheckJob {
+  gchar *key;
+  GString *text;
+  GString *sig;
+  gboolean cms;
+
+  SigCheckResult *result;
+
+  /* NULL once cancelled */
+  Rfc2015CheckFunc func;
+  gpointer data;
+};
+
+/* the cache and the job list are only touched from the main thread */
+static GHashTable *sig_cache = NULL;
+/* least recently used first */
+static GQueue sig_cache_keys = G_QUEUE_INIT;
+static GList *sig_check_jobs = NULL;
+static GThreadPool *sig_check_pool = NULL;
+
+static void
+sig_check_result_free (SigCheckResult * result)
+{
+  if (!result)
+    return;
+  g_free (result->status);
+  g_free (result->status_full);
+  g_free (result->popup_text);
+  g_free (result);
+}
+
+static SigCheckResult *
+sig_cache_lookup (const gchar * key)
+{
+  gpointer orig_key, value;
+
+  if (!sig_cache || !g_hash_table_lookup_extended (sig_cache, key, &orig_key, &value))
+    return NULL;
+
+  g_queue_remove (&sig_cache_keys, orig_key);
+  g_queue_push_tail (&sig_cache_keys, orig_key);
+
+  return (SigCheckResult *) value;
+}
+
+/* takes over key and result */
+static void
+sig_cache_insert (gchar * key, SigCheckResult * result)
+{
+  if (!sig_cache)
+    sig_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                       (GDestroyNotify) sig_check_result_free);
+
+  if (g_hash_table_contains (sig_cache, key))
+    {
+      /* keeps the stored key, which the queue refers to */
+      g_hash_table_insert (sig_cache, key, result);
+      return;
+    }
+
+  g_hash_table_insert (sig_cache, key, result);
+  g_queue_push_tail (&sig_cache_keys, key);
+
+  while (g_queue_get_length (&sig_cache_keys) > SIG_CACHE_SIZE)
+    g_hash_table_remove (sig_cache, g_queue_pop_head (&sig_cache_keys));
+}
+
+void
+rfc2015_clear_signature_cache (void)
+{
+  g_queue_clear (&sig_cache_keys);
+  if (sig_cache)
+    g_hash_table_remove_all (sig_cache);
+}
+
 static void
-check_signature (MimeInfo * mimeinfo, MimeInfo * partinfo, FILE * fp)
+set_signature_result (MimeInfo * partinfo, SigCheckResult * result)
+{
+  g_free (partinfo->sigstatus);
+  partinfo->sigstatus = g_strdup (result->status);
+  g_free (partinfo->sigstatus_full);
+  partinfo->sigstatus_full = g_strdup (result->status_full);
+}
+
+/* read a part into memory; canonical converts the line breaks to CRLF
+ * the same way canonicalize_file() does */
+static GString *
+read_part (FILE * fp, glong fpos, gsize size, gboolean canonical)
 {
+  GString *str;
+  gchar buf[BUFFSIZE];
+  gsize rest = size;
+  gboolean last_cr = FALSE;
+
+  if (fseek (fp, fpos, SEEK_SET) < 0)
+    {
+      FILE_OP_ERROR ("read_part", "fseek");
+      return NULL;
+    }
+
+  str = g_string_sized_new (canonical ? size + size / 32 + 2 : size);
+
+  while (rest > 0)
+    {
+      gsize n, i;
+
+      n = fread (buf, 1, MIN (rest, sizeof (buf)), fp);
+      if (n == 0)
+        break;
+      rest -= n;
+
+      if (!canonical)
+        {
+          g_string_append_len (str, buf, n);
+          continue;
+        }
+
+      for (i = 0; i < n; i++)
+        {
+          if (buf[i] == '\n' && !last_cr)
+            g_string_append_c (str, '\r');
+          g_string_append_c (str, buf[i]);
+          last_cr = (buf[i] == '\r');
+        }
+    }
+
+  if (ferror (fp))
+    {
+      FILE_OP_ERROR ("read_part", "fread");
+      g_string_free (str, TRUE);
+      return NULL;
+    }
+
+  if (canonical && str->len > 0 && str->str[str->len - 1] != '\n')
+    g_string_append (str, "\r\n");
+
+  return str;
+}
+
+static void
+show_signature_popup (SigCheckResult * result)
+{
+  GpgmegtkSigStatus statuswindow;
+
+  if (!prefs_common.gpg_signature_popup)
+    return;
+
+  statuswindow = gpgmegtk_sig_status_create ();
+  gpgmegtk_sig_status_set_text (statuswindow, result->popup_text);
+  gpgmegtk_sig_status_destroy (statuswindow);
+}
+
+static gboolean
+check_signature_done (gpointer data)
+{
+  SigCheckJob *job = (SigCheckJob *) data;
+
+  gdk_threads_enter ();
+
+  sig_check_jobs = g_list_remove (sig_check_jobs, job);
+
+  if (job->func)
+    show_signature_popup (job->result);
+
+  sig_cache_insert (job->key, job->result);
+
+  /* the callback looks the result up in the cache */
+  if (job->func)
+    job->func (job->data);
+
+  gdk_threads_leave ();
+
+  g_string_free (job->text, TRUE);
+  g_string_free (job->sig, TRUE);
+  g_free (job);
+
+  return FALSE;
+}
+
+static void
+check_signature_thread_func (gpointer data, gpointer user_data)
+{
+  SigCheckJob *job = (SigCheckJob *) data;
+  SigCheckResult *result;
   gpgme_ctx_t ctx = NULL;
   gpgme_error_t err;
   gpgme_data_t sig = NULL, text = NULL;
   gpgme_verify_result_t verifyresult = NULL;
-  GpgmegtkSigStatus statuswindow = NULL;
-  const gchar *result = NULL;
-  gchar *tmp_file;
-  gint n_exclude_chars = 0;
 
-  if (prefs_common.gpg_signature_popup)
-    statuswindow = gpgmegtk_sig_status_create ();
+  result = g_new0 (SigCheckResult, 1);
 
   err = gpgme_new (&ctx);
   if (err)
@@ -222,12 +410,57 @@ check_signature (MimeInfo * mimeinfo, MimeInfo * partinfo, FILE * fp)
       goto leave;
     }
 
-  if (rfc2015_is_pkcs7_signature_part (partinfo))
+  if (job->cms)
+    gpgme_set_protocol (ctx, GPGME_PROTOCOL_CMS);
+
+  err = gpgme_data_new_from_mem (&text, job->text->str, job->text->len, 0);
+  if (!err)
+    err = gpgme_data_new_from_mem (&sig, job->sig->str, job->sig->len, 0);
+  if (err)
     {
-      debug_print ("pkcs7 signature detected\n");
-      gpgme_set_protocol (ctx, GPGME_PROTOCOL_CMS);
+      debug_print ("gpgme_data_new_from_mem failed: %s\n", gpgme_strerror (err));
+      goto leave;
     }
 
+  err = gpgme_op_verify (ctx, sig, text, NULL);
+  if (err)
+    {
+      debug_print ("gpgme_op_verify failed: %s\n", gpgme_strerror (err));
+      goto leave;
+    }
+  verifyresult = gpgme_op_verify_result (ctx);
+
+  result->status_full = sig_status_full (ctx, verifyresult);
+  result->popup_text = gpgmegtk_sig_status_get_text (ctx);
+
+leave:
+  if (verifyresult)
+    result->status = g_strdup (gpgmegtk_sig_status_to_string (verifyresult->signatures, FALSE));
+  else
+    result->status = g_strdup (_("Error verifying the signature"));
+  debug_print ("verification status: %s\n", result->status);
+
+  gpgme_data_release (sig);
+  gpgme_data_release (text);
+  if (ctx)
+    gpgme_release (ctx);
+
+  job->result = result;
+  g_idle_add (check_signature_done, job);
+}
+
+static gboolean
+check_signature (MimeInfo * mimeinfo, MimeInfo * partinfo, FILE * fp, const gchar * id,
+                 Rfc2015CheckFunc func, gpointer data)
+{
+  SigCheckJob *job;
+  SigCheckResult *result;
+  GString *text, *sig;
+  GChecksum *checksum;
+  GList *cur;
+  gchar *key;
+  gint n_exclude_chars = 0;
+
   /* don't include the last empty line.
      It does not belong to the signed text */
   if (mimeinfo->children->size > 0)
@@ -235,7 +468,7 @@ check_signature (MimeInfo * mimeinfo, MimeInfo * partinfo, FILE * fp)
       if (fseek (fp, mimeinfo->children->fpos + mimeinfo->children->size - 1, SEEK_SET) < 0)
         {
           perror ("fseek");
-          goto leave;
+          goto error;
         }
       if (fgetc (fp) == '\n')
         {
@@ -245,7 +478,7 @@ check_signature (MimeInfo * mimeinfo, MimeInfo * partinfo, FILE * fp)
               if (fseek (fp, mimeinfo->children->fpos + mimeinfo->children->size - 2, SEEK_SET) < 0)
                 {
                   perror ("fseek");
-                  goto leave;
+                  goto error;
                 }
               if (fgetc (fp) == '\r')
                 n_exclude_chars++;
@@ -253,66 +486,92 @@ check_signature (MimeInfo * mimeinfo, MimeInfo * partinfo, FILE * fp)
         }
     }
 
-  /* canonicalize the file part. */
-  tmp_file = get_tmp_file ();
-  if (copy_file_part (fp, mimeinfo->children->fpos, mimeinfo->children->size - n_exclude_chars, tmp_file) < 0)
-    {
-      g_free (tmp_file);
-      goto leave;
-    }
-  if (canonicalize_file_replace (tmp_file) < 0)
+  /* canonicalize the signed part in memory */
+  text = read_part (fp, mimeinfo->children->fpos, mimeinfo->children->size - n_exclude_chars, TRUE);
+  if (!text)
+    goto error;
+  sig = read_part (fp, partinfo->fpos, partinfo->size, FALSE);
+  if (!sig)
     {
-      g_unlink (tmp_file);
-      g_free (tmp_file);
-      goto leave;
+      g_string_free (text, TRUE);
+      goto error;
     }
 
-  err = gpgme_data_new_from_file (&text, tmp_file, 1);
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (checksum, (guchar *) text->str, text->len);
+  g_checksum_update (checksum, (guchar *) sig->str, sig->len);
+  key = g_strconcat (id ? id : "", "\n", g_checksum_get_string (checksum), NULL);
+  g_checksum_free (checksum);
 
-  g_unlink (tmp_file);
-  g_free (tmp_file);
-
-  if (!err)
-    err = gpgme_data_new_from_filepart (&sig, NULL, fp, partinfo->fpos, partinfo->size);
-  if (err)
+  result = sig_cache_lookup (key);
+  if (result)
     {
-      debug_print ("gpgme_data_new_from_filepart failed: %s\n", gpgme_strerror (err));
-      goto leave;
+      debug_print ("verification status (cached): %s\n", result->status);
+      set_signature_result (partinfo, result);
+      show_signature_popup (result);
+      g_string_free (text, TRUE);
+      g_string_free (sig, TRUE);
+      g_free (key);
+      return TRUE;
     }
 
-  err = gpgme_op_verify (ctx, sig, text, NULL);
-  if (err)
+  g_free (partinfo->sigstatus);
+  partinfo->sigstatus = g_strdup (_("Checking signature..."));
+  g_free (partinfo->sigstatus_full);
+  partinfo->sigstatus_full = NULL;
+
+  for (cur = sig_check_jobs; cur != NULL; cur = cur->next)
     {
-      debug_print ("gpgme_op_verify failed: %s\n", gpgme_strerror (err));
-      goto leave;
+      job = (SigCheckJob *) cur->data;
+      if (!strcmp (job->key, key))
+        {
+          /* already running; just redirect the notification */
+          job->func = func;
+          job->data = data;
+          g_string_free (text, TRUE);
+          g_string_free (sig, TRUE);
+          g_free (key);
+          return FALSE;
+        }
     }
-  verifyresult = gpgme_op_verify_result (ctx);
 
-  /* FIXME: check what the heck this sig_status_full stuff is.
-   * Maybe it belongs in sigstatus.c 
-   *
-   * I think it belongs here as it is interfacing with gmime (Toshio). */
-  g_free (partinfo->sigstatus_full);
-  partinfo->sigstatus_full = sig_status_full (ctx, verifyresult);
+  job = g_new0 (SigCheckJob, 1);
+  job->key = key;
+  job->text = text;
+  job->sig = sig;
+  job->cms = rfc2015_is_pkcs7_signature_part (partinfo);
+  if (job->cms)
+    debug_print ("pkcs7 signature detected\n");
+  job->func = func;
+  job->data = data;
+  sig_check_jobs = g_list_prepend (sig_check_jobs, job);
 
-leave:
-  if (verifyresult)
-    result = gpgmegtk_sig_status_to_string (verifyresult->signatures, FALSE);
-  else
-    result = _("Error verifying the signature");
-  debug_print ("verification status: %s\n", result);
-  if (prefs_common.gpg_signature_popup)
-    gpgmegtk_sig_status_update (statuswindow, ctx);
+  if (!sig_check_pool)
+    sig_check_pool = g_thread_pool_new (check_signature_thread_func, NULL, 1, FALSE, NULL);
+  g_thread_pool_push (sig_check_pool, job, NULL);
+
+  return FALSE;
 
+error:
   g_free (partinfo->sigstatus);
-  partinfo->sigstatus = g_strdup (result);
+  partinfo->sigstatus = g_strdup (_("Error verifying the signature"));
+  g_free (partinfo->sigstatus_full);
+  partinfo->sigstatus_full = NULL;
+  return TRUE;
+}
 
-  gpgme_data_release (sig);
-  gpgme_data_release (text);
-  if (ctx)
-    gpgme_release (ctx);
-  if (prefs_common.gpg_signature_popup)
-    gpgmegtk_sig_status_destroy (statuswindow);
+void
+rfc2015_cancel_check_signature (gpointer data)
+{
+  GList *cur;
+
+  for (cur = sig_check_jobs; cur != NULL; cur = cur->next)
+    {
+      SigCheckJob *job = (SigCheckJob *) cur->data;
+
+      if (job->data == data)
+        job->func = NULL;
+    }
 }
 
 /*
@@ -491,14 +750,15 @@ rfc2015_has_signature (MimeInfo * mimeinfo)
   return rfc2015_find_signature (mimeinfo) != NULL;
 }
 
-void
-rfc2015_check_signature (MimeInfo * mimeinfo, FILE * fp)
+gboolean
+rfc2015_check_signature (MimeInfo * mimeinfo, FILE * fp, const gchar * id, Rfc2015CheckFunc func, gpointer data)
 {
   MimeInfo **signedinfo;
+  gboolean done;
 
   signedinfo = rfc2015_find_signature (mimeinfo);
   if (!signedinfo)
-    return;
+    return TRUE;
 
 #if 0
   g_message ("** yep, it is a pgp signature");
@@ -508,8 +768,10 @@ rfc2015_check_signature (MimeInfo * mimeinfo, FILE * fp)
   dump_part (mimeinfo->children, fp);
 #endif
 
-  check_signature (signedinfo[0], signedinfo[1], fp);
+  done = check_signature (signedinfo[0], signedinfo[1], fp, id, func, data);
   g_free (signedinfo);
+
+  return done;
 }
 
 gboolean
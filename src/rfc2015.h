@@ -27,6 +27,8 @@
 #include "procmsg.h"
 #include "procmime.h"
 
+typedef void (*Rfc2015CheckFunc) (gpointer data);
+
 void rfc2015_disable_all (void);
 gboolean rfc2015_is_available (void);
 
@@ -34,7 +36,12 @@ void rfc2015_secure_remove (const gchar * fname);
 
 MimeInfo **rfc2015_find_signature (MimeInfo * mimeinfo);
 gboolean rfc2015_has_signature (MimeInfo * mimeinfo);
-void rfc2015_check_signature (MimeInfo * mimeinfo, FILE * fp);
+/* returns FALSE if the result is not known yet; func is called from the
+ * main loop once it is cached, and should call this again */
+gboolean rfc2015_check_signature (MimeInfo * mimeinfo, FILE * fp, const gchar * id,
+                                  Rfc2015CheckFunc func, gpointer data);
+void rfc2015_cancel_check_signature (gpointer data);
+void rfc2015_clear_signature_cache (void);
 gboolean rfc2015_is_pgp_signature_part (MimeInfo * mimeinfo);
 gboolean rfc2015_is_pkcs7_signature_part (MimeInfo * mimeinfo);
 gboolean rfc2015_is_signature_part (MimeInfo * mimeinfo);
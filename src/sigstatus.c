@@ -186,18 +186,18 @@ gpgmegtk_sig_status_destroy (GpgmegtkSigStatus hd)
     }
 }
 
-void
-gpgmegtk_sig_status_update (GpgmegtkSigStatus hd, gpgme_ctx_t ctx)
+gchar *
+gpgmegtk_sig_status_get_text (gpgme_ctx_t ctx)
 {
   gpgme_verify_result_t result;
   gpgme_signature_t sig;
   gchar *text = NULL;
 
-  if (!hd || !hd->running || !ctx)
-    return;
+  if (!ctx)
+    return NULL;
   result = gpgme_op_verify_result (ctx);
   if (!result)
-    return;
+    return NULL;
 
   sig = result->signatures;
   while (sig)
@@ -218,13 +218,35 @@ gpgmegtk_sig_status_update (GpgmegtkSigStatus hd, gpgme_ctx_t ctx)
       gpgme_key_unref (key);
       sig = sig->next;
     }
+
+  return text;
+}
+
+void
+gpgmegtk_sig_status_set_text (GpgmegtkSigStatus hd, const gchar * text)
+{
+  if (!hd || !hd->running || !text)
+    return;
+
   gtk_label_set_text (GTK_LABEL (hd->label), text);
-  g_free (text);
 
   while (gtk_events_pending ())
     gtk_main_iteration ();
 }
 
+void
+gpgmegtk_sig_status_update (GpgmegtkSigStatus hd, gpgme_ctx_t ctx)
+{
+  gchar *text;
+
+  if (!hd || !hd->running || !ctx)
+    return;
+
+  text = gpgmegtk_sig_status_get_text (ctx);
+  gpgmegtk_sig_status_set_text (hd, text);
+  g_free (text);
+}
+
 const gchar *
 gpgmegtk_sig_status_to_string (gpgme_signature_t signature, gboolean use_name)
 {
@@ -27,6 +27,9 @@ typedef struct gpgmegtk_sig_status_s *GpgmegtkSigStatus;
 GpgmegtkSigStatus gpgmegtk_sig_status_create (void);
 void gpgmegtk_sig_status_destroy (GpgmegtkSigStatus hd);
 void gpgmegtk_sig_status_update (GpgmegtkSigStatus hd, gpgme_ctx_t ctx);
+void gpgmegtk_sig_status_set_text (GpgmegtkSigStatus hd, const gchar * text);
+/* does not touch the GUI; may be called from a worker thread */
+gchar *gpgmegtk_sig_status_get_text (gpgme_ctx_t ctx);
 
 const gchar *gpgmegtk_sig_status_to_string (gpgme_signature_t signature, gboolean use_name);
 
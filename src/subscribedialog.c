@@ -68,8 +68,10 @@ static GtkWidget *ok_button;
 
 static GtkTreeStore *tree_store;
 
+static NewsGroupIndex *group_index;
 static GSList *group_list;
 static GSList *subscribe_list;
+static GHashTable *subscribe_table;
 static Folder *news_folder;
 
 static void subscribe_dialog_create (void);
@@ -115,10 +117,12 @@ subscribe_dialog (Folder * folder)
   GTK_EVENTS_FLUSH ();
 
   subscribe_list = NULL;
+  subscribe_table = g_hash_table_new_full (str_case_hash, str_case_equal, g_free, NULL);
   for (node = folder->node->children; node != NULL; node = node->next)
     {
       item = FOLDER_ITEM (node->data);
       subscribe_list = g_slist_append (subscribe_list, g_strdup (item->path));
+      g_hash_table_replace (subscribe_table, g_strdup (item->path), GINT_TO_POINTER (1));
     }
 
   subscribe_dialog_set_list (NULL, TRUE);
@@ -130,22 +134,31 @@ subscribe_dialog (Folder * folder)
   gtk_widget_hide (dialog);
   main_window_popup (main_window_get ());
 
-  if (ack)
+  if (ack && group_index)
     {
-      GSList *cur;
+      GHashTableIter iter;
+      gpointer key;
 
       slist_free_strings (subscribe_list);
+      g_slist_free (subscribe_list);
       subscribe_list = NULL;
-      for (cur = group_list; cur != NULL; cur = cur->next)
+
+      /* groups which are no longer on the server are dropped */
+      g_hash_table_iter_init (&iter, subscribe_table);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
         {
-          NewsGroupInfo *ginfo = (NewsGroupInfo *) cur->data;
+          const gchar *name;
 
-          if (ginfo->subscribed)
-            subscribe_list = g_slist_append (subscribe_list, g_strdup (ginfo->name));
+          name = news_group_index_lookup (group_index, (const gchar *) key);
+          if (name)
+            subscribe_list = g_slist_prepend (subscribe_list, g_strdup (name));
         }
+      subscribe_list = g_slist_sort (subscribe_list, (GCompareFunc) g_ascii_strcasecmp);
     }
 
   subscribe_clear ();
+  g_hash_table_destroy (subscribe_table);
+  subscribe_table = NULL;
 
   return subscribe_list;
 }
@@ -400,7 +413,6 @@ subscribe_dialog_set_list (const gchar * pattern, gboolean refresh)
 {
   gchar *pattern_;
   GSList *cur;
-  GPatternSpec *pspec;
 
   if (locked)
     return;
@@ -422,11 +434,10 @@ subscribe_dialog_set_list (const gchar * pattern, gboolean refresh)
       gtk_label_set_text (GTK_LABEL (status_label), _("Getting newsgroup list..."));
       GTK_EVENTS_FLUSH ();
       recv_set_ui_func (subscribe_recv_func, NULL);
-      group_list = news_get_group_list (news_folder);
-      group_list = g_slist_reverse (group_list);
+      group_index = news_group_index_open (news_folder);
       recv_set_ui_func (NULL, NULL);
       statusbar_pop_all ();
-      if (group_list == NULL && ack == TRUE)
+      if (group_index == NULL && ack == TRUE)
         {
           alertpanel_error (_("Can't retrieve newsgroup list."));
           g_free (pattern_);
@@ -435,11 +446,23 @@ subscribe_dialog_set_list (const gchar * pattern, gboolean refresh)
         }
     }
   else
-    gtk_tree_store_clear (tree_store);
+    {
+      gtk_tree_store_clear (tree_store);
+      news_group_list_free (group_list);
+      group_list = NULL;
+    }
 
-  subscribe_hash_init ();
+  if (!group_index)
+    {
+      g_free (pattern_);
+      locked = FALSE;
+      return;
+    }
 
-  pspec = g_pattern_spec_new (pattern_);
+  group_list = news_group_index_search (group_index, pattern_);
+  group_list = g_slist_reverse (group_list);
+
+  subscribe_hash_init ();
 
   for (cur = group_list; cur != NULL; cur = cur->next)
     {
@@ -449,18 +472,14 @@ subscribe_dialog_set_list (const gchar * pattern, gboolean refresh)
       if (!ginfo->name || !is_ascii_str (ginfo->name))
         continue;
 
-      if (g_slist_find_custom (subscribe_list, ginfo->name, (GCompareFunc) g_ascii_strcasecmp) != NULL)
+      if (g_hash_table_lookup (subscribe_table, ginfo->name) != NULL)
         ginfo->subscribed = TRUE;
 
-      if (g_pattern_match_string (pspec, ginfo->name))
-        {
-          subscribe_create_branch (ginfo, pattern_, &iter);
-          if (ginfo->subscribed)
-            gtk_tree_store_set (tree_store, &iter, SUBSCRIBE_TOGGLE, TRUE, -1);
-        }
+      subscribe_create_branch (ginfo, pattern_, &iter);
+      if (ginfo->subscribed)
+        gtk_tree_store_set (tree_store, &iter, SUBSCRIBE_TOGGLE, TRUE, -1);
     }
 
-  g_pattern_spec_free (pspec);
   subscribe_hash_free ();
   g_free (pattern_);
 
@@ -489,6 +508,8 @@ subscribe_clear (void)
   gtk_entry_set_text (GTK_ENTRY (entry), "");
   news_group_list_free (group_list);
   group_list = NULL;
+  news_group_index_close (group_index);
+  group_index = NULL;
 }
 
 static gboolean
@@ -539,7 +560,19 @@ refresh_clicked (GtkWidget * widget, gpointer data)
   if (locked)
     return;
 
-  news_remove_group_list_cache (news_folder);
+  /* drop the results of the old index before it is replaced */
+  news_group_list_free (group_list);
+  group_list = NULL;
+  gtk_tree_store_clear (tree_store);
+  news_group_index_close (group_index);
+  group_index = NULL;
+
+  ack = TRUE;
+  gtk_label_set_text (GTK_LABEL (status_label), _("Updating newsgroup list..."));
+  GTK_EVENTS_FLUSH ();
+  recv_set_ui_func (subscribe_recv_func, NULL);
+  news_update_group_list (news_folder);
+  recv_set_ui_func (NULL, NULL);
 
   str = gtk_editable_get_chars (GTK_EDITABLE (entry), 0, -1);
   subscribe_dialog_set_list (str, TRUE);
@@ -589,6 +622,10 @@ subscribe_toggled (GtkCellRenderer * cell, gchar * path_str, gpointer data)
   if (ginfo && can_toggle)
     {
       ginfo->subscribed = !enabled;
+      if (ginfo->subscribed)
+        g_hash_table_replace (subscribe_table, g_strdup (ginfo->name), GINT_TO_POINTER (1));
+      else
+        g_hash_table_remove (subscribe_table, ginfo->name);
       gtk_tree_store_set (tree_store, &iter, SUBSCRIBE_TOGGLE, !enabled, -1);
     }
 }
@@ -39,6 +39,7 @@
 #include "folderview.h"
 #include "summaryview.h"
 #include "messageview.h"
+#include "prefetch.h"
 #include "foldersel.h"
 #include "procmsg.h"
 #include "procheader.h"
@@ -101,6 +102,12 @@
 #define SUMMARY_COL_UNREAD_WIDTH	24
 #define SUMMARY_COL_MIME_WIDTH	19
 
+/* delay before fetching the next messages from the server */
+#define SUMMARY_PREFETCH_DELAY	300
+/* the summary is write-locked during the fetch, so only small messages
+   are fetched in advance */
+#define SUMMARY_PREFETCH_REMOTE_MAX	(256 * 1024)
+
 static GdkPixbuf *mark_pixbuf = NULL;
 static GdkPixbuf *deleted_pixbuf = NULL;
 
@@ -155,6 +162,9 @@ static void summary_set_row (SummaryView * summaryview, GtkTreeIter * iter, MsgI
 static void summary_set_tree_model_from_list (SummaryView * summaryview, GSList * mlist);
 static gboolean summary_row_is_displayed (SummaryView * summaryview, GtkTreeIter * iter);
 static void summary_display_msg (SummaryView * summaryview, GtkTreeIter * iter);
+static void summary_prefetch_next (SummaryView * summaryview, GtkTreeIter * iter);
+static void summary_prefetch_cancel (SummaryView * summaryview);
+
 static void summary_display_msg_full (SummaryView * summaryview, GtkTreeIter * iter,
                                       gboolean new_window, gboolean all_headers, gboolean redisplay);
 
@@ -851,6 +861,8 @@ summary_clear_list_full (SummaryView * summaryview, gboolean is_refresh)
 void
 summary_clear_all (SummaryView * summaryview)
 {
+  summary_prefetch_cancel (summaryview);
+  prefetch_clear ();
   messageview_clear (summaryview->messageview);
   summary_clear_list (summaryview);
   summary_set_menu_sensitive (summaryview);
@@ -2360,8 +2372,10 @@ summary_insert_gnode (SummaryView * summaryview, GtkTreeStore * store,
 {
   MsgInfo *msginfo = (MsgInfo *) gnode->data;
 
+  /* the children are inserted from the last one, since prepending
+   * does not walk the siblings */
   if (parent && !sibling)
-    gtk_tree_store_append (store, iter, parent);
+    gtk_tree_store_prepend (store, iter, parent);
   else
     gtk_tree_store_insert_after (store, iter, parent, sibling);
 
@@ -2373,7 +2387,7 @@ summary_insert_gnode (SummaryView * summaryview, GtkTreeStore * store,
       gtk_tree_store_set (store, iter, S_COL_TDATE, tdate, -1);
     }
 
-  for (gnode = gnode->children; gnode != NULL; gnode = gnode->next)
+  for (gnode = g_node_last_child (gnode); gnode != NULL; gnode = gnode->prev)
     {
       GtkTreeIter child;
       summary_insert_gnode (summaryview, store, &child, iter, NULL, gnode);
@@ -2449,13 +2463,18 @@ summary_set_tree_model_from_list (SummaryView * summaryview, GSList * mlist)
     }
   else
     {
-      GSList *rev_mlist;
+      MsgVector *mvec;
       GtkTreeIter iter;
+      guint i;
+
+      /* rows are prepended, which is cheaper than appending */
+      mvec = procmsg_msg_vector_new (0);
+      for (cur = mlist; cur != NULL; cur = cur->next)
+        procmsg_msg_vector_append (mvec, (MsgInfo *) cur->data);
 
-      rev_mlist = g_slist_reverse (g_slist_copy (mlist));
-      for (cur = rev_mlist; cur != NULL; cur = cur->next)
+      for (i = mvec->len; i > 0; i--)
         {
-          msginfo = (MsgInfo *) cur->data;
+          msginfo = mvec->msgs[i - 1];
 
           gtk_tree_store_prepend (store, &iter, NULL);
           summary_set_row (summaryview, &iter, msginfo);
@@ -2468,7 +2487,7 @@ summary_set_tree_model_from_list (SummaryView * summaryview, GSList * mlist)
             summaryview->copied++;
           summaryview->total_size += msginfo->size;
         }
-      g_slist_free (rev_mlist);
+      procmsg_msg_vector_free (mvec, FALSE);
     }
 
   gtk_tree_view_set_model (GTK_TREE_VIEW (summaryview->treeview), GTK_TREE_MODEL (store));
@@ -2634,6 +2653,15 @@ summary_display_msg_full (SummaryView * summaryview,
   if (!new_window && !redisplay && summary_row_is_displayed (summaryview, iter))
     return;
 
+  if (summaryview->prefetching)
+    {
+      /* the session is busy; show the message after the fetch */
+      summaryview->display_pending = TRUE;
+      summaryview->display_pending_new_window = new_window;
+      summaryview->display_pending_all_headers = all_headers;
+      return;
+    }
+
   if (summary_is_read_locked (summaryview))
     return;
   summary_lock (summaryview);
@@ -2702,9 +2730,129 @@ summary_display_msg_full (SummaryView * summaryview,
 
   statusbar_pop_all ();
 
+  if (val == 0 && !new_window)
+    summary_prefetch_next (summaryview, iter);
+
   summary_unlock (summaryview);
 }
 
+static gboolean
+summary_prefetch_timeout (gpointer data)
+{
+  SummaryView *summaryview = (SummaryView *) data;
+  GtkTreeIter iter;
+  MsgInfo *msginfo = NULL;
+  guint msgnum;
+  gchar *file;
+
+  summaryview->prefetch_id = 0;
+
+  if (!summaryview->prefetch_list)
+    return FALSE;
+
+  msgnum = GPOINTER_TO_UINT (summaryview->prefetch_list->data);
+
+  if (summary_find_msg_by_msgnum (summaryview, msgnum, &iter))
+    GET_MSG_INFO (msginfo, &iter);
+
+  if (msginfo && (summary_is_locked (summaryview) ||
+                  (FOLDER_TYPE (msginfo->folder->folder) == F_IMAP &&
+                   imap_is_session_active (IMAP_FOLDER (msginfo->folder->folder)))))
+    {
+      /* try again later */
+      summaryview->prefetch_id = g_timeout_add (SUMMARY_PREFETCH_DELAY, summary_prefetch_timeout, summaryview);
+      return FALSE;
+    }
+
+  summaryview->prefetch_list = g_slist_remove (summaryview->prefetch_list, GUINT_TO_POINTER (msgnum));
+
+  if (msginfo)
+    {
+      debug_print ("summary_prefetch_timeout: fetching %u\n", msgnum);
+      summary_write_lock (summaryview);
+      summaryview->prefetching = TRUE;
+      file = procmsg_get_message_file (msginfo);
+      summaryview->prefetching = FALSE;
+      summary_write_unlock (summaryview);
+      if (file)
+        {
+          prefetch_message (msginfo);
+          g_free (file);
+        }
+    }
+
+  if (summaryview->display_pending)
+    {
+      summaryview->display_pending = FALSE;
+      summary_display_msg_selected (summaryview, summaryview->display_pending_new_window,
+                                    summaryview->display_pending_all_headers);
+    }
+
+  if (summaryview->prefetch_list && summaryview->prefetch_id == 0)
+    summaryview->prefetch_id = g_timeout_add (SUMMARY_PREFETCH_DELAY, summary_prefetch_timeout, summaryview);
+
+  return FALSE;
+}
+
+static void
+summary_prefetch_add (SummaryView * summaryview, MsgInfo * msginfo)
+{
+  gchar *file;
+
+  file = procmsg_get_message_file_path (msginfo);
+  if (!file)
+    return;
+
+  if (is_file_exist (file))
+    prefetch_message (msginfo);
+  else if (prefs_common.online_mode && msginfo->size <= SUMMARY_PREFETCH_REMOTE_MAX &&
+           !g_slist_find (summaryview->prefetch_list, GUINT_TO_POINTER (msginfo->msgnum)))
+    {
+      /* not in the cache yet; fetch it when idle */
+      summaryview->prefetch_list = g_slist_append (summaryview->prefetch_list, GUINT_TO_POINTER (msginfo->msgnum));
+      if (summaryview->prefetch_id == 0)
+        summaryview->prefetch_id = g_timeout_add (SUMMARY_PREFETCH_DELAY, summary_prefetch_timeout, summaryview);
+    }
+
+  g_free (file);
+}
+
+/* prepare the next message and the next unread one in the background */
+static void
+summary_prefetch_next (SummaryView * summaryview, GtkTreeIter * iter)
+{
+  GtkTreeIter iter_, next;
+  MsgInfo *msginfo;
+
+  summary_prefetch_cancel (summaryview);
+
+  iter_ = *iter;
+  if (yam_tree_model_next (GTK_TREE_MODEL (summaryview->store), &iter_) &&
+      summary_find_next_msg (summaryview, &next, &iter_))
+    {
+      GET_MSG_INFO (msginfo, &next);
+      summary_prefetch_add (summaryview, msginfo);
+    }
+
+  if (summary_find_next_flagged_msg (summaryview, &next, iter, MSG_UNREAD, TRUE))
+    {
+      GET_MSG_INFO (msginfo, &next);
+      summary_prefetch_add (summaryview, msginfo);
+    }
+}
+
+static void
+summary_prefetch_cancel (SummaryView * summaryview)
+{
+  if (summaryview->prefetch_id > 0)
+    {
+      g_source_remove (summaryview->prefetch_id);
+      summaryview->prefetch_id = 0;
+    }
+  g_slist_free (summaryview->prefetch_list);
+  summaryview->prefetch_list = NULL;
+}
+
 void
 summary_display_msg_selected (SummaryView * summaryview, gboolean new_window, gboolean all_headers)
 {
@@ -4098,7 +4246,8 @@ summary_execute_delete (SummaryView * summaryview)
   if (!trash)
     folder_get_default_trash ();
 
-  if (FOLDER_TYPE (summaryview->folder_item->folder) == F_MH)
+  if (FOLDER_TYPE (summaryview->folder_item->folder) == F_MH ||
+      FOLDER_TYPE (summaryview->folder_item->folder) == F_MAILDIR)
     g_return_val_if_fail (trash != NULL, 0);
 
   /* search deleting messages and execute */
@@ -4188,7 +4337,7 @@ summary_thread_build (SummaryView * summaryview)
           GtkTreeIter child;
           guint tdate;
 
-          for (cur = node->children; cur != NULL; cur = cur->next)
+          for (cur = g_node_last_child (node); cur != NULL; cur = cur->prev)
             summary_insert_gnode (summaryview, store, &child, &iter, NULL, cur);
 
           tdate = procmsg_get_thread_date (node);
@@ -155,6 +155,14 @@ private:
   /* junk filter list */
   GSList *junk_fltlist;
 
+  /* messages to be fetched for prefetching */
+  GSList *prefetch_list;
+  guint prefetch_id;
+  gboolean prefetching;
+  gboolean display_pending;
+  gboolean display_pending_new_window;
+  gboolean display_pending_all_headers;
+
   /* generic flag */
   gint tmp_flag;
 };
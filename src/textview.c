@@ -54,6 +54,7 @@
 #include "plugin.h"
 
 typedef struct _RemoteURI RemoteURI;
+typedef struct _TextViewRenderPart TextViewRenderPart;
 
 struct _RemoteURI {
   gchar *uri;
@@ -64,6 +65,24 @@ struct _RemoteURI {
   guint end;
 };
 
+/* body text inserted first, the rest is rendered at idle time */
+#define TEXTVIEW_RENDER_SYNC_SIZE	(64 * 1024)
+#define TEXTVIEW_RENDER_BATCH_SIZE	(512 * 1024)
+
+struct _TextViewRender {
+  GSList *parts;
+  guint idle_id;
+
+  /* URIs found by the batch being inserted */
+  GPtrArray *uris;
+};
+
+struct _TextViewRenderPart {
+  FILE *fp;
+  CodeConverter *conv;
+  GtkTextMark *mark;
+};
+
 static GdkRGBA quote_colors[3] = {
   { 0.0, 0.0, 0.0, 1.0 },
   { 0.0, 0.0, 0.0, 1.0 },
@@ -104,9 +123,13 @@ static void textview_add_parts (TextView * textview, MimeInfo * mimeinfo, FILE *
 static void textview_write_body (TextView * textview, MimeInfo * mimeinfo, FILE * fp, const gchar * charset);
 static void textview_show_html (TextView * textview, FILE * fp, CodeConverter * conv);
 
-static void textview_write_line (TextView * textview, const gchar * str, CodeConverter * conv);
+static gboolean textview_write_lines (TextView * textview, GtkTextIter * iter, FILE * fp, CodeConverter * conv, gint limit);
+static void textview_write_line (TextView * textview, GtkTextIter * iter, const gchar * str, CodeConverter * conv);
 static void textview_write_link (TextView * textview, const gchar * str, const gchar * uri, CodeConverter * conv);
 
+static void textview_render_queue (TextView * textview, GtkTextIter * iter, FILE * fp, CodeConverter * conv);
+static void textview_render_cancel (TextView * textview);
+
 static GPtrArray * textview_scan_header (TextView * textview, FILE * fp, const gchar * encoding);
 static void textview_show_header (TextView * textview, GPtrArray * headers);
 
@@ -137,7 +160,9 @@ static void textview_show_uri (TextView * textview, GtkTextIter * start, GtkText
 static void textview_set_cursor (TextView * textview, GtkTextView * text, gint x, gint y);
 
 static gboolean textview_uri_security_check (TextView * textview, RemoteURI * uri);
-static void textview_uri_list_remove_all (GSList * uri_list);
+static void textview_uri_free (gpointer data);
+static guint textview_uri_array_find (GPtrArray * array, guint start);
+static void textview_uri_add (TextView * textview, RemoteURI * uri);
 static void textview_uri_list_update_offsets (TextView * textview, gint start, gint add);
 
 TextView *
@@ -194,9 +219,10 @@ textview_create (void)
   textview->vbox = vbox;
   textview->scrolledwin = scrolledwin;
   textview->text = text;
-  textview->uri_list = NULL;
+  textview->uri_array = g_ptr_array_new_with_free_func (textview_uri_free);
   textview->body_pos = 0;
   textview->show_all_headers = FALSE;
+  textview->render = NULL;
 
   return textview;
 }
@@ -736,7 +762,7 @@ textview_add_part (TextView * textview, MimeInfo * mimeinfo, FILE * fp)
               uri->filename = procmime_get_part_file_name (mimeinfo);
               uri->start = gtk_text_iter_get_offset (&iter);
               uri->end = uri->start + 1;
-              textview->uri_list = g_slist_append (textview->uri_list, uri);
+              textview_uri_add (textview, uri);
             }
           gtk_text_buffer_insert_pixbuf (buffer, &iter, pixbuf);
           gtk_text_buffer_insert (buffer, &iter, "\n", 1);
@@ -900,20 +926,35 @@ textview_show_error (TextView * textview)
 static void
 textview_write_body (TextView * textview, MimeInfo * mimeinfo, FILE * fp, const gchar * charset)
 {
+  GtkTextBuffer *buffer;
+  GtkTextIter iter;
   FILE *tmpfp;
-  gchar buf[BUFFSIZE];
   CodeConverter *conv;
 
   conv = conv_code_converter_new (charset, NULL);
 
-  tmpfp = procmime_decode_content (NULL, fp, mimeinfo);
+  if (mimeinfo->decoded_fp)
+    {
+      /* already decoded by the prefetcher */
+      tmpfp = mimeinfo->decoded_fp;
+      mimeinfo->decoded_fp = NULL;
+    }
+  else
+    tmpfp = procmime_decode_content (NULL, fp, mimeinfo);
   if (tmpfp)
     {
       if (mimeinfo->mime_type == MIME_TEXT_HTML && prefs_common.render_html)
         textview_show_html (textview, tmpfp, conv);
       else
-        while (fgets (buf, sizeof (buf), tmpfp) != NULL)
-          textview_write_line (textview, buf, conv);
+        {
+          buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (textview->text));
+          gtk_text_buffer_get_end_iter (buffer, &iter);
+          if (textview_write_lines (textview, &iter, tmpfp, conv, TEXTVIEW_RENDER_SYNC_SIZE))
+            {
+              textview_render_queue (textview, &iter, tmpfp, conv);
+              return;
+            }
+        }
       fclose (tmpfp);
     }
   else
@@ -925,23 +966,162 @@ textview_write_body (TextView * textview, MimeInfo * mimeinfo, FILE * fp, const
   conv_code_converter_destroy (conv);
 }
 
+static gboolean
+textview_render_idle (gpointer data)
+{
+  TextView *textview = (TextView *) data;
+  TextViewRender *render = textview->render;
+  TextViewRenderPart *part;
+  GtkTextBuffer *buffer;
+  GtkTextIter iter;
+  gint start;
+  gboolean more;
+
+  if (!render->parts)
+    {
+      render->idle_id = 0;
+      return FALSE;
+    }
+
+  part = (TextViewRenderPart *) render->parts->data;
+  buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (textview->text));
+
+  gtk_text_buffer_get_iter_at_mark (buffer, &iter, part->mark);
+  start = gtk_text_iter_get_offset (&iter);
+
+  render->uris = g_ptr_array_new ();
+  more = textview_write_lines (textview, &iter, part->fp, part->conv, TEXTVIEW_RENDER_BATCH_SIZE);
+  gtk_text_buffer_move_mark (buffer, part->mark, &iter);
+
+  /* shift the links that follow the part, then put the new ones
+     in their place */
+  textview_uri_list_update_offsets (textview, start, gtk_text_iter_get_offset (&iter) - start);
+  if (render->uris->len > 0)
+    {
+      guint index;
+      guint i;
+
+      index = textview_uri_array_find (textview->uri_array, start);
+      for (i = 0; i < render->uris->len; i++)
+        g_ptr_array_insert (textview->uri_array, index + i, g_ptr_array_index (render->uris, i));
+    }
+  g_ptr_array_free (render->uris, TRUE);
+  render->uris = NULL;
+
+  if (more)
+    return TRUE;
+
+  render->parts = g_slist_remove (render->parts, part);
+  fclose (part->fp);
+  conv_code_converter_destroy (part->conv);
+  gtk_text_buffer_delete_mark (buffer, part->mark);
+  g_free (part);
+
+  if (render->parts)
+    return TRUE;
+
+  debug_print ("textview_render_idle: done\n");
+  render->idle_id = 0;
+  return FALSE;
+}
+
+/* render the rest of the body when idle; takes over fp and conv */
+static void
+textview_render_queue (TextView * textview, GtkTextIter * iter, FILE * fp, CodeConverter * conv)
+{
+  TextViewRender *render;
+  TextViewRenderPart *part;
+  GtkTextBuffer *buffer;
+
+  if (!textview->render)
+    textview->render = g_new0 (TextViewRender, 1);
+  render = textview->render;
+
+  buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (textview->text));
+
+  part = g_new (TextViewRenderPart, 1);
+  part->fp = fp;
+  part->conv = conv;
+  /* left gravity keeps the text added after the part behind it */
+  part->mark = gtk_text_buffer_create_mark (buffer, NULL, iter, TRUE);
+  render->parts = g_slist_append (render->parts, part);
+
+  debug_print ("textview_render_queue: rendering the rest in the background\n");
+
+  if (render->idle_id == 0)
+    render->idle_id = g_idle_add (textview_render_idle, textview);
+}
+
+static void
+textview_render_cancel (TextView * textview)
+{
+  TextViewRender *render = textview->render;
+  GtkTextBuffer *buffer;
+  GSList *cur;
+
+  if (!render)
+    return;
+
+  if (render->idle_id > 0)
+    {
+      g_source_remove (render->idle_id);
+      render->idle_id = 0;
+    }
+
+  buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (textview->text));
+
+  for (cur = render->parts; cur != NULL; cur = cur->next)
+    {
+      TextViewRenderPart *part = (TextViewRenderPart *) cur->data;
+
+      fclose (part->fp);
+      conv_code_converter_destroy (part->conv);
+      gtk_text_buffer_delete_mark (buffer, part->mark);
+      g_free (part);
+    }
+  g_slist_free (render->parts);
+  render->parts = NULL;
+}
+
+/* finish the body parts still being rendered at idle time */
+void
+textview_render_complete (TextView * textview)
+{
+  g_return_if_fail (textview != NULL);
+
+  if (!textview->render || !textview->render->parts)
+    return;
+
+  g_source_remove (textview->render->idle_id);
+  while (textview_render_idle (textview))
+    ;
+}
+
 static void
 textview_show_html (TextView * textview, FILE * fp, CodeConverter * conv)
 {
   HTMLParser *parser;
+  GtkTextBuffer *buffer;
+  GtkTextIter iter;
   const gchar *str;
 
   parser = html_parser_new (fp, conv);
   g_return_if_fail (parser != NULL);
 
+  buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (textview->text));
+
   while ((str = html_parse (parser)) != NULL)
     {
       if (parser->href != NULL)
         textview_write_link (textview, str, parser->href, NULL);
       else
-        textview_write_line (textview, str, NULL);
+        {
+          gtk_text_buffer_get_end_iter (buffer, &iter);
+          textview_write_line (textview, &iter, str, NULL);
+        }
     }
-  textview_write_line (textview, "\n", NULL);
+  gtk_text_buffer_get_end_iter (buffer, &iter);
+  textview_write_line (textview, &iter, "\n", NULL);
 
   html_parser_destroy (parser);
 }
@@ -1081,158 +1261,101 @@ make_email_string (const gchar * bp, const gchar * ep)
   return result;
 }
 
-#define ADD_TXT_POS(bp_, ep_, pti_) \
-{ \
-	struct txtpos *last; \
- \
-	last = g_new(struct txtpos, 1); \
-	last->bp = (bp_); \
-	last->ep = (ep_); \
-	last->pti = (pti_); \
-	txtpos_list = g_slist_append(txtpos_list, last); \
-}
+/* parse table - in order of priority */
+static const struct {
+  const gchar *needle;          /* token */
+
+  /* part parsing function */
+  gboolean (*parse) (const gchar * start, const gchar * scanpos, const gchar ** bp_, const gchar ** ep_);
+  /* part to URI function */
+  gchar *(*build_uri) (const gchar * bp, const gchar * ep);
+} uri_parser[] = {
+  {"http://", get_uri_part, make_uri_string},
+  {"https://", get_uri_part, make_uri_string},
+  {"ftp://", get_uri_part, make_uri_string},
+  {"www.", get_uri_part, make_http_uri_string},
+  {"mailto:", get_uri_part, make_uri_string},
+  {"@", get_email_part, make_email_string}
+};
 
-/* textview_make_clickable_parts() - colorizes clickable parts */
-static void
-textview_make_clickable_parts (TextView * textview, const gchar * fg_tag, const gchar * uri_tag, const gchar * linebuf)
+/* textview_find_uri() - finds the first clickable part in a single
+   pass over the line.  Returns its index in the parse table, or -1 */
+static gint
+textview_find_uri (const gchar * walk, const gchar ** bp, const gchar ** ep)
 {
-  GtkTextView *text = GTK_TEXT_VIEW (textview->text);
-  GtkTextBuffer *buffer;
-  GtkTextIter iter;
-
-  /* parse table - in order of priority */
-  struct table {
-    const gchar *needle;        /* token */
-
-    /* token search function */
-    gchar *(*search) (const gchar * haystack, const gchar * needle);
-    /* part parsing function */
-      gboolean (*parse) (const gchar * start, const gchar * scanpos, const gchar ** bp_, const gchar ** ep_);
-    /* part to URI function */
-    gchar *(*build_uri) (const gchar * bp, const gchar * ep);
-  };
-
-  static struct table parser[] = {
-    {"http://", strcasestr, get_uri_part, make_uri_string},
-    {"https://", strcasestr, get_uri_part, make_uri_string},
-    {"ftp://", strcasestr, get_uri_part, make_uri_string},
-    {"www.", strcasestr, get_uri_part, make_http_uri_string},
-    {"mailto:", strcasestr, get_uri_part, make_uri_string},
-    {"@", strcasestr, get_email_part, make_email_string}
-  };
-  const gint PARSE_ELEMS = sizeof parser / sizeof parser[0];
-
-  /* flags for search optimization */
-  gboolean do_search[] = { TRUE, TRUE, TRUE, TRUE, TRUE, TRUE };
-
+  const gchar *scanpos;
   gint n;
-  const gchar *walk, *bp, *ep;
-
-  struct txtpos {
-    const gchar *bp, *ep;       /* text position */
-    gint pti;                   /* index in parse table */
-  };
-  GSList *txtpos_list = NULL;
 
-  buffer = gtk_text_view_get_buffer (text);
-  gtk_text_buffer_get_end_iter (buffer, &iter);
-
-  /* parse for clickable parts, and build a list of begin and
-     end positions  */
-  for (walk = linebuf, n = 0;;)
+  for (scanpos = walk; *scanpos != '\0'; scanpos++)
     {
-      gint last_index = PARSE_ELEMS;
-      const gchar *scanpos = NULL;
+      gchar ch = g_ascii_tolower (*scanpos);
+
+      if (!strchr ("hfwm@", ch))
+        continue;
 
-      /* FIXME: this looks phony. scanning for anything in the
-         parse table */
-      for (n = 0; n < PARSE_ELEMS; n++)
+      for (n = 0; n < (gint) G_N_ELEMENTS (uri_parser); n++)
         {
-          const gchar *tmp;
+          const gchar *needle = uri_parser[n].needle;
+          gsize len;
 
-          if (do_search[n])
-            {
-              tmp = parser[n].search (walk, parser[n].needle);
-              if (tmp)
-                {
-                  if (scanpos == NULL || tmp < scanpos)
-                    {
-                      scanpos = tmp;
-                      last_index = n;
-                    }
-                }
-              else
-                do_search[n] = FALSE;
-            }
-        }
+          if (needle[0] != ch)
+            continue;
+          len = strlen (needle);
+          if (g_ascii_strncasecmp (scanpos, needle, len) != 0)
+            continue;
 
-      if (scanpos)
-        {
           /* check if URI can be parsed */
-          if (parser[last_index].parse (walk, scanpos, &bp, &ep) && (ep - bp - 1) > strlen (parser[last_index].needle))
-            {
-              ADD_TXT_POS (bp, ep, last_index);
-              walk = ep;
-            }
-          else
-            walk = scanpos + strlen (parser[last_index].needle);
+          if (uri_parser[n].parse (walk, scanpos, bp, ep) && (*ep - *bp - 1) > len)
+            return n;
+
+          walk = scanpos + len;
+          scanpos = walk - 1;
+          break;
         }
-      else
-        break;
     }
 
-  /* colorize this line */
-  if (txtpos_list)
-    {
-      const gchar *normal_text = linebuf;
-      GSList *cur;
-
-      /* insert URIs */
-      for (cur = txtpos_list; cur != NULL; cur = cur->next)
-        {
-          struct txtpos *pos = (struct txtpos *) cur->data;
-          RemoteURI *uri;
+  return -1;
+}
 
-          uri = g_new (RemoteURI, 1);
-          if (pos->bp - normal_text > 0)
-            gtk_text_buffer_insert_with_tags_by_name (buffer, &iter, normal_text, pos->bp - normal_text, fg_tag, NULL);
-          uri->uri = parser[pos->pti].build_uri (pos->bp, pos->ep);
-          uri->filename = NULL;
-          uri->start = gtk_text_iter_get_offset (&iter);
-          gtk_text_buffer_insert_with_tags_by_name (buffer, &iter, pos->bp, pos->ep - pos->bp, uri_tag, fg_tag, NULL);
-          uri->end = gtk_text_iter_get_offset (&iter);
-          textview->uri_list = g_slist_append (textview->uri_list, uri);
-          normal_text = pos->ep;
-
-          g_free (pos);
-        }
+/* textview_make_clickable_parts() - colorizes clickable parts */
+static void
+textview_make_clickable_parts (TextView * textview, GtkTextIter * iter,
+                               const gchar * fg_tag, const gchar * uri_tag, const gchar * linebuf)
+{
+  GtkTextBuffer *buffer;
+  const gchar *normal_text = linebuf;
+  const gchar *bp, *ep;
+  gint n;
 
-      if (*normal_text)
-        yam_text_buffer_insert_with_tag_by_name (buffer, &iter, normal_text, -1, fg_tag);
+  buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (textview->text));
 
-      g_slist_free (txtpos_list);
-    }
-  else
+  while ((n = textview_find_uri (normal_text, &bp, &ep)) >= 0)
     {
-      yam_text_buffer_insert_with_tag_by_name (buffer, &iter, linebuf, -1, fg_tag);
+      RemoteURI *uri;
+
+      if (bp - normal_text > 0)
+        gtk_text_buffer_insert_with_tags_by_name (buffer, iter, normal_text, bp - normal_text, fg_tag, NULL);
+      uri = g_new (RemoteURI, 1);
+      uri->uri = uri_parser[n].build_uri (bp, ep);
+      uri->filename = NULL;
+      uri->start = gtk_text_iter_get_offset (iter);
+      gtk_text_buffer_insert_with_tags_by_name (buffer, iter, bp, ep - bp, uri_tag, fg_tag, NULL);
+      uri->end = gtk_text_iter_get_offset (iter);
+      textview_uri_add (textview, uri);
+      normal_text = ep;
     }
+
+  if (*normal_text)
+    yam_text_buffer_insert_with_tag_by_name (buffer, iter, normal_text, -1, fg_tag);
 }
 
-#undef ADD_TXT_POS
+static const gchar *quote_tags[] = { "quote0", "quote1", "quote2" };
 
-static void
-textview_write_line (TextView * textview, const gchar * str, CodeConverter * conv)
+static gchar *
+textview_convert_line (const gchar * str, CodeConverter * conv, const gchar ** fg_tag)
 {
-  GtkTextView *text = GTK_TEXT_VIEW (textview->text);
-  GtkTextBuffer *buffer;
-  GtkTextIter iter;
   gchar *buf;
-  gchar *fg_color = NULL;
   gint quotelevel = -1;
-  gchar quote_tag_str[10];
-
-  buffer = gtk_text_view_get_buffer (text);
-  gtk_text_buffer_get_end_iter (buffer, &iter);
 
   if (conv)
     {
@@ -1265,18 +1388,88 @@ textview_write_line (TextView * textview, const gchar * str, CodeConverter * con
         }
     }
 
-  if (quotelevel != -1)
+  *fg_tag = quotelevel != -1 ? quote_tags[quotelevel] : NULL;
+
+  return buf;
+}
+
+static void
+textview_write_line (TextView * textview, GtkTextIter * iter, const gchar * str, CodeConverter * conv)
+{
+  const gchar *fg_tag;
+  gchar *buf;
+
+  buf = textview_convert_line (str, conv, &fg_tag);
+  textview_make_clickable_parts (textview, iter, fg_tag, prefs_common.enable_color ? "link" : NULL, buf);
+  g_free (buf);
+}
+
+/* write about limit bytes of fp at iter.  Returns TRUE if fp has more */
+static gboolean
+textview_write_lines (TextView * textview, GtkTextIter * iter, FILE * fp, CodeConverter * conv, gint limit)
+{
+  GtkTextBuffer *buffer;
+  GString *text;
+  const gchar *text_tag = NULL;
+  const gchar *uri_tag = prefs_common.enable_color ? "link" : NULL;
+  gchar buf[BUFFSIZE];
+  gint size = 0;
+  gboolean more = TRUE;
+
+  buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (textview->text));
+  text = g_string_sized_new (BUFFSIZE);
+
+#define FLUSH_TEXT()								\
+{										\
+  if (text->len > 0)								\
+    {										\
+      gtk_text_buffer_insert_with_tags_by_name (buffer, iter, text->str,	\
+                                                text->len, text_tag, NULL);	\
+      g_string_truncate (text, 0);						\
+    }										\
+}
+
+  while (size < limit)
     {
-      g_snprintf (quote_tag_str, sizeof (quote_tag_str), "quote%d", quotelevel);
-      fg_color = quote_tag_str;
+      const gchar *fg_tag;
+      const gchar *bp, *ep;
+      gchar *line;
+      gsize len;
+
+      if (fgets (buf, sizeof (buf), fp) == NULL)
+        {
+          more = FALSE;
+          break;
+        }
+      size += strlen (buf);
+
+      line = textview_convert_line (buf, conv, &fg_tag);
+      len = strlen (line);
+
+      /* whole lines without links are inserted together */
+      if (len > 0 && line[len - 1] == '\n' && textview_find_uri (line, &bp, &ep) < 0)
+        {
+          if (fg_tag != text_tag)
+            FLUSH_TEXT ();
+          g_string_append_len (text, line, len);
+          text_tag = fg_tag;
+        }
+      else
+        {
+          FLUSH_TEXT ();
+          textview_make_clickable_parts (textview, iter, fg_tag, uri_tag, line);
+        }
+
+      g_free (line);
     }
 
-  if (prefs_common.enable_color)
-    textview_make_clickable_parts (textview, fg_color, "link", buf);
-  else
-    textview_make_clickable_parts (textview, fg_color, NULL, buf);
+  FLUSH_TEXT ();
 
-  g_free (buf);
+#undef FLUSH_TEXT
+
+  g_string_free (text, TRUE);
+
+  return more;
 }
 
 static void
@@ -1334,7 +1527,7 @@ textview_write_link (TextView * textview, const gchar * str, const gchar * uri,
   r_uri->start = gtk_text_iter_get_offset (&iter);
   gtk_text_buffer_insert_with_tags_by_name (buffer, &iter, bufp, -1, "link", NULL);
   r_uri->end = gtk_text_iter_get_offset (&iter);
-  textview->uri_list = g_slist_append (textview->uri_list, r_uri);
+  textview_uri_add (textview, r_uri);
 
   g_free (buf);
 }
@@ -1346,6 +1539,8 @@ textview_clear (TextView * textview)
   GtkTextBuffer *buffer;
   GtkAdjustment *adj;
 
+  textview_render_cancel (textview);
+
   buffer = gtk_text_view_get_buffer (text);
   gtk_text_buffer_set_text (buffer, "", -1);
 
@@ -1355,8 +1550,7 @@ textview_clear (TextView * textview)
   gtk_adjustment_set_value (adj, 0.0);
 
   STATUSBAR_POP (textview);
-  textview_uri_list_remove_all (textview->uri_list);
-  textview->uri_list = NULL;
+  g_ptr_array_set_size (textview->uri_array, 0);
 
   textview->body_pos = 0;
 }
@@ -1371,10 +1565,12 @@ textview_destroy (TextView * textview)
   clipboard = gtk_clipboard_get (GDK_SELECTION_PRIMARY);
   gtk_text_buffer_remove_selection_clipboard (buffer, clipboard);
 
+  textview_render_cancel (textview);
+  g_free (textview->render);
+
   gtk_widget_destroy (textview->popup_menu);
 
-  textview_uri_list_remove_all (textview->uri_list);
-  textview->uri_list = NULL;
+  g_ptr_array_free (textview->uri_array, TRUE);
 
   g_free (textview);
 }
@@ -1490,9 +1686,9 @@ textview_show_header (TextView * textview, GPtrArray * headers)
            !strncmp (header->name, "X-Newsreader", 12)) && strstr (header->body, "YAM") != NULL)
         gtk_text_buffer_insert_with_tags_by_name (buffer, &iter, header->body, -1, "header", "emphasis", NULL);
       else if (prefs_common.enable_color)
-        textview_make_clickable_parts (textview, "header", "link", header->body);
+        textview_make_clickable_parts (textview, &iter, "header", "link", header->body);
       else
-        textview_make_clickable_parts (textview, "header", NULL, header->body);
+        textview_make_clickable_parts (textview, &iter, "header", NULL, header->body);
       gtk_text_buffer_get_end_iter (buffer, &iter);
       gtk_text_buffer_insert_with_tags_by_name (buffer, &iter, "\n", 1, "header", NULL);
     }
@@ -1543,6 +1739,8 @@ textview_search_string (TextView * textview, const gchar * str, gboolean case_se
 
   g_return_val_if_fail (str != NULL, FALSE);
 
+  textview_render_complete (textview);
+
   buffer = gtk_text_view_get_buffer (text);
 
   len = g_utf8_strlen (str, -1);
@@ -1576,6 +1774,8 @@ textview_search_string_backward (TextView * textview, const gchar * str, gboolea
 
   g_return_val_if_fail (str != NULL, FALSE);
 
+  textview_render_complete (textview);
+
   buffer = gtk_text_view_get_buffer (text);
 
   len = g_utf8_strlen (str, -1);
@@ -1927,17 +2127,19 @@ static RemoteURI *
 textview_get_uri (TextView * textview, GtkTextIter * start, GtkTextIter * end)
 {
   gint start_pos, end_pos;
-  GSList *cur;
+  guint i;
   RemoteURI *uri = NULL;
 
   start_pos = gtk_text_iter_get_offset (start);
   end_pos = gtk_text_iter_get_offset (end);
 
-  for (cur = textview->uri_list; cur != NULL; cur = cur->next)
+  for (i = textview_uri_array_find (textview->uri_array, start_pos); i < textview->uri_array->len; i++)
     {
-      RemoteURI *uri_ = (RemoteURI *) cur->data;
+      RemoteURI *uri_ = (RemoteURI *) g_ptr_array_index (textview->uri_array, i);
 
-      if (start_pos == uri_->start && end_pos == uri_->end)
+      if (uri_->start != start_pos)
+        break;
+      if (end_pos == uri_->end)
         {
           debug_print ("uri found: (%d, %d): %s\n", start_pos, end_pos, uri_->uri);
           uri = uri_;
@@ -2408,40 +2610,58 @@ textview_uri_security_check (TextView * textview, RemoteURI * uri)
 }
 
 static void
-textview_uri_list_remove_all (GSList * uri_list)
+textview_uri_free (gpointer data)
 {
-  GSList *cur;
+  RemoteURI *uri = (RemoteURI *) data;
 
-  for (cur = uri_list; cur != NULL; cur = cur->next)
+  g_free (uri->uri);
+  g_free (uri->filename);
+  g_free (uri);
+}
+
+/* index of the first URI starting at or after start */
+static guint
+textview_uri_array_find (GPtrArray * array, guint start)
+{
+  guint lo = 0, hi = array->len;
+
+  while (lo < hi)
     {
-      RemoteURI *uri = (RemoteURI *) cur->data;
+      guint mid = (lo + hi) / 2;
+      RemoteURI *uri = (RemoteURI *) g_ptr_array_index (array, mid);
 
-      if (uri)
-        {
-          g_free (uri->uri);
-          g_free (uri->filename);
-          g_free (uri);
-        }
+      if (uri->start < start)
+        lo = mid + 1;
+      else
+        hi = mid;
     }
 
-  g_slist_free (uri_list);
+  return lo;
+}
+
+/* URIs are added in text order; the ones found by an idle batch are
+   put in place when the batch is done */
+static void
+textview_uri_add (TextView * textview, RemoteURI * uri)
+{
+  if (textview->render && textview->render->uris)
+    g_ptr_array_add (textview->render->uris, uri);
+  else
+    g_ptr_array_add (textview->uri_array, uri);
 }
 
 static void
 textview_uri_list_update_offsets (TextView * textview, gint start, gint add)
 {
-  GSList *cur;
+  guint i;
 
   debug_print ("textview_uri_list_update_offsets: from %d: add %d\n", start, add);
 
-  for (cur = textview->uri_list; cur != NULL; cur = cur->next)
+  for (i = textview_uri_array_find (textview->uri_array, start); i < textview->uri_array->len; i++)
     {
-      RemoteURI *uri = (RemoteURI *) cur->data;
+      RemoteURI *uri = (RemoteURI *) g_ptr_array_index (textview->uri_array, i);
 
-      if (uri->start >= start)
-        {
-          uri->start += add;
-          uri->end += add;
-        }
+      uri->start += add;
+      uri->end += add;
     }
 }
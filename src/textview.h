@@ -30,6 +30,7 @@
 #include <gtk/gtktexttag.h>
 
 typedef struct _TextView TextView;
+typedef struct _TextViewRender TextViewRender;
 
 #include "itemfactory.h"
 #include "messageview.h"
@@ -49,11 +50,13 @@ struct _TextView {
   GtkTextTag *link_tag;
   GtkTextTag *hover_link_tag;
 
-  GSList *uri_list;
+  GPtrArray *uri_array;         /* RemoteURI, sorted by offset */
   gint body_pos;
 
   gboolean show_all_headers;
 
+  TextViewRender *render;       /* body text rendered at idle time */
+
   MessageView *messageview;
 };
 
@@ -64,6 +67,7 @@ void textview_reflect_prefs (TextView * textview);
 void textview_show_message (TextView * textview, MimeInfo * mimeinfo, const gchar * file);
 void textview_show_part (TextView * textview, MimeInfo * mimeinfo, FILE * fp);
 void textview_show_error (TextView * textview);
+void textview_render_complete (TextView * textview);
 
 void textview_clear (TextView * textview);
 void textview_destroy (TextView * textview);